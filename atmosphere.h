@@ -0,0 +1,434 @@
+#ifndef _ATMOSPHERE_H_
+
+#define _ATMOSPHERE_H_
+
+/* Physically based sky from precomputed scattering tables, after
+   Hillaire's "A Scalable and Production Ready Sky and Atmosphere
+   Rendering Technique" (2020), with Bruneton's transmittance mapping.
+
+   Three tables are baked on the CPU, row by row across the job pool:
+   - transmittance, by height and view zenith angle; depends only on the
+     atmosphere, so it is baked once
+   - multiple scattering, by height and sun zenith angle; also baked once
+   - sky-view, the radiance seen from the camera height, by view zenith
+     angle and azimuth relative to the sun; re-baked when the sun moves,
+     as many rows per frame as fit a time budget into a second table that
+     replaces the first once it is complete, so moving the sun never
+     stalls a frame
+
+   The sky shader then costs one sky-view fetch per pixel, plus a
+   transmittance fetch for the sun disk. atmosphere_sky() and
+   atmosphere_sun() are the same lookups on the CPU, for lighting.
+   Transmittance and sky-view are uploaded as RGBA16F 2D textures. The
+   mappings from (height, angle) to texture coordinates are duplicated in
+   skybox_fs and must stay in sync.
+
+   Distances are in km, the planet's center is the origin and y is up.
+   Radiance is for a sun of illuminance 1, the shader scales it. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ATMO_BOTTOM (6360.0f)
+#define ATMO_TOP (6460.0f)
+#define ATMO_TRANSMITTANCE_W (256)
+#define ATMO_TRANSMITTANCE_H (64)
+#define ATMO_MULTI_SIZE (32)
+#define ATMO_SKY_VIEW_W (192)
+#define ATMO_SKY_VIEW_H (108)
+
+typedef struct {
+  float view_height;          /* camera height above the ground */
+  Vec3 sun;                   /* toward the sun, normalized; sky_view is for this one */
+  Vec4 *transmittance;        /* [row][col], rgb with alpha 1 */
+  Vec4 *multi;
+  Vec4 *sky_view;
+  Vec4 *sky_view_next;        /* being baked for next_sun, next_row rows done */
+  Vec3 next_sun;
+  int next_row;               /* -1 when there is nothing to bake */
+  uint16_t *half;             /* upload staging, sized for the largest table */
+  sg_image transmittance_img, sky_view_img;
+  int sky_view_bakes;         /* completed sky-view tables */
+  double sky_view_ms;         /* time spent on the last complete one */
+  double row_ms;              /* per sky-view row in the last batch, for sizing the next */
+} Atmosphere;
+
+static void atmosphere_init(Atmosphere *atmo, float view_height, Vec3 sun);
+static void atmosphere_make_images(Atmosphere *atmo);
+static void atmosphere_set_sun(Atmosphere *atmo, Vec3 sun);
+static bool atmosphere_update(Atmosphere *atmo, double budget_ms);
+static Vec3 atmosphere_sky(const Atmosphere *atmo, Vec3 dir);
+static Vec3 atmosphere_sun(const Atmosphere *atmo);
+static void atmosphere_free(Atmosphere *atmo);
+
+/* Earth-like scattering and absorption coefficients, per km */
+static const Vec3 _atmo_rayleigh = {{ 5.802e-3f, 13.558e-3f, 33.1e-3f }};
+static const Vec3 _atmo_ozone = {{ 0.650e-3f, 1.881e-3f, 0.085e-3f }};
+static const float _atmo_mie_scattering = 3.996e-3f;
+static const float _atmo_mie_extinction = 4.40e-3f;
+static const float _atmo_mie_g = 0.8f;
+static const float _atmo_ground_albedo = 0.3f;
+
+typedef struct {
+  Vec3 rayleigh;              /* scattering */
+  float mie;                  /* scattering */
+  Vec3 extinction;
+} _AtmoMedium;
+
+static _AtmoMedium _atmo_medium(float r) {
+  float h = m_max(r - ATMO_BOTTOM, 0.0f);
+  float rayleigh = expf(-h / 8.0f), mie = expf(-h / 1.2f);
+  float ozone = m_max(0.0f, 1.0f - fabsf(h - 25.0f) / 15.0f);
+  _AtmoMedium m = {
+    .rayleigh = mul3_f(_atmo_rayleigh, rayleigh),
+    .mie = _atmo_mie_scattering * mie,
+  };
+  m.extinction = add3(add3_f(m.rayleigh, _atmo_mie_extinction * mie), mul3_f(_atmo_ozone, ozone));
+  return m;
+}
+
+static Vec3 _atmo_exp3(Vec3 v) {
+  return vec3(expf(v.x), expf(v.y), expf(v.z));
+}
+
+/* distance along the ray to a sphere around the origin, the far hit when
+   starting inside; -1 when it misses */
+static float _atmo_ray_sphere(Vec3 o, Vec3 d, float radius) {
+  float b = dot3(o, d), c = dot3(o, o) - radius * radius;
+  float disc = b * b - c;
+  if (disc < 0.0f) return -1.0f;
+  float s = sqrtf(disc), t0 = -b - s, t1 = -b + s;
+  if (t0 > 0.0f) return t0;
+  return t1 > 0.0f ? t1 : -1.0f;
+}
+
+/* texel centers to [0, 1] inclusive and back, so the table's edges hold
+   the edges of the parameter range */
+static float _atmo_to_unit(float u, int n) {
+  return (u - 0.5f / n) / (1.0f - 1.0f / n);
+}
+
+static float _atmo_from_unit(float x, int n) {
+  return 0.5f / n + x * (1.0f - 1.0f / n);
+}
+
+/* Bruneton's mapping: x is the distance to the top of the atmosphere
+   between its shortest and the horizon's, y the height as a fraction of
+   the horizon distance at the top */
+static void _atmo_transmittance_uv(float r, float mu, float *u, float *v) {
+  float H = sqrtf(ATMO_TOP * ATMO_TOP - ATMO_BOTTOM * ATMO_BOTTOM);
+  float rho = sqrtf(m_max(r * r - ATMO_BOTTOM * ATMO_BOTTOM, 0.0f));
+  float disc = r * r * (mu * mu - 1.0f) + ATMO_TOP * ATMO_TOP;
+  float d = m_max(-r * mu + sqrtf(m_max(disc, 0.0f)), 0.0f);
+  float d_min = ATMO_TOP - r, d_max = rho + H;
+  *u = _atmo_from_unit((d - d_min) / (d_max - d_min), ATMO_TRANSMITTANCE_W);
+  *v = _atmo_from_unit(rho / H, ATMO_TRANSMITTANCE_H);
+}
+
+static void _atmo_transmittance_params(float u, float v, float *r, float *mu) {
+  float H = sqrtf(ATMO_TOP * ATMO_TOP - ATMO_BOTTOM * ATMO_BOTTOM);
+  float rho = H * _atmo_to_unit(v, ATMO_TRANSMITTANCE_H);
+  *r = sqrtf(rho * rho + ATMO_BOTTOM * ATMO_BOTTOM);
+  float d_min = ATMO_TOP - *r, d_max = rho + H;
+  float d = d_min + _atmo_to_unit(u, ATMO_TRANSMITTANCE_W) * (d_max - d_min);
+  *mu = d == 0.0f ? 1.0f : (H * H - rho * rho - d * d) / (2.0f * *r * d);
+  *mu = m_clamp(*mu, -1.0f, 1.0f);
+}
+
+static Vec3 _atmo_bilinear(const Vec4 *table, int w, int h, float u, float v) {
+  float x = m_clamp(u * w - 0.5f, 0.0f, w - 1.0f), y = m_clamp(v * h - 0.5f, 0.0f, h - 1.0f);
+  int x0 = (int)x, y0 = (int)y, x1 = m_min(x0 + 1, w - 1), y1 = m_min(y0 + 1, h - 1);
+  float fx = x - x0, fy = y - y0;
+  const Vec4 *a = &table[y0 * w + x0], *b = &table[y0 * w + x1];
+  const Vec4 *c = &table[y1 * w + x0], *d = &table[y1 * w + x1];
+  Vec3 top = lerp3(vec3(a->x, a->y, a->z), vec3(b->x, b->y, b->z), fx);
+  Vec3 bottom = lerp3(vec3(c->x, c->y, c->z), vec3(d->x, d->y, d->z), fx);
+  return lerp3(top, bottom, fy);
+}
+
+/* transmittance from height r along zenith cosine mu to space, zero when
+   the planet is in the way */
+static Vec3 _atmo_transmittance(const Atmosphere *atmo, float r, float mu) {
+  float horizon = -sqrtf(m_max(1.0f - (ATMO_BOTTOM * ATMO_BOTTOM) / (r * r), 0.0f));
+  if (mu < horizon) return vec3_f(0.0f);
+  float u, v;
+  _atmo_transmittance_uv(r, mu, &u, &v);
+  return _atmo_bilinear(atmo->transmittance, ATMO_TRANSMITTANCE_W, ATMO_TRANSMITTANCE_H, u, v);
+}
+
+static Vec3 _atmo_multi(const Atmosphere *atmo, float r, float mu_sun) {
+  float u = _atmo_from_unit(mu_sun * 0.5f + 0.5f, ATMO_MULTI_SIZE);
+  float v = _atmo_from_unit((r - ATMO_BOTTOM) / (ATMO_TOP - ATMO_BOTTOM), ATMO_MULTI_SIZE);
+  return _atmo_bilinear(atmo->multi, ATMO_MULTI_SIZE, ATMO_MULTI_SIZE, u, v);
+}
+
+static float _atmo_rayleigh_phase(float c) {
+  return 3.0f / (16.0f * PI_f) * (1.0f + c * c);
+}
+
+/* Cornette-Shanks */
+static float _atmo_mie_phase(float c) {
+  float g = _atmo_mie_g, k = 3.0f / (8.0f * PI_f) * (1.0f - g * g) / (2.0f + g * g);
+  return k * (1.0f + c * c) / powf(1.0f + g * g - 2.0f * g * c, 1.5f);
+}
+
+static void _atmo_transmittance_rows(void *user, int begin, int end) {
+  Atmosphere *atmo = user;
+  enum { STEPS = 40 };
+  for (int y = begin; y < end; y++)
+    for (int x = 0; x < ATMO_TRANSMITTANCE_W; x++) {
+      float r, mu;
+      _atmo_transmittance_params((x + 0.5f) / ATMO_TRANSMITTANCE_W, (y + 0.5f) / ATMO_TRANSMITTANCE_H, &r, &mu);
+      Vec3 o = vec3(0.0f, r, 0.0f), d = vec3(sqrtf(1.0f - mu * mu), mu, 0.0f);
+      float len = m_max(_atmo_ray_sphere(o, d, ATMO_TOP), 0.0f), dt = len / STEPS;
+      Vec3 depth = vec3_f(0.0f);
+      for (int s = 0; s < STEPS; s++) {
+        Vec3 p = add3(o, mul3_f(d, (s + 0.5f) * dt));
+        depth = add3(depth, mul3_f(_atmo_medium(sqrtf(dot3(p, p))).extinction, dt));
+      }
+      Vec3 t = _atmo_exp3(mul3_f(depth, -1.0f));
+      atmo->transmittance[y * ATMO_TRANSMITTANCE_W + x] = vec4(t.x, t.y, t.z, 1.0f);
+    }
+}
+
+/* Scattered light along one ray, for a sun of illuminance 1. With
+   multi, the multiple scattering table is added in and phases are the real
+   ones; without, phases are isotropic and *transfer gets the fraction of
+   light scattered back into the ray, as the multiple scattering bake needs */
+static Vec3 _atmo_march(const Atmosphere *atmo, Vec3 o, Vec3 d, Vec3 sun, int steps, bool multi, Vec3 *transfer) {
+  float ground = _atmo_ray_sphere(o, d, ATMO_BOTTOM);
+  float top = _atmo_ray_sphere(o, d, ATMO_TOP);
+  float len = ground > 0.0f ? ground : top;
+  if (len <= 0.0f) return vec3_f(0.0f);
+
+  float c = dot3(d, sun), uniform = 1.0f / (4.0f * PI_f);
+  float phase_r = multi ? _atmo_rayleigh_phase(c) : uniform;
+  float phase_m = multi ? _atmo_mie_phase(c) : uniform;
+  float dt = len / steps;
+  Vec3 lum = vec3_f(0.0f), through = vec3_f(1.0f), fms = vec3_f(0.0f);
+  for (int s = 0; s < steps; s++) {
+    Vec3 p = add3(o, mul3_f(d, (s + 0.5f) * dt));
+    float r = sqrtf(dot3(p, p));
+    float mu_sun = dot3(p, sun) / r;
+    _AtmoMedium m = _atmo_medium(r);
+    Vec3 step_t = _atmo_exp3(mul3_f(m.extinction, -dt));
+    Vec3 sun_t = _atmo_transmittance(atmo, r, mu_sun);
+    Vec3 scattering = add3_f(m.rayleigh, m.mie);
+
+    Vec3 in = add3(mul3_f(m.rayleigh, phase_r), vec3_f(m.mie * phase_m));
+    Vec3 S = mul3(in, sun_t);
+    if (multi) S = add3(S, mul3(scattering, _atmo_multi(atmo, r, mu_sun)));
+    /* integrated analytically over the step, assuming S is constant */
+    Vec3 w = div3(sub3(vec3_f(1.0f), step_t), m.extinction);
+    lum = add3(lum, mul3(through, mul3(S, w)));
+    fms = add3(fms, mul3(through, mul3(scattering, w)));
+    through = mul3(through, step_t);
+  }
+  if (ground > 0.0f) {
+    /* light bounced off the ground, lambertian */
+    Vec3 p = add3(o, mul3_f(d, ground));
+    float mu_sun = dot3(p, sun) / ATMO_BOTTOM;
+    Vec3 sun_t = _atmo_transmittance(atmo, ATMO_BOTTOM, mu_sun);
+    lum = add3(lum, mul3(through, mul3_f(sun_t, m_max(mu_sun, 0.0f) * _atmo_ground_albedo / PI_f)));
+  }
+  if (transfer) *transfer = fms;
+  return lum;
+}
+
+/* Hillaire's multiple scattering: second order light and the transfer
+   fraction averaged over the sphere of directions, and the series of
+   higher orders summed as a geometric one */
+static void _atmo_multi_rows(void *user, int begin, int end) {
+  Atmosphere *atmo = user;
+  enum { DIRS = 8, STEPS = 20 };
+  for (int y = begin; y < end; y++)
+    for (int x = 0; x < ATMO_MULTI_SIZE; x++) {
+      float mu_sun = _atmo_to_unit((x + 0.5f) / ATMO_MULTI_SIZE, ATMO_MULTI_SIZE) * 2.0f - 1.0f;
+      float r = ATMO_BOTTOM + _atmo_to_unit((y + 0.5f) / ATMO_MULTI_SIZE, ATMO_MULTI_SIZE) * (ATMO_TOP - ATMO_BOTTOM);
+      r = m_clamp(r, ATMO_BOTTOM + 0.01f, ATMO_TOP - 0.01f);
+      Vec3 o = vec3(0.0f, r, 0.0f), sun = vec3(sqrtf(m_max(1.0f - mu_sun * mu_sun, 0.0f)), mu_sun, 0.0f);
+      Vec3 lum = vec3_f(0.0f), fms = vec3_f(0.0f);
+      for (int i = 0; i < DIRS; i++)
+        for (int j = 0; j < DIRS; j++) {
+          /* stratified over the sphere, equal solid angle per cell */
+          float cos_theta = 1.0f - 2.0f * (i + 0.5f) / DIRS, phi = 2.0f * PI_f * (j + 0.5f) / DIRS;
+          float sin_theta = sqrtf(1.0f - cos_theta * cos_theta);
+          Vec3 d = vec3(sin_theta * cosf(phi), cos_theta, sin_theta * sinf(phi));
+          Vec3 transfer;
+          lum = add3(lum, _atmo_march(atmo, o, d, sun, STEPS, false, &transfer));
+          fms = add3(fms, transfer);
+        }
+      lum = mul3_f(lum, 1.0f / (DIRS * DIRS));
+      fms = mul3_f(fms, 1.0f / (DIRS * DIRS));
+      Vec3 psi = div3(lum, sub3(vec3_f(1.0f), fms));
+      atmo->multi[y * ATMO_MULTI_SIZE + x] = vec4(psi.x, psi.y, psi.z, 1.0f);
+    }
+}
+
+typedef struct {
+  Atmosphere *atmo;
+  int first;
+} _AtmoSkyViewJob;
+
+/* rows are view zenith angles, squeezed toward the horizon; columns are
+   azimuths from the sun's, 0 to pi, squeezed toward the sun. Bakes into
+   sky_view_next for next_sun */
+static void _atmo_sky_view_rows(void *user, int begin, int end) {
+  _AtmoSkyViewJob *job = user;
+  Atmosphere *atmo = job->atmo;
+  enum { STEPS = 32 };
+  float r = ATMO_BOTTOM + atmo->view_height;
+  float horizon = sqrtf(r * r - ATMO_BOTTOM * ATMO_BOTTOM);
+  float beta = acosf(horizon / r), zenith_horizon = PI_f - beta;
+  Vec3 o = vec3(0.0f, r, 0.0f);
+  Vec3 sun = vec3(sqrtf(m_max(1.0f - atmo->next_sun.y * atmo->next_sun.y, 0.0f)), atmo->next_sun.y, 0.0f);
+  for (int y = job->first + begin; y < job->first + end; y++) {
+    float v = _atmo_to_unit((y + 0.5f) / ATMO_SKY_VIEW_H, ATMO_SKY_VIEW_H), zenith;
+    if (v < 0.5f) {
+      float c = 1.0f - 2.0f * v;
+      zenith = zenith_horizon * (1.0f - c * c);
+    } else {
+      float c = 2.0f * v - 1.0f;
+      zenith = zenith_horizon + beta * c * c;
+    }
+    for (int x = 0; x < ATMO_SKY_VIEW_W; x++) {
+      float u = _atmo_to_unit((x + 0.5f) / ATMO_SKY_VIEW_W, ATMO_SKY_VIEW_W);
+      float azimuth = acosf(m_clamp(1.0f - 2.0f * u * u, -1.0f, 1.0f));
+      Vec3 d = vec3(sinf(zenith) * cosf(azimuth), cosf(zenith), sinf(zenith) * sinf(azimuth));
+      Vec3 lum = _atmo_march(atmo, o, d, sun, STEPS, true, NULL);
+      atmo->sky_view_next[y * ATMO_SKY_VIEW_W + x] = vec4(lum.x, lum.y, lum.z, 1.0f);
+    }
+  }
+}
+
+/* a table as RGBA16F texels, in atmo->half */
+static sg_image_data _atmo_half(Atmosphere *atmo, const Vec4 *table, int w, int h) {
+  f32_to_f16_n(&table[0].x, atmo->half, (size_t)4 * w * h);
+  return (sg_image_data) {
+    .subimage[0][0] = { .ptr = atmo->half, .size = (size_t)w * h * 4 * sizeof(uint16_t) }
+  };
+}
+
+/* bakes every table for a camera view_height km above the ground */
+static void atmosphere_init(Atmosphere *atmo, float view_height, Vec3 sun) {
+  *atmo = (Atmosphere) {
+    .view_height = view_height,
+    .next_row = -1,
+    .transmittance = malloc(ATMO_TRANSMITTANCE_W * ATMO_TRANSMITTANCE_H * sizeof(Vec4)),
+    .multi = malloc(ATMO_MULTI_SIZE * ATMO_MULTI_SIZE * sizeof(Vec4)),
+    .sky_view = malloc(ATMO_SKY_VIEW_W * ATMO_SKY_VIEW_H * sizeof(Vec4)),
+    .sky_view_next = malloc(ATMO_SKY_VIEW_W * ATMO_SKY_VIEW_H * sizeof(Vec4)),
+    .half = malloc(4 * m_max(ATMO_TRANSMITTANCE_W * ATMO_TRANSMITTANCE_H, ATMO_SKY_VIEW_W * ATMO_SKY_VIEW_H) * sizeof(uint16_t)),
+  };
+  jobs_parallel_for(ATMO_TRANSMITTANCE_H, 4, _atmo_transmittance_rows, atmo);
+  jobs_parallel_for(ATMO_MULTI_SIZE, 2, _atmo_multi_rows, atmo);
+  atmosphere_set_sun(atmo, sun);
+  atmosphere_update(atmo, INFINITY);
+}
+
+/* the transmittance table is immutable, the sky-view one is rewritten
+   whenever the sun moves */
+static void atmosphere_make_images(Atmosphere *atmo) {
+  sg_image_desc desc = {
+    .pixel_format = SG_PIXELFORMAT_RGBA16F,
+    .min_filter = SG_FILTER_LINEAR,
+    .mag_filter = SG_FILTER_LINEAR,
+    .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+    .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+  };
+  desc.width = ATMO_TRANSMITTANCE_W;
+  desc.height = ATMO_TRANSMITTANCE_H;
+  desc.data = _atmo_half(atmo, atmo->transmittance, ATMO_TRANSMITTANCE_W, ATMO_TRANSMITTANCE_H);
+  desc.label = "atmosphere-transmittance";
+  atmo->transmittance_img = sg_make_image(&desc);
+
+  desc.width = ATMO_SKY_VIEW_W;
+  desc.height = ATMO_SKY_VIEW_H;
+  desc.usage = SG_USAGE_DYNAMIC;
+  desc.data = (sg_image_data) {0};
+  desc.label = "atmosphere-sky-view";
+  atmo->sky_view_img = sg_make_image(&desc);
+  sg_image_data data = _atmo_half(atmo, atmo->sky_view, ATMO_SKY_VIEW_W, ATMO_SKY_VIEW_H);
+  sg_update_image(atmo->sky_view_img, &data);
+}
+
+/* starts a sky-view bake if the sun's elevation changed since the table in
+   use, or the one being baked; its azimuth is applied in the shader */
+static void atmosphere_set_sun(Atmosphere *atmo, Vec3 sun) {
+  Vec3 target = atmo->next_row >= 0 ? atmo->next_sun : atmo->sun;
+  if (atmo->sky_view_bakes > 0 && fabsf(sun.y - target.y) <= 1e-5f) return;
+  atmo->next_sun = sun;
+  atmo->next_row = 0;
+}
+
+/* bakes rows of a pending sky-view table for about budget_ms, at least
+   one; once it is complete it replaces the one in use and is uploaded.
+   True if that happened. Batches are sized by the time rows took last */
+static bool atmosphere_update(Atmosphere *atmo, double budget_ms) {
+  if (atmo->next_row < 0) return false;
+  if (atmo->next_row == 0) atmo->sky_view_ms = 0.0;
+  uint64_t t = stm_now();
+  double spent = 0.0;
+  do {
+    _AtmoSkyViewJob job = { atmo, atmo->next_row };
+    int rows = atmo->row_ms > 0.0
+      ? (int)m_min((budget_ms - spent) / atmo->row_ms, (double)ATMO_SKY_VIEW_H)
+      : jobs_num_threads();
+    rows = m_clamp(rows, 1, ATMO_SKY_VIEW_H - atmo->next_row);
+    uint64_t batch = stm_now();
+    jobs_parallel_for(rows, 1, _atmo_sky_view_rows, &job);
+    atmo->next_row += rows;
+    atmo->row_ms = stm_ms(stm_since(batch)) / rows;
+    spent = stm_ms(stm_since(t));
+  } while (atmo->next_row < ATMO_SKY_VIEW_H && spent + atmo->row_ms <= budget_ms);
+  atmo->sky_view_ms += spent;
+  if (atmo->next_row < ATMO_SKY_VIEW_H) return false;
+
+  Vec4 *done = atmo->sky_view_next;
+  atmo->sky_view_next = atmo->sky_view;
+  atmo->sky_view = done;
+  atmo->sun = atmo->next_sun;
+  atmo->next_row = -1;
+  atmo->sky_view_bakes++;
+  if (atmo->sky_view_img.id != SG_INVALID_ID) {
+    sg_image_data data = _atmo_half(atmo, atmo->sky_view, ATMO_SKY_VIEW_W, ATMO_SKY_VIEW_H);
+    sg_update_image(atmo->sky_view_img, &data);
+  }
+  return true;
+}
+
+/* the sky radiance toward dir from the table in use, as skybox_fs reads it */
+static Vec3 atmosphere_sky(const Atmosphere *atmo, Vec3 dir) {
+  float r = ATMO_BOTTOM + atmo->view_height;
+  float beta = acosf(sqrtf(r * r - ATMO_BOTTOM * ATMO_BOTTOM) / r), zenith_horizon = PI_f - beta;
+  float zenith = acosf(m_clamp(dir.y, -1.0f, 1.0f));
+  float v = zenith < zenith_horizon
+    ? 0.5f - 0.5f * sqrtf(1.0f - zenith / zenith_horizon)
+    : 0.5f + 0.5f * sqrtf((zenith - zenith_horizon) / beta);
+  float a = m_max(sqrtf(dir.x * dir.x + dir.z * dir.z), 1e-6f);
+  float b = m_max(sqrtf(atmo->sun.x * atmo->sun.x + atmo->sun.z * atmo->sun.z), 1e-6f);
+  float c = (dir.x * atmo->sun.x + dir.z * atmo->sun.z) / (a * b);
+  float u = sqrtf(m_clamp(0.5f - 0.5f * c, 0.0f, 1.0f));
+  return _atmo_bilinear(atmo->sky_view, ATMO_SKY_VIEW_W, ATMO_SKY_VIEW_H,
+                        _atmo_from_unit(u, ATMO_SKY_VIEW_W), _atmo_from_unit(v, ATMO_SKY_VIEW_H));
+}
+
+/* the fraction of the sun's light that reaches the camera */
+static Vec3 atmosphere_sun(const Atmosphere *atmo) {
+  return _atmo_transmittance(atmo, ATMO_BOTTOM + atmo->view_height, atmo->sun.y);
+}
+
+static void atmosphere_free(Atmosphere *atmo) {
+  if (atmo->transmittance_img.id != SG_INVALID_ID) sg_destroy_image(atmo->transmittance_img);
+  if (atmo->sky_view_img.id != SG_INVALID_ID) sg_destroy_image(atmo->sky_view_img);
+  free(atmo->transmittance);
+  free(atmo->multi);
+  free(atmo->sky_view);
+  free(atmo->sky_view_next);
+  free(atmo->half);
+  *atmo = (Atmosphere) {0};
+}
+
+#endif
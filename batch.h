@@ -0,0 +1,315 @@
+#ifndef _BATCH_H_
+
+#define _BATCH_H_
+
+/* Draw-call batching on top of sokol_gfx.
+
+   Draws are queued between batch_begin() and batch_flush() instead of going
+   straight to sg_apply_pipeline/sg_apply_bindings/sg_apply_uniforms. On flush
+   they are sorted by layer, pipeline, bindings and uniforms; neighbours that
+   only differ in their per-instance data are merged into a single instanced
+   sg_draw, and state that is already applied is not applied again.
+
+   Per-draw instance data is appended to one persistent SG_USAGE_STREAM buffer
+   with sg_append_buffer. sokol already rotates SG_NUM_INFLIGHT_FRAMES backing
+   slots for stream buffers, so the CPU never writes into memory the GPU is
+   still reading from a previous frame. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_MAX_UNIFORM_SIZE (512)
+
+typedef struct {
+  int max_draws;              /* queued draws per frame */
+  int max_instances;          /* instances appended to the stream per frame */
+  int instance_size;          /* bytes per instance in the stream */
+  int stream_slot;            /* vertex buffer slot the stream is bound to */
+  const char *label;
+} BatchDesc;
+
+typedef struct {
+  int layer;                  /* sorted first, lower layers are drawn first */
+  sg_pipeline pip;
+  sg_bindings bind;           /* with instances, the stream slot is filled in by the batcher */
+  int ub_slot;                /* vertex shader uniform block slot */
+  const void *uniforms;       /* copied, may be NULL */
+  size_t uniforms_size;
+  int fs_ub_slot;             /* fragment shader uniform block, the same way */
+  const void *fs_uniforms;
+  size_t fs_uniforms_size;
+  int base_element, num_elements, num_instances;
+  const void *instances;      /* optional, num_instances * instance_size bytes, copied */
+} BatchDraw;
+
+typedef struct {
+  int submitted;              /* batch_draw calls */
+  int draws;                  /* sg_draw calls actually issued */
+  int pipelines, bindings, uniforms;    /* state changes issued */
+  int skipped;                /* state changes dropped as redundant */
+  size_t bytes;               /* instance stream + uniform bytes uploaded */
+} BatchStats;
+
+static void batch_setup(const BatchDesc *desc);
+static void batch_shutdown(void);
+static void batch_begin(void);
+static void batch_draw(const BatchDraw *draw);
+static void batch_flush(void);
+static BatchStats batch_stats(void);
+
+typedef struct {
+  uint64_t key;
+  int index;
+} _BatchKey;
+
+typedef struct {
+  int layer, bind_id, uniform_id, ub_slot, fs_uniform_id, fs_ub_slot;
+  sg_pipeline pip;
+  int base_element, num_elements, num_instances;
+  int first_instance;         /* into the staging array, -1 without stream data */
+} _BatchCmd;
+
+static struct {
+  BatchDesc desc;
+  sg_buffer stream;
+  uint8_t *staging, *sorted;  /* instances in submission order, then in draw order */
+  int num_instances;
+
+  _BatchCmd *cmds;
+  _BatchKey *keys;
+  int num_cmds;
+
+  /* bindings and uniform blocks are interned per frame,
+     so comparing two draws only compares small integers */
+  sg_bindings *binds;
+  int num_binds;
+  struct { uint8_t data[BATCH_MAX_UNIFORM_SIZE]; size_t size; } *ubs;
+  int num_ubs;
+
+  BatchStats stats, last_stats;
+} _batch;
+
+static void batch_setup(const BatchDesc *desc) {
+  _batch.desc = *desc;
+  _batch.cmds = calloc(desc->max_draws, sizeof(_BatchCmd));
+  _batch.keys = calloc(desc->max_draws, sizeof(_BatchKey));
+  _batch.binds = calloc(desc->max_draws, sizeof(sg_bindings));
+  _batch.ubs = calloc(2 * desc->max_draws, sizeof(*_batch.ubs));   /* a vertex and a fragment block per draw */
+  _batch.staging = malloc((size_t)desc->max_instances * desc->instance_size);
+  _batch.sorted = malloc((size_t)desc->max_instances * desc->instance_size);
+  _batch.stream = sg_make_buffer(&(sg_buffer_desc){
+    .size = (size_t)desc->max_instances * desc->instance_size,
+    .usage = SG_USAGE_STREAM,
+    .label = desc->label,
+  });
+}
+
+static void batch_shutdown(void) {
+  sg_destroy_buffer(_batch.stream);
+  free(_batch.cmds);
+  free(_batch.keys);
+  free(_batch.binds);
+  free(_batch.ubs);
+  free(_batch.staging);
+  free(_batch.sorted);
+}
+
+static void batch_begin(void) {
+  _batch.num_cmds = 0;
+  _batch.num_binds = 0;
+  _batch.num_ubs = 0;
+  _batch.num_instances = 0;
+  _batch.stats = (BatchStats) {0};
+}
+
+static int _batch_intern_bindings(const sg_bindings *bind) {
+  for (int i = 0; i < _batch.num_binds; i++)
+    if (memcmp(&_batch.binds[i], bind, sizeof(sg_bindings)) == 0)
+      return i;
+  _batch.binds[_batch.num_binds] = *bind;
+  return _batch.num_binds++;
+}
+
+static int _batch_intern_uniforms(const void *data, size_t size) {
+  if (data == NULL) return -1;
+  SOKOL_ASSERT(size <= BATCH_MAX_UNIFORM_SIZE);
+  for (int i = 0; i < _batch.num_ubs; i++)
+    if (_batch.ubs[i].size == size && memcmp(_batch.ubs[i].data, data, size) == 0)
+      return i;
+  memcpy(_batch.ubs[_batch.num_ubs].data, data, size);
+  _batch.ubs[_batch.num_ubs].size = size;
+  return _batch.num_ubs++;
+}
+
+static void batch_draw(const BatchDraw *draw) {
+  _batch.stats.submitted++;
+  if (_batch.num_cmds >= _batch.desc.max_draws) return;
+  if (draw->instances && _batch.num_instances + draw->num_instances > _batch.desc.max_instances) return;
+  SOKOL_ASSERT(draw->ub_slot >= 0 && draw->ub_slot < SG_MAX_SHADERSTAGE_UBS);
+  SOKOL_ASSERT(draw->fs_ub_slot >= 0 && draw->fs_ub_slot < SG_MAX_SHADERSTAGE_UBS);
+
+  _BatchCmd *cmd = &_batch.cmds[_batch.num_cmds];
+  *cmd = (_BatchCmd) {
+    .layer = draw->layer,
+    .pip = draw->pip,
+    .bind_id = _batch_intern_bindings(&draw->bind),
+    .uniform_id = _batch_intern_uniforms(draw->uniforms, draw->uniforms_size),
+    .ub_slot = draw->ub_slot,
+    .fs_uniform_id = _batch_intern_uniforms(draw->fs_uniforms, draw->fs_uniforms_size),
+    .fs_ub_slot = draw->fs_ub_slot,
+    .base_element = draw->base_element,
+    .num_elements = draw->num_elements,
+    .num_instances = draw->num_instances,
+    .first_instance = -1,
+  };
+  if (draw->instances) {
+    size_t stride = _batch.desc.instance_size;
+    memcpy(_batch.staging + _batch.num_instances*stride, draw->instances, draw->num_instances*stride);
+    cmd->first_instance = _batch.num_instances;
+    _batch.num_instances += draw->num_instances;
+  }
+
+  /* layer | pipeline | bindings | uniforms | fs uniforms, with the
+     pipeline's slot index standing in for the whole id; fs uniforms only get
+     8 bits, which can only cost a merge, never a wrong one. Submission order
+     breaks ties in the sort */
+  _batch.keys[_batch.num_cmds] = (_BatchKey) {
+    .key = ((uint64_t)(draw->layer & 0xFF) << 56)
+         | ((uint64_t)(draw->pip.id & 0xFFFF) << 40)
+         | ((uint64_t)(cmd->bind_id & 0xFFFF) << 24)
+         | ((uint64_t)((cmd->uniform_id + 1) & 0xFFFF) << 8)
+         | ((uint64_t)((cmd->fs_uniform_id + 1) & 0xFF)),
+    .index = _batch.num_cmds,
+  };
+  _batch.num_cmds++;
+}
+
+static int _batch_key_cmp(const void *a, const void *b) {
+  const _BatchKey *ka = a, *kb = b;
+  if (ka->key != kb->key) return ka->key < kb->key ? -1 : 1;
+  return ka->index - kb->index;
+}
+
+/* two sorted neighbours can share one sg_draw if everything but their
+   instance data matches */
+static bool _batch_mergeable(const _BatchCmd *a, const _BatchCmd *b) {
+  return a->first_instance >= 0 && b->first_instance >= 0
+      && a->layer == b->layer
+      && a->pip.id == b->pip.id
+      && a->bind_id == b->bind_id
+      && a->uniform_id == b->uniform_id
+      && a->ub_slot == b->ub_slot
+      && a->fs_uniform_id == b->fs_uniform_id
+      && a->fs_ub_slot == b->fs_ub_slot
+      && a->base_element == b->base_element
+      && a->num_elements == b->num_elements;
+}
+
+static void batch_flush(void) {
+  BatchStats *stats = &_batch.stats;
+  size_t stride = _batch.desc.instance_size;
+  qsort(_batch.keys, _batch.num_cmds, sizeof(_BatchKey), _batch_key_cmp);
+
+  /* lay the instance data out in draw order, so every merged run
+     is one contiguous range, then upload it all at once */
+  int sorted_instances = 0;
+  for (int i = 0; i < _batch.num_cmds; i++) {
+    _BatchCmd *cmd = &_batch.cmds[_batch.keys[i].index];
+    if (cmd->first_instance < 0) continue;
+    memcpy(_batch.sorted + sorted_instances*stride,
+           _batch.staging + cmd->first_instance*stride,
+           cmd->num_instances*stride);
+    cmd->first_instance = sorted_instances;
+    sorted_instances += cmd->num_instances;
+  }
+  int stream_offset = 0;
+  if (sorted_instances > 0) {
+    stream_offset = sg_append_buffer(_batch.stream, &(sg_range) {
+      .ptr = _batch.sorted,
+      .size = sorted_instances*stride
+    });
+    stats->bytes += sorted_instances*stride;
+  }
+
+  uint32_t last_pip = SG_INVALID_ID;
+  /* per uniform block slot, a block is only redundant in the slot it was applied to */
+  int last_uniforms[SG_MAX_SHADERSTAGE_UBS], last_fs_uniforms[SG_MAX_SHADERSTAGE_UBS];
+  memset(last_uniforms, -1, sizeof(last_uniforms));
+  memset(last_fs_uniforms, -1, sizeof(last_fs_uniforms));
+  sg_bindings last_bind;
+  bool have_bind = false;
+
+  for (int i = 0; i < _batch.num_cmds;) {
+    _BatchCmd *cmd = &_batch.cmds[_batch.keys[i].index];
+    int num_instances = cmd->num_instances;
+    int next = i + 1;
+    while (next < _batch.num_cmds) {
+      _BatchCmd *other = &_batch.cmds[_batch.keys[next].index];
+      if (!_batch_mergeable(cmd, other)) break;
+      num_instances += other->num_instances;
+      next++;
+    }
+
+    if (cmd->pip.id != last_pip) {
+      sg_apply_pipeline(cmd->pip);
+      last_pip = cmd->pip.id;
+      /* bindings and uniforms must be reapplied after a pipeline change */
+      have_bind = false;
+      memset(last_uniforms, -1, sizeof(last_uniforms));
+      memset(last_fs_uniforms, -1, sizeof(last_fs_uniforms));
+      stats->pipelines++;
+    } else stats->skipped++;
+
+    sg_bindings bind = _batch.binds[cmd->bind_id];
+    if (cmd->first_instance >= 0) {
+      bind.vertex_buffers[_batch.desc.stream_slot] = _batch.stream;
+      bind.vertex_buffer_offsets[_batch.desc.stream_slot] = stream_offset + cmd->first_instance*(int)stride;
+    }
+    if (!have_bind || memcmp(&bind, &last_bind, sizeof(sg_bindings)) != 0) {
+      sg_apply_bindings(&bind);
+      last_bind = bind;
+      have_bind = true;
+      stats->bindings++;
+    } else stats->skipped++;
+
+    if (cmd->uniform_id >= 0) {
+      if (cmd->uniform_id != last_uniforms[cmd->ub_slot]) {
+        sg_apply_uniforms(SG_SHADERSTAGE_VS, cmd->ub_slot, &(sg_range) {
+          .ptr = _batch.ubs[cmd->uniform_id].data,
+          .size = _batch.ubs[cmd->uniform_id].size
+        });
+        last_uniforms[cmd->ub_slot] = cmd->uniform_id;
+        stats->uniforms++;
+        stats->bytes += _batch.ubs[cmd->uniform_id].size;
+      } else stats->skipped++;
+    }
+    if (cmd->fs_uniform_id >= 0) {
+      if (cmd->fs_uniform_id != last_fs_uniforms[cmd->fs_ub_slot]) {
+        sg_apply_uniforms(SG_SHADERSTAGE_FS, cmd->fs_ub_slot, &(sg_range) {
+          .ptr = _batch.ubs[cmd->fs_uniform_id].data,
+          .size = _batch.ubs[cmd->fs_uniform_id].size
+        });
+        last_fs_uniforms[cmd->fs_ub_slot] = cmd->fs_uniform_id;
+        stats->uniforms++;
+        stats->bytes += _batch.ubs[cmd->fs_uniform_id].size;
+      } else stats->skipped++;
+    }
+
+    sg_draw(cmd->base_element, cmd->num_elements, num_instances);
+    stats->draws++;
+    i = next;
+  }
+
+  _batch.last_stats = *stats;
+  _batch.num_cmds = 0;
+  _batch.num_binds = 0;
+  _batch.num_ubs = 0;
+  _batch.num_instances = 0;
+}
+
+/* stats of the last flush */
+static BatchStats batch_stats(void) {
+  return _batch.last_stats;
+}
+
+#endif
@@ -0,0 +1,1435 @@
+#ifndef _BENCH_H_
+
+#define _BENCH_H_
+
+/* Startup micro-benchmarks, run with bench=1 on the command line.
+
+   Every kernel is first checked against its scalar reference on random
+   inputs, then both are timed over the same inputs. Results go to stdout. */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#define BENCH_INPUTS (1024)
+#define BENCH_ITERS (1 << 20)
+
+static volatile float bench_sink;
+
+static void bench_report(const char *name, double ref_ns, double ns, int mismatches) {
+  printf("%-28s ref %8.2f ns  fast %8.2f ns  x%5.2f  %s\n",
+         name, ref_ns, ns, ref_ns / ns,
+         mismatches ? "MISMATCH" : "exact");
+  if (mismatches) printf("  %d outputs differ from the reference\n", mismatches);
+}
+
+/* for kernels that are only accurate, not exact: worst relative error */
+static void bench_report_err(const char *name, double ref_ns, double ns, double max_err) {
+  printf("%-28s ref %8.2f ns  fast %8.2f ns  x%5.2f  max err %.2e\n",
+         name, ref_ns, ns, ref_ns / ns, max_err);
+}
+
+static Mat4 bench_rand4x4(void) {
+  Mat4 m;
+  for (int i = 0; i < 16; i++)
+    m.nums[i / 4][i % 4] = randf() * 4.0f - 2.0f;
+  return m;
+}
+
+static void bench_mat4(void) {
+  static Mat4 a[BENCH_INPUTS], b[BENCH_INPUTS];
+  static Vec4 v[BENCH_INPUTS];
+  for (int i = 0; i < BENCH_INPUTS; i++) {
+    a[i] = bench_rand4x4();
+    b[i] = bench_rand4x4();
+    v[i] = vec4(randf(), randf(), randf(), 1.0f);
+  }
+
+  int bad = 0;
+  for (int i = 0; i < BENCH_INPUTS; i++) {
+    Mat4 x = mul4x4(a[i], b[i]), y = mul4x4_scalar(a[i], b[i]);
+    bad += memcmp(&x, &y, sizeof(Mat4)) != 0;
+  }
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int i = 0; i < BENCH_ITERS; i++)
+    sum += mul4x4_scalar(a[i % BENCH_INPUTS], b[(i + 1) % BENCH_INPUTS]).nums[i & 3][1];
+  double ref = stm_ns(stm_since(t)) / BENCH_ITERS;
+  t = stm_now();
+  for (int i = 0; i < BENCH_ITERS; i++)
+    sum += mul4x4(a[i % BENCH_INPUTS], b[(i + 1) % BENCH_INPUTS]).nums[i & 3][1];
+  bench_report("mul4x4", ref, stm_ns(stm_since(t)) / BENCH_ITERS, bad);
+
+  bad = 0;
+  for (int i = 0; i < BENCH_INPUTS; i++) {
+    Vec4 x = mul4x44(a[i], v[i]), y = mul4x44_scalar(a[i], v[i]);
+    bad += memcmp(&x, &y, sizeof(Vec4)) != 0;
+  }
+  t = stm_now();
+  for (int i = 0; i < BENCH_ITERS; i++)
+    sum += mul4x44_scalar(a[i % BENCH_INPUTS], v[(i + 1) % BENCH_INPUTS]).nums[i & 3];
+  ref = stm_ns(stm_since(t)) / BENCH_ITERS;
+  t = stm_now();
+  for (int i = 0; i < BENCH_ITERS; i++)
+    sum += mul4x44(a[i % BENCH_INPUTS], v[(i + 1) % BENCH_INPUTS]).nums[i & 3];
+  bench_report("mul4x44", ref, stm_ns(stm_since(t)) / BENCH_ITERS, bad);
+
+  bad = 0;
+  for (int i = 0; i < BENCH_INPUTS; i++) {
+    Mat4 x = transpose4x4(a[i]), y = transpose4x4_scalar(a[i]);
+    bad += memcmp(&x, &y, sizeof(Mat4)) != 0;
+  }
+  t = stm_now();
+  for (int i = 0; i < BENCH_ITERS; i++)
+    sum += transpose4x4_scalar(a[i % BENCH_INPUTS]).nums[i & 3][2];
+  ref = stm_ns(stm_since(t)) / BENCH_ITERS;
+  t = stm_now();
+  for (int i = 0; i < BENCH_ITERS; i++)
+    sum += transpose4x4(a[i % BENCH_INPUTS]).nums[i & 3][2];
+  bench_report("transpose4x4", ref, stm_ns(stm_since(t)) / BENCH_ITERS, bad);
+
+  /* a full camera rebuild, the per-frame cost when the camera moves */
+  Camera cam = {0};
+  camera_perspective(&cam, 1.047f, 0.01f, 10.0f);
+  camera_viewport(&cam, 800.0f, 600.0f);
+  t = stm_now();
+  for (int i = 0; i < BENCH_ITERS / 16; i++) {
+    camera_look_at(&cam, vec3(a[i % BENCH_INPUTS].x.x, 1.0f, 6.0f), vec3_f(0.0f), vec3_y);
+    camera_update(&cam);
+    sum += cam.inv_view_proj.nums[i & 3][0];
+  }
+  printf("%-28s %8.2f ns\n", "camera_update", stm_ns(stm_since(t)) / (BENCH_ITERS / 16));
+
+  bench_sink = sum;
+}
+
+/* Gauss-Jordan with partial pivoting in double, the reference inverse */
+static void bench_inverse_f64(Mat4 m, double out[4][4]) {
+  double a[4][8];
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++) {
+      a[r][c] = m.nums[c][r];
+      a[r][c + 4] = r == c;
+    }
+  for (int c = 0; c < 4; c++) {
+    int p = c;
+    for (int r = c + 1; r < 4; r++)
+      if (fabs(a[r][c]) > fabs(a[p][c])) p = r;
+    for (int k = 0; k < 8; k++) {
+      double t = a[c][k]; a[c][k] = a[p][k]; a[p][k] = t;
+    }
+    double d = a[c][c];
+    for (int k = 0; k < 8; k++) a[c][k] /= d;
+    for (int r = 0; r < 4; r++) {
+      if (r == c) continue;
+      double f = a[r][c];
+      for (int k = 0; k < 8; k++) a[r][k] -= f * a[c][k];
+    }
+  }
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++)
+      out[c][r] = a[r][c + 4];
+}
+
+/* largest deviation from the double inverse, relative to its largest entry */
+static double bench_inverse_err(Mat4 m, Mat4 inv) {
+  double ref[4][4], err = 0.0, size = 0.0;
+  bench_inverse_f64(m, ref);
+  for (int c = 0; c < 4; c++)
+    for (int r = 0; r < 4; r++) {
+      err = fmax(err, fabs(inv.nums[c][r] - ref[c][r]));
+      size = fmax(size, fabs(ref[c][r]));
+    }
+  return err / size;
+}
+
+/* a macro rather than a function pointer, so the calls can be inlined
+   just like they are at real call sites */
+#define BENCH_INVERSE(name, fn, in) do {                                      \
+    double err = 0.0;                                                         \
+    for (int i = 0; i < BENCH_INPUTS; i++)                                    \
+      err = fmax(err, bench_inverse_err(in[i], fn(in[i])));                   \
+    uint64_t t = stm_now();                                                   \
+    for (int i = 0; i < BENCH_ITERS; i++)                                     \
+      sum += inverse4x4_scalar(in[i % BENCH_INPUTS]).nums[i & 3][i >> 2 & 3]; \
+    double ref = stm_ns(stm_since(t)) / BENCH_ITERS;                          \
+    t = stm_now();                                                            \
+    for (int i = 0; i < BENCH_ITERS; i++)                                     \
+      sum += fn(in[i % BENCH_INPUTS]).nums[i & 3][i >> 2 & 3];                \
+    bench_report_err(name, ref, stm_ns(stm_since(t)) / BENCH_ITERS, err);     \
+  } while (0)
+
+/* every inverse against the double reference on matching input, and its
+   speed against the general scalar inverse on the same matrices */
+static void bench_inverse(void) {
+  static Mat4 general[BENCH_INPUTS], affine[BENCH_INPUTS], rigid[BENCH_INPUTS], proj[BENCH_INPUTS];
+  for (int i = 0; i < BENCH_INPUTS; i++) {
+    /* diagonally dominant, so the reference itself is well conditioned */
+    general[i] = bench_rand4x4();
+    for (int k = 0; k < 4; k++) general[i].nums[k][k] += 8.0f;
+    affine[i] = mul4x4(translate4x4(mul3_f(rand3(), 10.0f)),
+                mul4x4(rotate4x4(rand3(), randf() * 6.28f),
+                       scale4x4(vec3(randf() + 0.5f, randf() + 0.5f, randf() + 0.5f))));
+    rigid[i] = look_at4x4(mul3_f(rand3(), 10.0f), mul3_f(rand3(), 0.5f), vec3_y);
+    proj[i] = perspective4x4(0.5f + randf(), 0.5f + randf(), 0.01f + randf() * 0.1f, 10.0f + randf() * 100.0f);
+  }
+
+  float sum = 0.0f;
+  BENCH_INVERSE("inverse4x4",             inverse4x4,             general);
+  BENCH_INVERSE("inverse_affine4x4",      inverse_affine4x4,      affine);
+  BENCH_INVERSE("inverse_rigid4x4",       inverse_rigid4x4,       rigid);
+  BENCH_INVERSE("inverse_perspective4x4", inverse_perspective4x4, proj);
+  bench_sink = sum;
+}
+
+#define BENCH_STREAM (100000)
+
+/* the batched kernels against a plain loop over the single-element
+   reference, 100k matrices / points at a time */
+static void bench_batch(void) {
+  Mat4 *a = malloc(BENCH_STREAM * sizeof(Mat4));
+  Mat4 *b = malloc(BENCH_STREAM * sizeof(Mat4));
+  Mat4 *out = malloc(BENCH_STREAM * sizeof(Mat4));
+  Mat4 *ref = malloc(BENCH_STREAM * sizeof(Mat4));
+  float *pts = malloc(BENCH_STREAM * 7 * sizeof(float));
+  Vec4SoA in = { pts, pts + BENCH_STREAM, pts + BENCH_STREAM*2, NULL };
+  Vec4SoA res = { pts + BENCH_STREAM*3, pts + BENCH_STREAM*4, pts + BENCH_STREAM*5, pts + BENCH_STREAM*6 };
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    a[i] = bench_rand4x4();
+    b[i] = bench_rand4x4();
+    in.x[i] = randf(); in.y[i] = randf(); in.z[i] = randf();
+  }
+  Mat4 m = a[0];
+  /* touch every output page up front, so no run pays for first faults */
+  memset(out, 0, BENCH_STREAM * sizeof(Mat4));
+  memset(ref, 0, BENCH_STREAM * sizeof(Mat4));
+  memset(res.x, 0, BENCH_STREAM * 4 * sizeof(float));
+
+  uint64_t t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    ref[i] = mul4x4_scalar(a[i], b[i]);
+  double ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  t = stm_now();
+  mul4x4_n(a, b, out, BENCH_STREAM);
+  double ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  bench_report("mul4x4_n (100k)", ref_ns, ns, memcmp(ref, out, BENCH_STREAM * sizeof(Mat4)) != 0);
+  memset(out, 0, BENCH_STREAM * sizeof(Mat4));
+  t = stm_now();
+  jobs_mul4x4_n(a, b, out, BENCH_STREAM);
+  ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  bench_report("jobs_mul4x4_n (100k)", ref_ns, ns, memcmp(ref, out, BENCH_STREAM * sizeof(Mat4)) != 0);
+
+  Vec4 *ref_pts = (Vec4 *)ref;
+  t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    ref_pts[i] = mul4x44_scalar(m, vec4(in.x[i], in.y[i], in.z[i], 1.0f));
+  ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+
+  for (int pass = 0; pass < 2; pass++) {
+    t = stm_now();
+    if (pass == 0) mul4x44_n(m, in, res, BENCH_STREAM);
+    else           jobs_mul4x44_n(m, in, res, BENCH_STREAM);
+    ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+    int bad = 0;
+    for (int i = 0; i < BENCH_STREAM; i++) {
+      Vec4 v = vec4(res.x[i], res.y[i], res.z[i], res.w[i]);
+      bad += memcmp(&v, &ref_pts[i], sizeof(Vec4)) != 0;
+    }
+    bench_report(pass == 0 ? "mul4x44_n (100k)" : "jobs_mul4x44_n (100k)", ref_ns, ns, bad);
+    memset(res.x, 0, BENCH_STREAM * 4 * sizeof(float));
+  }
+
+  free(a); free(b); free(out); free(ref); free(pts);
+}
+
+/* rotation hierarchies: the same random tree of 100k rotations composed
+   with mul_quat and with mul4x4, then a point stream rotated with
+   rotate_quat3_n and with mul4x44_n */
+static void bench_quat(void) {
+  int *parent = malloc(BENCH_STREAM * sizeof(int));
+  Quaternion *local_q = malloc(BENCH_STREAM * sizeof(Quaternion));
+  Quaternion *world_q = malloc(BENCH_STREAM * sizeof(Quaternion));
+  Mat4 *local_m = malloc(BENCH_STREAM * sizeof(Mat4));
+  Mat4 *world_m = malloc(BENCH_STREAM * sizeof(Mat4));
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    /* an 8-ary tree, parents come first just like in scene.h */
+    parent[i] = i == 0 ? -1 : (i - 1) / 8;
+    Vec3 axis = sub3_f(mul3_f(rand3(), 2.0f), 1.0f);
+    float angle = randf() * 0.5f;
+    local_q[i] = axis_angle_quat(axis, angle);
+    local_m[i] = rotate4x4(axis, angle);
+  }
+  memset(world_q, 0, BENCH_STREAM * sizeof(Quaternion));
+  memset(world_m, 0, BENCH_STREAM * sizeof(Mat4));
+
+  uint64_t t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    world_m[i] = parent[i] < 0 ? local_m[i] : mul4x4(world_m[parent[i]], local_m[i]);
+  double ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    world_q[i] = parent[i] < 0 ? local_q[i] : mul_quat(world_q[parent[i]], local_q[i]);
+  double ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  double err = 0.0;
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    Mat4 m = quat_to4x4(world_q[i]);
+    for (int k = 0; k < 16; k++)
+      err = fmax(err, fabs(m.nums[k / 4][k % 4] - world_m[i].nums[k / 4][k % 4]));
+  }
+  bench_report_err("mul_quat tree vs mul4x4", ref_ns, ns, err);
+
+  float *pts = malloc(BENCH_STREAM * 6 * sizeof(float));
+  Vec4SoA in = { pts, pts + BENCH_STREAM, pts + BENCH_STREAM*2, NULL };
+  Vec4SoA out = { pts + BENCH_STREAM*3, pts + BENCH_STREAM*4, pts + BENCH_STREAM*5, NULL };
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    in.x[i] = randf(); in.y[i] = randf(); in.z[i] = randf();
+  }
+  memset(out.x, 0, BENCH_STREAM * 3 * sizeof(float));
+  Quaternion q = world_q[BENCH_STREAM - 1];
+  Mat4 m = quat_to4x4(q);
+
+  /* exactness against the per-element version, then speed against the matrix */
+  int bad = 0;
+  rotate_quat3_n(q, in, out, BENCH_STREAM);
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    Vec3 v = rotate_quat3(q, vec3(in.x[i], in.y[i], in.z[i]));
+    bad += v.x != out.x[i] || v.y != out.y[i] || v.z != out.z[i];
+  }
+  t = stm_now();
+  mul4x44_n(m, in, out, BENCH_STREAM);
+  ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  Vec3 *ref = malloc(BENCH_STREAM * sizeof(Vec3));
+  for (int i = 0; i < BENCH_STREAM; i++)
+    ref[i] = vec3(out.x[i], out.y[i], out.z[i]);
+  t = stm_now();
+  rotate_quat3_n(q, in, out, BENCH_STREAM);
+  ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  err = 0.0;
+  for (int i = 0; i < BENCH_STREAM; i++)
+    err = fmax(err, fmax(fabs(out.x[i] - ref[i].x), fmax(fabs(out.y[i] - ref[i].y), fabs(out.z[i] - ref[i].z))));
+  bench_report_err("rotate_quat3_n vs mul4x44_n", ref_ns, ns, err);
+  if (bad) printf("  %d rotate_quat3_n outputs differ from rotate_quat3\n", bad);
+
+  free(parent); free(local_q); free(world_q); free(local_m); free(world_m);
+  free(pts); free(ref);
+}
+
+/* norm3_fast against norm3 on 100k directions of all lengths, the error
+   measured against a double precision normalize */
+static void bench_norm(void) {
+  float *pts = malloc(BENCH_STREAM * 6 * sizeof(float));
+  Vec4SoA in = { pts, pts + BENCH_STREAM, pts + BENCH_STREAM*2, NULL };
+  Vec4SoA out = { pts + BENCH_STREAM*3, pts + BENCH_STREAM*4, pts + BENCH_STREAM*5, NULL };
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    float len = powf(10.0f, randf() * 8.0f - 4.0f);
+    in.x[i] = (randf() * 2.0f - 1.0f) * len;
+    in.y[i] = (randf() * 2.0f - 1.0f) * len;
+    in.z[i] = (randf() * 2.0f - 1.0f) * len;
+  }
+  memset(out.x, 0, BENCH_STREAM * 3 * sizeof(float));
+
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    sum += norm3(vec3(in.x[i], in.y[i], in.z[i])).nums[i % 3];
+  double ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    sum += norm3_fast(vec3(in.x[i], in.y[i], in.z[i])).nums[i % 3];
+  double ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+
+  double err = 0.0;
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    double x = in.x[i], y = in.y[i], z = in.z[i];
+    double inv = 1.0 / sqrt(x*x + y*y + z*z);
+    Vec3 v = norm3_fast(vec3(in.x[i], in.y[i], in.z[i]));
+    err = fmax(err, fmax(fabs(v.x - x*inv), fmax(fabs(v.y - y*inv), fabs(v.z - z*inv))));
+  }
+  bench_report_err("norm3_fast vs norm3", ref_ns, ns, err);
+
+  t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    Vec3 v = norm3(vec3(in.x[i], in.y[i], in.z[i]));
+    out.x[i] = v.x; out.y[i] = v.y; out.z[i] = v.z;
+  }
+  ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  t = stm_now();
+  norm3_fast_n(in, out, BENCH_STREAM);
+  ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  int bad = 0;
+  for (int i = 0; i < BENCH_STREAM; i++) {
+    Vec3 v = norm3_fast(vec3(in.x[i], in.y[i], in.z[i]));
+    bad += v.x != out.x[i] || v.y != out.y[i] || v.z != out.z[i];
+  }
+  bench_report("norm3_fast_n vs norm3 loop", ref_ns, ns, bad);
+
+  bench_sink = sum;
+  free(pts);
+}
+
+/* bulk random floats: the global randf one at a time, randf_n eight
+   streams per step, and jobs_randf_n checked against a serial fill made
+   from the same splits */
+static void bench_rand(void) {
+  float *a = malloc(BENCH_STREAM * sizeof(float));
+  float *b = malloc(BENCH_STREAM * sizeof(float));
+  memset(a, 0, BENCH_STREAM * sizeof(float));
+  memset(b, 0, BENCH_STREAM * sizeof(float));
+
+  uint64_t t = stm_now();
+  for (int i = 0; i < BENCH_STREAM; i++)
+    a[i] = randf();
+  double ref_ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  RandN rn = randn_stream(1, 0);
+  t = stm_now();
+  randf_n(&rn, b, BENCH_STREAM);
+  double ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+
+  /* every lane must be its scalar stream, a jump apart from the last */
+  Rand lane = rand_seeded(1);
+  int bad = 0;
+  for (int l = 0; l < RAND_LANES; l++) {
+    Rand r = lane;
+    for (int i = l; i < BENCH_STREAM; i += RAND_LANES)
+      bad += b[i] != randf_r(&r);
+    rand_jump(&lane);
+  }
+  bench_report("randf_n vs randf", ref_ns, ns, bad);
+
+  Rand split = rand_seeded(7);
+  for (int c = 0; c * JOBS_MATH_GRAIN < BENCH_STREAM; c++) {
+    RandN r = randn_split(&split);
+    randf_n(&r, a + c * JOBS_MATH_GRAIN, m_min(JOBS_MATH_GRAIN, BENCH_STREAM - c * JOBS_MATH_GRAIN));
+  }
+  t = stm_now();
+  jobs_randf_n(7, b, BENCH_STREAM);
+  ns = stm_ns(stm_since(t)) / BENCH_STREAM;
+  bench_report("jobs_randf_n vs randf", ref_ns, ns, memcmp(a, b, BENCH_STREAM * sizeof(float)) != 0);
+
+  free(a); free(b);
+}
+
+/* a 512^2 cube's worth of directions: recomputed per texel as the bake
+   used to, versus read from the cached table (float and half) */
+static void bench_cube_dirs(void) {
+  const int size = 512;
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int f = 0; f < 6; f++)
+    for (int r = 0; r < size; r++)
+      for (int c = 0; c < size; c++)
+        sum += norm3(cube_texel_dir(f, (c + 0.5f) / size, (r + 0.5f) / size)).y;
+  double ref_ns = stm_ns(stm_since(t)) / (6.0 * size * size);
+
+  t = stm_now();
+  const CubeDirs *dirs = cube_dirs(size, false);
+  double build_ms = stm_ms(stm_since(t));
+  t = stm_now();
+  const CubeDirs *half = cube_dirs(size, true);
+  double half_build_ms = stm_ms(stm_since(t));
+
+  double err = 0.0, half_err = 0.0;
+  float *scratch = malloc(3 * size * sizeof(float));
+  for (int f = 0; f < 6; f++)
+    for (int r = 0; r < size; r++) {
+      Vec4SoA a = cube_dirs_row(dirs, f, r, NULL);
+      Vec4SoA b = cube_dirs_row(half, f, r, scratch);
+      for (int c = 0; c < size; c++) {
+        Vec3 d = norm3(cube_texel_dir(f, (c + 0.5f) / size, (r + 0.5f) / size));
+        err = fmax(err, fmax(fabs(a.x[c] - d.x), fmax(fabs(a.y[c] - d.y), fabs(a.z[c] - d.z))));
+        half_err = fmax(half_err, fmax(fabs(b.x[c] - d.x), fmax(fabs(b.y[c] - d.y), fabs(b.z[c] - d.z))));
+      }
+    }
+
+  t = stm_now();
+  for (int f = 0; f < 6; f++)
+    for (int r = 0; r < size; r++) {
+      Vec4SoA a = cube_dirs_row(cube_dirs(size, false), f, r, NULL);
+      for (int c = 0; c < size; c++) sum += a.y[c];
+    }
+  double ns = stm_ns(stm_since(t)) / (6.0 * size * size);
+  bench_report_err("cube_dirs float vs norm3", ref_ns, ns, err);
+  t = stm_now();
+  for (int f = 0; f < 6; f++)
+    for (int r = 0; r < size; r++) {
+      Vec4SoA b = cube_dirs_row(cube_dirs(size, true), f, r, scratch);
+      for (int c = 0; c < size; c++) sum += b.y[c];
+    }
+  ns = stm_ns(stm_since(t)) / (6.0 * size * size);
+  bench_report_err("cube_dirs half vs norm3", ref_ns, ns, half_err);
+  printf("%-28s %8.2f ms float, %.2f ms half\n", "cube_dirs first build", build_ms, half_build_ms);
+
+  free(scratch);
+  cube_dirs_release();
+  bench_sink = sum;
+}
+
+typedef struct {
+  float freq, t;
+} BenchField;
+
+/* 4D noise over scaled directions, in chunks that fit on the stack */
+static void bench_field(void *user, Vec4SoA dirs, float *out, int n) {
+  const BenchField *field = user;
+  float x[256], y[256], z[256];
+  for (int i = 0; i < n; i += 256) {
+    int m = m_min(256, n - i);
+    for (int j = 0; j < m; j++) {
+      x[j] = dirs.x[i + j] * field->freq;
+      y[j] = dirs.y[i + j] * field->freq;
+      z[j] = dirs.z[i + j] * field->freq;
+    }
+    sn4_sample_n(x, y, z, field->t, out + i, m);
+  }
+}
+
+/* sn4_sample_n against sn4_sample, then an animated field re-baked
+   incrementally against baking it from scratch at the last step */
+static void bench_noise4(void) {
+  enum { N = 4096, ROUNDS = 64 };
+  static float x[N], y[N], z[N], ref[N], out[N];
+  for (int i = 0; i < N; i++) {
+    x[i] = randf() * 64.0f - 32.0f;
+    y[i] = randf() * 64.0f - 32.0f;
+    z[i] = randf() * 64.0f - 32.0f;
+  }
+
+  int bad = 0;
+  for (int r = 0; r < 8; r++) {
+    float w = randf() * 64.0f - 32.0f;
+    for (int i = 0; i < N; i++) ref[i] = sn4_sample(x[i], y[i], z[i], w);
+    sn4_sample_n(x, y, z, w, out, N);
+    bad += memcmp(ref, out, sizeof(ref)) != 0;
+  }
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn4_sample(x[i], y[i], z[i], r * 0.01f);
+  double ref_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn4_sample_n(x, y, z, r * 0.01f, out, N);
+    sum += out[r];
+  }
+  bench_report("sn4_sample_n", ref_ns, stm_ns(stm_since(t)) / (ROUNDS * N), bad);
+
+  const int size = 256, steps = 32;
+  const float threshold = 0.02f;
+  BenchField params = { 4.0f, 0.0f };
+  CubeField field, fresh;
+  cube_field_init(&field, size);
+  cube_field_init(&fresh, size);
+  t = stm_now();
+  cube_field_update(&field, bench_field, &params, threshold);
+  double full_ms = stm_ms(stm_since(t));
+
+  int rebaked = 0;
+  t = stm_now();
+  for (int s = 0; s < steps; s++) {
+    params.t += 0.005f;
+    rebaked += cube_field_update(&field, bench_field, &params, threshold);
+  }
+  double step_ms = stm_ms(stm_since(t)) / steps;
+
+  cube_field_update(&fresh, bench_field, &params, threshold);
+  double err = 0.0;
+  for (size_t i = 0; i < (size_t)6 * size * size; i++)
+    err = fmax(err, fabs(field.values[i] - fresh.values[i]));
+  printf("%-28s %8.2f ms full, %.2f ms per step, %.1f%% of tiles, max err %.2e\n",
+         "cube_field sn4 256", full_ms, step_ms,
+         100.0 * rebaked / (steps * 6.0 * field.tiles * field.tiles), err);
+
+  cube_field_free(&field);
+  cube_field_free(&fresh);
+  cube_dirs_release();
+  bench_sink = sum;
+}
+
+/* sn3_sample_periodic_n against sn3_sample_periodic, and how closely
+   the noise repeats one period over */
+static void bench_noise_periodic(void) {
+  enum { N = 4096, ROUNDS = 64 };
+  static float x[N], y[N], z[N], ref[N], out[N];
+  static const int periods[4][3] = { { 0, 0, 0 }, { 4, 4, 4 }, { 3, 5, 7 }, { 1, 16, 0 } };
+  for (int i = 0; i < N; i++) {
+    x[i] = randf() * 64.0f - 32.0f;
+    y[i] = randf() * 64.0f - 32.0f;
+    z[i] = randf() * 64.0f - 32.0f;
+  }
+
+  int bad = 0;
+  for (int r = 0; r < 4; r++) {
+    const int *p = periods[r];
+    for (int i = 0; i < N; i++) ref[i] = sn3_sample_periodic(x[i], y[i], z[i], p[0], p[1], p[2]);
+    sn3_sample_periodic_n(x, y, z, p[0], p[1], p[2], out, N);
+    bad += memcmp(ref, out, sizeof(ref)) != 0;
+  }
+  double seam = 0.0;
+  for (int i = 0; i < N; i++) {
+    float a = sn3_sample_periodic(x[i], y[i], z[i], 3, 5, 7);
+    float b = sn3_sample_periodic(x[i] + 3.0f, y[i] - 10.0f, z[i] + 7.0f, 3, 5, 7);
+    seam = fmax(seam, fabs(a - b));
+  }
+
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn3_sample_periodic(x[i], y[i], z[i], 8, 8, 8);
+  double ref_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_periodic_n(x, y, z, 8, 8, 8, out, N);
+    sum += out[r];
+  }
+  bench_report("sn3_sample_periodic_n", ref_ns, stm_ns(stm_since(t)) / (ROUNDS * N), bad);
+  printf("%-28s max err %.2e one period over\n", "sn3_sample_periodic", seam);
+  bench_sink = sum;
+}
+
+/* sn3_sample_grad_n against four sn3_sample taps of forward differences.
+   The 0.6 radius makes sn3_sample slightly discontinuous, so a few points
+   disagree with central differences by more than rounding */
+static void bench_noise_grad(void) {
+  enum { N = 4096, ROUNDS = 64 };
+  static float x[N], y[N], z[N], val[N], dx[N], dy[N], dz[N];
+  for (int i = 0; i < N; i++) {
+    x[i] = randf() * 16.0f - 8.0f;
+    y[i] = randf() * 16.0f - 8.0f;
+    z[i] = randf() * 16.0f - 8.0f;
+  }
+
+  int bad = 0, close = 0;
+  sn3_sample_grad_n(x, y, z, val, dx, dy, dz, N);
+  for (int i = 0; i < N; i++) {
+    float gx, gy, gz, v = sn3_sample_grad(x[i], y[i], z[i], &gx, &gy, &gz);
+    float plain = sn3_sample(x[i], y[i], z[i]);
+    bad += v != val[i] || v != plain || gx != dx[i] || gy != dy[i] || gz != dz[i];
+    const float h = 1e-3f;
+    float cx = (sn3_sample(x[i] + h, y[i], z[i]) - sn3_sample(x[i] - h, y[i], z[i])) / (2.0f * h);
+    close += fabsf(cx - gx) < 1e-2f;
+  }
+
+  float sum = 0.0f;
+  const float h = 1e-3f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) {
+      float v = sn3_sample(x[i], y[i], z[i]);
+      sum += v + sn3_sample(x[i] + h, y[i], z[i]) + sn3_sample(x[i], y[i] + h, z[i]) + sn3_sample(x[i], y[i], z[i] + h);
+    }
+  double ref_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn3_sample(x[i], y[i], z[i]);
+  double plain_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) {
+      float gx, gy, gz;
+      sum += sn3_sample_grad(x[i], y[i], z[i], &gx, &gy, &gz) + gx;
+    }
+  double grad_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_grad_n(x, y, z, val, dx, dy, dz, N);
+    sum += dx[r];
+  }
+  bench_report("sn3_sample_grad_n vs 4 taps", ref_ns, stm_ns(stm_since(t)) / (ROUNDS * N), bad);
+  printf("%-28s %.2fx a plain sample, %.1f%% within 1e-2 of central differences\n",
+         "sn3_sample_grad", grad_ns / plain_ns, 100.0 * close / N);
+  bench_sink = sum;
+}
+
+/* every one of the 27 cells, no early-out */
+static Worley bench_worley3_all(float x, float y, float z) {
+  int i = sn3_fastfloor(x), j = sn3_fastfloor(y), k = sn3_fastfloor(z);
+  float fx = x - i, fy = y - j, fz = z - k, f1 = INFINITY, f2 = INFINITY;
+  int yz[3][3];
+  _worley3_hash_yz(j, k, yz);
+  for (int n = 0; n < 27; n++) {
+    const int8_t o[3] = { n / 9 - 1, n / 3 % 3 - 1, n % 3 - 1 };
+    _worley3_visit(_worley3_point(i, o, yz), o[0], o[1], o[2], fx, fy, fz, &f1, &f2);
+  }
+  return (Worley) { sqrtf(f1), sqrtf(f2) };
+}
+
+/* worley3 against the full search, worley3_n against worley3, and both
+   against the cost of sn3_sample */
+static void bench_worley(void) {
+  enum { N = 4096, ROUNDS = 64 };
+  static float x[N], y[N], z[N], f1[N], f2[N];
+  for (int i = 0; i < N; i++) {
+    x[i] = randf() * 64.0f - 32.0f;
+    y[i] = randf() * 64.0f - 32.0f;
+    z[i] = randf() * 64.0f - 32.0f;
+  }
+
+  int bad = 0, bad_n = 0;
+  worley3_n(x, y, z, f1, f2, N);
+  for (int i = 0; i < N; i++) {
+    Worley a = worley3(x[i], y[i], z[i]), b = bench_worley3_all(x[i], y[i], z[i]);
+    bad += a.f1 != b.f1 || a.f2 != b.f2;
+    bad_n += a.f1 != f1[i] || a.f2 != f2[i];
+  }
+
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += bench_worley3_all(x[i], y[i], z[i]).f1;
+  double all_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += worley3(x[i], y[i], z[i]).f1;
+  double ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    worley3_n(x, y, z, f1, f2, N);
+    sum += f1[r];
+  }
+  double batch_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn3_sample(x[i], y[i], z[i]);
+  double simplex_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+
+  bench_report("worley3 vs all 27 cells", all_ns, ns, bad);
+  bench_report("worley3_n", ns, batch_ns, bad_n);
+  printf("%-28s %.2fx sn3_sample scalar, %.2fx batched\n", "worley3", ns / simplex_ns, batch_ns / simplex_ns);
+  bench_sink = sum;
+}
+
+/* value statistics of a noise over random points: standard deviation,
+   largest magnitude and a 32 bin histogram over [-1, 1] */
+static void bench_noise_stats(const char *name, float (*noise)(float, float, float),
+                              const float *x, const float *y, const float *z, int n, double hist[32]) {
+  double sq = 0.0;
+  float peak = 0.0f;
+  memset(hist, 0, 32 * sizeof(double));
+  for (int i = 0; i < n; i++) {
+    float v = noise(x[i], y[i], z[i]);
+    sq += v * v;
+    peak = m_max(peak, fabsf(v));
+    hist[m_clamp((int)((v + 1.0f) * 16.0f), 0, 31)] += 1.0 / n;
+  }
+  printf("%-28s std %.3f  max |v| %.3f\n", name, sqrt(sq / n), peak);
+}
+
+/* power along random lines, summed into octave bands of frequency in
+   cycles per unit: below 1/4, 1/4 to 1/2, 1/2 to 1, above 1 */
+static void bench_noise_spectrum(float (*noise)(float, float, float), double band[4]) {
+  enum { LINES = 32, LEN = 256 };
+  const float step = 0.125f;
+  static float v[LEN];
+  double total = 0.0;
+  memset(band, 0, 4 * sizeof(double));
+  for (int l = 0; l < LINES; l++) {
+    Vec3 o = vec3(randf() * 100.0f, randf() * 100.0f, randf() * 100.0f);
+    Vec3 d = norm3(vec3(randf() - 0.5f, randf() - 0.5f, randf() - 0.5f));
+    for (int i = 0; i < LEN; i++)
+      v[i] = noise(o.x + d.x * step * i, o.y + d.y * step * i, o.z + d.z * step * i);
+    for (int f = 1; f < LEN / 2; f++) {
+      double re = 0.0, im = 0.0;
+      for (int i = 0; i < LEN; i++) {
+        re += v[i] * cosf(PI_f * 2.0f * f * i / LEN);
+        im += v[i] * sinf(PI_f * 2.0f * f * i / LEN);
+      }
+      double cycles = f / (LEN * step), power = re * re + im * im;
+      band[cycles < 0.25 ? 0 : cycles < 0.5 ? 1 : cycles < 1.0 ? 2 : 3] += power;
+      total += power;
+    }
+  }
+  for (int b = 0; b < 4; b++) band[b] /= total;
+}
+
+/* the table-free noise against sn3_sample: exactness of the batched form,
+   throughput of both, and how close their value distributions and spectra are */
+static void bench_noise_hash(void) {
+  enum { N = 4096, ROUNDS = 64, STATS = 1 << 16 };
+  static float x[STATS], y[STATS], z[STATS], ref[N], out[N];
+  for (int i = 0; i < STATS; i++) {
+    x[i] = randf() * 512.0f - 256.0f;
+    y[i] = randf() * 512.0f - 256.0f;
+    z[i] = randf() * 512.0f - 256.0f;
+  }
+
+  int bad = 0;
+  sn3_sample_hash_n(x, y, z, out, N);
+  for (int i = 0; i < N; i++) bad += sn3_sample_hash(x[i], y[i], z[i]) != out[i];
+
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn3_sample(x[i], y[i], z[i]);
+  double table_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn3_sample_hash(x[i], y[i], z[i]);
+  double hash_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_n(x, y, z, ref, N);
+    sum += ref[r];
+  }
+  double table_n_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_hash_n(x, y, z, out, N);
+    sum += out[r];
+  }
+  double hash_n_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  bench_report("sn3_sample_hash vs table", table_ns, hash_ns, 0);
+  bench_report("sn3_sample_hash_n", hash_ns, hash_n_ns, bad);
+  bench_report("sn3_sample_hash_n vs table", table_n_ns, hash_n_ns, 0);
+
+  double ha[32], hb[32], sa[4], sb[4], tv = 0.0;
+  bench_noise_stats("sn3_sample", sn3_sample, x, y, z, STATS, ha);
+  bench_noise_stats("sn3_sample_hash", sn3_sample_hash, x, y, z, STATS, hb);
+  for (int b = 0; b < 32; b++) tv += fabs(ha[b] - hb[b]) / 2.0;
+  bench_noise_spectrum(sn3_sample, sa);
+  bench_noise_spectrum(sn3_sample_hash, sb);
+  printf("%-28s histograms %.3f apart (total variation)\n", "", tv);
+  printf("%-28s power <1/4 %.3f %.3f  <1/2 %.3f %.3f  <1 %.3f %.3f  >1 %.3f %.3f\n", "table, hash",
+         sa[0], sb[0], sa[1], sb[1], sa[2], sb[2], sa[3], sb[3]);
+  bench_sink = sum;
+}
+
+/* FNV-1a over bytes, chained through h */
+static uint64_t bench_fnv1a(const void *data, size_t size, uint64_t h) {
+  const uint8_t *p = data;
+  for (size_t i = 0; i < size; i++) h = (h ^ p[i]) * 0x100000001b3ull;
+  return h;
+}
+
+/* hashes of a 6x256^2 direction table and of three octaves of
+   sn3_sample_fixed baked over it, as this tree produces them on any
+   machine; a change to either means cached bakes are invalid */
+#define BENCH_GOLDEN_DIRS (0xa5b680f5b2af0ab5ull)
+#define BENCH_GOLDEN_BAKE (0xf88f84d91ed46bfeull)
+
+static float bench_golden_fbm(float x, float y, float z) {
+  return sn3_sample_fixed(x * 2.0f, y * 2.0f, z * 2.0f)
+       + sn3_sample_fixed(x * 4.0f, y * 4.0f, z * 4.0f) * 0.5f
+       + sn3_sample_fixed(x * 8.0f, y * 8.0f, z * 8.0f) * 0.25f;
+}
+
+/* the reproducible bake: scalar and batched sn3_sample_fixed against
+   each other and against the golden hashes, and what it costs next to
+   the float noise it follows */
+static void bench_golden(void) {
+  enum { SIZE = 256, ROUNDS = 16 };
+  static float x[SIZE * 8], y[SIZE * 8], z[SIZE * 8], a[SIZE * 8], b[SIZE * 8], row[SIZE];
+  const CubeDirs *dirs = cube_dirs(SIZE, false);
+
+  uint64_t dirs_hash = 0xcbf29ce484222325ull, bake = dirs_hash, bake_n = dirs_hash;
+  for (int f = 0; f < 6; f++)
+    for (int r = 0; r < SIZE; r++) {
+      Vec4SoA d = cube_dirs_row(dirs, f, r, NULL);
+      dirs_hash = bench_fnv1a(d.x, SIZE * sizeof(float), dirs_hash);
+      dirs_hash = bench_fnv1a(d.y, SIZE * sizeof(float), dirs_hash);
+      dirs_hash = bench_fnv1a(d.z, SIZE * sizeof(float), dirs_hash);
+      for (int c = 0; c < SIZE; c++) row[c] = bench_golden_fbm(d.x[c], d.y[c], d.z[c]);
+      bake = bench_fnv1a(row, sizeof(row), bake);
+
+      /* the same octaves through the batched form */
+      for (int o = 0; o < 3; o++)
+        for (int c = 0; c < SIZE; c++) {
+          float k = (float)(2 << o);
+          x[o * SIZE + c] = d.x[c] * k;
+          y[o * SIZE + c] = d.y[c] * k;
+          z[o * SIZE + c] = d.z[c] * k;
+        }
+      sn3_sample_fixed_n(x, y, z, a, 3 * SIZE);
+      for (int c = 0; c < SIZE; c++) row[c] = a[c] + a[SIZE + c] * 0.5f + a[2 * SIZE + c] * 0.25f;
+      bake_n = bench_fnv1a(row, sizeof(row), bake_n);
+    }
+
+  /* batched against scalar and the float noise over a wider range */
+  int bad = 0;
+  float err = 0.0f;
+  for (int i = 0; i < SIZE * 8; i++) {
+    x[i] = randf() * 4000.0f - 2000.0f;
+    y[i] = randf() * 4000.0f - 2000.0f;
+    z[i] = randf() * 4000.0f - 2000.0f;
+  }
+  sn3_sample_fixed_n(x, y, z, a, SIZE * 8);
+  sn3_sample_hash_n(x, y, z, b, SIZE * 8);
+  for (int i = 0; i < SIZE * 8; i++) {
+    bad += a[i] != sn3_sample_fixed(x[i], y[i], z[i]);
+    err = m_max(err, fabsf(a[i] - b[i]));
+  }
+
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < SIZE * 8; i++) sum += sn3_sample_fixed(x[i], y[i], z[i]);
+  double scalar_ns = stm_ns(stm_since(t)) / (ROUNDS * SIZE * 8);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_hash_n(x, y, z, b, SIZE * 8);
+    sum += b[r];
+  }
+  double hash_ns = stm_ns(stm_since(t)) / (ROUNDS * SIZE * 8);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_fixed_n(x, y, z, a, SIZE * 8);
+    sum += a[r];
+  }
+  double ns = stm_ns(stm_since(t)) / (ROUNDS * SIZE * 8);
+  bench_report("sn3_sample_fixed_n", scalar_ns, ns, bad);
+  bench_report_err("sn3_sample_fixed_n vs hash", hash_ns, ns, err);
+  printf("%-28s dirs %016llx %s\n", "golden", (unsigned long long)dirs_hash,
+         dirs_hash == BENCH_GOLDEN_DIRS ? "ok" : "CHANGED");
+  printf("%-28s bake %016llx %s, batched %s\n", "", (unsigned long long)bake,
+         bake == BENCH_GOLDEN_BAKE ? "ok" : "CHANGED", bake_n == bake ? "ok" : "MISMATCH");
+  cube_dirs_release();
+  bench_sink = sum;
+}
+
+/* the sky's clouds with an animated, ridged layer on top, by hand: every
+   source is a scalar call per texel, in the same order noise_eval adds */
+static float bench_noise_graph_ref(float x, float y, float z, float time) {
+  float w[3];
+  for (int a = 0; a < 3; a++) {
+    float offset = (float[]) { 0.0f, 31.7f, 73.1f }[a];
+    w[a] = sn3_sample(x * 2.0f + offset, y * 2.0f + offset, z * 2.0f + offset)
+         + sn3_sample(x * 4.0f + offset, y * 4.0f + offset, z * 4.0f + offset) * 0.5f;
+  }
+  float wx = x + 0.08f * w[0], wy = y + 0.08f * w[1], wz = z + 0.08f * w[2];
+  Worley cell = worley3(wx * 6.0f, wy * 6.0f, wz * 6.0f);
+  float cells = m_clamp(cell.f1 * -1.4f + 1.0f, 0.0f, 1.0f);
+  float ridge = fabsf(sn4_sample(x * 3.0f + 5.0f, y * 3.0f + 5.0f, z * 3.0f + 5.0f, time * 0.25f) * 0.5f);
+  return cells * ridge;
+}
+
+static int bench_noise_graph_build(NoiseGraph *g) {
+  int wx = noise_fbm(g, 2.0f, 1.0f, 2, 0.0f);
+  int wy = noise_fbm(g, 2.0f, 1.0f, 2, 31.7f);
+  int wz = noise_fbm(g, 2.0f, 1.0f, 2, 73.1f);
+  int cells = noise_warp(g, noise_worley(g, NOISE_F1, 6.0f, 1.0f, 0.0f), wx, wy, wz, 0.08f);
+  int ridge = noise_abs(g, noise_simplex4(g, 3.0f, 0.5f, 5.0f, 0.25f));
+  return noise_mul(g, noise_remap(g, cells, -1.4f, 1.0f, 0.0f, 1.0f), ridge);
+}
+
+/* sn3_sample_n against sn3_sample, and a compiled noise graph against
+   the same composition written out per texel */
+static void bench_noise_graph(void) {
+  enum { N = 4096, ROUNDS = 16 };
+  static float x[N], y[N], z[N], ref[N], out[N];
+  for (int i = 0; i < N; i++) {
+    Vec3 d = norm3(vec3(randf() * 2.0f - 1.0f, randf() * 2.0f - 1.0f, randf() * 2.0f - 1.0f));
+    x[i] = d.x;
+    y[i] = d.y;
+    z[i] = d.z;
+  }
+
+  int bad = 0;
+  for (int i = 0; i < N; i++) ref[i] = sn3_sample(x[i] * 8.0f, y[i] * 8.0f, z[i] * 8.0f);
+  float sum = 0.0f;
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += sn3_sample(x[i], y[i], z[i]);
+  double ref_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  static float sx[N], sy[N], sz[N];
+  for (int i = 0; i < N; i++) {
+    sx[i] = x[i] * 8.0f;
+    sy[i] = y[i] * 8.0f;
+    sz[i] = z[i] * 8.0f;
+  }
+  sn3_sample_n(sx, sy, sz, out, N);
+  bad = memcmp(ref, out, sizeof(ref)) != 0;
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    sn3_sample_n(x, y, z, out, N);
+    sum += out[r];
+  }
+  bench_report("sn3_sample_n", ref_ns, stm_ns(stm_since(t)) / (ROUNDS * N), bad);
+
+  NoiseGraph g = {0};
+  NoiseProgram prog;
+  bad = !noise_compile(&g, bench_noise_graph_build(&g), &prog);
+  prog.time = 1.5f;
+  Vec4SoA dirs = { x, y, z, NULL };
+  noise_eval(&prog, dirs, out, N);
+  for (int i = 0; i < N; i++) {
+    ref[i] = bench_noise_graph_ref(x[i], y[i], z[i], prog.time);
+    bad += ref[i] != out[i];
+  }
+
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < N; i++) sum += bench_noise_graph_ref(x[i], y[i], z[i], prog.time);
+  ref_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    noise_eval(&prog, dirs, out, N);
+    sum += out[r];
+  }
+  bench_report("noise_eval vs nested calls", ref_ns, stm_ns(stm_since(t)) / (ROUNDS * N), bad);
+  printf("%-28s %d nodes, %d instructions\n", "noise graph", g.count, prog.count);
+  bench_sink = sum;
+}
+
+/* float to half, scalar against f32_to_f16_n, and the packed HDR format:
+   the largest relative error over values a sky can have, against half an
+   ulp of its mantissa plus the rounding to half on the way, and the
+   batched packer against the scalar */
+static void bench_half(void) {
+  enum { N = 4096, ROUNDS = 64 };
+  static float in[4 * N];
+  static uint16_t a[4 * N], b[4 * N];
+  static uint32_t packed[N];
+  for (int i = 0; i < 4 * N; i++) in[i] = expf(randf() * 20.0f - 12.0f);
+
+  uint64_t t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < 4 * N; i++) a[i] = f32_to_f16(in[i]);
+    bench_sink += a[r];
+  }
+  double scalar_ns = stm_ns(stm_since(t)) / (ROUNDS * 4 * N);
+  t = stm_now();
+  /* a few short, so the scalar tail is checked too */
+  int n = 4 * N - 3;
+  for (int r = 0; r < ROUNDS; r++) {
+    f32_to_f16_n(in, b, n);
+    bench_sink += b[r];
+  }
+  double batch_ns = stm_ns(stm_since(t)) / (ROUNDS * n);
+  int bad = 0;
+  for (int i = 0; i < n; i++) bad += f32_to_f16(in[i]) != b[i];
+  bench_report("f32_to_f16_n", scalar_ns, batch_ns, bad);
+
+  t = stm_now();
+  for (int r = 0; r < ROUNDS; r++) {
+    rg11b10_pack_n(in, packed, N);
+    bench_sink += packed[r];
+  }
+  double pack_ns = stm_ns(stm_since(t)) / (ROUNDS * N);
+  int bad_n = 0;
+  float err_rg = 0.0f, err_b = 0.0f;
+  for (int i = 0; i < N; i++) {
+    Vec3 c = vec3(in[4*i], in[4*i + 1], in[4*i + 2]);
+    bad_n += rg11b10_pack(c) != packed[i];
+    Vec3 d = rg11b10_unpack(packed[i]);
+    /* below half's normal range the error is absolute, not relative */
+    if (c.x > 6.2e-5f) err_rg = m_max(err_rg, fabsf(d.x - c.x) / c.x);
+    if (c.y > 6.2e-5f) err_rg = m_max(err_rg, fabsf(d.y - c.y) / c.y);
+    if (c.z > 6.2e-5f) err_b = m_max(err_b, fabsf(d.z - c.z) / c.z);
+  }
+  printf("%-28s %.2f ns/texel, %s, rel err rg %.2e (<%.2e) b %.2e (<%.2e)\n",
+         "rg11b10_pack_n", pack_ns, bad_n ? "DIFFERS" : "exact",
+         err_rg, 1.0f / 128.0f + 1.0f / 2048.0f, err_b, 1.0f / 64.0f + 1.0f / 2048.0f);
+  printf("%-28s rgba16f %d, rg11b10f %d, rgba8 %d bytes/texel\n", "cube_img", 8, 4, 4);
+}
+
+static void bench_sh_linear(void *user, Vec4SoA dirs, Vec4SoA out, int n) {
+  (void)user;
+  for (int i = 0; i < n; i++) {
+    out.x[i] = 1.0f;
+    out.y[i] = 1.0f + dirs.y[i];
+    out.z[i] = 1.0f + 0.5f * dirs.x[i] * dirs.z[i];
+  }
+}
+
+/* the same integral one texel at a time on one thread, normalized the
+   same way */
+static ShL2 bench_sh_reference(int size) {
+  float buf[6 * 256];
+  Vec4SoA rgb = { buf, buf + size, buf + 2*size, NULL };
+  Vec4SoA d = { buf + 3*size, buf + 4*size, buf + 5*size, NULL };
+  double sum[27] = {0}, weight = 0.0;
+  for (int r = 0; r < 6 * size; r++) {
+    cube_texel_row(r / size, r % size, size, d);
+    bench_sh_linear(NULL, d, rgb, size);
+    for (int c = 0; c < size; c++) {
+      Vec3 v = vec3(d.x[c], d.y[c], d.z[c]);
+      float m = m_max(fabsf(v.x), m_max(fabsf(v.y), fabsf(v.z))), basis[9];
+      double w = m * m * m * 4.0 / ((double)size * size);
+      _sh_basis(v, basis);
+      for (int k = 0; k < 9; k++) {
+        sum[3*k] += w * basis[k] * rgb.x[c];
+        sum[3*k + 1] += w * basis[k] * rgb.y[c];
+        sum[3*k + 2] += w * basis[k] * rgb.z[c];
+      }
+      weight += w;
+    }
+  }
+  ShL2 sh;
+  for (int k = 0; k < 9; k++)
+    sh.c[k] = vec3((float)(sum[3*k] * 4.0 * PI_f / weight), (float)(sum[3*k + 1] * 4.0 * PI_f / weight),
+                   (float)(sum[3*k + 2] * 4.0 * PI_f / weight));
+  return sh;
+}
+
+/* spherical harmonics: the projection against a scalar one in doubles,
+   twice to show it's deterministic, and the reflected radiance of
+   radiance 1, 1 + y and 1 + xz/2 against its exact value, 1, 1 + 2y/3
+   and 1 + xz/8 */
+static void bench_sh(void) {
+  enum { SIZE = 128, ROUNDS = 8 };
+  uint64_t t = stm_now();
+  ShL2 ref = bench_sh_reference(SIZE);
+  double ref_ms = stm_ms(stm_since(t));
+  t = stm_now();
+  ShL2 sh;
+  for (int r = 0; r < ROUNDS; r++) sh = sh_project(SIZE, bench_sh_linear, NULL);
+  double ms = stm_ms(stm_since(t)) / ROUNDS;
+  ShL2 again = sh_project(SIZE, bench_sh_linear, NULL);
+
+  float diff = 0.0f;
+  for (int k = 0; k < 9; k++) diff = m_max(diff, mag3(sub3(sh.c[k], ref.c[k])));
+  ShL2 irr = sh_irradiance(sh);
+  float err = 0.0f;
+  for (int i = 0; i < 256; i++) {
+    Vec3 n = norm3(vec3(randf() * 2.0f - 1.0f, randf() * 2.0f - 1.0f, randf() * 2.0f - 1.0f));
+    Vec3 e = sh_eval(&irr, n);
+    Vec3 exact = vec3(1.0f, 1.0f + 2.0f / 3.0f * n.y, 1.0f + n.x * n.z / 8.0f);
+    err = m_max(err, mag3(sub3(e, exact)));
+  }
+  printf("%-28s ref %8.2f ms  fast %8.2f ms  x%5.2f  max diff %.1e, %s\n", "sh_project 6x128^2",
+         ref_ms, ms, ref_ms / ms, diff, memcmp(&sh, &again, sizeof(sh)) == 0 ? "deterministic" : "NOT DETERMINISTIC");
+  printf("%-28s max err %.1e against the exact irradiance\n", "sh_irradiance", err);
+}
+
+static void bench_env_constant(void *user, Vec4SoA dirs, Vec4SoA out, int n) {
+  (void)user; (void)dirs;
+  for (int i = 0; i < n; i++) out.x[i] = out.y[i] = out.z[i] = 1.0f;
+}
+
+static void bench_env_linear(void *user, Vec4SoA dirs, Vec4SoA out, int n) {
+  (void)user;
+  for (int i = 0; i < n; i++) out.x[i] = out.y[i] = out.z[i] = 1.0f + dirs.y[i];
+}
+
+/* 1 + y convolved with a mip's lobe around nrm, with many samples of the
+   function itself instead of the filtered source chain */
+static float bench_env_reference(const EnvMap *env, int mip, Vec3 nrm) {
+  enum { N = 4096 };
+  float roughness = (float)mip / (env->mips - 1), a2 = powf(roughness, 4.0f);
+  Vec3 up = fabsf(nrm.y) < 0.9f ? vec3_y : vec3_x;
+  Vec3 tx = norm3(cross3(up, nrm)), ty = cross3(nrm, tx);
+  double sum = 0.0, weight = 0.0;
+  for (int i = 0; i < N; i++) {
+    float e1 = (float)i / N, e2 = _env_reverse_bits(i) * 2.3283064365386963e-10f;
+    float cos_h = sqrtf((1.0f - e2) / (1.0f + (a2 - 1.0f) * e2)), sin_h = sqrtf(1.0f - cos_h * cos_h);
+    float phi = 2.0f * PI_f * e1, lz = 2.0f * cos_h * cos_h - 1.0f;
+    if (lz <= 0.0f) continue;
+    Vec3 l = add3(add3(mul3_f(tx, 2.0f * cos_h * sin_h * cosf(phi)), mul3_f(ty, 2.0f * cos_h * sin_h * sinf(phi))),
+                  mul3_f(nrm, lz));
+    sum += (1.0 + l.y) * lz;
+    weight += lz;
+  }
+  return (float)(sum / weight);
+}
+
+/* the specular environment map: cube_dir_texel() inverting
+   cube_texel_dir(), the time of a bake of the size the sky uses, the
+   same bake spread over frames, a constant that has to stay constant at
+   every roughness and 1 + y against the same convolution with many more
+   samples */
+static void bench_env(void) {
+  enum { SIZE = 128, MIPS = 6, ROUNDS = 4 };
+  int wrong = 0;
+  for (int f = 0; f < 6; f++)
+    for (int y = 0; y < 64; y++)
+      for (int x = 0; x < 64; x++) {
+        float u, v;
+        Vec3 d = mul3_f(norm3(cube_texel_dir(f, (x + 0.5f) / 64, (y + 0.5f) / 64)), 3.0f);
+        wrong += cube_dir_texel(d, &u, &v) != f || (int)(u * 64) != x || (int)(v * 64) != y;
+      }
+
+  EnvMap env;
+  env_init(&env, SIZE, MIPS);
+  double source_ms = 0.0, prefilter_ms = 0.0;
+  for (int r = 0; r < ROUNDS; r++) {
+    env_bake(&env, bench_env_constant, NULL);
+    source_ms += env.source_ms;
+    prefilter_ms += env.prefilter_ms;
+  }
+  float constant = 0.0f;
+  for (int m = 0; m < env.mips; m++)
+    for (int f = 0; f < 6; f++)
+      for (int i = 0; i < (SIZE >> m) * (SIZE >> m); i++)
+        constant = m_max(constant, fabsf(env.levels[m][f][i].x - 1.0f));
+
+  env_bake(&env, bench_env_linear, NULL);
+  EnvMap again;
+  env_init(&again, SIZE, MIPS);
+  env_begin(&again, bench_env_linear, NULL);
+  int frames = 1;
+  double frame_ms = 0.0;
+  for (;; frames++) {
+    uint64_t t = stm_now();
+    bool done = env_update(&again, 2.0);
+    frame_ms = m_max(frame_ms, stm_ms(stm_since(t)));
+    if (done) break;
+  }
+  bool same = true;
+  for (int m = 0; m < env.mips; m++)
+    for (int f = 0; f < 6; f++)
+      same &= memcmp(env.levels[m][f], again.levels[m][f], (size_t)(SIZE >> m) * (SIZE >> m) * sizeof(Vec4)) == 0;
+  env_free(&again);
+
+  printf("%-28s %d of 6x64^2 texels wrong\n", "cube_dir_texel", wrong);
+  printf("%-28s source %.2f ms  prefilter %.2f ms  (%d mips, %d samples)\n", "env_bake 6x128^2",
+         source_ms / ROUNDS, prefilter_ms / ROUNDS, env.mips, ENV_SAMPLES);
+  printf("%-28s %s, %d frames of 2.0 ms, %.2f ms at most\n", "env_update",
+         same ? "same as env_bake" : "MISMATCH", frames, frame_ms);
+  printf("%-28s constant max err %.1e; 1 + y max err per roughness:", "env prefilter", constant);
+  for (int m = 1; m < env.mips; m++) {
+    int n = SIZE >> m;
+    float err = 0.0f;
+    for (int f = 0; f < 6; f++)
+      for (int row = 0; row < n; row += 3)
+        for (int col = 0; col < n; col += 3) {
+          float ref = bench_env_reference(&env, m, norm3(cube_texel_dir(f, (col + 0.5f) / n, (row + 0.5f) / n)));
+          err = m_max(err, fabsf(env.levels[m][f][row * n + col].x - ref));
+        }
+    printf(" %.2f %.1e", (float)m / (env.mips - 1), err);
+  }
+  printf("\n");
+  env_free(&env);
+}
+
+static Vec4 bench_pano_fn(Vec3 d) {
+  return vec4(0.5f + 0.5f * d.x, 0.5f + 0.5f * d.y * d.z, 0.5f + 0.5f * sinf(3.0f * d.x + 2.0f * d.y), 1.0f);
+}
+
+static void bench_pano_fill(Pano *pano, PanoCube *cube) {
+  int n = pano ? pano->width : cube->size, rows = pano ? pano->height : 6 * cube->size;
+  float *buf = malloc(3 * n * sizeof(float));
+  Vec4SoA d = { buf, buf + n, buf + 2 * n, NULL };
+  for (int r = 0; r < rows; r++) {
+    if (pano) pano_row_dirs(pano->layout, n, pano->height, r, d);
+    else cube_texel_row(r / n, r % n, n, d);
+    Vec4 *dst = pano ? pano->texels + (size_t)r * n : cube->faces[r / n] + (size_t)(r % n) * n;
+    for (int i = 0; i < n; i++) dst[i] = bench_pano_fn(vec3(d.x[i], d.y[i], d.z[i]));
+  }
+  free(buf);
+}
+
+/* the largest difference from bench_pano_fn over every texel, edges and
+   seams included */
+static float bench_pano_err(const Pano *pano, const PanoCube *cube) {
+  int n = pano ? pano->width : cube->size, rows = pano ? pano->height : 6 * cube->size;
+  float *buf = malloc(3 * n * sizeof(float)), err = 0.0f;
+  Vec4SoA d = { buf, buf + n, buf + 2 * n, NULL };
+  for (int r = 0; r < rows; r++) {
+    if (pano) pano_row_dirs(pano->layout, n, pano->height, r, d);
+    else cube_texel_row(r / n, r % n, n, d);
+    const Vec4 *t = pano ? pano->texels + (size_t)r * n : cube->faces[r / n] + (size_t)(r % n) * n;
+    for (int i = 0; i < n; i++) {
+      Vec4 e = bench_pano_fn(vec3(d.x[i], d.y[i], d.z[i]));
+      for (int k = 0; k < 3; k++) err = m_max(err, fabsf(t[i].nums[k] - e.nums[k]));
+    }
+  }
+  free(buf);
+  return err;
+}
+
+/* sky layouts: the atan2 the equirect mapping uses, then every
+   conversion between equirect, octahedral and cube timed and checked
+   against the function the source was filled from. A seam that doesn't
+   wrap shows up as an error many times the rest */
+static void bench_panorama(void) {
+  enum { N = 1 << 16 };
+  float err_atan = 0.0f;
+  for (int i = 0; i < N; i++) {
+    float y = randf() * 2.0f - 1.0f, x = randf() * 2.0f - 1.0f;
+    err_atan = m_max(err_atan, fabsf(_pano_atan2(y, x) - atan2f(y, x)));
+  }
+  float x4[N], y4[N], z4[N], u[N], v[N], err_simd = 0.0f;
+  for (int i = 0; i < N; i++) {
+    x4[i] = randf() * 2.0f - 1.0f;
+    y4[i] = randf() * 2.0f - 1.0f;
+    z4[i] = randf() * 2.0f - 1.0f;
+  }
+  for (int layout = PANO_EQUIRECT; layout <= PANO_OCTAHEDRAL; layout++) {
+    pano_dirs_uv(layout, (Vec4SoA) { x4, y4, z4, NULL }, u, v, N);
+    for (int i = 0; i < N; i++) {
+      float su, sv;
+      _pano_dir_uv(layout, vec3(x4[i], y4[i], z4[i]), &su, &sv);
+      err_simd = m_max(err_simd, m_max(fabsf(su - u[i]), fabsf(sv - v[i])));
+    }
+  }
+  printf("%-28s atan2 max err %.1e rad, simd vs scalar uv %.1e\n", "pano_dirs_uv", err_atan, err_simd);
+
+  Pano equirect, oct, back;
+  PanoCube cube;
+  pano_init(&equirect, PANO_EQUIRECT, 2048, 1024);
+  pano_init(&oct, PANO_OCTAHEDRAL, 1024, 1024);
+  pano_init(&back, PANO_EQUIRECT, 2048, 1024);
+  pano_cube_init(&cube, 512);
+  bench_pano_fill(&equirect, NULL);
+
+  uint64_t t = stm_now();
+  pano_to_cube(&equirect, &cube);
+  double to_cube_ms = stm_ms(stm_since(t));
+  float to_cube = bench_pano_err(NULL, &cube);
+  t = stm_now();
+  pano_convert(&equirect, &oct);
+  double to_oct_ms = stm_ms(stm_since(t));
+  float to_oct = bench_pano_err(&oct, NULL);
+
+  bench_pano_fill(NULL, &cube);
+  t = stm_now();
+  pano_from_cube(&cube, &back);
+  double from_cube_ms = stm_ms(stm_since(t));
+  float from_cube = bench_pano_err(&back, NULL);
+  bench_pano_fill(&oct, NULL);
+  t = stm_now();
+  pano_to_cube(&oct, &cube);
+  double oct_cube_ms = stm_ms(stm_since(t));
+  float oct_cube = bench_pano_err(NULL, &cube);
+  t = stm_now();
+  pano_convert(&oct, &back);
+  double oct_equirect_ms = stm_ms(stm_since(t));
+  float oct_equirect = bench_pano_err(&back, NULL);
+
+  printf("%-28s %7.2f ms  %5.1f ns/texel  max err %.1e\n", "equirect 2048 -> cube 512",
+         to_cube_ms, to_cube_ms * 1e6 / (6 * 512 * 512), to_cube);
+  printf("%-28s %7.2f ms  %5.1f ns/texel  max err %.1e\n", "equirect 2048 -> oct 1024",
+         to_oct_ms, to_oct_ms * 1e6 / (1024 * 1024), to_oct);
+  printf("%-28s %7.2f ms  %5.1f ns/texel  max err %.1e\n", "cube 512 -> equirect 2048",
+         from_cube_ms, from_cube_ms * 1e6 / (2048 * 1024), from_cube);
+  printf("%-28s %7.2f ms  %5.1f ns/texel  max err %.1e\n", "oct 1024 -> cube 512",
+         oct_cube_ms, oct_cube_ms * 1e6 / (6 * 512 * 512), oct_cube);
+  printf("%-28s %7.2f ms  %5.1f ns/texel  max err %.1e\n", "oct 1024 -> equirect 2048",
+         oct_equirect_ms, oct_equirect_ms * 1e6 / (2048 * 1024), oct_equirect);
+  pano_free(&equirect);
+  pano_free(&oct);
+  pano_free(&back);
+  pano_cube_free(&cube);
+}
+
+/* the illuminance a cube of radiance adds up to, each texel times its
+   solid angle */
+static Vec3 bench_stars_energy(const CubeImg *img) {
+  int n = img->size;
+  double sum[3] = {0};
+  float row[4 * 1024];
+  for (int f = 0; f < 6; f++)
+    for (int y = 0; y < n; y++) {
+      f16_to_f32_n((const uint16_t *)img->faces[f] + (size_t)4 * n * y, row, 4 * n);
+      for (int x = 0; x < n; x++) {
+        float sc = 2.0f * (x + 0.5f) / n - 1.0f, tc = 2.0f * (y + 0.5f) / n - 1.0f, l2 = 1.0f + sc * sc + tc * tc;
+        double omega = 4.0 / ((double)n * n) / (l2 * sqrtf(l2));
+        for (int k = 0; k < 3; k++) sum[k] += row[4 * x + k] * omega;
+      }
+    }
+  return vec3((float)sum[0], (float)sum[1], (float)sum[2]);
+}
+
+/* the star field: bakes of 1k to 100k stars into a 1024 cube, whose cost
+   should follow the count; the illuminance the cube adds up to against
+   the stars', which catches footprints lost or doubled at face edges;
+   and the same seed giving the same bytes */
+static void bench_stars(void) {
+  enum { SIZE = 1024 };
+  CubeImg img, again;
+  cube_img_init(&img, SIZE, SG_PIXELFORMAT_RGBA16F);
+  cube_img_init(&again, SIZE, SG_PIXELFORMAT_RGBA16F);
+  for (int count = 1000; count <= 100000; count *= 10) {
+    for (int f = 0; f < 6; f++) memset(img.faces[f], 0, (size_t)SIZE * SIZE * img.texel_bytes);
+    StarField stars;
+    stars_scatter(&stars, count, 7, 1e-6f);
+    stars_bake(&stars, &img);
+    Vec3 total = vec3_f(0.0f);
+    for (int i = 0; i < count; i++) total = add3(total, stars.stars[i].color);
+    Vec3 energy = bench_stars_energy(&img);
+    float err = m_max(fabsf(energy.x / total.x - 1.0f), m_max(fabsf(energy.y / total.y - 1.0f), fabsf(energy.z / total.z - 1.0f)));
+    printf("%-28s bin %6.2f ms  splat %6.2f ms  %5.0f ns/star  %5d of %d tiles  energy err %.1e\n",
+           count == 1000 ? "stars_bake 1k" : count == 10000 ? "stars_bake 10k" : "stars_bake 100k",
+           stars.bin_ms, stars.splat_ms, (stars.bin_ms + stars.splat_ms) * 1e6 / count,
+           stars.busy_count, stars.tiles, err);
+    stars_free(&stars);
+  }
+  for (int f = 0; f < 6; f++) memset(again.faces[f], 0, (size_t)SIZE * SIZE * again.texel_bytes);
+  StarField stars;
+  stars_scatter(&stars, 100000, 7, 1e-6f);
+  stars_bake(&stars, &again);
+  stars_free(&stars);
+  bool same = true;
+  for (int f = 0; f < 6; f++)
+    same &= memcmp(img.faces[f], again.faces[f], (size_t)SIZE * SIZE * img.texel_bytes) == 0;
+  printf("%-28s %s\n", "stars seed", same ? "deterministic" : "NOT DETERMINISTIC");
+  cube_img_free(&img);
+  cube_img_free(&again);
+}
+
+/* the scattering tables: baking times, a sky-view table baked a frame's
+   budget at a time against one baked at once, and the colors that say
+   the model is sane: a blue zenith at noon, a red horizon toward the sun
+   at sunset */
+static void bench_atmosphere(void) {
+  const double budget_ms = 2.0;
+  Atmosphere atmo;
+  uint64_t t = stm_now();
+  atmosphere_init(&atmo, 0.5f, vec3(0.0f, 1.0f, 0.0f));
+  double init_ms = stm_ms(stm_since(t));
+  double full_ms = atmo.sky_view_ms;
+  Vec4 noon_zenith = atmo.sky_view[0];
+  Vec4 noon_horizon = atmo.sky_view[(ATMO_SKY_VIEW_H / 2 - 1) * ATMO_SKY_VIEW_W];
+
+  Vec3 sunset = norm3(vec3(1.0f, 0.02f, 0.0f));
+  atmosphere_set_sun(&atmo, sunset);
+  int frames = 1;
+  double frame_ms = 0.0;
+  for (;; frames++) {
+    t = stm_now();
+    bool done = atmosphere_update(&atmo, budget_ms);
+    frame_ms = m_max(frame_ms, stm_ms(stm_since(t)));
+    if (done) break;
+  }
+  Vec4 *rows = malloc(ATMO_SKY_VIEW_W * ATMO_SKY_VIEW_H * sizeof(Vec4));
+  memcpy(rows, atmo.sky_view, ATMO_SKY_VIEW_W * ATMO_SKY_VIEW_H * sizeof(Vec4));
+  atmosphere_set_sun(&atmo, vec3(0.0f, 1.0f, 0.0f));
+  atmosphere_update(&atmo, INFINITY);
+  atmosphere_set_sun(&atmo, sunset);
+  atmosphere_update(&atmo, INFINITY);
+  bool same = memcmp(rows, atmo.sky_view, ATMO_SKY_VIEW_W * ATMO_SKY_VIEW_H * sizeof(Vec4)) == 0;
+  Vec4 sunset_horizon = atmo.sky_view[(ATMO_SKY_VIEW_H / 2 - 1) * ATMO_SKY_VIEW_W];
+  free(rows);
+  atmosphere_free(&atmo);
+
+  printf("%-28s %.1f ms, sky-view %.1f ms whole, %d frames of %.1f ms, %.2f ms at most\n",
+         "atmosphere tables", init_ms, full_ms, frames, budget_ms, frame_ms);
+  printf("%-28s %s, noon zenith b/r %.1f %s horizon %.1f, sunset horizon r/b %.1f %s\n",
+         "atmosphere sky-view", same ? "incremental ok" : "INCREMENTAL DIFFERS",
+         noon_zenith.z / noon_zenith.x, noon_zenith.z / noon_zenith.x > noon_horizon.z / noon_horizon.x ? ">" : "NOT >",
+         noon_horizon.z / noon_horizon.x, sunset_horizon.x / sunset_horizon.z, sunset_horizon.x > sunset_horizon.z ? "ok" : "NOT RED");
+}
+
+static void bench_run(void) {
+#if defined(MATH_AVX)
+  printf("math.h kernels: AVX\n");
+#elif defined(MATH_SSE)
+  printf("math.h kernels: SSE\n");
+#elif defined(MATH_NEON)
+  printf("math.h kernels: NEON\n");
+#else
+  printf("math.h kernels: scalar\n");
+#endif
+  seed_rand(0x9E3779B9, 0x243F6A88, 0xB7E15162, 0x7F4A7C15);
+  bench_mat4();
+  bench_inverse();
+  bench_batch();
+  bench_quat();
+  bench_norm();
+  bench_rand();
+  bench_cube_dirs();
+  bench_noise4();
+  bench_noise_periodic();
+  bench_noise_grad();
+  bench_worley();
+  bench_noise_graph();
+  bench_noise_hash();
+  bench_golden();
+  bench_half();
+  bench_atmosphere();
+  bench_sh();
+  bench_env();
+  bench_panorama();
+  bench_stars();
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _CAMERA_H_
+
+#define _CAMERA_H_
+
+/* Per-frame camera matrices.
+
+   The setters only mark the camera dirty when a value actually changes,
+   and camera_update() recomputes view, projection, their product, the
+   rotation-only sky matrix and all of their inverses at most once. Every
+   pass reads the results from here instead of rebuilding them. */
+
+#include <stdbool.h>
+
+typedef struct {
+  Vec3 eye, focus, up;
+  float fov, near_z, far_z;
+  float width, height;
+  bool dirty;
+
+  /* valid after camera_update() */
+  Mat4 view, proj, view_proj, sky;
+  Mat4 inv_view, inv_proj, inv_view_proj, inv_sky;
+} Camera;
+
+static void camera_look_at(Camera *cam, Vec3 eye, Vec3 focus, Vec3 up);
+static void camera_perspective(Camera *cam, float fov, float near_z, float far_z);
+static void camera_viewport(Camera *cam, float width, float height);
+static bool camera_update(Camera *cam);
+
+static bool _camera_vec3_eq(Vec3 a, Vec3 b) {
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static void camera_look_at(Camera *cam, Vec3 eye, Vec3 focus, Vec3 up) {
+  if (_camera_vec3_eq(cam->eye, eye) && _camera_vec3_eq(cam->focus, focus) && _camera_vec3_eq(cam->up, up))
+    return;
+  cam->eye = eye;
+  cam->focus = focus;
+  cam->up = up;
+  cam->dirty = true;
+}
+
+static void camera_perspective(Camera *cam, float fov, float near_z, float far_z) {
+  if (cam->fov == fov && cam->near_z == near_z && cam->far_z == far_z)
+    return;
+  cam->fov = fov;
+  cam->near_z = near_z;
+  cam->far_z = far_z;
+  cam->dirty = true;
+}
+
+static void camera_viewport(Camera *cam, float width, float height) {
+  if (cam->width == width && cam->height == height)
+    return;
+  cam->width = width;
+  cam->height = height;
+  cam->dirty = true;
+}
+
+/* returns true if anything was recomputed */
+static bool camera_update(Camera *cam) {
+  if (!cam->dirty) return false;
+  cam->dirty = false;
+
+  cam->proj = perspective4x4(cam->fov, cam->width / cam->height, cam->near_z, cam->far_z);
+  cam->view = look_at4x4(cam->eye, cam->focus, cam->up);
+  cam->view_proj = mul4x4(cam->proj, cam->view);
+
+  /* the sky is infinitely far away, so it only follows the rotation */
+  Mat4 sky_view = cam->view;
+  sky_view.w = vec4(0, 0, 0, 1);
+  cam->sky = mul4x4(cam->proj, sky_view);
+
+  cam->inv_proj = inverse_perspective4x4(cam->proj);
+  cam->inv_view = inverse_rigid4x4(cam->view);
+  cam->inv_view_proj = mul4x4(cam->inv_view, cam->inv_proj);
+  cam->inv_sky = mul4x4(transpose4x4(sky_view), cam->inv_proj);
+  return true;
+}
+
+#endif
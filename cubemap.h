@@ -0,0 +1,424 @@
+#ifndef _CUBEMAP_H_
+
+#define _CUBEMAP_H_
+
+/* Cached texel directions for baking cubemaps on the CPU.
+
+   The direction of a texel only depends on the face size, so it is
+   computed once per size and shared by every pass that bakes a face of
+   that size. cube_dirs() builds the table on first use and returns the
+   cached one after that; tables stay alive until cube_dirs_release().
+
+   Each face is three planes (x, y, z) of size*size values, rows in the
+   same order as the face images (row = the outer index), already
+   normalized. Tables can be kept as float16 to halve their memory, at
+   about 5e-4 precision; cube_dirs_row() hides the difference.
+
+   Texel offsets are exact for power of two sizes up to 2048, so are their
+   squared lengths, and norm3 only adds a correctly rounded sqrt and
+   division: tables come out the same on every machine, whatever the SIMD
+   width or FMA use, which reproducible bakes rely on.
+
+   CubeField keeps a scalar field baked over the cube, like cloud density
+   at some time t, and re-bakes it tile by tile. Every tile remembers a few
+   probe texels from its last bake; an update only re-evaluates the probes
+   and re-bakes the tiles where one of them drifted past the threshold.
+   Probes of skipped tiles are kept, so slow changes still add up.
+
+   cube_texel_dir() and cube_dir_texel() map between directions and face
+   coordinates the way the GPU samples cubemaps (the GL convention, which
+   D3D and Metal share), with texel centers at (i + 0.5) / size. Anything
+   read back through a samplerCube by direction has to be baked with
+   them, and cube_dirs() tables are built from them.
+
+   CubeImg holds baked faces in the format they are uploaded in. Bakes
+   hand it rows of float rgba and it converts them right away, so a float
+   copy of the whole cube never exists: RGBA16F through f32_to_f16_n,
+   R11G11B10F at half the memory but without alpha, or RGBA8 clamped to
+   [0, 1] where float textures can't be filtered. cube_img_init_2d() makes
+   one with a single square face, for layouts that pack the sphere into a
+   2D texture. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define CUBE_DIRS_MAX_CACHED (16)
+
+typedef struct {
+  int size;
+  bool half;
+  void *data;                 /* float or uint16_t, [face][plane][row][col] */
+} CubeDirs;
+
+#define CUBE_TILE (32)
+#define CUBE_TILE_PROBES (9)
+
+/* evaluates the field at n directions; called from several threads at once */
+typedef void (*CubeFieldFn)(void *user, Vec4SoA dirs, float *out, int n);
+
+typedef struct {
+  int size, tiles;            /* texels and tiles along a face edge */
+  const CubeDirs *dirs;
+  float *values;              /* [face][row][col] */
+  float *probe_dirs;          /* x, y, z planes of [face][tile][probe] */
+  float *probes;              /* probe values as of each tile's last bake */
+  float *next_probes;
+  bool *dirty;                /* [face][tile], re-baked by the last update */
+  int *work;
+  int rebaked;                /* tiles re-baked by the last update */
+  bool baked;
+} CubeField;
+
+static const CubeDirs *cube_dirs(int size, bool half);
+static Vec4SoA cube_dirs_row(const CubeDirs *dirs, int face, int row, float *scratch);
+static void cube_dirs_release(void);
+static bool cube_field_init(CubeField *field, int size);
+static int cube_field_update(CubeField *field, CubeFieldFn fn, void *user, float threshold);
+static void cube_field_free(CubeField *field);
+static Vec3 cube_texel_dir(int face, float u, float v);
+static int cube_dir_texel(Vec3 d, float *u, float *v);
+static void cube_texel_row(int face, int row, int size, Vec4SoA out);
+static Vec4SoA cube_texel_row_cached(const CubeDirs *dirs, int face, int row, int size, float *scratch);
+
+typedef struct {
+  int size;
+  sg_pixel_format format;     /* RGBA16F, RG11B10F or RGBA8 */
+  int texel_bytes;
+  int face_count;             /* 6, or 1 for a 2D image */
+  uint8_t *faces[6];          /* [row][col] */
+} CubeImg;
+
+static bool cube_img_init(CubeImg *img, int size, sg_pixel_format format);
+static bool cube_img_init_2d(CubeImg *img, int size, sg_pixel_format format);
+static void cube_img_store_row(CubeImg *img, int face, int row, const float *rgba);
+static void cube_img_store_span(CubeImg *img, int face, int row, int col, int n, const float *rgba);
+static void cube_img_rgba8(const CubeImg *img, int face, uint8_t *out);
+static sg_image_data cube_img_data(const CubeImg *img);
+static void cube_img_free(CubeImg *img);
+
+static struct {
+  CubeDirs tables[CUBE_DIRS_MAX_CACHED];
+  int count;
+} _cube_dirs;
+
+/* one job per row of any face */
+static void _cube_dirs_build(void *user, int begin, int end) {
+  CubeDirs *dirs = user;
+  int size = dirs->size;
+  size_t plane = (size_t)size * size;
+  float *row_buf = malloc(3 * size * sizeof(float));
+  Vec4SoA v = { row_buf, row_buf + size, row_buf + 2*size, NULL };
+
+  for (int r = begin; r < end; r++) {
+    int face = r / size, row = r % size;
+    cube_texel_row(face, row, size, v);
+
+    size_t offset = face * 3 * plane + (size_t)row * size;
+    for (int p = 0; p < 3; p++) {
+      const float *src = row_buf + p * size;
+      if (dirs->half) {
+        uint16_t *dst = (uint16_t *)dirs->data + offset + p * plane;
+        f32_to_f16_n(src, dst, size);
+      } else {
+        memcpy((float *)dirs->data + offset + p * plane, src, size * sizeof(float));
+      }
+    }
+  }
+  free(row_buf);
+}
+
+/* the table for size x size faces; NULL if the cache is full */
+static const CubeDirs *cube_dirs(int size, bool half) {
+  for (int i = 0; i < _cube_dirs.count; i++)
+    if (_cube_dirs.tables[i].size == size && _cube_dirs.tables[i].half == half)
+      return &_cube_dirs.tables[i];
+  if (_cube_dirs.count >= CUBE_DIRS_MAX_CACHED) return NULL;
+
+  CubeDirs *dirs = &_cube_dirs.tables[_cube_dirs.count++];
+  *dirs = (CubeDirs) {
+    .size = size,
+    .half = half,
+    .data = malloc((size_t)6 * 3 * size * size * (half ? sizeof(uint16_t) : sizeof(float))),
+  };
+  jobs_parallel_for(6 * size, 16, _cube_dirs_build, dirs);
+  return dirs;
+}
+
+/* directions of one row of texels. Float tables are read in place,
+   half tables are expanded into scratch, which needs 3*size floats
+   (it may be NULL for float tables) */
+static Vec4SoA cube_dirs_row(const CubeDirs *dirs, int face, int row, float *scratch) {
+  size_t plane = (size_t)dirs->size * dirs->size;
+  size_t offset = face * 3 * plane + (size_t)row * dirs->size;
+  if (!dirs->half) {
+    float *base = (float *)dirs->data + offset;
+    return (Vec4SoA) { base, base + plane, base + 2*plane, NULL };
+  }
+
+  const uint16_t *base = (const uint16_t *)dirs->data + offset;
+  for (int p = 0; p < 3; p++)
+    f16_to_f32_n(base + p * plane, scratch + p * dirs->size, dirs->size);
+  return (Vec4SoA) { scratch, scratch + dirs->size, scratch + 2*dirs->size, NULL };
+}
+
+static void cube_dirs_release(void) {
+  for (int i = 0; i < _cube_dirs.count; i++)
+    free(_cube_dirs.tables[i].data);
+  _cube_dirs.count = 0;
+}
+
+/* a 3x3 grid over a tile: corners, edge midpoints and center, clipped to the face */
+static void _cube_tile_probe(int size, int tile, int probe, int *row, int *col) {
+  static const int at[3] = { 0, CUBE_TILE/2, CUBE_TILE-1 };
+  int tiles = (size + CUBE_TILE - 1) / CUBE_TILE;
+  *row = m_min((tile / tiles) * CUBE_TILE + at[probe / 3], size - 1);
+  *col = m_min((tile % tiles) * CUBE_TILE + at[probe % 3], size - 1);
+}
+
+/* false if the direction table can't be cached */
+static bool cube_field_init(CubeField *field, int size) {
+  const CubeDirs *dirs = cube_dirs(size, false);
+  if (!dirs) return false;
+  int tiles = (size + CUBE_TILE - 1) / CUBE_TILE;
+  int count = 6 * tiles * tiles;
+  *field = (CubeField) {
+    .size = size,
+    .tiles = tiles,
+    .dirs = dirs,
+    .values = malloc((size_t)6 * size * size * sizeof(float)),
+    .probe_dirs = malloc(3 * count * CUBE_TILE_PROBES * sizeof(float)),
+    .probes = malloc(count * CUBE_TILE_PROBES * sizeof(float)),
+    .next_probes = malloc(count * CUBE_TILE_PROBES * sizeof(float)),
+    .dirty = calloc(count, sizeof(bool)),
+    .work = malloc(count * sizeof(int)),
+  };
+
+  int plane = count * CUBE_TILE_PROBES;
+  for (int face = 0; face < 6; face++)
+    for (int tile = 0; tile < tiles * tiles; tile++)
+      for (int p = 0; p < CUBE_TILE_PROBES; p++) {
+        int row, col;
+        _cube_tile_probe(size, tile, p, &row, &col);
+        Vec4SoA src = cube_dirs_row(dirs, face, row, NULL);
+        int i = (face * tiles * tiles + tile) * CUBE_TILE_PROBES + p;
+        field->probe_dirs[i] = src.x[col];
+        field->probe_dirs[plane + i] = src.y[col];
+        field->probe_dirs[2*plane + i] = src.z[col];
+      }
+  return true;
+}
+
+typedef struct {
+  CubeField *field;
+  CubeFieldFn fn;
+  void *user;
+} _CubeFieldJob;
+
+static void _cube_field_probes(void *user, int begin, int end) {
+  _CubeFieldJob *job = user;
+  CubeField *field = job->field;
+  int plane = 6 * field->tiles * field->tiles * CUBE_TILE_PROBES;
+  Vec4SoA dirs = {
+    field->probe_dirs + begin, field->probe_dirs + plane + begin, field->probe_dirs + 2*plane + begin, NULL
+  };
+  job->fn(job->user, dirs, field->next_probes + begin, end - begin);
+}
+
+/* bakes the tiles listed in work, one row segment at a time */
+static void _cube_field_tiles(void *user, int begin, int end) {
+  _CubeFieldJob *job = user;
+  CubeField *field = job->field;
+  int per_face = field->tiles * field->tiles;
+  for (int w = begin; w < end; w++) {
+    int face = field->work[w] / per_face, tile = field->work[w] % per_face;
+    int row0 = (tile / field->tiles) * CUBE_TILE, col0 = (tile % field->tiles) * CUBE_TILE;
+    int rows = m_min(CUBE_TILE, field->size - row0), cols = m_min(CUBE_TILE, field->size - col0);
+    for (int r = row0; r < row0 + rows; r++) {
+      Vec4SoA row = cube_dirs_row(field->dirs, face, r, NULL);
+      Vec4SoA dirs = { row.x + col0, row.y + col0, row.z + col0, NULL };
+      float *out = field->values + ((size_t)face * field->size + r) * field->size + col0;
+      job->fn(job->user, dirs, out, cols);
+    }
+  }
+}
+
+/* brings the field up to date with fn, which should already describe the
+   new time step; the first update bakes every tile. Returns the number of
+   tiles re-baked, their flags are left in field->dirty */
+static int cube_field_update(CubeField *field, CubeFieldFn fn, void *user, float threshold) {
+  _CubeFieldJob job = { field, fn, user };
+  int count = 6 * field->tiles * field->tiles;
+  jobs_parallel_for(count * CUBE_TILE_PROBES, 1024, _cube_field_probes, &job);
+
+  int rebaked = 0;
+  for (int i = 0; i < count; i++) {
+    const float *old = field->probes + i * CUBE_TILE_PROBES;
+    const float *cur = field->next_probes + i * CUBE_TILE_PROBES;
+    bool dirty = !field->baked;
+    for (int p = 0; p < CUBE_TILE_PROBES && !dirty; p++)
+      dirty = fabsf(cur[p] - old[p]) > threshold;
+    field->dirty[i] = dirty;
+    if (dirty) {
+      memcpy(field->probes + i * CUBE_TILE_PROBES, cur, CUBE_TILE_PROBES * sizeof(float));
+      field->work[rebaked++] = i;
+    }
+  }
+  jobs_parallel_for(rebaked, 1, _cube_field_tiles, &job);
+
+  field->baked = true;
+  field->rebaked = rebaked;
+  return rebaked;
+}
+
+/* the direction table stays cached, see cube_dirs_release() */
+static void cube_field_free(CubeField *field) {
+  free(field->values);
+  free(field->probe_dirs);
+  free(field->probes);
+  free(field->next_probes);
+  free(field->dirty);
+  free(field->work);
+  *field = (CubeField) {0};
+}
+
+/* the unnormalized direction through (u, v) of a face, both in [0, 1] */
+static Vec3 cube_texel_dir(int face, float u, float v) {
+  float sc = 2.0f * u - 1.0f, tc = 2.0f * v - 1.0f;
+  switch (face) {
+    case SG_CUBEFACE_POS_X: return vec3( 1.0f,   -tc,   -sc);
+    case SG_CUBEFACE_NEG_X: return vec3(-1.0f,   -tc,    sc);
+    case SG_CUBEFACE_POS_Y: return vec3(   sc,  1.0f,    tc);
+    case SG_CUBEFACE_NEG_Y: return vec3(   sc, -1.0f,   -tc);
+    case SG_CUBEFACE_POS_Z: return vec3(   sc,   -tc,  1.0f);
+    default:                return vec3(  -sc,   -tc, -1.0f);
+  }
+}
+
+/* the face d points into and where, ties going to x, then y */
+static int cube_dir_texel(Vec3 d, float *u, float *v) {
+  float ax = fabsf(d.x), ay = fabsf(d.y), az = fabsf(d.z);
+  int face;
+  float sc, tc, ma;
+  if (ax >= ay && ax >= az) {
+    face = d.x > 0.0f ? SG_CUBEFACE_POS_X : SG_CUBEFACE_NEG_X;
+    sc = d.x > 0.0f ? -d.z : d.z;
+    tc = -d.y;
+    ma = ax;
+  } else if (ay >= az) {
+    face = d.y > 0.0f ? SG_CUBEFACE_POS_Y : SG_CUBEFACE_NEG_Y;
+    sc = d.x;
+    tc = d.y > 0.0f ? d.z : -d.z;
+    ma = ay;
+  } else {
+    face = d.z > 0.0f ? SG_CUBEFACE_POS_Z : SG_CUBEFACE_NEG_Z;
+    sc = d.z > 0.0f ? d.x : -d.x;
+    tc = -d.y;
+    ma = az;
+  }
+  *u = 0.5f * (sc / ma + 1.0f);
+  *v = 0.5f * (tc / ma + 1.0f);
+  return face;
+}
+
+/* normalized cube_texel_dir()s through the texel centers of a row */
+static void cube_texel_row(int face, int row, int size, Vec4SoA out) {
+  for (int col = 0; col < size; col++) {
+    Vec3 d = norm3(cube_texel_dir(face, (col + 0.5f) / size, (row + 0.5f) / size));
+    out.x[col] = d.x;
+    out.y[col] = d.y;
+    out.z[col] = d.z;
+  }
+}
+
+/* the same directions read from a cube_dirs() table of that size, or
+   computed into scratch when dirs is NULL (the cache was full); scratch
+   holds 3*size floats */
+static Vec4SoA cube_texel_row_cached(const CubeDirs *dirs, int face, int row, int size, float *scratch) {
+  if (dirs) return cube_dirs_row(dirs, face, row, scratch);
+  Vec4SoA out = { scratch, scratch + size, scratch + 2*size, NULL };
+  cube_texel_row(face, row, size, out);
+  return out;
+}
+
+static bool _cube_img_init(CubeImg *img, int size, sg_pixel_format format, int face_count) {
+  int bytes = format == SG_PIXELFORMAT_RGBA16F ? 8
+            : format == SG_PIXELFORMAT_RG11B10F || format == SG_PIXELFORMAT_RGBA8 ? 4 : 0;
+  if (bytes == 0) return false;
+  *img = (CubeImg) { .size = size, .format = format, .texel_bytes = bytes, .face_count = face_count };
+  for (int i = 0; i < face_count; i++)
+    img->faces[i] = malloc((size_t)size * size * bytes);
+  return true;
+}
+
+/* false for a format it can't store */
+static bool cube_img_init(CubeImg *img, int size, sg_pixel_format format) {
+  return _cube_img_init(img, size, format, 6);
+}
+
+/* a single size x size face, uploaded as a 2D image */
+static bool cube_img_init_2d(CubeImg *img, int size, sg_pixel_format format) {
+  return _cube_img_init(img, size, format, 1);
+}
+
+/* n texels of interleaved rgba from column col on; spans that don't
+   overlap can be stored from several threads at once */
+static void cube_img_store_span(CubeImg *img, int face, int row, int col, int n, const float *rgba) {
+  uint8_t *dst = img->faces[face] + ((size_t)row * img->size + col) * img->texel_bytes;
+  switch (img->format) {
+    case SG_PIXELFORMAT_RGBA16F:
+      f32_to_f16_n(rgba, (uint16_t *)dst, 4 * n);
+      break;
+    case SG_PIXELFORMAT_RG11B10F:
+      rg11b10_pack_n(rgba, (uint32_t *)dst, n);
+      break;
+    default:
+      for (int i = 0; i < 4 * n; i++)
+        dst[i] = (uint8_t)(m_clamp(rgba[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+      break;
+  }
+}
+
+/* size texels of interleaved rgba; rows of different faces or rows can be
+   stored from several threads at once */
+static void cube_img_store_row(CubeImg *img, int face, int row, const float *rgba) {
+  cube_img_store_span(img, face, row, 0, img->size, rgba);
+}
+
+/* a face as RGBA8 for inspection, values clamped to [0, 1] and alpha 255
+   for formats without it */
+static void cube_img_rgba8(const CubeImg *img, int face, uint8_t *out) {
+  size_t n = (size_t)img->size * img->size;
+  const uint8_t *src = img->faces[face];
+  for (size_t i = 0; i < n; i++) {
+    Vec4 c;
+    if (img->format == SG_PIXELFORMAT_RGBA16F) {
+      f16_to_f32_n((const uint16_t *)src + 4 * i, c.nums, 4);
+    } else if (img->format == SG_PIXELFORMAT_RG11B10F) {
+      Vec3 v = rg11b10_unpack(((const uint32_t *)src)[i]);
+      c = vec4(v.x, v.y, v.z, 1.0f);
+    } else {
+      memcpy(out + 4 * i, src + 4 * i, 4);
+      continue;
+    }
+    for (int k = 0; k < 4; k++)
+      out[4 * i + k] = (uint8_t)(m_clamp(c.nums[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+}
+
+static sg_image_data cube_img_data(const CubeImg *img) {
+  sg_image_data data = {0};
+  for (int i = 0; i < img->face_count; i++) {
+    data.subimage[i][0].ptr = img->faces[i];
+    data.subimage[i][0].size = (size_t)img->size * img->size * img->texel_bytes;
+  }
+  return data;
+}
+
+static void cube_img_free(CubeImg *img) {
+  for (int i = 0; i < img->face_count; i++) free(img->faces[i]);
+  *img = (CubeImg) {0};
+}
+
+#endif
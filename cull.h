@@ -0,0 +1,179 @@
+#ifndef _CULL_H_
+
+#define _CULL_H_
+
+/* Frustum culling of axis aligned bounding boxes.
+
+   Boxes are stored as structure-of-arrays so that 4 (SSE, NEON) or 8 (AVX)
+   of them are tested against a plane with a handful of vector instructions.
+   For each plane only the box corner furthest along the plane normal (the
+   "positive vertex") is tested: if that corner is behind the plane, the
+   whole box is. The test is conservative, boxes near frustum corners can be
+   reported visible when they are not. */
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULL_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULL_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CULL_NEON
+#endif
+
+typedef struct {
+  Vec4 planes[6];             /* xyz = normal pointing inside, w = distance */
+} Frustum;
+
+typedef struct {
+  float *min_x, *min_y, *min_z;
+  float *max_x, *max_y, *max_z;
+  int count;
+} AabbSoA;
+
+static Frustum frustum_from_view_proj(Mat4 view_proj);
+static int cull_aabbs(const Frustum *f, const AabbSoA *boxes, int begin, int end, uint32_t *visible);
+static int cull_aabbs_parallel(const Frustum *f, const AabbSoA *boxes, uint32_t *visible);
+
+/* Gribb/Hartmann plane extraction. The near plane uses the -w <= z clip
+   range, which also holds (conservatively) for projections into 0 <= z. */
+static Frustum frustum_from_view_proj(Mat4 m) {
+  Vec4 row[4];
+  for (int r = 0; r < 4; r++)
+    row[r] = vec4(m.nums[0][r], m.nums[1][r], m.nums[2][r], m.nums[3][r]);
+
+  Frustum f = {{
+    add4(row[3], row[0]),     /* left */
+    sub4(row[3], row[0]),     /* right */
+    add4(row[3], row[1]),     /* bottom */
+    sub4(row[3], row[1]),     /* top */
+    add4(row[3], row[2]),     /* near */
+    sub4(row[3], row[2]),     /* far */
+  }};
+  return f;
+}
+
+static inline bool _cull_box_visible(const Frustum *f, const AabbSoA *b, int i) {
+  for (int p = 0; p < 6; p++) {
+    Vec4 pl = f->planes[p];
+    float d = pl.x * (pl.x > 0.0f ? b->max_x[i] : b->min_x[i])
+            + pl.y * (pl.y > 0.0f ? b->max_y[i] : b->min_y[i])
+            + pl.z * (pl.z > 0.0f ? b->max_z[i] : b->min_z[i])
+            + pl.w;
+    if (d < 0.0f) return false;
+  }
+  return true;
+}
+
+/* writes the indices of the visible boxes in [begin, end) to `visible`,
+   in order, and returns how many there are */
+static int cull_aabbs(const Frustum *f, const AabbSoA *b, int begin, int end, uint32_t *visible) {
+  int n = 0, i = begin;
+
+  /* the positive vertex only depends on the plane, so per plane each
+     axis just reads either the min or the max array for all lanes */
+  const float *px[6], *py[6], *pz[6];
+  for (int p = 0; p < 6; p++) {
+    px[p] = f->planes[p].x > 0.0f ? b->max_x : b->min_x;
+    py[p] = f->planes[p].y > 0.0f ? b->max_y : b->min_y;
+    pz[p] = f->planes[p].z > 0.0f ? b->max_z : b->min_z;
+  }
+
+#if defined(CULL_AVX)
+  for (; i + 8 <= end; i += 8) {
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      Vec4 pl = f->planes[p];
+      __m256 d = _mm256_set1_ps(pl.w);
+      d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(pl.x), _mm256_loadu_ps(px[p] + i)));
+      d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(pl.y), _mm256_loadu_ps(py[p] + i)));
+      d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(pl.z), _mm256_loadu_ps(pz[p] + i)));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+    int mask = _mm256_movemask_ps(inside);
+    for (int lane = 0; lane < 8; lane++)
+      if (mask & (1 << lane)) visible[n++] = i + lane;
+  }
+#elif defined(CULL_SSE)
+  for (; i + 4 <= end; i += 4) {
+    __m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+    for (int p = 0; p < 6; p++) {
+      Vec4 pl = f->planes[p];
+      __m128 d = _mm_set1_ps(pl.w);
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl.x), _mm_loadu_ps(px[p] + i)));
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl.y), _mm_loadu_ps(py[p] + i)));
+      d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl.z), _mm_loadu_ps(pz[p] + i)));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+    }
+    int mask = _mm_movemask_ps(inside);
+    for (int lane = 0; lane < 4; lane++)
+      if (mask & (1 << lane)) visible[n++] = i + lane;
+  }
+#elif defined(CULL_NEON)
+  for (; i + 4 <= end; i += 4) {
+    uint32x4_t inside = vdupq_n_u32(~0u);
+    for (int p = 0; p < 6; p++) {
+      Vec4 pl = f->planes[p];
+      float32x4_t d = vdupq_n_f32(pl.w);
+      d = vaddq_f32(d, vmulq_n_f32(vld1q_f32(px[p] + i), pl.x));
+      d = vaddq_f32(d, vmulq_n_f32(vld1q_f32(py[p] + i), pl.y));
+      d = vaddq_f32(d, vmulq_n_f32(vld1q_f32(pz[p] + i), pl.z));
+      inside = vandq_u32(inside, vcgeq_f32(d, vdupq_n_f32(0.0f)));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, inside);
+    for (int lane = 0; lane < 4; lane++)
+      if (lanes[lane]) visible[n++] = i + lane;
+  }
+#endif
+
+  for (; i < end; i++)
+    if (_cull_box_visible(f, b, i)) visible[n++] = i;
+  return n;
+}
+
+#define CULL_GRAIN (4096)
+#define CULL_MAX_CHUNKS (1024)
+
+typedef struct {
+  const Frustum *frustum;
+  const AabbSoA *boxes;
+  uint32_t *visible;
+  int grain;
+  int counts[CULL_MAX_CHUNKS];
+} _CullJob;
+
+/* every chunk writes its results into its own slice of `visible`,
+   so the chunks don't need to coordinate */
+static void _cull_job(void *user, int begin, int end) {
+  _CullJob *job = user;
+  job->counts[begin / job->grain] =
+    cull_aabbs(job->frustum, job->boxes, begin, end, job->visible + begin);
+}
+
+/* same as cull_aabbs over all boxes, split across the job system */
+static int cull_aabbs_parallel(const Frustum *f, const AabbSoA *b, uint32_t *visible) {
+  if (b->count <= CULL_GRAIN)
+    return cull_aabbs(f, b, 0, b->count, visible);
+
+  _CullJob job = {
+    .frustum = f,
+    .boxes = b,
+    .visible = visible,
+    .grain = m_max(CULL_GRAIN, (b->count + CULL_MAX_CHUNKS - 1) / CULL_MAX_CHUNKS),
+  };
+  /* keep the chunks a multiple of the vector width */
+  job.grain = (job.grain + 7) & ~7;
+  jobs_parallel_for(b->count, job.grain, _cull_job, &job);
+
+  /* compact the per-chunk slices, they only ever move towards the front */
+  int n = 0, chunks = (b->count + job.grain - 1) / job.grain;
+  for (int c = 0; c < chunks; c++) {
+    memmove(visible + n, visible + c*job.grain, job.counts[c] * sizeof(uint32_t));
+    n += job.counts[c];
+  }
+  return n;
+}
+
+#endif
@@ -0,0 +1,358 @@
+#ifndef _ENVMAP_H_
+
+#define _ENVMAP_H_
+
+/* Prefiltered specular environment maps: a cube of radiance with a mip
+   chain where each mip holds it convolved with the GGX lobe of one
+   roughness, so a glossy reflection is a single textureLod with the lod
+   picked by roughness. This is the first half of the split sum in Karis'
+   "Real Shading in Unreal Engine 4" (2013), with the usual assumption
+   that normal, view and reflection direction are the same.
+
+   env_bake() fills the base level from a radiance function, box filters
+   it down into a source chain and prefilters every other mip from that
+   chain. The GGX samples of each mip are drawn once by env_init(): a
+   Hammersley set in the lobe's tangent space, each with its weight and
+   the source level to read, which is filtered importance sampling
+   (Krivanek and Colbert, GPU Gems 3 ch. 20), so a texel only rotates and
+   looks up its samples. The prefilter is split into tiles of every face
+   and mip.
+
+   env_begin() and env_update() do the same bake spread over frames: each
+   update runs source rows, then tiles, for about a time budget, and says
+   when the chain is complete and can be uploaded.
+
+   Mip m is for roughness m / (mips - 1). Faces are laid out like
+   cube_texel_dir(); lookups are bilinear within a face and clamp at its
+   edges. The chain is uploaded as RGBA16F. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ENV_MAX_MIPS (8)
+#define ENV_SAMPLES (32)
+#define ENV_TILE (16)
+
+/* radiance toward n directions, rgb into out.x, out.y and out.z; called
+   from several threads at once */
+typedef void (*EnvRadianceFn)(void *user, Vec4SoA dirs, Vec4SoA out, int n);
+
+typedef struct {
+  Vec3 l;                     /* tangent space, the normal is +z */
+  float weight, lod;
+} EnvSample;
+
+typedef struct {
+  int size, mips;             /* base face size, levels in the chain */
+  Vec4 *source[ENV_MAX_MIPS][6];  /* box filtered radiance, [row][col] */
+  Vec4 *levels[ENV_MAX_MIPS][6];  /* prefiltered; level 0 is source level 0 */
+  EnvSample samples[ENV_MAX_MIPS][ENV_SAMPLES];
+  int counts[ENV_MAX_MIPS];   /* samples per mip, the ones below the horizon are dropped */
+  const CubeDirs *dirs[ENV_MAX_MIPS];  /* texel directions per level, NULL past the cache */
+  int *tiles;                 /* mip, face, tile x, tile y of every prefiltered tile */
+  int tile_count;
+  uint16_t *half;             /* upload staging, the whole chain */
+  sg_image img;
+  double source_ms, prefilter_ms;   /* of the last bake */
+  /* of the bake in progress */
+  EnvRadianceFn fn;
+  void *user;
+  int next;                   /* source rows then tiles done, -1 when there is nothing to bake */
+  double texel_ms[2];         /* per texel of rows and of tiles in their last batch, to size the next */
+} EnvMap;
+
+static void env_init(EnvMap *env, int size, int mips);
+static void env_bake(EnvMap *env, EnvRadianceFn fn, void *user);
+static void env_begin(EnvMap *env, EnvRadianceFn fn, void *user);
+static bool env_update(EnvMap *env, double budget_ms);
+static void env_make_image(EnvMap *env);
+static void env_upload(EnvMap *env);
+static void env_free(EnvMap *env);
+
+static uint32_t _env_reverse_bits(uint32_t b) {
+  b = (b << 16) | (b >> 16);
+  b = ((b & 0x55555555u) << 1) | ((b & 0xAAAAAAAAu) >> 1);
+  b = ((b & 0x33333333u) << 2) | ((b & 0xCCCCCCCCu) >> 2);
+  b = ((b & 0x0F0F0F0Fu) << 4) | ((b & 0xF0F0F0F0u) >> 4);
+  b = ((b & 0x00FF00FFu) << 8) | ((b & 0xFF00FF00u) >> 8);
+  return b;
+}
+
+/* GGX importance samples for one mip's roughness, reflected about the
+   normal. A sample reads the source level whose texels cover about as
+   much of the sphere as the sample does, one level blurrier */
+static void _env_samples(EnvMap *env, int mip) {
+  float roughness = (float)mip / (env->mips - 1);
+  float a = roughness * roughness, a2 = a * a;
+  float texel = 4.0f * PI_f / (6.0f * env->size * env->size);
+  float total = 0.0f;
+  int count = 0;
+  for (int i = 0; i < ENV_SAMPLES; i++) {
+    float e1 = (float)i / ENV_SAMPLES, e2 = _env_reverse_bits(i) * 2.3283064365386963e-10f;
+    float cos_h = sqrtf((1.0f - e2) / (1.0f + (a2 - 1.0f) * e2));
+    float sin_h = sqrtf(m_max(1.0f - cos_h * cos_h, 0.0f)), phi = 2.0f * PI_f * e1;
+    Vec3 h = vec3(sin_h * cosf(phi), sin_h * sinf(phi), cos_h);
+    Vec3 l = vec3(2.0f * cos_h * h.x, 2.0f * cos_h * h.y, 2.0f * cos_h * cos_h - 1.0f);
+    if (l.z <= 0.0f) continue;
+    /* pdf of l: D(h) (n.h) / (4 v.h), and n.h = v.h here */
+    float q = (a2 - 1.0f) * cos_h * cos_h + 1.0f;
+    float pdf = a2 / (PI_f * q * q) / 4.0f;
+    float lod = 0.5f * log2f(1.0f / (ENV_SAMPLES * pdf * texel)) + 1.0f;
+    env->samples[mip][count++] = (EnvSample) { l, l.z, m_clamp(lod, 0.0f, env->mips - 1.0f) };
+    total += l.z;
+  }
+  for (int i = 0; i < count; i++) env->samples[mip][i].weight /= total;
+  env->counts[mip] = count;
+}
+
+/* mips is clamped to what the size and ENV_MAX_MIPS allow, and at least 2 */
+static void env_init(EnvMap *env, int size, int mips) {
+  *env = (EnvMap) { .size = size, .next = -1 };
+  int max_mips = 1;
+  while ((size >> max_mips) > 0) max_mips++;
+  env->mips = m_clamp(mips, 2, m_min(max_mips, ENV_MAX_MIPS));
+
+  size_t texels = 0;
+  for (int m = 0; m < env->mips; m++) {
+    int n = size >> m;
+    texels += (size_t)6 * n * n;
+    env->dirs[m] = cube_dirs(n, false);
+    for (int f = 0; f < 6; f++) {
+      env->source[m][f] = malloc((size_t)n * n * sizeof(Vec4));
+      env->levels[m][f] = m == 0 ? env->source[0][f] : malloc((size_t)n * n * sizeof(Vec4));
+    }
+    if (m > 0) {
+      _env_samples(env, m);
+      int t = (n + ENV_TILE - 1) / ENV_TILE;
+      env->tile_count += 6 * t * t;
+    }
+  }
+  env->half = malloc(texels * 4 * sizeof(uint16_t));
+
+  env->tiles = malloc((size_t)env->tile_count * 4 * sizeof(int));
+  int *tile = env->tiles;
+  /* roughest first, those have the fewest texels but the widest lookups */
+  for (int m = env->mips - 1; m > 0; m--) {
+    int t = ((size >> m) + ENV_TILE - 1) / ENV_TILE;
+    for (int f = 0; f < 6; f++)
+      for (int y = 0; y < t; y++)
+        for (int x = 0; x < t; x++) {
+          tile[0] = m;
+          tile[1] = f;
+          tile[2] = x;
+          tile[3] = y;
+          tile += 4;
+        }
+  }
+}
+
+typedef struct {
+  EnvMap *env;
+  int level;
+  int first;                  /* row or tile the job's range starts at */
+} _EnvJob;
+
+/* one job per row of any face of the base level */
+static void _env_source_rows(void *user, int begin, int end) {
+  _EnvJob *job = user;
+  EnvMap *env = job->env;
+  int n = env->size;
+  float *buf = malloc(6 * n * sizeof(float));
+  Vec4SoA rgb = { buf + 3*n, buf + 4*n, buf + 5*n, NULL };
+  for (int r = job->first + begin; r < job->first + end; r++) {
+    int face = r / n, row = r % n;
+    Vec4SoA dirs = cube_texel_row_cached(env->dirs[0], face, row, n, buf);
+    env->fn(env->user, dirs, rgb, n);
+    Vec4 *dst = env->source[0][face] + (size_t)row * n;
+    for (int col = 0; col < n; col++) dst[col] = vec4(rgb.x[col], rgb.y[col], rgb.z[col], 1.0f);
+  }
+  free(buf);
+}
+
+/* one job per row of any face of job->level, from the level above */
+static void _env_downsample_rows(void *user, int begin, int end) {
+  _EnvJob *job = user;
+  EnvMap *env = job->env;
+  int n = env->size >> job->level;
+  for (int r = begin; r < end; r++) {
+    int face = r / n, row = r % n;
+    const Vec4 *src = env->source[job->level - 1][face];
+    Vec4 *dst = env->source[job->level][face] + (size_t)row * n;
+    for (int col = 0; col < n; col++) {
+      const Vec4 *a = src + (size_t)(2 * row) * (2 * n) + 2 * col, *b = a + 2 * n;
+      dst[col] = mul4_f(add4(add4(a[0], a[1]), add4(b[0], b[1])), 0.25f);
+    }
+  }
+}
+
+static Vec3 _env_bilinear(const EnvMap *env, int level, int face, float u, float v) {
+  int n = env->size >> level;
+  float x = m_clamp(u * n - 0.5f, 0.0f, n - 1.0f), y = m_clamp(v * n - 0.5f, 0.0f, n - 1.0f);
+  int x0 = (int)x, y0 = (int)y, x1 = m_min(x0 + 1, n - 1), y1 = m_min(y0 + 1, n - 1);
+  float fx = x - x0, fy = y - y0;
+  const Vec4 *t = env->source[level][face];
+  const Vec4 *a = &t[y0 * n + x0], *b = &t[y0 * n + x1], *c = &t[y1 * n + x0], *d = &t[y1 * n + x1];
+  Vec3 top = lerp3(vec3(a->x, a->y, a->z), vec3(b->x, b->y, b->z), fx);
+  Vec3 bottom = lerp3(vec3(c->x, c->y, c->z), vec3(d->x, d->y, d->z), fx);
+  return lerp3(top, bottom, fy);
+}
+
+/* trilinear: between the two source levels around lod */
+static Vec3 _env_sample_lod(const EnvMap *env, Vec3 d, float lod) {
+  float u, v;
+  int face = cube_dir_texel(d, &u, &v);
+  int l0 = (int)lod, l1 = m_min(l0 + 1, env->mips - 1);
+  Vec3 a = _env_bilinear(env, l0, face, u, v);
+  if (l1 == l0) return a;
+  return lerp3(a, _env_bilinear(env, l1, face, u, v), lod - l0);
+}
+
+static void _env_prefilter_tiles(void *user, int begin, int end) {
+  _EnvJob *job = user;
+  EnvMap *env = job->env;
+  float *scratch = malloc(3 * (env->size >> 1) * sizeof(float));
+  for (int t = job->first + begin; t < job->first + end; t++) {
+    const int *tile = env->tiles + 4 * t;
+    int mip = tile[0], face = tile[1], n = env->size >> mip;
+    const EnvSample *samples = env->samples[mip];
+    Vec4 *dst = env->levels[mip][face];
+    for (int row = tile[3] * ENV_TILE; row < m_min((tile[3] + 1) * ENV_TILE, n); row++) {
+      Vec4SoA dirs = cube_texel_row_cached(env->dirs[mip], face, row, n, scratch);
+      for (int col = tile[2] * ENV_TILE; col < m_min((tile[2] + 1) * ENV_TILE, n); col++) {
+        Vec3 nrm = vec3(dirs.x[col], dirs.y[col], dirs.z[col]);
+        /* an orthonormal basis around the normal, after Duff et al.,
+           "Building an Orthonormal Basis, Revisited" (2017) */
+        float sign = copysignf(1.0f, nrm.z), a = -1.0f / (sign + nrm.z), b = nrm.x * nrm.y * a;
+        Vec3 tx = vec3(1.0f + sign * nrm.x * nrm.x * a, sign * b, -sign * nrm.x);
+        Vec3 ty = vec3(b, sign + nrm.y * nrm.y * a, -nrm.y);
+        Vec3 sum = vec3_f(0.0f);
+        for (int s = 0; s < env->counts[mip]; s++) {
+          const EnvSample *smp = &samples[s];
+          Vec3 l = add3(add3(mul3_f(tx, smp->l.x), mul3_f(ty, smp->l.y)), mul3_f(nrm, smp->l.z));
+          sum = add3(sum, mul3_f(_env_sample_lod(env, l, smp->lod), smp->weight));
+        }
+        dst[row * n + col] = vec4(sum.x, sum.y, sum.z, 1.0f);
+      }
+    }
+  }
+  free(scratch);
+}
+
+/* fn and user have to stay valid until the bake is complete; starting
+   one restarts the one in progress */
+static void env_begin(EnvMap *env, EnvRadianceFn fn, void *user) {
+  env->fn = fn;
+  env->user = user;
+  env->next = 0;
+  env->source_ms = env->prefilter_ms = 0.0;
+}
+
+/* texels of the bake's item i: source rows, then prefilter tiles */
+static int _env_item_texels(const EnvMap *env, int i) {
+  int rows = 6 * env->size;
+  if (i < rows) return env->size;
+  const int *tile = env->tiles + 4 * (i - rows);
+  int n = env->size >> tile[0];
+  return m_min(n - tile[2] * ENV_TILE, ENV_TILE) * m_min(n - tile[3] * ENV_TILE, ENV_TILE);
+}
+
+/* works on the bake in progress for about budget_ms, at least one row or
+   tile. Batches are sized by the time per texel their kind took last, the
+   first of a kind is an item per thread. The chain is downsampled right
+   after the last source row, tiles read it. True once the bake is
+   complete */
+static bool env_update(EnvMap *env, double budget_ms) {
+  if (env->next < 0) return false;
+  int rows = 6 * env->size, total = rows + env->tile_count;
+  uint64_t start = stm_now();
+  double spent = 0.0;
+  do {
+    bool source = env->next < rows;
+    double texel_ms = env->texel_ms[!source];
+    int end = source ? rows : total, n = 0, texels = 0;
+    while (env->next + n < end) {
+      int t = _env_item_texels(env, env->next + n);
+      if (n > 0 && (texel_ms > 0.0 ? spent + (texels + t) * texel_ms > budget_ms : n >= jobs_num_threads())) break;
+      texels += t;
+      n++;
+    }
+    _EnvJob job = { env, 0, source ? env->next : env->next - rows };
+    uint64_t batch = stm_now();
+    if (source) {
+      jobs_parallel_for(n, 1, _env_source_rows, &job);
+      if (env->next + n == rows)
+        for (job.level = 1; job.level < env->mips; job.level++)
+          jobs_parallel_for(6 * (env->size >> job.level), 8, _env_downsample_rows, &job);
+    } else {
+      jobs_parallel_for(n, 1, _env_prefilter_tiles, &job);
+    }
+    double ms = stm_ms(stm_since(batch));
+    env->texel_ms[!source] = ms / texels;
+    *(source ? &env->source_ms : &env->prefilter_ms) += ms;
+    env->next += n;
+    spent = stm_ms(stm_since(start));
+  } while (env->next < total &&
+           spent + _env_item_texels(env, env->next) * env->texel_ms[env->next >= rows] <= budget_ms);
+  if (env->next < total) return false;
+  env->next = -1;
+  return true;
+}
+
+static void env_bake(EnvMap *env, EnvRadianceFn fn, void *user) {
+  env_begin(env, fn, user);
+  env_update(env, INFINITY);
+}
+
+/* converts the whole chain into env->half and points data at it */
+static sg_image_data _env_half(EnvMap *env) {
+  sg_image_data data = {0};
+  uint16_t *dst = env->half;
+  for (int m = 0; m < env->mips; m++) {
+    int n = env->size >> m;
+    for (int f = 0; f < 6; f++) {
+      f32_to_f16_n(&env->levels[m][f][0].x, dst, (size_t)4 * n * n);
+      data.subimage[f][m] = (sg_range) { dst, (size_t)n * n * 4 * sizeof(uint16_t) };
+      dst += (size_t)4 * n * n;
+    }
+  }
+  return data;
+}
+
+/* dynamic, so re-bakes can be uploaded; call env_upload() after a bake */
+static void env_make_image(EnvMap *env) {
+  env->img = sg_make_image(&(sg_image_desc) {
+    .type = SG_IMAGETYPE_CUBE,
+    .width = env->size,
+    .height = env->size,
+    .num_mipmaps = env->mips,
+    .usage = SG_USAGE_DYNAMIC,
+    .pixel_format = SG_PIXELFORMAT_RGBA16F,
+    .min_filter = SG_FILTER_LINEAR_MIPMAP_LINEAR,
+    .mag_filter = SG_FILTER_LINEAR,
+    .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+    .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+    .wrap_w = SG_WRAP_CLAMP_TO_EDGE,
+    .label = "environment-specular",
+  });
+}
+
+static void env_upload(EnvMap *env) {
+  sg_image_data data = _env_half(env);
+  sg_update_image(env->img, &data);
+}
+
+static void env_free(EnvMap *env) {
+  if (env->img.id != SG_INVALID_ID) sg_destroy_image(env->img);
+  for (int m = 0; m < env->mips; m++)
+    for (int f = 0; f < 6; f++) {
+      free(env->source[m][f]);
+      if (m > 0) free(env->levels[m][f]);
+    }
+  free(env->tiles);
+  free(env->half);
+  *env = (EnvMap) {0};
+}
+
+#endif
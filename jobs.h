@@ -0,0 +1,283 @@
+#ifndef _JOBS_H_
+
+#define _JOBS_H_
+
+/* A tiny fork-join thread pool.
+
+   jobs_parallel_for() splits [0, count) into chunks of `grain` items and
+   hands them out to the worker threads; the calling thread works on chunks
+   too and returns once all of them are done. Calls must not be nested, and
+   only one thread may submit work at a time.
+
+   Without thread support (emscripten, or JOBS_NO_THREADS defined) every
+   call simply runs on the calling thread. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__EMSCRIPTEN__) && !defined(JOBS_NO_THREADS)
+#define JOBS_NO_THREADS
+#endif
+
+#if !defined(JOBS_NO_THREADS)
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#endif
+
+#define JOBS_MAX_THREADS (32)
+
+typedef void (*JobFn)(void *user, int begin, int end);
+
+static void jobs_setup(int num_threads);
+static void jobs_shutdown(void);
+static int jobs_num_threads(void);
+static void jobs_parallel_for(int count, int grain, JobFn fn, void *user);
+
+/* math.h batch kernels split across the pool */
+static void jobs_mul4x4_n(const Mat4 *a, const Mat4 *b, Mat4 *out, int n);
+static void jobs_mul4x44_n(Mat4 m, Vec4SoA in, Vec4SoA out, int n);
+static void jobs_randf_n(uint32_t seed, float *out, int n);
+
+#if defined(JOBS_NO_THREADS)
+
+static void jobs_setup(int num_threads) { (void)num_threads; }
+static void jobs_shutdown(void) {}
+static int jobs_num_threads(void) { return 1; }
+static void jobs_parallel_for(int count, int grain, JobFn fn, void *user) {
+  (void)grain;
+  if (count > 0) fn(user, 0, count);
+}
+
+#else
+
+#if defined(_WIN32)
+typedef HANDLE _JobsThread;
+typedef CRITICAL_SECTION _JobsMutex;
+typedef CONDITION_VARIABLE _JobsCond;
+#define _jobs_lock()          EnterCriticalSection(&_jobs.mutex)
+#define _jobs_unlock()        LeaveCriticalSection(&_jobs.mutex)
+#define _jobs_wait(c)         SleepConditionVariableCS(&(c), &_jobs.mutex, INFINITE)
+#define _jobs_signal(c)       WakeConditionVariable(&(c))
+#define _jobs_broadcast(c)    WakeAllConditionVariable(&(c))
+#else
+typedef pthread_t _JobsThread;
+typedef pthread_mutex_t _JobsMutex;
+typedef pthread_cond_t _JobsCond;
+#define _jobs_lock()          pthread_mutex_lock(&_jobs.mutex)
+#define _jobs_unlock()        pthread_mutex_unlock(&_jobs.mutex)
+#define _jobs_wait(c)         pthread_cond_wait(&(c), &_jobs.mutex)
+#define _jobs_signal(c)       pthread_cond_signal(&(c))
+#define _jobs_broadcast(c)    pthread_cond_broadcast(&(c))
+#endif
+
+static struct {
+  int num_workers;
+  _JobsThread threads[JOBS_MAX_THREADS];
+  _JobsMutex mutex;
+  _JobsCond wake, done;
+  uint32_t generation;
+  bool quit;
+
+  /* the job in flight, only touched with the mutex held */
+  JobFn fn;
+  void *user;
+  int count, grain, next, pending;
+} _jobs;
+
+/* grabs chunks of the current job until there are none left */
+static void _jobs_work(void) {
+  _jobs_lock();
+  while (_jobs.next < _jobs.count) {
+    int begin = _jobs.next;
+    int end = m_min(begin + _jobs.grain, _jobs.count);
+    JobFn fn = _jobs.fn;
+    void *user = _jobs.user;
+    _jobs.next = end;
+    _jobs_unlock();
+
+    fn(user, begin, end);
+
+    _jobs_lock();
+    if (--_jobs.pending == 0)
+      _jobs_signal(_jobs.done);
+  }
+  _jobs_unlock();
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI _jobs_worker(LPVOID arg) {
+#else
+static void *_jobs_worker(void *arg) {
+#endif
+  (void)arg;
+  uint32_t seen = 0;
+  for (;;) {
+    _jobs_lock();
+    while (!_jobs.quit && _jobs.generation == seen)
+      _jobs_wait(_jobs.wake);
+    seen = _jobs.generation;
+    bool quit = _jobs.quit;
+    _jobs_unlock();
+    if (quit) break;
+
+    _jobs_work();
+  }
+  return 0;
+}
+
+/* num_threads counts the calling thread, 0 picks one per core */
+static void jobs_setup(int num_threads) {
+  if (num_threads <= 0) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    num_threads = (int)info.dwNumberOfProcessors;
+#else
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+  _jobs.num_workers = m_clamp(num_threads - 1, 0, JOBS_MAX_THREADS);
+
+#if defined(_WIN32)
+  InitializeCriticalSection(&_jobs.mutex);
+  InitializeConditionVariable(&_jobs.wake);
+  InitializeConditionVariable(&_jobs.done);
+  for (int i = 0; i < _jobs.num_workers; i++)
+    _jobs.threads[i] = CreateThread(NULL, 0, _jobs_worker, NULL, 0, NULL);
+#else
+  pthread_mutex_init(&_jobs.mutex, NULL);
+  pthread_cond_init(&_jobs.wake, NULL);
+  pthread_cond_init(&_jobs.done, NULL);
+  for (int i = 0; i < _jobs.num_workers; i++)
+    pthread_create(&_jobs.threads[i], NULL, _jobs_worker, NULL);
+#endif
+}
+
+static void jobs_shutdown(void) {
+  _jobs_lock();
+  _jobs.quit = true;
+  _jobs_broadcast(_jobs.wake);
+  _jobs_unlock();
+
+#if defined(_WIN32)
+  for (int i = 0; i < _jobs.num_workers; i++) {
+    WaitForSingleObject(_jobs.threads[i], INFINITE);
+    CloseHandle(_jobs.threads[i]);
+  }
+  DeleteCriticalSection(&_jobs.mutex);
+#else
+  for (int i = 0; i < _jobs.num_workers; i++)
+    pthread_join(_jobs.threads[i], NULL);
+  pthread_cond_destroy(&_jobs.wake);
+  pthread_cond_destroy(&_jobs.done);
+  pthread_mutex_destroy(&_jobs.mutex);
+#endif
+  _jobs.num_workers = 0;
+}
+
+static int jobs_num_threads(void) {
+  return _jobs.num_workers + 1;
+}
+
+static void jobs_parallel_for(int count, int grain, JobFn fn, void *user) {
+  if (count <= 0) return;
+  grain = m_max(grain, 1);
+  if (_jobs.num_workers == 0 || count <= grain) {
+    fn(user, 0, count);
+    return;
+  }
+
+  _jobs_lock();
+  _jobs.fn = fn;
+  _jobs.user = user;
+  _jobs.count = count;
+  _jobs.grain = grain;
+  _jobs.next = 0;
+  _jobs.pending = (count + grain - 1) / grain;
+  _jobs.generation++;
+  _jobs_broadcast(_jobs.wake);
+  _jobs_unlock();
+
+  _jobs_work();
+
+  _jobs_lock();
+  while (_jobs.pending > 0)
+    _jobs_wait(_jobs.done);
+  _jobs_unlock();
+}
+
+#endif
+
+#define JOBS_MATH_GRAIN (16384)
+
+typedef struct {
+  const Mat4 *a, *b;
+  Mat4 *out;
+  Mat4 m;
+  Vec4SoA in, vout;
+} _JobsMath;
+
+static void _jobs_mul4x4_n(void *user, int begin, int end) {
+  _JobsMath *job = user;
+  mul4x4_n(job->a + begin, job->b + begin, job->out + begin, end - begin);
+}
+
+static void jobs_mul4x4_n(const Mat4 *a, const Mat4 *b, Mat4 *out, int n) {
+  _JobsMath job = { .a = a, .b = b, .out = out };
+  jobs_parallel_for(n, JOBS_MATH_GRAIN, _jobs_mul4x4_n, &job);
+}
+
+static Vec4SoA _jobs_soa_offset(Vec4SoA v, int offset) {
+  return (Vec4SoA) {
+    v.x + offset, v.y + offset, v.z + offset,
+    v.w ? v.w + offset : NULL
+  };
+}
+
+static void _jobs_mul4x44_n(void *user, int begin, int end) {
+  _JobsMath *job = user;
+  mul4x44_n(job->m, _jobs_soa_offset(job->in, begin), _jobs_soa_offset(job->vout, begin), end - begin);
+}
+
+static void jobs_mul4x44_n(Mat4 m, Vec4SoA in, Vec4SoA out, int n) {
+  _JobsMath job = { .m = m, .in = in, .vout = out };
+  jobs_parallel_for(n, JOBS_MATH_GRAIN, _jobs_mul4x44_n, &job);
+}
+
+typedef struct {
+  RandN *streams;
+  float *out;
+  int n;
+} _JobsRand;
+
+/* a range can cover several chunks when the pool runs it inline */
+static void _jobs_randf_n(void *user, int begin, int end) {
+  _JobsRand *job = user;
+  for (int c = begin / JOBS_MATH_GRAIN; c * JOBS_MATH_GRAIN < end; c++) {
+    int first = c * JOBS_MATH_GRAIN;
+    RandN r = job->streams[c];
+    randf_n(&r, job->out + first, m_min(JOBS_MATH_GRAIN, job->n - first));
+  }
+}
+
+/* fills out with uniform floats in [0, 1); every chunk has its own split
+   of the seed, so the result doesn't depend on the number of threads */
+static void jobs_randf_n(uint32_t seed, float *out, int n) {
+  int chunks = (n + JOBS_MATH_GRAIN - 1) / JOBS_MATH_GRAIN;
+  _JobsRand job = { .streams = malloc(chunks * sizeof(RandN)), .out = out, .n = n };
+  Rand r = rand_seeded(seed);
+  for (int c = 0; c < chunks; c++)
+    job.streams[c] = randn_split(&r);
+  jobs_parallel_for(n, JOBS_MATH_GRAIN, _jobs_randf_n, &job);
+  free(job.streams);
+}
+
+#endif
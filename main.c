@@ -20,30 +20,118 @@
 #include "sokol/sokol_time.h"
 #include "sokol/sokol_gfx.h"
 #include "sokol/sokol_glue.h"
+#include "sokol/sokol_args.h"
 
 #include <math.h>
 #include "math.h"
 
 #include "build/shaders.glsl.h"
+#include "batch.h"
+#include "jobs.h"
+#include "cull.h"
+#include "scene.h"
+#include "camera.h"
+#include "cubemap.h"
 #include "snoise3.h"
+#include "worley3.h"
+#include "noise.h"
+#include "atmosphere.h"
+#include "sh.h"
+#include "envmap.h"
+#include "panorama.h"
+#include "stars.h"
+#include "bench.h"
 #define CUTE_PNG_IMPLEMENTATION
 #include "cute_png.h"
 
 #define OFFSCREEN_SAMPLE_COUNT (4)
+#define MAX_INSTANCES (1 << 17)
+/* time per frame the sky-view table gets to re-bake while the sun
+   moves, at least one row even when that takes longer */
+#define SKY_VIEW_MS (2.0)
+#define SKY_EXPOSURE (10.0f)
+/* face size the sky is sampled at for ambient light */
+#define SKY_SH_SIZE (32)
+/* base face size and levels of the sky's reflections, 128 down to 4 */
+#define SKY_ENV_SIZE (128)
+#define SKY_ENV_MIPS (6)
+/* time per frame their re-bake gets, at least a row or tile */
+#define SKY_ENV_MS (2.0)
+/* face size of the cloud layer as a cube, and the side of the square
+   holding it as an octahedral map instead: 2/3 of the texels */
+#define SKY_CUBE_SIZE (1024)
+#define SKY_OCT_SIZE (2048)
+/* face size of the clouds' animated cover, which only has broad
+   features, and how far a tile's probes drift before it is re-baked */
+#define SKY_COVER_SIZE (128)
+#define SKY_COVER_THRESHOLD (0.02f)
+/* illuminance of a magnitude 0 star, relative to the sun's 1; far more
+   than the real 2e-11, which only shows with an exposure for the night */
+#define SKY_STAR_BRIGHTNESS (2.4e-6f)
+
+/* batch layers, the sky is drawn last so it only fills uncovered pixels */
+enum { LAYER_OPAQUE, LAYER_SKY };
+
+/* per-instance vertex data, streamed to the second vertex buffer slot */
+typedef struct {
+  Mat4 model;
+  Vec4 color;
+} Instance;
 
 static struct {
-  float rx, ry;
+  Quaternion orbit;           /* camera position around the origin */
+  Camera camera;
+  camera_params_t camera_params;
   struct {
     sg_image tex;
+    sg_image stars;           /* star radiance, in the same layout as tex */
+    bool octahedral;          /* tex is a 2D octahedral map, not a cube */
     sg_pipeline pip;
+    Atmosphere atmo;
+    float hours;              /* time of day, sets the sun */
+    sky_params_t params;
+    NoiseProgram clouds;
+    PanoCube loaded;          /* the clouds= layer for lighting, size 0 when baked */
+    NoiseProgram cover;       /* scales the clouds' opacity, animated by its time */
+    CubeField cover_field;    /* size 0 with a loaded layer, which doesn't move */
+    uint8_t *cover_texels;    /* R8 upload staging, [face][row][col] */
+    bool cover_pending;       /* re-baked tiles not uploaded yet */
+    sg_image cover_tex;
+    uint64_t last_frame;
+    sh_params_t ambient;      /* for meshes, updated with the sky-view table */
+    double ambient_ms;
+    EnvMap env;               /* reflections, re-baked over frames after ambient */
+    bool env_stale;           /* the sky-view table changed since env's bake began */
+    float roughness;          /* of every mesh */
   } skybox;
   struct {
     sg_buffer ibuf, vbuf;
     sg_pass_action pass_action;
     sg_pipeline pip;
   } mesh;
+  struct {
+    bool enabled, cull, paused;
+    int count, visible_count;
+    Instance *data, *visible;
+    AabbSoA bounds;
+    uint32_t *visible_ids;
+    sg_pipeline pip;
+    /* root -> one node per grid column -> one node per cube */
+    Scene scene;
+    int scene_count, columns, first_cube;
+    /* benchmark stats, reported about once a second */
+    uint64_t last_frame, last_report;
+    double frame_ms, fill_ms, cull_ms, scene_ms;
+    int frames, scene_updated;
+  } inst;
 } state;
 
+/* the sun rises in +x at 6 and sets in -x at 18, tilted toward +z */
+static Vec3 sky_sun(float hours) {
+  float a = (hours - 6.0f) / 12.0f * PI_f;
+  return norm3(vec3(cosf(a), sinf(a), 0.3f));
+}
+
 /* can be called once on initialization */
 void mesh_init(void) {
   /* mesh pass action */
@@ -56,7 +144,8 @@ void mesh_init(void) {
     .layout = {
       .attrs = {
         [ATTR_mesh_vs_position].format = SG_VERTEXFORMAT_FLOAT3,
-        [ATTR_mesh_vs_color0].format   = SG_VERTEXFORMAT_FLOAT4
+        [ATTR_mesh_vs_color0].format   = SG_VERTEXFORMAT_FLOAT4,
+        [ATTR_mesh_vs_normal].format   = SG_VERTEXFORMAT_FLOAT3,
       }
     },
     .index_type = SG_INDEXTYPE_UINT16,
@@ -70,48 +159,397 @@ void mesh_init(void) {
   desc.shader = sg_make_shader(mesh_shader_desc(sg_query_backend()));
   state.mesh.pip = sg_make_pipeline(&desc);
 
-  desc.shader = sg_make_shader(skybox_shader_desc(sg_query_backend()));
+  desc.shader = sg_make_shader(state.skybox.octahedral ? skybox_oct_shader_desc(sg_query_backend())
+                                                      : skybox_shader_desc(sg_query_backend()));
   desc.depth.write_enabled = false;
   desc.cull_mode = SG_CULLMODE_BACK;
   state.skybox.pip = sg_make_pipeline(&desc);
+
+  state.inst.pip = sg_make_pipeline(&(sg_pipeline_desc) {
+    .layout = {
+      .buffers[1].step_func = SG_VERTEXSTEP_PER_INSTANCE,
+      .attrs = {
+        [ATTR_instanced_vs_position]   = { .format = SG_VERTEXFORMAT_FLOAT3, .buffer_index = 0 },
+        [ATTR_instanced_vs_color0]     = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 0 },
+        [ATTR_instanced_vs_normal]     = { .format = SG_VERTEXFORMAT_FLOAT3, .buffer_index = 0 },
+        [ATTR_instanced_vs_inst_m0]    = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 1 },
+        [ATTR_instanced_vs_inst_m1]    = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 1 },
+        [ATTR_instanced_vs_inst_m2]    = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 1 },
+        [ATTR_instanced_vs_inst_m3]    = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 1 },
+        [ATTR_instanced_vs_inst_color] = { .format = SG_VERTEXFORMAT_FLOAT4, .buffer_index = 1 },
+      }
+    },
+    .shader = sg_make_shader(instanced_shader_desc(sg_query_backend())),
+    .index_type = SG_INDEXTYPE_UINT16,
+    .cull_mode = SG_CULLMODE_FRONT,
+    .depth = {
+      .write_enabled = true,
+      .compare = SG_COMPAREFUNC_LESS_EQUAL,
+    },
+    .label = "instanced-pipeline"
+  });
+}
+
+/* the instance stream is sized for MAX_INSTANCES up front,
+   so changing the count never reallocates anything */
+void instances_init(void) {
+  state.inst.count = m_clamp(atoi(sargs_value_def("instances", "0")), 0, MAX_INSTANCES);
+  state.inst.enabled = state.inst.count > 0;
+  if (state.inst.count == 0) state.inst.count = 1024;
+
+  state.inst.cull = true;
+  scene_init(&state.inst.scene, 1 + MAX_INSTANCES*2);
+  state.inst.data = calloc(MAX_INSTANCES, sizeof(Instance));
+  state.inst.visible = calloc(MAX_INSTANCES, sizeof(Instance));
+  state.inst.visible_ids = calloc(MAX_INSTANCES, sizeof(uint32_t));
+  float **bounds[] = {
+    &state.inst.bounds.min_x, &state.inst.bounds.min_y, &state.inst.bounds.min_z,
+    &state.inst.bounds.max_x, &state.inst.bounds.max_y, &state.inst.bounds.max_z,
+  };
+  for (int i = 0; i < 6; i++)
+    *bounds[i] = calloc(MAX_INSTANCES, sizeof(float));
+  batch_setup(&(BatchDesc) {
+    .max_draws = 1024,
+    .max_instances = MAX_INSTANCES + 1024,
+    .instance_size = sizeof(Instance),
+    .stream_slot = 1,
+    .label = "instance-stream"
+  });
+}
+
+/* benchmark scene: lays the cubes out in a grid that always fits in the
+   same volume, so the instance count can be scaled without moving the camera.
+   The grid is larger than the view, so a good part of it is culled */
+#define GRID_EXTENT (16.0f)
+
+static Vec3 grid_column_pos(int column, int n) {
+  float spacing = GRID_EXTENT / (float)n;
+  return vec3((float)(column % n) * spacing - GRID_EXTENT*0.5f + spacing*0.5f,
+              0.0f,
+              (float)(column / n) * spacing - GRID_EXTENT*0.5f + spacing*0.5f);
+}
+
+/* rebuilds the hierarchy whenever the instance count changes,
+   cube i is always node first_cube + i */
+void instances_build(void) {
+  Scene *scene = &state.inst.scene;
+  int n = (int)ceilf(cbrtf((float)state.inst.count));
+  float spacing = GRID_EXTENT / (float)n;
+  Mat4 scale = scale4x4(vec3_f(spacing * 0.3f));
+
+  scene_clear(scene);
+  int root = scene_add(scene, -1, ident4x4());
+  state.inst.columns = m_min(n*n, state.inst.count);
+  for (int c = 0; c < state.inst.columns; c++)
+    scene_add(scene, root, translate4x4(grid_column_pos(c, n)));
+
+  state.inst.first_cube = scene->count;
+  for (int i = 0; i < state.inst.count; i++) {
+    float y = (float)(i / (n*n)) * spacing - GRID_EXTENT*0.5f + spacing*0.5f;
+    scene_add(scene, 1 + i % (n*n), mul4x4(translate4x4(vec3(0.0f, y, 0.0f)), scale));
+
+    Vec3 cell = vec3((float)(i % n), (float)(i / (n*n)), (float)((i / n) % n));
+    state.inst.data[i].color = vec4(cell.x / n, cell.y / n, cell.z / n, 1.0f);
+  }
+  state.inst.scene_count = state.inst.count;
+}
+
+void instances_fill(float t) {
+  Scene *scene = &state.inst.scene;
+  int n = (int)ceilf(cbrtf((float)state.inst.count));
+  float spacing = GRID_EXTENT / (float)n;
+  if (state.inst.scene_count != state.inst.count)
+    instances_build();
+
+  /* only the columns bob, the cubes follow through the hierarchy */
+  if (!state.inst.paused)
+    for (int c = 0; c < state.inst.columns; c++) {
+      Vec3 pos = grid_column_pos(c, n);
+      pos.y = sinf(t*2.0f + pos.x + pos.z) * spacing * 0.25f;
+      scene_set_local(scene, 1 + c, translate4x4(pos));
+    }
+
+  uint64_t scene_start = stm_now();
+  state.inst.scene_updated += scene_update(scene);
+  state.inst.scene_ms += stm_ms(stm_since(scene_start));
+
+  /* the cube spans -1..1, so each world axis extends by the
+     absolute sum of the matrix row that produces it */
+  AabbSoA *b = &state.inst.bounds;
+  for (int i = 0; i < state.inst.count; i++) {
+    Mat4 m = scene->world[state.inst.first_cube + i];
+    state.inst.data[i].model = m;
+
+    float ex = fabsf(m.nums[0][0]) + fabsf(m.nums[1][0]) + fabsf(m.nums[2][0]);
+    float ey = fabsf(m.nums[0][1]) + fabsf(m.nums[1][1]) + fabsf(m.nums[2][1]);
+    float ez = fabsf(m.nums[0][2]) + fabsf(m.nums[1][2]) + fabsf(m.nums[2][2]);
+    b->min_x[i] = m.w.x - ex; b->max_x[i] = m.w.x + ex;
+    b->min_y[i] = m.w.y - ey; b->max_y[i] = m.w.y + ey;
+    b->min_z[i] = m.w.z - ez; b->max_z[i] = m.w.z + ez;
+  }
+  b->count = state.inst.count;
+}
+
+/* gathers the instances inside the frustum into state.inst.visible */
+void instances_cull(Mat4 view_proj) {
+  if (!state.inst.cull) {
+    memcpy(state.inst.visible, state.inst.data, state.inst.count * sizeof(Instance));
+    state.inst.visible_count = state.inst.count;
+    return;
+  }
+
+  Frustum frustum = frustum_from_view_proj(view_proj);
+  int n = cull_aabbs_parallel(&frustum, &state.inst.bounds, state.inst.visible_ids);
+  for (int i = 0; i < n; i++)
+    state.inst.visible[i] = state.inst.data[state.inst.visible_ids[i]];
+  state.inst.visible_count = n;
+}
+
+/* cloud cells, F1 of Worley noise with its coordinates warped by fbm so
+   the cells lose their straight edges */
+static void sky_clouds_compile(NoiseProgram *prog) {
+  NoiseGraph g = {0};
+  int wx = noise_fbm(&g, 2.0f, 1.0f, 2, 0.0f);
+  int wy = noise_fbm(&g, 2.0f, 1.0f, 2, 31.7f);
+  int wz = noise_fbm(&g, 2.0f, 1.0f, 2, 73.1f);
+  int cells = noise_warp(&g, noise_worley(&g, NOISE_F1, 6.0f, 1.0f, 0.0f), wx, wy, wz, 0.08f);
+  int clouds = noise_remap(&g, cells, -1.4f, 1.0f, 0.0f, 1.0f);
+  noise_compile(&g, clouds, prog);
+}
+
+/* how much of the baked clouds is there: 4D noise over the direction
+   and time, so the cover changes in place instead of sliding */
+static void sky_cover_compile(NoiseProgram *prog) {
+  NoiseGraph g = {0};
+  int drift = noise_simplex4(&g, 1.5f, 1.0f, 11.0f, 0.05f);
+  noise_compile(&g, noise_remap(&g, drift, 0.8f, 0.7f, 0.0f, 1.0f), prog);
+}
+
+static void sky_cover_field(void *user, Vec4SoA dirs, float *out, int n) {
+  noise_eval(user, dirs, out, n);
+}
+
+/* brings the cover up to its program's time, re-baking only the tiles
+   that drifted; those are converted for the next upload */
+static void sky_cover_update(void) {
+  CubeField *field = &state.skybox.cover_field;
+  if (cube_field_update(field, sky_cover_field, &state.skybox.cover, SKY_COVER_THRESHOLD) == 0) return;
+  int n = field->size, t = field->tiles;
+  for (int i = 0; i < 6 * t * t; i++) {
+    if (!field->dirty[i]) continue;
+    int face = i / (t * t), row0 = i % (t * t) / t * CUBE_TILE, col0 = i % t * CUBE_TILE;
+    for (int r = row0; r < m_min(row0 + CUBE_TILE, n); r++)
+      for (int c = col0; c < m_min(col0 + CUBE_TILE, n); c++) {
+        size_t k = ((size_t)face * n + r) * n + c;
+        state.skybox.cover_texels[k] = (uint8_t)(field->values[k] * 255.0f + 0.5f);
+      }
+  }
+  state.skybox.cover_pending = true;
+}
+
+/* the cover toward d, from the nearest texel; 1 until it is baked */
+static float sky_cover(Vec3 d) {
+  const CubeField *field = &state.skybox.cover_field;
+  if (!field->baked) return 1.0f;
+  float u, v;
+  int face = cube_dir_texel(d, &u, &v), n = field->size;
+  int x = m_min((int)(u * n), n - 1), y = m_min((int)(v * n), n - 1);
+  return field->values[((size_t)face * n + y) * n + x];
+}
+
+/* the fraction of the sky behind the clouds that shows through, toward n
+   directions. Clouds fade out at the horizon, directions all below it
+   skip them */
+static void sky_clouds(const NoiseProgram *clouds, Vec4SoA dirs, float *through, int n) {
+  bool above = false;
+  for (int i = 0; i < n; i++) above |= dirs.y[i] > 0.0f;
+  if (above) noise_eval(clouds, dirs, through, n);
+  for (int i = 0; i < n; i++)
+    through[i] = above ? 1.0f - through[i] * m_clamp(dirs.y[i] * 3.0f, 0.0f, 1.0f) * 0.7f : 1.0f;
+}
+
+typedef struct {
+  CubeImg *img;
+  const CubeDirs *dirs;       /* of a cube's faces */
+} SkyBake;
+
+/* one job per row of any face, or of the octahedral map */
+static void sky_bake_rows(void *user, int begin, int end) {
+  SkyBake *bake = user;
+  CubeImg *img = bake->img;
+  int n = img->size;
+  float *buf = malloc(8 * n * sizeof(float));
+  float *through = buf + 3*n, *texels = buf + 4*n;
+  for (int r = begin; r < end; r++) {
+    int face = r / n, row = r % n;
+    Vec4SoA dirs = { buf, buf + n, buf + 2*n, NULL };
+    if (img->face_count == 1)
+      pano_row_dirs(PANO_OCTAHEDRAL, n, n, row, dirs);
+    else
+      dirs = cube_texel_row_cached(bake->dirs, face, row, n, buf);
+    sky_clouds(&state.skybox.clouds, dirs, through, n);
+    for (int i = 0; i < n; i++) {
+      texels[4*i] = texels[4*i + 1] = texels[4*i + 2] = through[i];
+      texels[4*i + 3] = 1.0f;
+    }
+    cube_img_store_row(img, face, row, texels);
+  }
+  free(buf);
+}
+
+/* the cloud layer over the atmosphere, as the fraction of the sky behind
+   that shows through, per channel; no alpha, so it packs. Faces are laid
+   out the way the GPU samples them */
+static void sky_bake(CubeImg *img) {
+  SkyBake bake = { img, img->face_count == 6 ? cube_dirs(img->size, false) : NULL };
+  jobs_parallel_for(img->face_count * img->size, 16, sky_bake_rows, &bake);
+}
+
+/* the cloud layer from an equirect PNG instead, its rgb as what shows
+   through, plus a cube of it at the reflections' base size for lighting,
+   which never looks closer; false if it can't be read */
+static bool sky_load(const char *path, CubeImg *img, PanoCube *lighting) {
+  cp_image_t png = cp_load_png(path);
+  if (!png.pix) return false;
+  Pano src;
+  pano_init(&src, PANO_EQUIRECT, png.w, png.h);
+  for (int i = 0; i < png.w * png.h; i++) {
+    cp_pixel_t p = png.pix[i];
+    src.texels[i] = vec4(p.r / 255.0f, p.g / 255.0f, p.b / 255.0f, 1.0f);
+  }
+  cp_free_png(&png);
+
+  int n = img->size;
+  if (img->face_count == 1) {
+    Pano oct;
+    pano_init(&oct, PANO_OCTAHEDRAL, n, n);
+    pano_convert(&src, &oct);
+    for (int row = 0; row < n; row++) cube_img_store_row(img, 0, row, &oct.texels[(size_t)row * n].x);
+    pano_free(&oct);
+  } else {
+    PanoCube cube;
+    pano_cube_init(&cube, n);
+    pano_to_cube(&src, &cube);
+    for (int f = 0; f < 6; f++)
+      for (int row = 0; row < n; row++) cube_img_store_row(img, f, row, &cube.faces[f][(size_t)row * n].x);
+    pano_cube_free(&cube);
+  }
+  pano_cube_init(lighting, SKY_ENV_SIZE);
+  pano_to_cube(&src, lighting);
+  pano_free(&src);
+  return true;
+}
+
+/* what shows through the cloud layer toward n <= 256 directions, per
+   channel: the loaded layer if there is one, else the baked clouds under
+   their current cover, like skybox_fs */
+static void sky_through(Vec4SoA dirs, Vec3 *through, int n) {
+  if (state.skybox.loaded.size) {
+    for (int i = 0; i < n; i++) {
+      Vec4 t = pano_cube_sample(&state.skybox.loaded, vec3(dirs.x[i], dirs.y[i], dirs.z[i]));
+      through[i] = vec3(t.x, t.y, t.z);
+    }
+    return;
+  }
+  float f[256];
+  sky_clouds(&state.skybox.clouds, dirs, f, n);
+  for (int i = 0; i < n; i++)
+    through[i] = vec3_f(1.0f - (1.0f - f[i]) * sky_cover(vec3(dirs.x[i], dirs.y[i], dirs.z[i])));
+}
+
+/* what skybox_fs shows, without the sun disk */
+static void sky_radiance(void *user, Vec4SoA dirs, Vec4SoA out, int n) {
+  const Atmosphere *atmo = user;
+  Vec3 through[256];
+  Vec3 light = add3(mul3_f(atmosphere_sun(atmo), m_max(atmo->sun.y, 0.0f) / PI_f), atmosphere_sky(atmo, vec3_y));
+  for (int first = 0; first < n; first += 256) {
+    int count = m_min(n - first, 256);
+    sky_through((Vec4SoA) { dirs.x + first, dirs.y + first, dirs.z + first, NULL }, through, count);
+    for (int i = 0; i < count; i++) {
+      Vec3 sky = atmosphere_sky(atmo, vec3(dirs.x[first + i], dirs.y[first + i], dirs.z[first + i]));
+      Vec3 lum = add3(mul3(sky, through[i]), mul3(light, sub3(vec3_f(1.0f), through[i])));
+      out.x[first + i] = lum.x;
+      out.y[first + i] = lum.y;
+      out.z[first + i] = lum.z;
+    }
+  }
+}
+
+/* ambient light for meshes from the sky the atmosphere's table is for,
+   plus the sun through the clouds in front of it */
+static void sky_ambient(void) {
+  uint64_t start = stm_now();
+  Atmosphere *atmo = &state.skybox.atmo;
+  ShL2 sh = sh_project(SKY_SH_SIZE, sky_radiance, atmo);
+  Vec3 sun = atmo->sun;
+  Vec3 through;
+  sky_through((Vec4SoA) { &sun.x, &sun.y, &sun.z, NULL }, &through, 1);
+  sh_add_directional(&sh, sun, mul3(atmosphere_sun(atmo), through));
+  sh = sh_irradiance(sh);
+
+  Vec4 c[9];
+  sh_shader_coeffs(&sh, SKY_EXPOSURE, c);
+  state.skybox.ambient = (sh_params_t) {
+    .sh0 = c[0], .sh1 = c[1], .sh2 = c[2], .sh3 = c[3], .sh4 = c[4],
+    .sh5 = c[5], .sh6 = c[6], .sh7 = c[7], .sh8 = c[8],
+  };
+  state.skybox.ambient_ms = stm_ms(stm_since(start));
+}
+
+/* the sky prefiltered for glossy reflections; the sun disk is left out,
+   it's smaller than a texel of the base level. All at once, frame()
+   re-bakes them over several */
+static void sky_reflections(void) {
+  EnvMap *env = &state.skybox.env;
+  env_bake(env, sky_radiance, &state.skybox.atmo);
+  env_upload(env);
+  printf("sky: reflections in %.1f ms (source %.1f ms, prefilter %.1f ms)\n",
+         env->source_ms + env->prefilter_ms, env->source_ms, env->prefilter_ms);
 }
 
 void init(void) {
   sg_setup(&(sg_desc){
     .context = sapp_sgcontext()
   });
+  stm_setup();
+  jobs_setup(0);
+  state.orbit = quat_ident();
+  sn3_sino_init();
+  worley3_init();
+  if (sargs_boolean("bench"))
+    bench_run();
 
-  /* cube vertex buffer */
+  /* cube vertex buffer: position, color, normal */
   float vertices[] = {
-    -1.0, -1.0, -1.0,   1.0, 0.0, 0.0, 1.0,
-    1.0, -1.0, -1.0,   1.0, 0.0, 0.0, 1.0,
-    1.0,  1.0, -1.0,   1.0, 0.0, 0.0, 1.0,
-    -1.0,  1.0, -1.0,   1.0, 0.0, 0.0, 1.0,
-
-    -1.0, -1.0,  1.0,   0.0, 1.0, 0.0, 1.0,
-    1.0, -1.0,  1.0,   0.0, 1.0, 0.0, 1.0,
-    1.0,  1.0,  1.0,   0.0, 1.0, 0.0, 1.0,
-    -1.0,  1.0,  1.0,   0.0, 1.0, 0.0, 1.0,
-
-    -1.0, -1.0, -1.0,   0.0, 0.0, 1.0, 1.0,
-    -1.0,  1.0, -1.0,   0.0, 0.0, 1.0, 1.0,
-    -1.0,  1.0,  1.0,   0.0, 0.0, 1.0, 1.0,
-    -1.0, -1.0,  1.0,   0.0, 0.0, 1.0, 1.0,
-
-    1.0, -1.0, -1.0,    1.0, 0.5, 0.0, 1.0,
-    1.0,  1.0, -1.0,    1.0, 0.5, 0.0, 1.0,
-    1.0,  1.0,  1.0,    1.0, 0.5, 0.0, 1.0,
-    1.0, -1.0,  1.0,    1.0, 0.5, 0.0, 1.0,
-
-    -1.0, -1.0, -1.0,   0.0, 0.5, 1.0, 1.0,
-    -1.0, -1.0,  1.0,   0.0, 0.5, 1.0, 1.0,
-    1.0, -1.0,  1.0,   0.0, 0.5, 1.0, 1.0,
-    1.0, -1.0, -1.0,   0.0, 0.5, 1.0, 1.0,
-
-    -1.0,  1.0, -1.0,   1.0, 0.0, 0.5, 1.0,
-    -1.0,  1.0,  1.0,   1.0, 0.0, 0.5, 1.0,
-    1.0,  1.0,  1.0,   1.0, 0.0, 0.5, 1.0,
-    1.0,  1.0, -1.0,   1.0, 0.0, 0.5, 1.0
+    -1.0, -1.0, -1.0,   1.0, 0.0, 0.0, 1.0,   0.0, 0.0, -1.0,
+    1.0, -1.0, -1.0,   1.0, 0.0, 0.0, 1.0,   0.0, 0.0, -1.0,
+    1.0,  1.0, -1.0,   1.0, 0.0, 0.0, 1.0,   0.0, 0.0, -1.0,
+    -1.0,  1.0, -1.0,   1.0, 0.0, 0.0, 1.0,   0.0, 0.0, -1.0,
+
+    -1.0, -1.0,  1.0,   0.0, 1.0, 0.0, 1.0,   0.0, 0.0, 1.0,
+    1.0, -1.0,  1.0,   0.0, 1.0, 0.0, 1.0,   0.0, 0.0, 1.0,
+    1.0,  1.0,  1.0,   0.0, 1.0, 0.0, 1.0,   0.0, 0.0, 1.0,
+    -1.0,  1.0,  1.0,   0.0, 1.0, 0.0, 1.0,   0.0, 0.0, 1.0,
+
+    -1.0, -1.0, -1.0,   0.0, 0.0, 1.0, 1.0,   -1.0, 0.0, 0.0,
+    -1.0,  1.0, -1.0,   0.0, 0.0, 1.0, 1.0,   -1.0, 0.0, 0.0,
+    -1.0,  1.0,  1.0,   0.0, 0.0, 1.0, 1.0,   -1.0, 0.0, 0.0,
+    -1.0, -1.0,  1.0,   0.0, 0.0, 1.0, 1.0,   -1.0, 0.0, 0.0,
+
+    1.0, -1.0, -1.0,    1.0, 0.5, 0.0, 1.0,   1.0, 0.0, 0.0,
+    1.0,  1.0, -1.0,    1.0, 0.5, 0.0, 1.0,   1.0, 0.0, 0.0,
+    1.0,  1.0,  1.0,    1.0, 0.5, 0.0, 1.0,   1.0, 0.0, 0.0,
+    1.0, -1.0,  1.0,    1.0, 0.5, 0.0, 1.0,   1.0, 0.0, 0.0,
+
+    -1.0, -1.0, -1.0,   0.0, 0.5, 1.0, 1.0,   0.0, -1.0, 0.0,
+    -1.0, -1.0,  1.0,   0.0, 0.5, 1.0, 1.0,   0.0, -1.0, 0.0,
+    1.0, -1.0,  1.0,   0.0, 0.5, 1.0, 1.0,   0.0, -1.0, 0.0,
+    1.0, -1.0, -1.0,   0.0, 0.5, 1.0, 1.0,   0.0, -1.0, 0.0,
+
+    -1.0,  1.0, -1.0,   1.0, 0.0, 0.5, 1.0,   0.0, 1.0, 0.0,
+    -1.0,  1.0,  1.0,   1.0, 0.0, 0.5, 1.0,   0.0, 1.0, 0.0,
+    1.0,  1.0,  1.0,   1.0, 0.0, 0.5, 1.0,   0.0, 1.0, 0.0,
+    1.0,  1.0, -1.0,   1.0, 0.0, 0.5, 1.0,   0.0, 1.0, 0.0
   };
   state.mesh.vbuf = sg_make_buffer(&(sg_buffer_desc){
     .data = SG_RANGE(vertices),
@@ -133,66 +571,117 @@ void init(void) {
     .label = "cube-indices"
   });
 
-  sn3_sino_init();
-  typedef struct { Vec4 tl, tr, bl, br; } Face;
-  typedef struct { uint8_t r, g, b, a; } Byte4;
-  typedef struct { Byte4 pixels[1024][1024]; } FaceImg;
-  typedef struct { FaceImg faces[6]; } CubeImg;
-  CubeImg *img = calloc(sizeof(CubeImg), 1);
-  for (int x = 0; x < 1024; x++)
-    for (int y = 0; y < 1024; y++)
-      for (int i = 0; i < 6; i++) {
-        float dy = lerp(-1.0f, 1.0f, (float)x / 1024.0f);
-        float dx = lerp(-1.0f, 1.0f, (float)y / 1024.0f);
-        Vec3 dir;
-        switch (i) {
-          case SG_CUBEFACE_POS_X: dir = vec3( 1.0f,    dx,    dy); break;
-          case SG_CUBEFACE_NEG_X: dir = vec3(-1.0f,    dx,    dy); break;
-          case SG_CUBEFACE_POS_Y: dir = vec3(   dy,  1.0f,    dx); break;
-          case SG_CUBEFACE_NEG_Y: dir = vec3(   dy, -1.0f,    dx); break;
-          case SG_CUBEFACE_POS_Z: dir = vec3(   dx,    dy,  1.0f); break;
-          case SG_CUBEFACE_NEG_Z: dir = vec3(   dx,    dy, -1.0f); break;
-          default: continue;
-        }
-        dir = norm3(dir);
-        // int octaves = 8;
-        // float frequency = 1.0f;
-        // float amplitude = 1.0f;
-        // float persistence = 0.5f;
-
-        // float t = 0.0f;
-        // for (int o = 0; o < octaves; o++) {
-        //   float freq = frequency * powf(2, o);
-        //   Vec3 coord = mul3_f(dir, freq);
-        //   float sample = sn3_sample(coord.x, coord.y, coord.z);
-        //   t += sample * amplitude * powf(persistence, o);
-        // }
-        // t = t / (2.0f - 1.0f / powf(2, octaves - 1));
-
-        Vec3 color = lerp3(vec3(0.3f, 1.0f, 0.9f), vec3(0.0f, 0.0f, 1.0f), dir.y);
-        // Vec3 color = vec3(dir.x, dir.y, dir.z); // vec3_f(t);
-        img->faces[i].pixels[x][y] = (Byte4) { color.x*255.0f, color.y*255.0f, color.z*255.0f, 255 };
-    }
-  cp_save_png("pos_x.png", &(cp_image_t) { 1024, 1024, (cp_pixel_t *)img->faces[SG_CUBEFACE_POS_X].pixels });
-  cp_save_png("pos_y.png", &(cp_image_t) { 1024, 1024, (cp_pixel_t *)img->faces[SG_CUBEFACE_POS_Y].pixels });
-
-  sg_image_data skybox;
-  for (int i = 0; i < 6; ++i) {
-    skybox.subimage[i][0].ptr = &img->faces[i].pixels;
-    skybox.subimage[i][0].size = 1024*1024*4;
+  instances_init();
+
+  /* sky_format=rgba16f (the default), rg11b10f or rgba8; float formats
+     fall back to RGBA8 where they can't be filtered */
+  const char *format_name = sargs_value_def("sky_format", "rgba16f");
+  sg_pixel_format format = sargs_equals("sky_format", "rg11b10f") ? SG_PIXELFORMAT_RG11B10F
+                         : sargs_equals("sky_format", "rgba8") ? SG_PIXELFORMAT_RGBA8
+                         : SG_PIXELFORMAT_RGBA16F;
+  if (!sg_query_pixelformat(format).filter) {
+    printf("sky: %s can't be filtered here, using rgba8\n", format_name);
+    format = SG_PIXELFORMAT_RGBA8;
+  }
+  /* sky_layout=cube (the default) or octahedral, one 2D texture with 2/3
+     of the cube's texels; clouds=<equirect png> loads the cloud layer
+     instead of baking it, and ambient light and reflections follow it */
+  state.skybox.octahedral = sargs_equals("sky_layout", "octahedral");
+  CubeImg img;
+  if (state.skybox.octahedral)
+    cube_img_init_2d(&img, SKY_OCT_SIZE, format);
+  else
+    cube_img_init(&img, SKY_CUBE_SIZE, format);
+  sky_clouds_compile(&state.skybox.clouds);
+  uint64_t bake_start = stm_now();
+  const char *clouds_path = sargs_value("clouds");
+  bool loaded = *clouds_path && sky_load(clouds_path, &img, &state.skybox.loaded);
+  if (!loaded) {
+    if (*clouds_path) printf("sky: can't load %s, baking the clouds\n", clouds_path);
+    sky_bake(&img);
   }
-  state.skybox.tex = sg_make_image(&(sg_image_desc) {
+  /* the face sized direction table only served the bake, and at 1024 it
+     holds 72 MB; nothing keeps a pointer into the cache yet */
+  cube_dirs_release();
+
+  /* the baked clouds come and go under an animated cover, re-baked a few
+     tiles at a time as it drifts; a loaded layer gets a constant one */
+  int cn = SKY_COVER_SIZE;
+  state.skybox.cover_texels = malloc((size_t)6 * cn * cn);
+  memset(state.skybox.cover_texels, 255, (size_t)6 * cn * cn);
+  sg_image_desc cover_desc = {
     .type = SG_IMAGETYPE_CUBE,
-    .width = 1024,
-    .height = 1024,
-    .pixel_format = SG_PIXELFORMAT_RGBA8,
+    .width = cn,
+    .height = cn,
+    .usage = loaded ? SG_USAGE_IMMUTABLE : SG_USAGE_STREAM,
+    .pixel_format = SG_PIXELFORMAT_R8,
     .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
     .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
     .wrap_w = SG_WRAP_CLAMP_TO_EDGE,
     .min_filter = SG_FILTER_LINEAR,
     .mag_filter = SG_FILTER_LINEAR,
-    .data = skybox,
-  });
+    .label = "sky-cloud-cover",
+  };
+  if (loaded)
+    for (int f = 0; f < 6; f++)
+      cover_desc.data.subimage[f][0] = (sg_range) { state.skybox.cover_texels + (size_t)f * cn * cn, (size_t)cn * cn };
+  state.skybox.cover_tex = sg_make_image(&cover_desc);
+  sky_cover_compile(&state.skybox.cover);
+  if (!loaded && cube_field_init(&state.skybox.cover_field, cn)) sky_cover_update();
+  int n = img.size;
+  printf("sky: %s %s in %.1f ms, %.1f MB\n", state.skybox.octahedral ? "octahedral" : "cube",
+         loaded ? "converted" : "baked", stm_ms(stm_since(bake_start)),
+         (double)img.face_count * n * n * img.texel_bytes / (1024.0 * 1024.0));
+  uint8_t *png = malloc((size_t)n * n * 4);
+  if (state.skybox.octahedral) {
+    cube_img_rgba8(&img, 0, png);
+    cp_save_png("octahedral.png", &(cp_image_t) { n, n, (cp_pixel_t *)png });
+  } else {
+    cube_img_rgba8(&img, SG_CUBEFACE_POS_X, png);
+    cp_save_png("pos_x.png", &(cp_image_t) { n, n, (cp_pixel_t *)png });
+    cube_img_rgba8(&img, SG_CUBEFACE_POS_Y, png);
+    cp_save_png("pos_y.png", &(cp_image_t) { n, n, (cp_pixel_t *)png });
+  }
+  free(png);
+
+  sg_image_desc desc = {
+    .type = state.skybox.octahedral ? SG_IMAGETYPE_2D : SG_IMAGETYPE_CUBE,
+    .width = n,
+    .height = n,
+    .pixel_format = format,
+    .wrap_u = SG_WRAP_CLAMP_TO_EDGE,
+    .wrap_v = SG_WRAP_CLAMP_TO_EDGE,
+    .wrap_w = SG_WRAP_CLAMP_TO_EDGE,
+    .min_filter = SG_FILTER_LINEAR,
+    .mag_filter = SG_FILTER_LINEAR,
+    .data = cube_img_data(&img),
+  };
+  state.skybox.tex = sg_make_image(&desc);
+
+  /* stars=<count> (20000 by default) and stars_seed=<n>, splatted over an
+     empty layer of the same layout and format */
+  int star_count = atoi(sargs_value_def("stars", "20000"));
+  uint32_t star_seed = (uint32_t)strtoul(sargs_value_def("stars_seed", "1"), NULL, 10);
+  for (int f = 0; f < img.face_count; f++) memset(img.faces[f], 0, (size_t)n * n * img.texel_bytes);
+  StarField stars;
+  stars_scatter(&stars, star_count, star_seed, SKY_STAR_BRIGHTNESS);
+  stars_bake(&stars, &img);
+  printf("sky: %d stars in %.1f ms (binned %.1f ms, splatted %.1f ms into %d of %d tiles)\n",
+         star_count, stars.bin_ms + stars.splat_ms, stars.bin_ms, stars.splat_ms, stars.busy_count, stars.tiles);
+  stars_free(&stars);
+  desc.data = cube_img_data(&img);
+  state.skybox.stars = sg_make_image(&desc);
+  cube_img_free(&img);
+
+  state.skybox.hours = 15.0f;
+  atmosphere_init(&state.skybox.atmo, 0.5f, sky_sun(state.skybox.hours));
+  atmosphere_make_images(&state.skybox.atmo);
+  sky_ambient();
+  printf("sky: ambient in %.2f ms\n", state.skybox.ambient_ms);
+  state.skybox.roughness = 0.25f;
+  env_init(&state.skybox.env, SKY_ENV_SIZE, SKY_ENV_MIPS);
+  env_make_image(&state.skybox.env);
+  sky_reflections();
 
   mesh_init();
 }
@@ -202,69 +691,219 @@ static void event(const sapp_event *ev) {
     case (SAPP_EVENTTYPE_KEY_DOWN): {
       if (ev->key_code == SAPP_KEYCODE_ESCAPE)
         sapp_request_quit();
+      /* pitch about the camera's own x axis, yaw about the world's y */
       if (ev->key_code == SAPP_KEYCODE_W)
-        state.rx += 0.03f;
+        state.orbit = mul_quat(state.orbit, axis_angle_quat(vec3_x, -0.03f));
       if (ev->key_code == SAPP_KEYCODE_S)
-        state.rx -= 0.03f;
+        state.orbit = mul_quat(state.orbit, axis_angle_quat(vec3_x, 0.03f));
       if (ev->key_code == SAPP_KEYCODE_A)
-        state.ry += 0.03f;
+        state.orbit = mul_quat(axis_angle_quat(vec3_y, 0.03f), state.orbit);
       if (ev->key_code == SAPP_KEYCODE_D)
-        state.ry -= 0.03f;
+        state.orbit = mul_quat(axis_angle_quat(vec3_y, -0.03f), state.orbit);
+      state.orbit = norm_quat(state.orbit);
+      if (ev->key_code == SAPP_KEYCODE_I)
+        state.inst.enabled = !state.inst.enabled;
+      if (ev->key_code == SAPP_KEYCODE_P)
+        state.inst.paused = !state.inst.paused;
+      if (ev->key_code == SAPP_KEYCODE_C)
+        state.inst.cull = !state.inst.cull;
+      if (ev->key_code == SAPP_KEYCODE_UP)
+        state.inst.count = m_min(state.inst.count * 2, MAX_INSTANCES);
+      if (ev->key_code == SAPP_KEYCODE_DOWN)
+        state.inst.count = m_max(state.inst.count / 2, 1);
+      if (ev->key_code == SAPP_KEYCODE_T)
+        state.skybox.hours = fmodf(state.skybox.hours + 0.25f, 24.0f);
+      if (ev->key_code == SAPP_KEYCODE_G)
+        state.skybox.hours = fmodf(state.skybox.hours + 23.75f, 24.0f);
+      if (ev->key_code == SAPP_KEYCODE_R)
+        state.skybox.roughness = fmodf(state.skybox.roughness + 0.25f, 1.25f);
     } break;
   }
 }
 
 void frame(void) {
-  /* NOTE: the vs_params_t struct has been code-generated by the shader-code-gen */
-  mesh_vs_params_t vs_params;
   const float w = sapp_widthf();
   const float h = sapp_heightf();
-  Mat4 proj = perspective4x4(1.047f, w/h, 0.01f, 10.0f);
-  Vec3 eye = mul3_f(vec3(
-    cosf(state.rx)*sinf(state.ry),
-    sinf(state.rx),
-    cosf(state.rx)*cosf(state.ry)
-  ), 6.0f);
-  Mat4 view = look_at4x4(eye, vec3_f(0.0f), vec3_y);
-  Mat4 view_proj = mul4x4(proj, view);
+  Vec3 eye = rotate_quat3(state.orbit, vec3(0.0f, 0.0f, 6.0f));
+  camera_look_at(&state.camera, eye, vec3_f(0.0f), vec3_y);
+  camera_perspective(&state.camera, 1.047f, 0.01f, 10.0f);
+  camera_viewport(&state.camera, w, h);
+
+  /* NOTE: the camera_params_t struct has been code-generated by the shader-code-gen */
+  if (camera_update(&state.camera))
+    state.camera_params = (camera_params_t) {
+      .view_proj = state.camera.view_proj,
+      .inv_view_proj = state.camera.inv_view_proj,
+      .sky = state.camera.sky,
+      .inv_sky = state.camera.inv_sky,
+      .eye_pos = vec4(eye.x, eye.y, eye.z, 1.0f),
+    };
+
+  /* the cloud cover moves on with the time, uploaded once per frame */
+  if (state.skybox.cover_field.size) {
+    state.skybox.cover.time += (float)stm_sec(stm_laptime(&state.skybox.last_frame));
+    sky_cover_update();
+  }
+  if (state.skybox.cover_pending) {
+    sg_image_data data = {0};
+    for (int f = 0; f < 6; f++)
+      data.subimage[f][0] = (sg_range) {
+        state.skybox.cover_texels + (size_t)f * SKY_COVER_SIZE * SKY_COVER_SIZE, SKY_COVER_SIZE * SKY_COVER_SIZE
+      };
+    sg_update_image(state.skybox.cover_tex, &data);
+    state.skybox.cover_pending = false;
+  }
 
-  vs_params.mvp = view_proj;
+  /* the sky-view table catches up over a few frames, the sun's azimuth
+     and disk follow right away */
+  Atmosphere *atmo = &state.skybox.atmo;
+  Vec3 sun = sky_sun(state.skybox.hours);
+  atmosphere_set_sun(atmo, sun);
+  if (atmosphere_update(atmo, SKY_VIEW_MS)) {
+    sky_ambient();
+    state.skybox.env_stale = true;
+  }
+  /* a re-bake in progress finishes first, so the sun moving on every
+     frame still gets its reflections updated */
+  EnvMap *env = &state.skybox.env;
+  if (state.skybox.env_stale && env->next < 0) {
+    env_begin(env, sky_radiance, atmo);
+    state.skybox.env_stale = false;
+  }
+  if (env_update(env, SKY_ENV_MS)) env_upload(env);
+  /* a dielectric's reflectance, 4% at normal incidence */
+  state.skybox.ambient.specular = vec4(state.skybox.roughness, 0.04f, state.skybox.env.mips - 1.0f, SKY_EXPOSURE);
+  state.skybox.params = (sky_params_t) {
+    .sun_dir = vec4(sun.x, sun.y, sun.z, 0.01f),
+    .planet = vec4(ATMO_BOTTOM, ATMO_TOP, ATMO_BOTTOM + atmo->view_height, SKY_EXPOSURE),
+    .night = vec4(m_clamp((0.05f - sun.y) / 0.15f, 0.0f, 1.0f), 0.0f, 0.0f, 0.0f),
+  };
 
   sg_begin_default_pass(&state.mesh.pass_action, (int)w, (int)h);
+  batch_begin();
+
+  if (!state.inst.enabled)
+    batch_draw(&(BatchDraw) {
+      .layer = LAYER_OPAQUE,
+      .pip = state.mesh.pip,
+      .bind = {
+        .vertex_buffers[0] = state.mesh.vbuf,
+        .index_buffer = state.mesh.ibuf,
+        .fs_images[SLOT_env] = state.skybox.env.img,
+      },
+      .ub_slot = SLOT_camera_params,
+      .uniforms = &state.camera_params,
+      .uniforms_size = sizeof(state.camera_params),
+      .fs_ub_slot = SLOT_sh_params,
+      .fs_uniforms = &state.skybox.ambient,
+      .fs_uniforms_size = sizeof(state.skybox.ambient),
+      .num_elements = 36,
+      .num_instances = 1,
+    });
+  else {
+    uint64_t fill_start = stm_now();
+    instances_fill((float)stm_sec(fill_start));
+    state.inst.fill_ms += stm_ms(stm_since(fill_start));
+
+    uint64_t cull_start = stm_now();
+    instances_cull(state.camera.view_proj);
+    state.inst.cull_ms += stm_ms(stm_since(cull_start));
+
+    batch_draw(&(BatchDraw) {
+      .layer = LAYER_OPAQUE,
+      .pip = state.inst.pip,
+      .bind = {
+        .vertex_buffers[0] = state.mesh.vbuf,
+        .index_buffer = state.mesh.ibuf,
+        .fs_images[SLOT_env] = state.skybox.env.img,
+      },
+      .ub_slot = SLOT_camera_params,
+      .uniforms = &state.camera_params,
+      .uniforms_size = sizeof(state.camera_params),
+      .fs_ub_slot = SLOT_sh_params,
+      .fs_uniforms = &state.skybox.ambient,
+      .fs_uniforms_size = sizeof(state.skybox.ambient),
+      .num_elements = 36,
+      .num_instances = state.inst.visible_count,
+      .instances = state.inst.visible,
+    });
+  }
 
-  sg_apply_pipeline(state.mesh.pip);
-  sg_apply_bindings(&(sg_bindings) {
-    .vertex_buffers[0] = state.mesh.vbuf,
-    .index_buffer = state.mesh.ibuf,
-  });
-  vs_params.mvp = mul4x4(proj, view);
-  sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_mesh_vs_params, &SG_RANGE(vs_params));
-  sg_draw(0, 36, 1);
-
-  sg_apply_pipeline(state.skybox.pip);
-  sg_apply_bindings(&(sg_bindings) {
-    .vertex_buffers[0] = state.mesh.vbuf,
-    .index_buffer = state.mesh.ibuf,
-    .fs_images[SLOT_skybox] = state.skybox.tex,
-  });
-  Mat4 skybox_view = view;
-  skybox_view.w = vec4(0, 0, 0, 1);
-  vs_params.mvp = mul4x4(proj, skybox_view);
-  sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_mesh_vs_params, &SG_RANGE(vs_params));
-  sg_draw(0, 36, 1);
+  BatchDraw sky = {
+    .layer = LAYER_SKY,
+    .pip = state.skybox.pip,
+    .bind = {
+      .vertex_buffers[0] = state.mesh.vbuf,
+      .index_buffer = state.mesh.ibuf,
+      .fs_images = {
+        [SLOT_transmittance_lut] = atmo->transmittance_img,
+        [SLOT_sky_view_lut] = atmo->sky_view_img,
+      },
+    },
+    .ub_slot = SLOT_camera_params,
+    .uniforms = &state.camera_params,
+    .uniforms_size = sizeof(state.camera_params),
+    .fs_ub_slot = SLOT_sky_params,
+    .fs_uniforms = &state.skybox.params,
+    .fs_uniforms_size = sizeof(state.skybox.params),
+    .num_elements = 36,
+    .num_instances = 1,
+  };
+  sky.bind.fs_images[state.skybox.octahedral ? SLOT_skybox_oct : SLOT_skybox] = state.skybox.tex;
+  sky.bind.fs_images[state.skybox.octahedral ? SLOT_stars_oct : SLOT_stars] = state.skybox.stars;
+  sky.bind.fs_images[SLOT_cloud_cover] = state.skybox.cover_tex;
+  batch_draw(&sky);
 
+  batch_flush();
   sg_end_pass();
 
   sg_commit();
+
+  double frame_ms = stm_ms(stm_laptime(&state.inst.last_frame));
+  if (!state.inst.enabled) return;
+  state.inst.frame_ms += frame_ms;
+  state.inst.frames++;
+  if (stm_sec(stm_since(state.inst.last_report)) >= 1.0) {
+    BatchStats stats = batch_stats();
+    printf("instances: %6d  visible: %6d  frame: %6.3f ms  fill: %6.3f ms  "
+           "scene: %6.3f ms (%d of %d nodes)  cull: %6.3f ms  "
+           "draws: %d/%d  state changes: %d (%d skipped)  uploaded: %zu bytes\n",
+           state.inst.count, state.inst.visible_count,
+           state.inst.frame_ms / state.inst.frames,
+           state.inst.fill_ms / state.inst.frames,
+           state.inst.scene_ms / state.inst.frames,
+           state.inst.scene_updated / state.inst.frames, state.inst.scene.count,
+           state.inst.cull_ms / state.inst.frames,
+           stats.draws, stats.submitted,
+           stats.pipelines + stats.bindings + stats.uniforms, stats.skipped,
+           stats.bytes);
+    state.inst.last_report = stm_now();
+    state.inst.frame_ms = state.inst.fill_ms = state.inst.cull_ms = state.inst.scene_ms = 0.0;
+    state.inst.frames = state.inst.scene_updated = 0;
+  }
 }
 
 void cleanup(void) {
+  batch_shutdown();
+  atmosphere_free(&state.skybox.atmo);
+  env_free(&state.skybox.env);
+  pano_cube_free(&state.skybox.loaded);
+  if (state.skybox.cover_field.size) cube_field_free(&state.skybox.cover_field);
+  free(state.skybox.cover_texels);
+  cube_dirs_release();
+  jobs_shutdown();
+  scene_free(&state.inst.scene);
+  free(state.inst.data);
+  free(state.inst.visible);
+  free(state.inst.visible_ids);
+  free(state.inst.bounds.min_x); free(state.inst.bounds.min_y); free(state.inst.bounds.min_z);
+  free(state.inst.bounds.max_x); free(state.inst.bounds.max_y); free(state.inst.bounds.max_z);
   sg_shutdown();
+  sargs_shutdown();
 }
 
 sapp_desc sokol_main(int argc, char* argv[]) {
-  (void)argc;
-  (void)argv;
+  sargs_setup(&(sargs_desc){ .argc = argc, .argv = argv });
   return (sapp_desc){
     .init_cb = init,
     .frame_cb = frame,
@@ -22,6 +22,39 @@
 
 #define PI_f (3.14159265359f)
 
+/* SIMD kernels are picked at compile time, define MATH_NO_SIMD to force
+   the scalar code. The vector paths do the same multiplies and adds in the
+   same order as the scalar ones, so they produce bit-identical results as
+   long as the compiler doesn't contract a*b + c into an FMA, which it may
+   do to some and not others where FMA is enabled (-mfma, -march=native,
+   and clang by default). bake builds with -ffp-contract=off for that;
+   the batched samplers in snoise3.h, worley3.h and noise.h rely on it
+   the same way. */
+#if !defined(MATH_NO_SIMD)
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MATH_AVX
+#define MATH_SSE
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MATH_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MATH_NEON
+#endif
+/* integer lanes, only the random streams use these */
+#if defined(MATH_SSE) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MATH_SSE2
+#endif
+#if defined(MATH_AVX) && defined(__AVX2__)
+#define MATH_AVX2
+#endif
+#if defined(MATH_AVX) && defined(__F16C__)
+#define MATH_F16C
+#endif
+#endif
+
 const uint32_t positive_inf = 0x7F800000; // 0xFF << 23
 
 typedef struct { float x, y; } Vec2;
@@ -38,6 +71,11 @@ typedef union {
     struct { Vec4 x, y, z, w; };
     Vec4 cols[4];
 } Mat4;
+/* structure-of-arrays stream of points/vectors; w may be NULL, on
+   input that means 1.0 for every element, on output it isn't written */
+typedef struct {
+  float *x, *y, *z, *w;
+} Vec4SoA;
 typedef union {
     struct {
         union { Vec3 xyz; struct { float x,y,z; }; };
@@ -46,6 +84,13 @@ typedef union {
     float elements[4];
 } Quaternion;
 
+/* xoshiro128+ state, one per thread or job */
+typedef struct { uint32_t s[4]; } Rand;
+
+/* eight independent xoshiro128+ streams stepped together, s[word][lane] */
+#define RAND_LANES (8)
+typedef struct { uint32_t s[4][RAND_LANES]; } RandN;
+
 //Utillity
 static float to_radians(float degrees);
 static float lerp(float a, float b, float t);
@@ -56,6 +101,22 @@ static uint32_t rand32(void);
 static void seed_rand(uint32_t s0, uint32_t s1, uint32_t s2, uint32_t s3);
 static float randf(void);
 static uint32_t rotl(const uint32_t x, int k);
+static uint16_t f32_to_f16(float f);
+static float f16_to_f32(uint16_t h);
+static void f16_to_f32_n(const uint16_t *in, float *out, size_t n);
+static void f32_to_f16_n(const float *in, uint16_t *out, size_t n);
+static uint32_t rg11b10_pack(Vec3 c);
+static Vec3 rg11b10_unpack(uint32_t v);
+static void rg11b10_pack_n(const float *rgba, uint32_t *out, size_t n);
+static Rand rand_seeded(uint32_t seed);
+static uint32_t rand32_r(Rand *r);
+static float randf_r(Rand *r);
+static void rand_jump(Rand *r);
+static void rand_long_jump(Rand *r);
+static RandN randn_split(Rand *r);
+static RandN randn_stream(uint32_t seed, uint32_t stream);
+static void rand32_n(RandN *r, uint32_t *out, size_t n);
+static void randf_n(RandN *r, float *out, size_t n);
 
 //Vector operations
 //2d
@@ -94,6 +155,9 @@ static float dot3(Vec3 a, Vec3 b);
 static float mag3(Vec3 a);
 static float magmag3(Vec3 a);
 static Vec3 norm3(Vec3 a);
+static float rsqrt_fast(float x);
+static Vec3 norm3_fast(Vec3 a);
+static void norm3_fast_n(Vec4SoA in, Vec4SoA out, size_t n);
 static Vec3 abs3(Vec3 a);
 static Vec3 sign3(Vec3 a);
 static Vec3 max3_f(Vec3 v, float f);
@@ -124,6 +188,11 @@ static Vec4 sign4(Vec4 a);
 //Matrix
 static Mat4 mul4x4(Mat4 a, Mat4 b);
 static Vec4 mul4x44(Mat4 a, Vec4 b);
+static Mat4 mul4x4_scalar(Mat4 a, Mat4 b);
+static Vec4 mul4x44_scalar(Mat4 a, Vec4 b);
+static Mat4 transpose4x4_scalar(Mat4 a);
+static void mul4x4_n(const Mat4 *a, const Mat4 *b, Mat4 *out, size_t n);
+static void mul4x44_n(Mat4 m, Vec4SoA in, Vec4SoA out, size_t n);
 static Mat4 scale4x4(Vec3 v);
 static Mat4 ident4x4();
 static Mat4 transpose4x4(Mat4 a);
@@ -134,6 +203,27 @@ static Mat4 y_rotate4x4(float angle);
 static Mat4 z_rotate4x4(float angle);
 static Mat4 perspective4x4(float fov, float aspect, float n, float f);
 static Mat4 look_at4x4(Vec3 eye, Vec3 focus, Vec3 up);
+static Mat4 inverse4x4(Mat4 m);
+static Mat4 inverse4x4_scalar(Mat4 m);
+static Mat4 inverse_affine4x4(Mat4 m);
+static Mat4 inverse_rigid4x4(Mat4 m);
+static Mat4 inverse_perspective4x4(Mat4 p);
+
+/* Quaternion, (x, y, z) imaginary and w real; rotations follow the
+   same conventions as rotate4x4 */
+static Quaternion quat(float x, float y, float z, float w);
+static Quaternion quat_ident(void);
+static Quaternion axis_angle_quat(Vec3 axis, float angle);
+static Quaternion mul_quat(Quaternion a, Quaternion b);
+static Quaternion conj_quat(Quaternion q);
+static float dot_quat(Quaternion a, Quaternion b);
+static Quaternion norm_quat(Quaternion q);
+static Quaternion nlerp_quat(Quaternion a, Quaternion b, float t);
+static Quaternion slerp_quat(Quaternion a, Quaternion b, float t);
+static Mat4 quat_to4x4(Quaternion q);
+static Quaternion quat_from4x4(Mat4 m);
+static Vec3 rotate_quat3(Quaternion q, Vec3 v);
+static void rotate_quat3_n(Quaternion q, Vec4SoA in, Vec4SoA out, size_t n);
 
 //Uncomment to use in true single header style
 #define MATH_IMPLEMENTATION
@@ -171,32 +261,305 @@ static float step(float edge, float x) {
 static uint32_t rotl(const uint32_t x, int k) {
     return (x << k) | (x >> (32 - k));
 }
-static uint32_t _math_rand_seed[4];
 /* source: http://prng.di.unimi.it/xoshiro128plus.c
    NOTE: The state must be seeded so that it is not everywhere zero. */
-static uint32_t rand32(void) {
-    const uint32_t result = _math_rand_seed[0] + _math_rand_seed[3],
-                        t = _math_rand_seed[1] << 9;
+static uint32_t rand32_r(Rand *r) {
+    uint32_t *s = r->s;
+    const uint32_t result = s[0] + s[3],
+                        t = s[1] << 9;
 
-    _math_rand_seed[2] ^= _math_rand_seed[0];
-    _math_rand_seed[3] ^= _math_rand_seed[1];
-    _math_rand_seed[1] ^= _math_rand_seed[2];
-    _math_rand_seed[0] ^= _math_rand_seed[3];
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
 
-    _math_rand_seed[2] ^= t;
+    s[2] ^= t;
 
-    _math_rand_seed[3] = rotl(_math_rand_seed[3], 11);
+    s[3] = rotl(s[3], 11);
 
     return result;
 }
+static inline float randf_r(Rand *r) {
+    return (rand32_r(r) >> 8) * 0x1.0p-24f;
+}
+
+/* the global generator behind rand32/randf, not thread-safe */
+static Rand _math_rand;
+static uint32_t rand32(void) {
+    return rand32_r(&_math_rand);
+}
 static void seed_rand(uint32_t s0, uint32_t s1, uint32_t s2, uint32_t s3) {
-    _math_rand_seed[0] = s0;
-    _math_rand_seed[1] = s1;
-    _math_rand_seed[2] = s2;
-    _math_rand_seed[3] = s3;
+    _math_rand = (Rand) {{ s0, s1, s2, s3 }};
 }
 static inline float randf(void) {
-    return (rand32() >> 8) * 0x1.0p-24f;
+    return randf_r(&_math_rand);
+}
+
+/* expands one word into a full state with splitmix32 (murmur3's
+   finalizer), so nearby seeds still give unrelated streams */
+static Rand rand_seeded(uint32_t seed) {
+    Rand r;
+    for (int i = 0; i < 4; ++i) {
+        uint32_t z = (seed += 0x9E3779B9);
+        z = (z ^ (z >> 16)) * 0x85EBCA6B;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35;
+        r.s[i] = z ^ (z >> 16);
+    }
+    if ((r.s[0] | r.s[1] | r.s[2] | r.s[3]) == 0) r.s[0] = 1;
+    return r;
+}
+
+static void _rand_jump(Rand *r, const uint32_t jump[4]) {
+    uint32_t s[4] = {0};
+    for (int i = 0; i < 4; ++i)
+        for (int b = 0; b < 32; ++b) {
+            if (jump[i] & (1u << b))
+                for (int k = 0; k < 4; ++k) s[k] ^= r->s[k];
+            rand32_r(r);
+        }
+    *r = (Rand) {{ s[0], s[1], s[2], s[3] }};
+}
+
+/* equivalent to 2^64 calls, splits the period into 2^64 streams
+   that never overlap; hand one to each thread */
+static void rand_jump(Rand *r) {
+    static const uint32_t jump[4] = { 0x8764000B, 0xF542D2D3, 0x6FA035C3, 0x77F2DB5B };
+    _rand_jump(r, jump);
+}
+
+/* equivalent to 2^96 calls, 2^32 starting points that rand_jump
+   can each split further */
+static void rand_long_jump(Rand *r) {
+    static const uint32_t jump[4] = { 0xB523952E, 0x0B6F099F, 0xCCF5A0EF, 0x1C580662 };
+    _rand_jump(r, jump);
+}
+
+/* lanes start at r and one jump apart from each other, then r itself
+   takes a long jump, so consecutive splits never overlap */
+static RandN randn_split(Rand *r) {
+    RandN res;
+    Rand lane_r = *r;
+    for (int lane = 0; lane < RAND_LANES; ++lane) {
+        for (int k = 0; k < 4; ++k) res.s[k][lane] = lane_r.s[k];
+        rand_jump(&lane_r);
+    }
+    rand_long_jump(r);
+    return res;
+}
+
+/* the stream-th split of a seed; costs a long jump per index, to hand
+   out many streams call randn_split in a loop instead */
+static RandN randn_stream(uint32_t seed, uint32_t stream) {
+    Rand r = rand_seeded(seed);
+    for (uint32_t i = 0; i < stream; ++i)
+        rand_long_jump(&r);
+    return randn_split(&r);
+}
+
+/* steps all lanes once, out[lane] is what rand32_r would have returned
+   for that lane; every instruction set produces the same values */
+static void _rand_step_n(RandN *r, uint32_t out[RAND_LANES]) {
+#if defined(MATH_AVX2)
+    __m256i s0 = _mm256_loadu_si256((__m256i *)r->s[0]);
+    __m256i s1 = _mm256_loadu_si256((__m256i *)r->s[1]);
+    __m256i s2 = _mm256_loadu_si256((__m256i *)r->s[2]);
+    __m256i s3 = _mm256_loadu_si256((__m256i *)r->s[3]);
+    _mm256_storeu_si256((__m256i *)out, _mm256_add_epi32(s0, s3));
+    __m256i t = _mm256_slli_epi32(s1, 9);
+    s2 = _mm256_xor_si256(s2, s0);
+    s3 = _mm256_xor_si256(s3, s1);
+    s1 = _mm256_xor_si256(s1, s2);
+    s0 = _mm256_xor_si256(s0, s3);
+    s2 = _mm256_xor_si256(s2, t);
+    s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+    _mm256_storeu_si256((__m256i *)r->s[0], s0);
+    _mm256_storeu_si256((__m256i *)r->s[1], s1);
+    _mm256_storeu_si256((__m256i *)r->s[2], s2);
+    _mm256_storeu_si256((__m256i *)r->s[3], s3);
+#elif defined(MATH_SSE2)
+    for (int h = 0; h < RAND_LANES; h += 4) {
+        __m128i s0 = _mm_loadu_si128((__m128i *)(r->s[0] + h));
+        __m128i s1 = _mm_loadu_si128((__m128i *)(r->s[1] + h));
+        __m128i s2 = _mm_loadu_si128((__m128i *)(r->s[2] + h));
+        __m128i s3 = _mm_loadu_si128((__m128i *)(r->s[3] + h));
+        _mm_storeu_si128((__m128i *)(out + h), _mm_add_epi32(s0, s3));
+        __m128i t = _mm_slli_epi32(s1, 9);
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+        _mm_storeu_si128((__m128i *)(r->s[0] + h), s0);
+        _mm_storeu_si128((__m128i *)(r->s[1] + h), s1);
+        _mm_storeu_si128((__m128i *)(r->s[2] + h), s2);
+        _mm_storeu_si128((__m128i *)(r->s[3] + h), s3);
+    }
+#elif defined(MATH_NEON)
+    for (int h = 0; h < RAND_LANES; h += 4) {
+        uint32x4_t s0 = vld1q_u32(r->s[0] + h);
+        uint32x4_t s1 = vld1q_u32(r->s[1] + h);
+        uint32x4_t s2 = vld1q_u32(r->s[2] + h);
+        uint32x4_t s3 = vld1q_u32(r->s[3] + h);
+        vst1q_u32(out + h, vaddq_u32(s0, s3));
+        uint32x4_t t = vshlq_n_u32(s1, 9);
+        s2 = veorq_u32(s2, s0);
+        s3 = veorq_u32(s3, s1);
+        s1 = veorq_u32(s1, s2);
+        s0 = veorq_u32(s0, s3);
+        s2 = veorq_u32(s2, t);
+        s3 = vsriq_n_u32(vshlq_n_u32(s3, 11), s3, 21);
+        vst1q_u32(r->s[0] + h, s0);
+        vst1q_u32(r->s[1] + h, s1);
+        vst1q_u32(r->s[2] + h, s2);
+        vst1q_u32(r->s[3] + h, s3);
+    }
+#else
+    for (int lane = 0; lane < RAND_LANES; ++lane) {
+        Rand l = {{ r->s[0][lane], r->s[1][lane], r->s[2][lane], r->s[3][lane] }};
+        out[lane] = rand32_r(&l);
+        for (int k = 0; k < 4; ++k) r->s[k][lane] = l.s[k];
+    }
+#endif
+}
+
+/* lanes interleaved: out[i] comes from lane i % RAND_LANES. A partial
+   last step still advances every lane, the leftover values are dropped */
+static void rand32_n(RandN *r, uint32_t *out, size_t n) {
+    size_t i = 0;
+    for (; i + RAND_LANES <= n; i += RAND_LANES)
+        _rand_step_n(r, out + i);
+    if (i < n) {
+        uint32_t last[RAND_LANES];
+        _rand_step_n(r, last);
+        for (size_t k = 0; i + k < n; ++k) out[i + k] = last[k];
+    }
+}
+
+/* same mapping to [0, 1) as randf */
+static void randf_n(RandN *r, float *out, size_t n) {
+    size_t i = 0;
+    uint32_t bits[RAND_LANES];
+    for (; i < n; i += RAND_LANES) {
+        _rand_step_n(r, bits);
+        size_t count = m_min(n - i, (size_t)RAND_LANES);
+#if defined(MATH_AVX2)
+        if (count == RAND_LANES) {
+            __m256i v = _mm256_srli_epi32(_mm256_loadu_si256((__m256i *)bits), 8);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(0x1.0p-24f)));
+            continue;
+        }
+#elif defined(MATH_SSE2)
+        if (count == RAND_LANES) {
+            for (int h = 0; h < RAND_LANES; h += 4) {
+                __m128i v = _mm_srli_epi32(_mm_loadu_si128((__m128i *)(bits + h)), 8);
+                _mm_storeu_ps(out + i + h, _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(0x1.0p-24f)));
+            }
+            continue;
+        }
+#endif
+        for (size_t k = 0; k < count; ++k)
+            out[i + k] = (bits[k] >> 8) * 0x1.0p-24f;
+    }
+}
+
+/* IEEE half precision, rounded to nearest even; overflow gives inf and
+   nan stays nan. After ryg's float_to_half_fast3_rtne / half_to_float */
+static uint16_t f32_to_f16(float f) {
+    union { float f; uint32_t u; } v = { f };
+    uint32_t sign = (v.u >> 16) & 0x8000;
+    uint32_t u = v.u & 0x7FFFFFFF;
+    uint16_t h;
+    if (u >= 0x47800000) {
+        h = u > 0x7F800000 ? 0x7E00 : 0x7C00;
+    } else if (u < 0x38800000) {
+        /* subnormal or zero: let the FPU round by adding a magic number */
+        union { uint32_t u; float f; } magic = { 126u << 23 }, r = { u };
+        r.f += magic.f;
+        h = (uint16_t)(r.u - magic.u);
+    } else {
+        uint32_t mant_odd = (u >> 13) & 1;
+        u += (uint32_t)(15 - 127) << 23;
+        u += 0xFFF + mant_odd;
+        h = (uint16_t)(u >> 13);
+    }
+    return (uint16_t)(h | sign);
+}
+static float f16_to_f32(uint16_t h) {
+    union { uint32_t u; float f; } o, magic = { 113u << 23 };
+    o.u = (uint32_t)(h & 0x7FFF) << 13;
+    uint32_t exp = o.u & (0x7C00u << 13);
+    o.u += (uint32_t)(127 - 15) << 23;
+    if (exp == 0x7C00u << 13) {
+        o.u += (uint32_t)(128 - 16) << 23;
+    } else if (exp == 0) {
+        o.u += 1u << 23;
+        o.f -= magic.f;
+    }
+    o.u |= (uint32_t)(h & 0x8000) << 16;
+    return o.f;
+}
+static void f16_to_f32_n(const uint16_t *in, float *out, size_t n) {
+    size_t i = 0;
+#if defined(MATH_F16C)
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + i))));
+#elif defined(MATH_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(out + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(in + i))));
+#endif
+    for (; i < n; ++i)
+        out[i] = f16_to_f32(in[i]);
+}
+/* the hardware conversions round to nearest even too; only nan payloads
+   can differ from f32_to_f16 */
+static void f32_to_f16_n(const float *in, uint16_t *out, size_t n) {
+    size_t i = 0;
+#if defined(MATH_F16C)
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(MATH_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+    for (; i + 4 <= n; i += 4)
+        vst1_u16(out + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(in + i))));
+#endif
+    for (; i < n; ++i)
+        out[i] = f32_to_f16(in[i]);
+}
+
+/* R11G11B10F, the packed HDR format: unsigned floats with a 5 bit
+   exponent like half's and 6, 6 and 5 bits of mantissa, red in the low
+   bits. Negative values become 0. Packing rounds a half to nearest even,
+   so a float exactly between two packed values can round the wrong way */
+static uint32_t _f16_to_uf(uint16_t h, int shift) {
+    if (h & 0x8000) return 0;
+    if ((h & 0x7C00) == 0x7C00) return (uint32_t)(h >> shift) | ((h & 0x3FF) != 0);
+    /* a carry out of the mantissa bumps the exponent, up to inf */
+    return ((uint32_t)h + (1u << (shift - 1)) - 1 + ((h >> shift) & 1)) >> shift;
+}
+static uint32_t rg11b10_pack(Vec3 c) {
+    return _f16_to_uf(f32_to_f16(c.x), 4)
+         | _f16_to_uf(f32_to_f16(c.y), 4) << 11
+         | _f16_to_uf(f32_to_f16(c.z), 5) << 22;
+}
+static Vec3 rg11b10_unpack(uint32_t v) {
+    return (Vec3) {{
+        f16_to_f32((uint16_t)((v & 0x7FF) << 4)),
+        f16_to_f32((uint16_t)(((v >> 11) & 0x7FF) << 4)),
+        f16_to_f32((uint16_t)(((v >> 22) & 0x3FF) << 5)),
+    }};
+}
+/* n texels of interleaved rgba, alpha is dropped; goes through
+   f32_to_f16_n so the float conversion is vectorized */
+static void rg11b10_pack_n(const float *rgba, uint32_t *out, size_t n) {
+    uint16_t half[4 * 256];
+    for (size_t i = 0; i < n; i += 256) {
+        size_t count = m_min(n - i, (size_t)256);
+        f32_to_f16_n(rgba + 4 * i, half, 4 * count);
+        for (size_t j = 0; j < count; j++)
+            out[i + j] = _f16_to_uf(half[4 * j], 4)
+                       | _f16_to_uf(half[4 * j + 1], 4) << 11
+                       | _f16_to_uf(half[4 * j + 2], 5) << 22;
+    }
 }
 
 static Vec2 vec2(float x, float y) {
@@ -355,6 +718,92 @@ static Vec4 norm4(Vec4 a) {
   return div4_f(a, mag4(a));
 }
 
+/* Approximate 1/sqrt(x), opt-in so norm3 and everything built on it keep
+   their results.
+
+   SSE: hardware estimate (|rel err| <= 1.5 * 2^-12) plus one Newton step,
+   within 3e-7 relative of the exact value (bench=1 measures it). NEON's
+   estimate only has ~8 bits, so it takes two steps to get to about the
+   same. Without SIMD this is just 1.0f / sqrtf(x). x == 0 gives inf/nan
+   like the exact version would. */
+static float rsqrt_fast(float x) {
+#if defined(MATH_SSE)
+  float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+  return y * (1.5f - 0.5f * x * y * y);
+#elif defined(MATH_NEON)
+  float32x2_t v = vdup_n_f32(x);
+  float32x2_t y = vrsqrte_f32(v);
+  y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y));
+  y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y));
+  return vget_lane_f32(y, 0);
+#else
+  return 1.0f / sqrtf(x);
+#endif
+}
+
+/* norm3_fast_n per element, and what it is checked against. One vector
+   at a time this is no faster than norm3 (bench=1 has it at about 0.9x):
+   the estimate and its Newton step cost as much as the sqrt and divide
+   they replace. Only the batched form is worth choosing for speed */
+static Vec3 norm3_fast(Vec3 a) {
+  return mul3_f(a, rsqrt_fast(dot3(a, a)));
+}
+
+/* norm3_fast over a whole stream, bit-identical to calling it per
+   element without contraction (see the top of the file); only x, y and z
+   are read and written, in may equal out */
+static void norm3_fast_n(Vec4SoA in, Vec4SoA out, size_t n) {
+  size_t i = 0;
+#if defined(MATH_AVX)
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(in.x + i);
+    __m256 y = _mm256_loadu_ps(in.y + i);
+    __m256 z = _mm256_loadu_ps(in.z + i);
+    __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+    __m256 r = _mm256_rsqrt_ps(d);
+    __m256 t = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), d), r), r);
+    r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.5f), t));
+    _mm256_storeu_ps(out.x + i, _mm256_mul_ps(x, r));
+    _mm256_storeu_ps(out.y + i, _mm256_mul_ps(y, r));
+    _mm256_storeu_ps(out.z + i, _mm256_mul_ps(z, r));
+  }
+#endif
+#if defined(MATH_SSE)
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(in.x + i);
+    __m128 y = _mm_loadu_ps(in.y + i);
+    __m128 z = _mm_loadu_ps(in.z + i);
+    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    __m128 r = _mm_rsqrt_ps(d);
+    __m128 t = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), d), r), r);
+    r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), t));
+    _mm_storeu_ps(out.x + i, _mm_mul_ps(x, r));
+    _mm_storeu_ps(out.y + i, _mm_mul_ps(y, r));
+    _mm_storeu_ps(out.z + i, _mm_mul_ps(z, r));
+  }
+#elif defined(MATH_NEON)
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t x = vld1q_f32(in.x + i);
+    float32x4_t y = vld1q_f32(in.y + i);
+    float32x4_t z = vld1q_f32(in.z + i);
+    float32x4_t d = vaddq_f32(vaddq_f32(vmulq_f32(x, x), vmulq_f32(y, y)), vmulq_f32(z, z));
+    float32x4_t r = vrsqrteq_f32(d);
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d, r), r));
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d, r), r));
+    vst1q_f32(out.x + i, vmulq_f32(x, r));
+    vst1q_f32(out.y + i, vmulq_f32(y, r));
+    vst1q_f32(out.z + i, vmulq_f32(z, r));
+  }
+#endif
+  /* counted down for the same gcc warning as in rotate_quat3_n */
+  for (size_t left = n - i; left > 0; --left, ++i) {
+    Vec3 v = norm3_fast(vec3(in.x[i], in.y[i], in.z[i]));
+    out.x[i] = v.x;
+    out.y[i] = v.y;
+    out.z[i] = v.z;
+  }
+}
+
 static Vec2 abs2(Vec2 a) {
   return vec2(fabsf(a.x), fabsf(a.y));
 }
@@ -429,19 +878,20 @@ static Vec3 rand3(void) {
                 z               );
 }
 
-static Mat4 mul4x4(Mat4 a, Mat4 b) {
-  Mat4 out = {0};
-  int8_t k, r, c;
-  for (c = 0; c < 4; ++c)
-    for (r = 0; r < 4; ++r) {
-      out.nums[c][r] = 0.0f;
-      for (k = 0; k < 4; ++k)
-        out.nums[c][r] += a.nums[k][r] * b.nums[c][k];
+/* reference versions, the SIMD kernels below must match these bit for bit */
+static Mat4 mul4x4_scalar(Mat4 a, Mat4 b) {
+  Mat4 out;
+  for (int c = 0; c < 4; ++c)
+    for (int r = 0; r < 4; ++r) {
+      float sum = 0.0f;
+      for (int k = 0; k < 4; ++k)
+        sum += a.nums[k][r] * b.nums[c][k];
+      out.nums[c][r] = sum;
     }
   return out;
 }
 
-static Vec4 mul4x44(Mat4 m, Vec4 v) {
+static Vec4 mul4x44_scalar(Mat4 m, Vec4 v) {
   Vec4 res;
   for(int x = 0; x < 4; ++x) {
     float sum = 0;
@@ -453,6 +903,180 @@ static Vec4 mul4x44(Mat4 m, Vec4 v) {
   return res;
 }
 
+static Mat4 transpose4x4_scalar(Mat4 a) {
+  Mat4 res;
+  for(int c = 0; c < 4; ++c)
+    for(int r = 0; r < 4; ++r)
+      res.nums[r][c] = a.nums[c][r];
+  return res;
+}
+
+/* every output column is a linear combination of the columns of `a`;
+   the sum starts from zero just like the scalar loop, so -0.0 comes out
+   the same way too. With AVX enabled this is still the 128-bit kernel (VEX
+   encoded), handling two columns per 256-bit register needs in-lane
+   broadcasts that cost more than they save at this size */
+static Mat4 mul4x4(Mat4 a, Mat4 b) {
+#if defined(MATH_SSE)
+  Mat4 out;
+  __m128 a0 = _mm_loadu_ps(a.cols[0].nums);
+  __m128 a1 = _mm_loadu_ps(a.cols[1].nums);
+  __m128 a2 = _mm_loadu_ps(a.cols[2].nums);
+  __m128 a3 = _mm_loadu_ps(a.cols[3].nums);
+  for (int c = 0; c < 4; ++c) {
+    __m128 sum = _mm_setzero_ps();
+    sum = _mm_add_ps(sum, _mm_mul_ps(a0, _mm_set1_ps(b.nums[c][0])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(b.nums[c][1])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(b.nums[c][2])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(b.nums[c][3])));
+    _mm_storeu_ps(out.nums[c], sum);
+  }
+  return out;
+#elif defined(MATH_NEON)
+  Mat4 out;
+  float32x4_t a0 = vld1q_f32(a.cols[0].nums);
+  float32x4_t a1 = vld1q_f32(a.cols[1].nums);
+  float32x4_t a2 = vld1q_f32(a.cols[2].nums);
+  float32x4_t a3 = vld1q_f32(a.cols[3].nums);
+  for (int c = 0; c < 4; ++c) {
+    float32x4_t sum = vdupq_n_f32(0.0f);
+    sum = vaddq_f32(sum, vmulq_n_f32(a0, b.nums[c][0]));
+    sum = vaddq_f32(sum, vmulq_n_f32(a1, b.nums[c][1]));
+    sum = vaddq_f32(sum, vmulq_n_f32(a2, b.nums[c][2]));
+    sum = vaddq_f32(sum, vmulq_n_f32(a3, b.nums[c][3]));
+    vst1q_f32(out.nums[c], sum);
+  }
+  return out;
+#else
+  return mul4x4_scalar(a, b);
+#endif
+}
+
+static Vec4 mul4x44(Mat4 m, Vec4 v) {
+#if defined(MATH_SSE)
+  Vec4 res;
+  __m128 sum = _mm_setzero_ps();
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(m.cols[0].nums), _mm_set1_ps(v.x)));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(m.cols[1].nums), _mm_set1_ps(v.y)));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(m.cols[2].nums), _mm_set1_ps(v.z)));
+  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(m.cols[3].nums), _mm_set1_ps(v.w)));
+  _mm_storeu_ps(res.nums, sum);
+  return res;
+#elif defined(MATH_NEON)
+  Vec4 res;
+  float32x4_t sum = vdupq_n_f32(0.0f);
+  sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(m.cols[0].nums), v.x));
+  sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(m.cols[1].nums), v.y));
+  sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(m.cols[2].nums), v.z));
+  sum = vaddq_f32(sum, vmulq_n_f32(vld1q_f32(m.cols[3].nums), v.w));
+  vst1q_f32(res.nums, sum);
+  return res;
+#else
+  return mul4x44_scalar(m, v);
+#endif
+}
+
+/* out[i] = a[i] * b[i]; out may alias a or b */
+static void mul4x4_n(const Mat4 *a, const Mat4 *b, Mat4 *out, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+#if defined(MATH_SSE)
+    __m128 a0 = _mm_loadu_ps(a[i].cols[0].nums);
+    __m128 a1 = _mm_loadu_ps(a[i].cols[1].nums);
+    __m128 a2 = _mm_loadu_ps(a[i].cols[2].nums);
+    __m128 a3 = _mm_loadu_ps(a[i].cols[3].nums);
+    for (int c = 0; c < 4; ++c) {
+      __m128 sum = _mm_setzero_ps();
+      sum = _mm_add_ps(sum, _mm_mul_ps(a0, _mm_set1_ps(b[i].nums[c][0])));
+      sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_set1_ps(b[i].nums[c][1])));
+      sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_set1_ps(b[i].nums[c][2])));
+      sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_set1_ps(b[i].nums[c][3])));
+      _mm_storeu_ps(out[i].nums[c], sum);
+    }
+#elif defined(MATH_NEON)
+    float32x4_t a0 = vld1q_f32(a[i].cols[0].nums);
+    float32x4_t a1 = vld1q_f32(a[i].cols[1].nums);
+    float32x4_t a2 = vld1q_f32(a[i].cols[2].nums);
+    float32x4_t a3 = vld1q_f32(a[i].cols[3].nums);
+    for (int c = 0; c < 4; ++c) {
+      float32x4_t sum = vdupq_n_f32(0.0f);
+      sum = vaddq_f32(sum, vmulq_n_f32(a0, b[i].nums[c][0]));
+      sum = vaddq_f32(sum, vmulq_n_f32(a1, b[i].nums[c][1]));
+      sum = vaddq_f32(sum, vmulq_n_f32(a2, b[i].nums[c][2]));
+      sum = vaddq_f32(sum, vmulq_n_f32(a3, b[i].nums[c][3]));
+      vst1q_f32(out[i].nums[c], sum);
+    }
+#else
+    out[i] = mul4x4_scalar(a[i], b[i]);
+#endif
+  }
+}
+
+/* out = m * in for a whole stream, one lane per element; the sums are
+   ordered like mul4x44_scalar so every element matches it bit for bit */
+static void mul4x44_n(Mat4 m, Vec4SoA in, Vec4SoA out, size_t n) {
+  size_t i = 0;
+#if defined(MATH_AVX)
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(in.x + i);
+    __m256 y = _mm256_loadu_ps(in.y + i);
+    __m256 z = _mm256_loadu_ps(in.z + i);
+    __m256 w = in.w ? _mm256_loadu_ps(in.w + i) : _mm256_set1_ps(1.0f);
+    float *dst[4] = { out.x, out.y, out.z, out.w };
+    for (int r = 0; r < 4; ++r) {
+      if (!dst[r]) continue;
+      __m256 sum = _mm256_setzero_ps();
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m.nums[0][r]), x));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m.nums[1][r]), y));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m.nums[2][r]), z));
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m.nums[3][r]), w));
+      _mm256_storeu_ps(dst[r] + i, sum);
+    }
+  }
+#endif
+#if defined(MATH_SSE)
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(in.x + i);
+    __m128 y = _mm_loadu_ps(in.y + i);
+    __m128 z = _mm_loadu_ps(in.z + i);
+    __m128 w = in.w ? _mm_loadu_ps(in.w + i) : _mm_set1_ps(1.0f);
+    float *dst[4] = { out.x, out.y, out.z, out.w };
+    for (int r = 0; r < 4; ++r) {
+      if (!dst[r]) continue;
+      __m128 sum = _mm_setzero_ps();
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m.nums[0][r]), x));
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m.nums[1][r]), y));
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m.nums[2][r]), z));
+      sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m.nums[3][r]), w));
+      _mm_storeu_ps(dst[r] + i, sum);
+    }
+  }
+#elif defined(MATH_NEON)
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t x = vld1q_f32(in.x + i);
+    float32x4_t y = vld1q_f32(in.y + i);
+    float32x4_t z = vld1q_f32(in.z + i);
+    float32x4_t w = in.w ? vld1q_f32(in.w + i) : vdupq_n_f32(1.0f);
+    float *dst[4] = { out.x, out.y, out.z, out.w };
+    for (int r = 0; r < 4; ++r) {
+      if (!dst[r]) continue;
+      float32x4_t sum = vdupq_n_f32(0.0f);
+      sum = vaddq_f32(sum, vmulq_n_f32(x, m.nums[0][r]));
+      sum = vaddq_f32(sum, vmulq_n_f32(y, m.nums[1][r]));
+      sum = vaddq_f32(sum, vmulq_n_f32(z, m.nums[2][r]));
+      sum = vaddq_f32(sum, vmulq_n_f32(w, m.nums[3][r]));
+      vst1q_f32(dst[r] + i, sum);
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    Vec4 v = mul4x44_scalar(m, vec4(in.x[i], in.y[i], in.z[i], in.w ? in.w[i] : 1.0f));
+    out.x[i] = v.x;
+    out.y[i] = v.y;
+    out.z[i] = v.z;
+    if (out.w) out.w[i] = v.w;
+  }
+}
+
 static Mat4 scale4x4(Vec3 v) {
   Mat4 res = {0};
   res.nums[0][0] = v.x;
@@ -464,11 +1088,29 @@ static Mat4 scale4x4(Vec3 v) {
 static Mat4 ident4x4() { return scale4x4(vec3_f(1.0)); }
 
 static Mat4 transpose4x4(Mat4 a) {
+#if defined(MATH_SSE)
+  __m128 c0 = _mm_loadu_ps(a.cols[0].nums);
+  __m128 c1 = _mm_loadu_ps(a.cols[1].nums);
+  __m128 c2 = _mm_loadu_ps(a.cols[2].nums);
+  __m128 c3 = _mm_loadu_ps(a.cols[3].nums);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
   Mat4 res;
-  for(int c = 0; c < 4; ++c)
-    for(int r = 0; r < 4; ++r)
-      res.nums[r][c] = a.nums[c][r];
+  _mm_storeu_ps(res.cols[0].nums, c0);
+  _mm_storeu_ps(res.cols[1].nums, c1);
+  _mm_storeu_ps(res.cols[2].nums, c2);
+  _mm_storeu_ps(res.cols[3].nums, c3);
+  return res;
+#elif defined(MATH_NEON)
+  float32x4x4_t m = vld4q_f32(a.nums[0]);
+  Mat4 res;
+  vst1q_f32(res.cols[0].nums, m.val[0]);
+  vst1q_f32(res.cols[1].nums, m.val[1]);
+  vst1q_f32(res.cols[2].nums, m.val[2]);
+  vst1q_f32(res.cols[3].nums, m.val[3]);
   return res;
+#else
+  return transpose4x4_scalar(a);
+#endif
 }
 
 static Mat4 translate4x4(Vec3 pos) {
@@ -575,6 +1217,177 @@ static Mat4 look_at4x4(Vec3 eye, Vec3 focus, Vec3 up) {
   }};
 }
 
+/* inverse of a rotation + translation, e.g. anything from look_at4x4 */
+static Mat4 inverse_rigid4x4(Mat4 m) {
+  Vec3 t = vec3(m.w.x, m.w.y, m.w.z);
+  return (Mat4) {{
+    { m.x.x, m.y.x, m.z.x, 0.0f },
+    { m.x.y, m.y.y, m.z.y, 0.0f },
+    { m.x.z, m.y.z, m.z.z, 0.0f },
+    { -dot3(vec3(m.x.x, m.x.y, m.x.z), t),
+      -dot3(vec3(m.y.x, m.y.y, m.y.z), t),
+      -dot3(vec3(m.z.x, m.z.y, m.z.z), t), 1.0f }
+  }};
+}
+/* inverse of a matrix from perspective4x4, only the five
+   non-zero entries take part, so no general inverse is needed.
+   All four reciprocals come out of a single divide */
+static Mat4 inverse_perspective4x4(Mat4 p) {
+  float a = p.nums[0][0], b = p.nums[1][1];
+  float c = p.nums[2][2], d = p.nums[3][2], e = p.nums[2][3];
+  float ab = a * b, de = d * e;
+  float r = 1.0f / (ab * de);
+  float inv_ab = de * r, inv_de = ab * r;
+
+  return (Mat4) {{
+    { b * inv_ab, 0.0f, 0.0f, 0.0f },
+    { 0.0f, a * inv_ab, 0.0f, 0.0f },
+    { 0.0f, 0.0f, 0.0f, e * inv_de },
+    { 0.0f, 0.0f, d * inv_de, -c * inv_de }
+  }};
+}
+
+/* general inverse from the 2x2 sub-determinants of the top and bottom
+   halves. A singular matrix gives infs/nans, check the determinant first
+   if that can happen. Since inverse(transpose(m)) == transpose(inverse(m))
+   it doesn't matter that nums[] is indexed column first here */
+static Mat4 inverse4x4_scalar(Mat4 m) {
+  float (*a)[4] = m.nums;
+  float s0 = a[0][0]*a[1][1] - a[1][0]*a[0][1];
+  float s1 = a[0][0]*a[1][2] - a[1][0]*a[0][2];
+  float s2 = a[0][0]*a[1][3] - a[1][0]*a[0][3];
+  float s3 = a[0][1]*a[1][2] - a[1][1]*a[0][2];
+  float s4 = a[0][1]*a[1][3] - a[1][1]*a[0][3];
+  float s5 = a[0][2]*a[1][3] - a[1][2]*a[0][3];
+  float c5 = a[2][2]*a[3][3] - a[3][2]*a[2][3];
+  float c4 = a[2][1]*a[3][3] - a[3][1]*a[2][3];
+  float c3 = a[2][1]*a[3][2] - a[3][1]*a[2][2];
+  float c2 = a[2][0]*a[3][3] - a[3][0]*a[2][3];
+  float c1 = a[2][0]*a[3][2] - a[3][0]*a[2][2];
+  float c0 = a[2][0]*a[3][1] - a[3][0]*a[2][1];
+  float inv = 1.0f / (s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0);
+
+  Mat4 res;
+  res.nums[0][0] = ( a[1][1]*c5 - a[1][2]*c4 + a[1][3]*c3) * inv;
+  res.nums[0][1] = (-a[0][1]*c5 + a[0][2]*c4 - a[0][3]*c3) * inv;
+  res.nums[0][2] = ( a[3][1]*s5 - a[3][2]*s4 + a[3][3]*s3) * inv;
+  res.nums[0][3] = (-a[2][1]*s5 + a[2][2]*s4 - a[2][3]*s3) * inv;
+  res.nums[1][0] = (-a[1][0]*c5 + a[1][2]*c2 - a[1][3]*c1) * inv;
+  res.nums[1][1] = ( a[0][0]*c5 - a[0][2]*c2 + a[0][3]*c1) * inv;
+  res.nums[1][2] = (-a[3][0]*s5 + a[3][2]*s2 - a[3][3]*s1) * inv;
+  res.nums[1][3] = ( a[2][0]*s5 - a[2][2]*s2 + a[2][3]*s1) * inv;
+  res.nums[2][0] = ( a[1][0]*c4 - a[1][1]*c2 + a[1][3]*c0) * inv;
+  res.nums[2][1] = (-a[0][0]*c4 + a[0][1]*c2 - a[0][3]*c0) * inv;
+  res.nums[2][2] = ( a[3][0]*s4 - a[3][1]*s2 + a[3][3]*s0) * inv;
+  res.nums[2][3] = (-a[2][0]*s4 + a[2][1]*s2 - a[2][3]*s0) * inv;
+  res.nums[3][0] = (-a[1][0]*c3 + a[1][1]*c1 - a[1][2]*c0) * inv;
+  res.nums[3][1] = ( a[0][0]*c3 - a[0][1]*c1 + a[0][2]*c0) * inv;
+  res.nums[3][2] = (-a[3][0]*s3 + a[3][1]*s1 - a[3][2]*s0) * inv;
+  res.nums[3][3] = ( a[2][0]*s3 - a[2][1]*s1 + a[2][2]*s0) * inv;
+  return res;
+}
+
+#if defined(MATH_SSE)
+#define _math_shuffle(a, b, x, y, z, w) _mm_shuffle_ps((a), (b), _MM_SHUFFLE(w, z, y, x))
+#define _math_swizzle(a, x, y, z, w)    _math_shuffle(a, a, x, y, z, w)
+
+/* 2x2 blocks packed as (m00, m01, m10, m11): a*b, adj(a)*b, a*adj(b) */
+static inline __m128 _math_mat2_mul(__m128 a, __m128 b) {
+  return _mm_add_ps(_mm_mul_ps(a, _math_swizzle(b, 0,3,0,3)),
+                    _mm_mul_ps(_math_swizzle(a, 1,0,3,2), _math_swizzle(b, 2,1,2,1)));
+}
+static inline __m128 _math_mat2_adj_mul(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(_math_swizzle(a, 3,3,0,0), b),
+                    _mm_mul_ps(_math_swizzle(a, 1,1,2,2), _math_swizzle(b, 2,3,0,1)));
+}
+static inline __m128 _math_mat2_mul_adj(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(a, _math_swizzle(b, 3,0,3,0)),
+                    _mm_mul_ps(_math_swizzle(a, 1,0,3,2), _math_swizzle(b, 2,1,2,1)));
+}
+#endif
+
+/* the same inverse done blockwise: with m = | A B | the four 2x2
+                                             | C D |
+   adjugate blocks and the determinant all come out of 2x2 products, which
+   map onto four-wide registers without any horizontal work except one
+   trace. Rounding differs slightly from the scalar version, both are
+   around 1e-6 relative error on well-conditioned input (bench=1 checks
+   against a double precision inverse). NEON builds use the scalar code */
+static Mat4 inverse4x4(Mat4 m) {
+#if defined(MATH_SSE)
+  __m128 c0 = _mm_loadu_ps(m.cols[0].nums);
+  __m128 c1 = _mm_loadu_ps(m.cols[1].nums);
+  __m128 c2 = _mm_loadu_ps(m.cols[2].nums);
+  __m128 c3 = _mm_loadu_ps(m.cols[3].nums);
+
+  __m128 A = _mm_movelh_ps(c0, c1);
+  __m128 B = _mm_movehl_ps(c1, c0);
+  __m128 C = _mm_movelh_ps(c2, c3);
+  __m128 D = _mm_movehl_ps(c3, c2);
+
+  /* (|A|, |B|, |C|, |D|) */
+  __m128 det_sub = _mm_sub_ps(
+    _mm_mul_ps(_math_shuffle(c0, c2, 0,2,0,2), _math_shuffle(c1, c3, 1,3,1,3)),
+    _mm_mul_ps(_math_shuffle(c0, c2, 1,3,1,3), _math_shuffle(c1, c3, 0,2,0,2)));
+  __m128 det_a = _math_swizzle(det_sub, 0,0,0,0);
+  __m128 det_b = _math_swizzle(det_sub, 1,1,1,1);
+  __m128 det_c = _math_swizzle(det_sub, 2,2,2,2);
+  __m128 det_d = _math_swizzle(det_sub, 3,3,3,3);
+
+  __m128 d_c = _math_mat2_adj_mul(D, C);
+  __m128 a_b = _math_mat2_adj_mul(A, B);
+  __m128 x = _mm_sub_ps(_mm_mul_ps(det_d, A), _math_mat2_mul(B, d_c));
+  __m128 w = _mm_sub_ps(_mm_mul_ps(det_a, D), _math_mat2_mul(C, a_b));
+  __m128 y = _mm_sub_ps(_mm_mul_ps(det_b, C), _math_mat2_mul_adj(D, a_b));
+  __m128 z = _mm_sub_ps(_mm_mul_ps(det_c, B), _math_mat2_mul_adj(A, d_c));
+
+  /* |m| = |A||D| + |B||C| - tr(adj(A)B adj(D)C) */
+  __m128 tr = _mm_mul_ps(a_b, _math_swizzle(d_c, 0,2,1,3));
+  tr = _mm_add_ps(tr, _math_swizzle(tr, 2,3,0,1));
+  tr = _mm_add_ps(tr, _math_swizzle(tr, 1,0,3,2));
+  __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+  __m128 rdet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+
+  x = _mm_mul_ps(x, rdet);
+  y = _mm_mul_ps(y, rdet);
+  z = _mm_mul_ps(z, rdet);
+  w = _mm_mul_ps(w, rdet);
+
+  /* the adjugate's swap and the block layout undone in one shuffle each */
+  Mat4 res;
+  _mm_storeu_ps(res.cols[0].nums, _math_shuffle(x, y, 3,1,3,1));
+  _mm_storeu_ps(res.cols[1].nums, _math_shuffle(x, y, 2,0,2,0));
+  _mm_storeu_ps(res.cols[2].nums, _math_shuffle(z, w, 3,1,3,1));
+  _mm_storeu_ps(res.cols[3].nums, _math_shuffle(z, w, 2,0,2,0));
+  return res;
+#else
+  return inverse4x4_scalar(m);
+#endif
+}
+
+/* inverse of any matrix whose last row is (0, 0, 0, 1): rotation, scale,
+   shear plus translation. The 3x3 part is inverted through cross products */
+static Mat4 inverse_affine4x4(Mat4 m) {
+  Vec3 a = vec3(m.x.x, m.x.y, m.x.z);
+  Vec3 b = vec3(m.y.x, m.y.y, m.y.z);
+  Vec3 c = vec3(m.z.x, m.z.y, m.z.z);
+  Vec3 r0 = cross3(b, c);
+  Vec3 r1 = cross3(c, a);
+  Vec3 r2 = cross3(a, b);
+  float inv = 1.0f / dot3(a, r0);
+  r0 = mul3_f(r0, inv);
+  r1 = mul3_f(r1, inv);
+  r2 = mul3_f(r2, inv);
+
+  Vec3 t = vec3(m.w.x, m.w.y, m.w.z);
+  return (Mat4) {{
+    { r0.x, r1.x, r2.x, 0.0f },
+    { r0.y, r1.y, r2.y, 0.0f },
+    { r0.z, r1.z, r2.z, 0.0f },
+    { -dot3(r0, t), -dot3(r1, t), -dot3(r2, t), 1.0f }
+  }};
+}
+
 static Mat4 ortho4x4(
   float view_width,
   float view_height,
@@ -604,6 +1417,197 @@ static Mat4 shear2d4x4(float x, float y) {
   }};
 }
 
+static Quaternion quat(float x, float y, float z, float w) {
+  return (Quaternion) { .elements = { x, y, z, w } };
+}
+
+static Quaternion quat_ident(void) { return quat(0.0f, 0.0f, 0.0f, 1.0f); }
+
+static Quaternion axis_angle_quat(Vec3 axis, float angle) {
+  Vec3 v = mul3_f(norm3(axis), sinf(angle * 0.5f));
+  return quat(v.x, v.y, v.z, cosf(angle * 0.5f));
+}
+
+/* rotating by the result rotates by b first, then by a;
+   quat_to4x4(mul_quat(a, b)) == mul4x4(quat_to4x4(a), quat_to4x4(b)) */
+static Quaternion mul_quat(Quaternion a, Quaternion b) {
+  return quat(a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y,
+              a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x,
+              a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w,
+              a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z);
+}
+
+/* the inverse, for unit quaternions */
+static Quaternion conj_quat(Quaternion q) { return quat(-q.x, -q.y, -q.z, q.w); }
+
+static float dot_quat(Quaternion a, Quaternion b) {
+  return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+}
+
+static Quaternion norm_quat(Quaternion q) {
+  float inv = 1.0f / sqrtf(dot_quat(q, q));
+  return quat(q.x*inv, q.y*inv, q.z*inv, q.w*inv);
+}
+
+/* both interpolations take the short way around */
+static Quaternion nlerp_quat(Quaternion a, Quaternion b, float t) {
+  float s = dot_quat(a, b) < 0.0f ? -t : t;
+  return norm_quat(quat(a.x + (b.x*s - a.x*t),
+                        a.y + (b.y*s - a.y*t),
+                        a.z + (b.z*s - a.z*t),
+                        a.w + (b.w*s - a.w*t)));
+}
+
+/* constant angular velocity; nearly parallel inputs fall back to nlerp,
+   where sinf(theta) is too small to divide by and the two agree anyway */
+static Quaternion slerp_quat(Quaternion a, Quaternion b, float t) {
+  float d = dot_quat(a, b);
+  float sign = 1.0f;
+  if (d < 0.0f) {
+    d = -d;
+    sign = -1.0f;
+  }
+  if (d > 0.9995f) return nlerp_quat(a, b, t);
+
+  float theta = acosf(d);
+  float inv_sin = 1.0f / sinf(theta);
+  float wa = sinf((1.0f - t) * theta) * inv_sin;
+  float wb = sinf(t * theta) * inv_sin * sign;
+  return quat(a.x*wa + b.x*wb, a.y*wa + b.y*wb, a.z*wa + b.z*wb, a.w*wa + b.w*wb);
+}
+
+static Mat4 quat_to4x4(Quaternion q) {
+  float xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z;
+  float xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+  float wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+  return (Mat4) {{
+    { 1.0f - 2.0f*(yy + zz),        2.0f*(xy + wz),        2.0f*(xz - wy), 0.0f },
+    {        2.0f*(xy - wz), 1.0f - 2.0f*(xx + zz),        2.0f*(yz + wx), 0.0f },
+    {        2.0f*(xz + wy),        2.0f*(yz - wx), 1.0f - 2.0f*(xx + yy), 0.0f },
+    {                  0.0f,                  0.0f,                  0.0f, 1.0f }
+  }};
+}
+
+/* the rotation part of m, which must not be scaled. Shepperd's method:
+   the square root is taken of whichever component is largest, so it
+   never divides by something close to zero */
+static Quaternion quat_from4x4(Mat4 m) {
+  float m00 = m.nums[0][0], m11 = m.nums[1][1], m22 = m.nums[2][2];
+  float trace = m00 + m11 + m22;
+  if (trace > 0.0f) {
+    float s = sqrtf(trace + 1.0f) * 2.0f, inv = 1.0f / s;
+    return quat((m.nums[1][2] - m.nums[2][1]) * inv,
+                (m.nums[2][0] - m.nums[0][2]) * inv,
+                (m.nums[0][1] - m.nums[1][0]) * inv,
+                s * 0.25f);
+  }
+  if (m00 > m11 && m00 > m22) {
+    float s = sqrtf(1.0f + m00 - m11 - m22) * 2.0f, inv = 1.0f / s;
+    return quat(s * 0.25f,
+                (m.nums[1][0] + m.nums[0][1]) * inv,
+                (m.nums[2][0] + m.nums[0][2]) * inv,
+                (m.nums[1][2] - m.nums[2][1]) * inv);
+  }
+  if (m11 > m22) {
+    float s = sqrtf(1.0f + m11 - m00 - m22) * 2.0f, inv = 1.0f / s;
+    return quat((m.nums[1][0] + m.nums[0][1]) * inv,
+                s * 0.25f,
+                (m.nums[2][1] + m.nums[1][2]) * inv,
+                (m.nums[2][0] - m.nums[0][2]) * inv);
+  }
+  float s = sqrtf(1.0f + m22 - m00 - m11) * 2.0f, inv = 1.0f / s;
+  return quat((m.nums[2][0] + m.nums[0][2]) * inv,
+              (m.nums[2][1] + m.nums[1][2]) * inv,
+              s * 0.25f,
+              (m.nums[0][1] - m.nums[1][0]) * inv);
+}
+
+/* v + w*t + q.xyz x t with t = 2 * (q.xyz x v), fewer operations than
+   going through a matrix for a single vector */
+static Vec3 rotate_quat3(Quaternion q, Vec3 v) {
+  float tx = 2.0f * (q.y*v.z - q.z*v.y);
+  float ty = 2.0f * (q.z*v.x - q.x*v.z);
+  float tz = 2.0f * (q.x*v.y - q.y*v.x);
+  return vec3(v.x + (q.w*tx + (q.y*tz - q.z*ty)),
+              v.y + (q.w*ty + (q.z*tx - q.x*tz)),
+              v.z + (q.w*tz + (q.x*ty - q.y*tx)));
+}
+
+/* rotate_quat3 over a whole stream, bit-identical to calling it per
+   element without contraction (see the top of the file);
+   only x, y and z are read and written */
+static void rotate_quat3_n(Quaternion q, Vec4SoA in, Vec4SoA out, size_t n) {
+  size_t i = 0;
+#if defined(MATH_AVX)
+  {
+    __m256 qx = _mm256_set1_ps(q.x), qy = _mm256_set1_ps(q.y);
+    __m256 qz = _mm256_set1_ps(q.z), qw = _mm256_set1_ps(q.w);
+    __m256 two = _mm256_set1_ps(2.0f);
+    for (; i + 8 <= n; i += 8) {
+      __m256 x = _mm256_loadu_ps(in.x + i);
+      __m256 y = _mm256_loadu_ps(in.y + i);
+      __m256 z = _mm256_loadu_ps(in.z + i);
+      __m256 tx = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(qy, z), _mm256_mul_ps(qz, y)));
+      __m256 ty = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(qz, x), _mm256_mul_ps(qx, z)));
+      __m256 tz = _mm256_mul_ps(two, _mm256_sub_ps(_mm256_mul_ps(qx, y), _mm256_mul_ps(qy, x)));
+      _mm256_storeu_ps(out.x + i, _mm256_add_ps(x, _mm256_add_ps(_mm256_mul_ps(qw, tx),
+        _mm256_sub_ps(_mm256_mul_ps(qy, tz), _mm256_mul_ps(qz, ty)))));
+      _mm256_storeu_ps(out.y + i, _mm256_add_ps(y, _mm256_add_ps(_mm256_mul_ps(qw, ty),
+        _mm256_sub_ps(_mm256_mul_ps(qz, tx), _mm256_mul_ps(qx, tz)))));
+      _mm256_storeu_ps(out.z + i, _mm256_add_ps(z, _mm256_add_ps(_mm256_mul_ps(qw, tz),
+        _mm256_sub_ps(_mm256_mul_ps(qx, ty), _mm256_mul_ps(qy, tx)))));
+    }
+  }
+#endif
+#if defined(MATH_SSE)
+  {
+    __m128 qx = _mm_set1_ps(q.x), qy = _mm_set1_ps(q.y);
+    __m128 qz = _mm_set1_ps(q.z), qw = _mm_set1_ps(q.w);
+    __m128 two = _mm_set1_ps(2.0f);
+    for (; i + 4 <= n; i += 4) {
+      __m128 x = _mm_loadu_ps(in.x + i);
+      __m128 y = _mm_loadu_ps(in.y + i);
+      __m128 z = _mm_loadu_ps(in.z + i);
+      __m128 tx = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qy, z), _mm_mul_ps(qz, y)));
+      __m128 ty = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qz, x), _mm_mul_ps(qx, z)));
+      __m128 tz = _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(qx, y), _mm_mul_ps(qy, x)));
+      _mm_storeu_ps(out.x + i, _mm_add_ps(x, _mm_add_ps(_mm_mul_ps(qw, tx),
+        _mm_sub_ps(_mm_mul_ps(qy, tz), _mm_mul_ps(qz, ty)))));
+      _mm_storeu_ps(out.y + i, _mm_add_ps(y, _mm_add_ps(_mm_mul_ps(qw, ty),
+        _mm_sub_ps(_mm_mul_ps(qz, tx), _mm_mul_ps(qx, tz)))));
+      _mm_storeu_ps(out.z + i, _mm_add_ps(z, _mm_add_ps(_mm_mul_ps(qw, tz),
+        _mm_sub_ps(_mm_mul_ps(qx, ty), _mm_mul_ps(qy, tx)))));
+    }
+  }
+#elif defined(MATH_NEON)
+  {
+    float32x4_t two = vdupq_n_f32(2.0f);
+    for (; i + 4 <= n; i += 4) {
+      float32x4_t x = vld1q_f32(in.x + i);
+      float32x4_t y = vld1q_f32(in.y + i);
+      float32x4_t z = vld1q_f32(in.z + i);
+      float32x4_t tx = vmulq_f32(two, vsubq_f32(vmulq_n_f32(z, q.y), vmulq_n_f32(y, q.z)));
+      float32x4_t ty = vmulq_f32(two, vsubq_f32(vmulq_n_f32(x, q.z), vmulq_n_f32(z, q.x)));
+      float32x4_t tz = vmulq_f32(two, vsubq_f32(vmulq_n_f32(y, q.x), vmulq_n_f32(x, q.y)));
+      vst1q_f32(out.x + i, vaddq_f32(x, vaddq_f32(vmulq_n_f32(tx, q.w),
+        vsubq_f32(vmulq_n_f32(tz, q.y), vmulq_n_f32(ty, q.z)))));
+      vst1q_f32(out.y + i, vaddq_f32(y, vaddq_f32(vmulq_n_f32(ty, q.w),
+        vsubq_f32(vmulq_n_f32(tx, q.z), vmulq_n_f32(tz, q.x)))));
+      vst1q_f32(out.z + i, vaddq_f32(z, vaddq_f32(vmulq_n_f32(tz, q.w),
+        vsubq_f32(vmulq_n_f32(ty, q.x), vmulq_n_f32(tx, q.y)))));
+    }
+  }
+#endif
+  /* counted down, with `i < n` gcc 12 -O2 wrongly warns about overflow
+     once n is a known multiple of four */
+  for (size_t left = n - i; left > 0; --left, ++i) {
+    Vec3 v = rotate_quat3(q, vec3(in.x[i], in.y[i], in.z[i]));
+    out.x[i] = v.x;
+    out.y[i] = v.y;
+    out.z[i] = v.z;
+  }
+}
+
 #endif
 #endif
 #endif
@@ -0,0 +1,364 @@
+#ifndef _NOISE_H_
+
+#define _NOISE_H_
+
+/* Composable noise for sky bakes.
+
+   A NoiseGraph is built from sources (simplex, animated simplex, Worley)
+   and nodes that combine them: warp, sum, mul, abs and remap. Nodes are
+   plain indices and can only refer to nodes created before them, so a
+   graph is always in evaluation order. A node that couldn't be added is
+   -1, and anything built on it is -1 as well.
+
+   noise_compile() flattens what the output depends on into a list of
+   instructions over batch registers, reusing a register once its value
+   is dead. noise_eval() runs the list over NOISE_BATCH directions at a
+   time, every instruction being one tight loop or one batched sampler
+   call, so the graph costs nothing per texel beyond the arithmetic.
+
+   A warp evaluates its source at displaced coordinates. Sources under a
+   warp are emitted once per set of coordinates they are needed at.
+
+   noise_eval() gives the same bits as the graph written out as nested
+   sampler calls per texel, when built without FP contraction like the
+   batched kernels in math.h. */
+
+#include <stdbool.h>
+#include <string.h>
+
+#define NOISE_MAX_NODES (64)
+#define NOISE_MAX_INSTS (128)
+#define NOISE_MAX_REGS (16)
+#define NOISE_MAX_COORDS (4)
+#define NOISE_BATCH (256)
+
+typedef enum {
+  NOISE_SIMPLEX,              /* amp * sn3(p*freq + offset) */
+  NOISE_SIMPLEX4,             /* amp * sn4(p*freq + offset, time*speed) */
+  NOISE_WORLEY,               /* amp * F1, F2 or F2-F1 of worley3(p*freq + offset) */
+  NOISE_WARP,                 /* a at p + strength * (b, c, d) */
+  NOISE_SUM,                  /* a + b */
+  NOISE_MUL,                  /* a * b */
+  NOISE_ABS,                  /* |a| */
+  NOISE_REMAP,                /* clamp(a*scale + bias, lo, hi) */
+} NoiseOp;
+
+typedef enum {
+  NOISE_F1,
+  NOISE_F2,
+  NOISE_F2_F1,
+} NoiseFeature;
+
+typedef struct {
+  NoiseOp op;
+  int a, b, c, d;             /* input nodes */
+  float k[4];                 /* freq, amp, offset, speed or feature; strength; scale, bias, lo, hi */
+} NoiseNode;
+
+typedef struct {
+  NoiseNode nodes[NOISE_MAX_NODES];
+  int count;
+} NoiseGraph;
+
+/* sources read coordinate register a, warps write coordinate register dst */
+typedef struct {
+  NoiseOp op;
+  int dst, a, b, c, d;
+  float k[4];
+} NoiseInst;
+
+typedef struct {
+  NoiseInst insts[NOISE_MAX_INSTS];
+  int count;
+  int out;                    /* register holding the result */
+  float time;                 /* read by NOISE_SIMPLEX4 */
+} NoiseProgram;
+
+static int noise_simplex(NoiseGraph *g, float freq, float amp, float offset);
+static int noise_simplex4(NoiseGraph *g, float freq, float amp, float offset, float speed);
+static int noise_worley(NoiseGraph *g, NoiseFeature feature, float freq, float amp, float offset);
+static int noise_warp(NoiseGraph *g, int src, int x, int y, int z, float strength);
+static int noise_sum(NoiseGraph *g, int a, int b);
+static int noise_mul(NoiseGraph *g, int a, int b);
+static int noise_abs(NoiseGraph *g, int a);
+static int noise_remap(NoiseGraph *g, int a, float scale, float bias, float lo, float hi);
+static int noise_fbm(NoiseGraph *g, float freq, float amp, int octaves, float offset);
+static bool noise_compile(const NoiseGraph *g, int out, NoiseProgram *prog);
+static void noise_eval(const NoiseProgram *prog, Vec4SoA dirs, float *out, int n);
+
+static int _noise_add(NoiseGraph *g, NoiseNode node) {
+  int inputs[4] = { node.a, node.b, node.c, node.d };
+  int needed = node.op == NOISE_WARP ? 4 : node.op == NOISE_SUM || node.op == NOISE_MUL ? 2
+             : node.op == NOISE_ABS || node.op == NOISE_REMAP ? 1 : 0;
+  for (int i = 0; i < needed; i++)
+    if (inputs[i] < 0 || inputs[i] >= g->count) return -1;
+  if (g->count >= NOISE_MAX_NODES) return -1;
+  g->nodes[g->count] = node;
+  return g->count++;
+}
+
+static int noise_simplex(NoiseGraph *g, float freq, float amp, float offset) {
+  return _noise_add(g, (NoiseNode) { NOISE_SIMPLEX, .k = { freq, amp, offset } });
+}
+
+static int noise_simplex4(NoiseGraph *g, float freq, float amp, float offset, float speed) {
+  return _noise_add(g, (NoiseNode) { NOISE_SIMPLEX4, .k = { freq, amp, offset, speed } });
+}
+
+static int noise_worley(NoiseGraph *g, NoiseFeature feature, float freq, float amp, float offset) {
+  return _noise_add(g, (NoiseNode) { NOISE_WORLEY, .k = { freq, amp, offset, (float)feature } });
+}
+
+static int noise_warp(NoiseGraph *g, int src, int x, int y, int z, float strength) {
+  return _noise_add(g, (NoiseNode) { NOISE_WARP, src, x, y, z, .k = { strength } });
+}
+
+static int noise_sum(NoiseGraph *g, int a, int b) {
+  return _noise_add(g, (NoiseNode) { NOISE_SUM, a, b });
+}
+
+static int noise_mul(NoiseGraph *g, int a, int b) {
+  return _noise_add(g, (NoiseNode) { NOISE_MUL, a, b });
+}
+
+static int noise_abs(NoiseGraph *g, int a) {
+  return _noise_add(g, (NoiseNode) { NOISE_ABS, a });
+}
+
+static int noise_remap(NoiseGraph *g, int a, float scale, float bias, float lo, float hi) {
+  return _noise_add(g, (NoiseNode) { NOISE_REMAP, a, .k = { scale, bias, lo, hi } });
+}
+
+/* octaves of simplex noise, doubling the frequency and halving the amplitude */
+static int noise_fbm(NoiseGraph *g, float freq, float amp, int octaves, float offset) {
+  int sum = noise_simplex(g, freq, amp, offset);
+  for (int o = 1; o < octaves; o++) {
+    freq *= 2.0f;
+    amp *= 0.5f;
+    sum = noise_sum(g, sum, noise_simplex(g, freq, amp, offset));
+  }
+  return sum;
+}
+
+/* compiling: values are numbered as they are emitted, then mapped to
+   registers; a register frees up after the last instruction reading it */
+typedef struct {
+  int node, coord, value;
+} _NoiseMemo;
+
+typedef struct {
+  const NoiseGraph *g;
+  NoiseInst insts[NOISE_MAX_INSTS];
+  int count, values, coords;
+  _NoiseMemo memo[NOISE_MAX_INSTS];
+  int memos;
+  bool failed;
+} _NoiseCompiler;
+
+static int _noise_emit(_NoiseCompiler *nc, NoiseInst inst) {
+  if (nc->count >= NOISE_MAX_INSTS) {
+    nc->failed = true;
+    return -1;
+  }
+  nc->insts[nc->count++] = inst;
+  return inst.dst;
+}
+
+static int _noise_visit(_NoiseCompiler *nc, int node, int coord) {
+  for (int i = 0; i < nc->memos; i++)
+    if (nc->memo[i].node == node && nc->memo[i].coord == coord)
+      return nc->memo[i].value;
+  if (nc->failed) return -1;
+
+  const NoiseNode *n = &nc->g->nodes[node];
+  NoiseInst inst = { n->op, .k = { n->k[0], n->k[1], n->k[2], n->k[3] } };
+  int value;
+  switch (n->op) {
+    case NOISE_SIMPLEX:
+    case NOISE_SIMPLEX4:
+    case NOISE_WORLEY:
+      inst.a = coord;
+      inst.dst = nc->values++;
+      value = _noise_emit(nc, inst);
+      break;
+    case NOISE_WARP:
+      inst.a = coord;
+      inst.b = _noise_visit(nc, n->b, coord);
+      inst.c = _noise_visit(nc, n->c, coord);
+      inst.d = _noise_visit(nc, n->d, coord);
+      inst.dst = nc->coords++;
+      value = _noise_visit(nc, n->a, _noise_emit(nc, inst));
+      break;
+    case NOISE_SUM:
+    case NOISE_MUL:
+      inst.a = _noise_visit(nc, n->a, coord);
+      inst.b = _noise_visit(nc, n->b, coord);
+      inst.dst = nc->values++;
+      value = _noise_emit(nc, inst);
+      break;
+    default:
+      inst.a = _noise_visit(nc, n->a, coord);
+      inst.dst = nc->values++;
+      value = _noise_emit(nc, inst);
+      break;
+  }
+  if (nc->failed || nc->memos >= NOISE_MAX_INSTS) {
+    nc->failed = true;
+    return -1;
+  }
+  nc->memo[nc->memos++] = (_NoiseMemo) { node, coord, value };
+  return value;
+}
+
+/* maps the values of one kind to registers; reads[i] lists the operands
+   instruction i reads, writes[i] the value it defines or -1 */
+static bool _noise_alloc(int count, const int reads[][4], const int *writes, int values,
+                         int keep, int first, int max_regs, int *reg) {
+  int last[NOISE_MAX_INSTS * 2];
+  bool busy[NOISE_MAX_REGS] = {0};
+  for (int v = 0; v < values; v++) last[v] = -1;
+  for (int i = 0; i < count; i++)
+    for (int r = 0; r < 4; r++)
+      if (reads[i][r] >= 0) last[reads[i][r]] = i;
+  if (keep >= 0) last[keep] = count;
+
+  for (int v = 0; v < first; v++) {
+    reg[v] = v;
+    busy[v] = true;
+  }
+  for (int i = 0; i < count; i++) {
+    /* operands dying here free their registers first; every instruction
+       works element by element, so its result may overwrite them */
+    for (int r = 0; r < 4; r++) {
+      int v = reads[i][r];
+      if (v >= 0 && last[v] == i) busy[reg[v]] = false;
+    }
+    int v = writes[i];
+    if (v < 0) continue;
+    int free = 0;
+    while (free < max_regs && busy[free]) free++;
+    if (free == max_regs) return false;
+    reg[v] = free;
+    busy[free] = last[v] >= 0;
+  }
+  return true;
+}
+
+/* false if the output is missing or the program doesn't fit the limits */
+static bool noise_compile(const NoiseGraph *g, int out, NoiseProgram *prog) {
+  if (out < 0 || out >= g->count) return false;
+  _NoiseCompiler nc = { .g = g, .coords = 1 };
+  int result = _noise_visit(&nc, out, 0);
+  if (nc.failed) return false;
+
+  /* field values and coordinate sets are allocated separately */
+  int field_reads[NOISE_MAX_INSTS][4], coord_reads[NOISE_MAX_INSTS][4];
+  int field_writes[NOISE_MAX_INSTS], coord_writes[NOISE_MAX_INSTS];
+  for (int i = 0; i < nc.count; i++) {
+    const NoiseInst *inst = &nc.insts[i];
+    bool warp = inst->op == NOISE_WARP;
+    bool source = inst->op == NOISE_SIMPLEX || inst->op == NOISE_SIMPLEX4 || inst->op == NOISE_WORLEY;
+    int *fr = field_reads[i], *cr = coord_reads[i];
+    fr[0] = fr[1] = fr[2] = fr[3] = cr[0] = cr[1] = cr[2] = cr[3] = -1;
+    if (warp) {
+      cr[0] = inst->a;
+      fr[0] = inst->b; fr[1] = inst->c; fr[2] = inst->d;
+    } else if (source) {
+      cr[0] = inst->a;
+    } else {
+      fr[0] = inst->a;
+      if (inst->op == NOISE_SUM || inst->op == NOISE_MUL) fr[1] = inst->b;
+    }
+    field_writes[i] = warp ? -1 : inst->dst;
+    coord_writes[i] = warp ? inst->dst : -1;
+  }
+  int field_reg[NOISE_MAX_INSTS], coord_reg[NOISE_MAX_INSTS];
+  if (!_noise_alloc(nc.count, field_reads, field_writes, nc.values, result, 0, NOISE_MAX_REGS, field_reg)) return false;
+  if (!_noise_alloc(nc.count, coord_reads, coord_writes, nc.coords, -1, 1, NOISE_MAX_COORDS, coord_reg)) return false;
+
+  prog->count = nc.count;
+  prog->out = field_reg[result];
+  for (int i = 0; i < nc.count; i++) {
+    NoiseInst inst = nc.insts[i];
+    if (inst.op == NOISE_WARP) {
+      inst.dst = coord_reg[inst.dst];
+      inst.a = coord_reg[inst.a];
+      inst.b = field_reg[inst.b];
+      inst.c = field_reg[inst.c];
+      inst.d = field_reg[inst.d];
+    } else {
+      bool source = inst.op == NOISE_SIMPLEX || inst.op == NOISE_SIMPLEX4 || inst.op == NOISE_WORLEY;
+      inst.dst = field_reg[inst.dst];
+      inst.a = source ? coord_reg[inst.a] : field_reg[inst.a];
+      if (inst.op == NOISE_SUM || inst.op == NOISE_MUL) inst.b = field_reg[inst.b];
+    }
+    prog->insts[i] = inst;
+  }
+  return true;
+}
+
+/* evaluates a compiled program at n directions; safe to call from several
+   threads at once, all state lives on the stack */
+static void noise_eval(const NoiseProgram *prog, Vec4SoA dirs, float *out, int n) {
+  float regs[NOISE_MAX_REGS][NOISE_BATCH];
+  float coords[NOISE_MAX_COORDS][3][NOISE_BATCH];
+  float p[3][NOISE_BATCH], f2[NOISE_BATCH];
+
+  for (int base = 0; base < n; base += NOISE_BATCH) {
+    int m = m_min(NOISE_BATCH, n - base);
+    memcpy(coords[0][0], dirs.x + base, m * sizeof(float));
+    memcpy(coords[0][1], dirs.y + base, m * sizeof(float));
+    memcpy(coords[0][2], dirs.z + base, m * sizeof(float));
+
+    for (int i = 0; i < prog->count; i++) {
+      const NoiseInst *inst = &prog->insts[i];
+      float *dst = regs[inst->dst];
+      const float *a = regs[inst->a], *b = regs[inst->b];
+      switch (inst->op) {
+        case NOISE_SIMPLEX:
+        case NOISE_SIMPLEX4:
+        case NOISE_WORLEY: {
+          float freq = inst->k[0], amp = inst->k[1], offset = inst->k[2];
+          for (int ax = 0; ax < 3; ax++)
+            for (int j = 0; j < m; j++) p[ax][j] = coords[inst->a][ax][j] * freq + offset;
+          if (inst->op == NOISE_SIMPLEX)
+            sn3_sample_n(p[0], p[1], p[2], dst, m);
+          else if (inst->op == NOISE_SIMPLEX4)
+            sn4_sample_n(p[0], p[1], p[2], prog->time * inst->k[3], dst, m);
+          else {
+            worley3_n(p[0], p[1], p[2], dst, f2, m);
+            if (inst->k[3] == NOISE_F2)
+              memcpy(dst, f2, m * sizeof(float));
+            else if (inst->k[3] == NOISE_F2_F1)
+              for (int j = 0; j < m; j++) dst[j] = f2[j] - dst[j];
+          }
+          if (amp != 1.0f)
+            for (int j = 0; j < m; j++) dst[j] *= amp;
+        } break;
+        case NOISE_WARP: {
+          float s = inst->k[0];
+          const float *d[3] = { regs[inst->b], regs[inst->c], regs[inst->d] };
+          for (int ax = 0; ax < 3; ax++)
+            for (int j = 0; j < m; j++)
+              coords[inst->dst][ax][j] = coords[inst->a][ax][j] + s * d[ax][j];
+        } break;
+        case NOISE_SUM:
+          for (int j = 0; j < m; j++) dst[j] = a[j] + b[j];
+          break;
+        case NOISE_MUL:
+          for (int j = 0; j < m; j++) dst[j] = a[j] * b[j];
+          break;
+        case NOISE_ABS:
+          for (int j = 0; j < m; j++) dst[j] = fabsf(a[j]);
+          break;
+        case NOISE_REMAP: {
+          float scale = inst->k[0], bias = inst->k[1], lo = inst->k[2], hi = inst->k[3];
+          for (int j = 0; j < m; j++) dst[j] = m_clamp(a[j] * scale + bias, lo, hi);
+        } break;
+      }
+    }
+    memcpy(out + base, regs[prog->out], m * sizeof(float));
+  }
+}
+
+#endif
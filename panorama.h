@@ -0,0 +1,334 @@
+#ifndef _PANORAMA_H_
+
+#define _PANORAMA_H_
+
+/* Sky layouts other than six cube faces, and conversions between them.
+
+   An equirectangular panorama maps longitude and latitude straight to
+   columns and rows: u = 0.5 + atan2(x, -z) / 2 pi, so the middle column
+   looks down -z, and v = acos(y) / pi, so the top row looks straight up.
+   Sky assets usually come as one, but it spends most of its texels on
+   the poles.
+
+   An octahedral map projects the sphere onto an octahedron and unfolds it
+   into a square, with y up: the upper hemisphere is the diamond in the
+   middle and the lower one the four corners folded out around it. A
+   square of twice the cube's face size has 4/6 of the cube's texels,
+   spread more evenly, in one 2D texture.
+
+   Conversions go through directions: the center of every destination
+   texel is mapped into the source, which is sampled bilinearly. Taps that
+   fall off the source continue the way its layout does: around in
+   longitude and across the poles for equirect, mirrored across the fold
+   for octahedral, onto the neighbouring face for cubes. That way no seam
+   shows where layouts meet. Destination rows are spread over the job
+   pool. Mapping directions to coordinates (the atan2s, the octahedral
+   folding) and the bilinear blends run four lanes wide with SSE. Cube
+   faces are laid out like cube_texel_dir(), and their directions come
+   from the cube_dirs() table of their size. Images are float rgba. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef enum {
+  PANO_EQUIRECT,
+  PANO_OCTAHEDRAL,
+} PanoLayout;
+
+typedef struct {
+  PanoLayout layout;
+  int width, height;          /* equirect is twice as wide as high, octahedral square */
+  Vec4 *texels;               /* [row][col] */
+} Pano;
+
+typedef struct {
+  int size;
+  Vec4 *faces[6];             /* [row][col] */
+} PanoCube;
+
+static void pano_init(Pano *pano, PanoLayout layout, int width, int height);
+static void pano_free(Pano *pano);
+static void pano_cube_init(PanoCube *cube, int size);
+static void pano_cube_free(PanoCube *cube);
+static void pano_dirs_uv(PanoLayout layout, Vec4SoA dirs, float *u, float *v, int n);
+static void pano_row_dirs(PanoLayout layout, int width, int height, int row, Vec4SoA out);
+static Vec4 pano_sample(const Pano *pano, float u, float v);
+static Vec4 pano_cube_sample(const PanoCube *cube, Vec3 d);
+static void pano_to_cube(const Pano *src, PanoCube *dst);
+static void pano_from_cube(const PanoCube *src, Pano *dst);
+static void pano_convert(const Pano *src, Pano *dst);
+
+static void pano_init(Pano *pano, PanoLayout layout, int width, int height) {
+  *pano = (Pano) { layout, width, height };
+  pano->texels = malloc((size_t)width * height * sizeof(Vec4));
+}
+
+static void pano_free(Pano *pano) {
+  free(pano->texels);
+  *pano = (Pano) {0};
+}
+
+static void pano_cube_init(PanoCube *cube, int size) {
+  cube->size = size;
+  for (int f = 0; f < 6; f++) cube->faces[f] = malloc((size_t)size * size * sizeof(Vec4));
+}
+
+static void pano_cube_free(PanoCube *cube) {
+  for (int f = 0; f < 6; f++) free(cube->faces[f]);
+  *cube = (PanoCube) {0};
+}
+
+/* atan of the smaller over the larger magnitude as an odd polynomial,
+   then moved into the right octant; about 2e-6 radians off. The SSE
+   version below is the same arithmetic, so a row's last few texels,
+   done here, line up with the rest */
+static const float _pano_atan_k[6] = {
+  0.99997726f, -0.33262347f, 0.19354346f, -0.11643287f, 0.05265332f, -0.01172120f,
+};
+
+static float _pano_atan2(float y, float x) {
+  float ax = fabsf(x), ay = fabsf(y);
+  float t = m_min(ax, ay) / m_max(m_max(ax, ay), 1e-30f), t2 = t * t;
+  float r = _pano_atan_k[5];
+  for (int k = 4; k >= 0; k--) r = r * t2 + _pano_atan_k[k];
+  r *= t;
+  if (ay > ax) r = 0.5f * PI_f - r;
+  if (x < 0.0f) r = PI_f - r;
+  return copysignf(r, y);
+}
+
+#if defined(MATH_SSE)
+static __m128 _pano_atan2_ps(__m128 y, __m128 x) {
+  __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+  __m128 t = _mm_div_ps(_mm_min_ps(ax, ay), _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(1e-30f)));
+  __m128 t2 = _mm_mul_ps(t, t);
+  __m128 r = _mm_set1_ps(_pano_atan_k[5]);
+  for (int k = 4; k >= 0; k--) r = _mm_add_ps(_mm_mul_ps(r, t2), _mm_set1_ps(_pano_atan_k[k]));
+  r = _mm_mul_ps(r, t);
+  __m128 swap = _mm_cmpgt_ps(ay, ax), back = _mm_cmplt_ps(x, _mm_setzero_ps());
+  r = _mm_or_ps(_mm_and_ps(swap, _mm_sub_ps(_mm_set1_ps(0.5f * PI_f), r)), _mm_andnot_ps(swap, r));
+  r = _mm_or_ps(_mm_and_ps(back, _mm_sub_ps(_mm_set1_ps(PI_f), r)), _mm_andnot_ps(back, r));
+  return _mm_or_ps(r, _mm_and_ps(sign, y));
+}
+#endif
+
+static void _pano_dir_uv(PanoLayout layout, Vec3 d, float *u, float *v) {
+  if (layout == PANO_EQUIRECT) {
+    *u = 0.5f + _pano_atan2(d.x, -d.z) * (0.5f / PI_f);
+    *v = 0.5f - _pano_atan2(d.y, sqrtf(d.x * d.x + d.z * d.z)) * (1.0f / PI_f);
+  } else {
+    float l1 = fabsf(d.x) + fabsf(d.y) + fabsf(d.z);
+    float px = d.x / l1, pz = d.z / l1;
+    if (d.y < 0.0f) {
+      float fx = copysignf(1.0f - fabsf(pz), px), fz = copysignf(1.0f - fabsf(px), pz);
+      px = fx;
+      pz = fz;
+    }
+    *u = 0.5f * px + 0.5f;
+    *v = 0.5f * pz + 0.5f;
+  }
+}
+
+/* coordinates in [0, 1] of n directions, which don't need to be
+   normalized */
+static void pano_dirs_uv(PanoLayout layout, Vec4SoA dirs, float *u, float *v, int n) {
+  int i = 0;
+#if defined(MATH_SSE)
+  __m128 sign = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f);
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(dirs.x + i), y = _mm_loadu_ps(dirs.y + i), z = _mm_loadu_ps(dirs.z + i);
+    __m128 pu, pv;
+    if (layout == PANO_EQUIRECT) {
+      __m128 r = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z)));
+      pu = _mm_add_ps(half, _mm_mul_ps(_pano_atan2_ps(x, _mm_xor_ps(z, sign)), _mm_set1_ps(0.5f / PI_f)));
+      pv = _mm_sub_ps(half, _mm_mul_ps(_pano_atan2_ps(y, r), _mm_set1_ps(1.0f / PI_f)));
+    } else {
+      __m128 l1 = _mm_add_ps(_mm_andnot_ps(sign, x), _mm_add_ps(_mm_andnot_ps(sign, y), _mm_andnot_ps(sign, z)));
+      __m128 px = _mm_div_ps(x, l1), pz = _mm_div_ps(z, l1);
+      __m128 one = _mm_set1_ps(1.0f), below = _mm_cmplt_ps(y, _mm_setzero_ps());
+      __m128 fx = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, pz)), _mm_and_ps(sign, px));
+      __m128 fz = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, px)), _mm_and_ps(sign, pz));
+      px = _mm_or_ps(_mm_and_ps(below, fx), _mm_andnot_ps(below, px));
+      pz = _mm_or_ps(_mm_and_ps(below, fz), _mm_andnot_ps(below, pz));
+      pu = _mm_add_ps(_mm_mul_ps(half, px), half);
+      pv = _mm_add_ps(_mm_mul_ps(half, pz), half);
+    }
+    _mm_storeu_ps(u + i, pu);
+    _mm_storeu_ps(v + i, pv);
+  }
+#endif
+  for (; i < n; i++) _pano_dir_uv(layout, vec3(dirs.x[i], dirs.y[i], dirs.z[i]), u + i, v + i);
+}
+
+/* normalized directions through the texel centers of a row */
+static void pano_row_dirs(PanoLayout layout, int width, int height, int row, Vec4SoA out) {
+  float v = (row + 0.5f) / height;
+  if (layout == PANO_EQUIRECT) {
+    float theta = v * PI_f, s = sinf(theta), c = cosf(theta);
+    /* longitude steps by a rotation, in doubles so it doesn't drift */
+    double phi = (0.5 / width - 0.5) * 2.0 * PI_f, step = 2.0 * PI_f / width;
+    double sp = sin(phi), cp = cos(phi), ss = sin(step), cs = cos(step);
+    for (int col = 0; col < width; col++) {
+      out.x[col] = s * (float)sp;
+      out.y[col] = c;
+      out.z[col] = -s * (float)cp;
+      double next = sp * cs + cp * ss;
+      cp = cp * cs - sp * ss;
+      sp = next;
+    }
+    return;
+  }
+  float pz = 2.0f * v - 1.0f;
+  for (int col = 0; col < width; col++) {
+    float px = 2.0f * (col + 0.5f) / width - 1.0f;
+    float y = 1.0f - fabsf(px) - fabsf(pz), x = px, z = pz;
+    if (y < 0.0f) {
+      x = copysignf(1.0f - fabsf(pz), px);
+      z = copysignf(1.0f - fabsf(px), pz);
+    }
+    float inv = 1.0f / sqrtf(x * x + y * y + z * z);
+    out.x[col] = x * inv;
+    out.y[col] = y * inv;
+    out.z[col] = z * inv;
+  }
+}
+
+static Vec4 _pano_bilinear(const Vec4 *a, const Vec4 *b, const Vec4 *c, const Vec4 *d, float fx, float fy) {
+#if defined(MATH_SSE)
+  __m128 wx = _mm_set1_ps(fx), wy = _mm_set1_ps(fy);
+  __m128 va = _mm_loadu_ps(a->nums), vc = _mm_loadu_ps(c->nums);
+  __m128 top = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b->nums), va), wx));
+  __m128 bottom = _mm_add_ps(vc, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(d->nums), vc), wx));
+  Vec4 out;
+  _mm_storeu_ps(out.nums, _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), wy)));
+  return out;
+#else
+  Vec4 out;
+  for (int k = 0; k < 4; k++) {
+    float top = a->nums[k] + (b->nums[k] - a->nums[k]) * fx;
+    float bottom = c->nums[k] + (d->nums[k] - c->nums[k]) * fx;
+    out.nums[k] = top + (bottom - top) * fy;
+  }
+  return out;
+#endif
+}
+
+/* texel (x, y), less than a width or height off the edges, moved to
+   where the layout continues past them */
+static void _pano_wrap(PanoLayout layout, int w, int h, int *x, int *y) {
+  if (layout == PANO_EQUIRECT) {
+    if (*y < 0 || *y >= h) {
+      *y = *y < 0 ? -1 - *y : 2 * h - 1 - *y;
+      *x += w / 2;
+    }
+    *x = (*x % w + w) % w;
+  } else {
+    if (*x < 0 || *x >= w) {
+      *x = *x < 0 ? -1 - *x : 2 * w - 1 - *x;
+      *y = h - 1 - *y;
+    }
+    if (*y < 0 || *y >= h) {
+      *y = *y < 0 ? -1 - *y : 2 * h - 1 - *y;
+      *x = w - 1 - *x;
+    }
+  }
+}
+
+static const Vec4 *_pano_texel(const Pano *pano, int x, int y) {
+  _pano_wrap(pano->layout, pano->width, pano->height, &x, &y);
+  return &pano->texels[(size_t)y * pano->width + x];
+}
+
+static Vec4 pano_sample(const Pano *pano, float u, float v) {
+  float x = u * pano->width - 0.5f, y = v * pano->height - 0.5f;
+  float x0 = floorf(x), y0 = floorf(y);
+  int ix = (int)x0, iy = (int)y0;
+  if (ix >= 0 && iy >= 0 && ix + 1 < pano->width && iy + 1 < pano->height) {
+    const Vec4 *t = &pano->texels[(size_t)iy * pano->width + ix];
+    return _pano_bilinear(t, t + 1, t + pano->width, t + pano->width + 1, x - x0, y - y0);
+  }
+  return _pano_bilinear(_pano_texel(pano, ix, iy), _pano_texel(pano, ix + 1, iy),
+                        _pano_texel(pano, ix, iy + 1), _pano_texel(pano, ix + 1, iy + 1), x - x0, y - y0);
+}
+
+/* texel (x, y) of a face of size n; off the face, the texel of whichever
+   face the direction through its center lands on */
+static void _pano_cube_wrap(int n, int *face, int *x, int *y) {
+  if (*x >= 0 && *x < n && *y >= 0 && *y < n) return;
+  float u, v;
+  *face = cube_dir_texel(cube_texel_dir(*face, (*x + 0.5f) / n, (*y + 0.5f) / n), &u, &v);
+  *x = m_clamp((int)(u * n), 0, n - 1);
+  *y = m_clamp((int)(v * n), 0, n - 1);
+}
+
+static const Vec4 *_pano_cube_texel(const PanoCube *cube, int face, int x, int y) {
+  _pano_cube_wrap(cube->size, &face, &x, &y);
+  return &cube->faces[face][(size_t)y * cube->size + x];
+}
+
+static Vec4 pano_cube_sample(const PanoCube *cube, Vec3 d) {
+  float u, v;
+  int face = cube_dir_texel(d, &u, &v);
+  float x = u * cube->size - 0.5f, y = v * cube->size - 0.5f;
+  float x0 = floorf(x), y0 = floorf(y);
+  int ix = (int)x0, iy = (int)y0;
+  return _pano_bilinear(_pano_cube_texel(cube, face, ix, iy), _pano_cube_texel(cube, face, ix + 1, iy),
+                        _pano_cube_texel(cube, face, ix, iy + 1), _pano_cube_texel(cube, face, ix + 1, iy + 1),
+                        x - x0, y - y0);
+}
+
+typedef struct {
+  const Pano *src;
+  const PanoCube *src_cube;
+  Pano *dst;
+  PanoCube *dst_cube;
+  const CubeDirs *dirs;       /* of dst_cube */
+} _PanoJob;
+
+/* one job per destination row, of any face for cubes */
+static void _pano_rows(void *user, int begin, int end) {
+  _PanoJob *job = user;
+  int width = job->dst ? job->dst->width : job->dst_cube->size;
+  float *buf = malloc(5 * width * sizeof(float));
+  float *u = buf + 3 * width, *v = buf + 4 * width;
+  for (int r = begin; r < end; r++) {
+    Vec4SoA dirs = { buf, buf + width, buf + 2 * width, NULL };
+    Vec4 *dst;
+    if (job->dst) {
+      pano_row_dirs(job->dst->layout, width, job->dst->height, r, dirs);
+      dst = job->dst->texels + (size_t)r * width;
+    } else {
+      dirs = cube_texel_row_cached(job->dirs, r / width, r % width, width, buf);
+      dst = job->dst_cube->faces[r / width] + (size_t)(r % width) * width;
+    }
+    if (job->src) {
+      pano_dirs_uv(job->src->layout, dirs, u, v, width);
+      for (int i = 0; i < width; i++) dst[i] = pano_sample(job->src, u[i], v[i]);
+    } else {
+      for (int i = 0; i < width; i++)
+        dst[i] = pano_cube_sample(job->src_cube, vec3(dirs.x[i], dirs.y[i], dirs.z[i]));
+    }
+  }
+  free(buf);
+}
+
+static void pano_to_cube(const Pano *src, PanoCube *dst) {
+  _PanoJob job = { .src = src, .dst_cube = dst, .dirs = cube_dirs(dst->size, false) };
+  jobs_parallel_for(6 * dst->size, 8, _pano_rows, &job);
+}
+
+static void pano_from_cube(const PanoCube *src, Pano *dst) {
+  _PanoJob job = { .src_cube = src, .dst = dst };
+  jobs_parallel_for(dst->height, 8, _pano_rows, &job);
+}
+
+/* between 2D layouts, or the same one at another size */
+static void pano_convert(const Pano *src, Pano *dst) {
+  _PanoJob job = { .src = src, .dst = dst };
+  jobs_parallel_for(dst->height, 8, _pano_rows, &job);
+}
+
+#endif
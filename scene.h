@@ -0,0 +1,93 @@
+#ifndef _SCENE_H_
+
+#define _SCENE_H_
+
+/* Transform hierarchy stored as flat arrays.
+
+   Nodes are only ever appended and a node's parent must already exist, so
+   parents always come before their children. That makes updating world
+   matrices a single forward sweep: by the time a node is reached its
+   parent's world matrix is final, and a parent's dirty flag can simply be
+   pushed down to the child in the same pass. The sweep starts at the first
+   dirty node, nothing in front of it can be affected. */
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  int count, capacity;
+  int *parent;                /* index of the parent, -1 for roots */
+  Mat4 *local, *world;
+  uint8_t *dirty;
+  int first_dirty;
+} Scene;
+
+static void scene_init(Scene *s, int capacity);
+static void scene_free(Scene *s);
+static void scene_clear(Scene *s);
+static int scene_add(Scene *s, int parent, Mat4 local);
+static void scene_set_local(Scene *s, int node, Mat4 local);
+static int scene_update(Scene *s);
+
+static void scene_init(Scene *s, int capacity) {
+  *s = (Scene) {
+    .capacity = capacity,
+    .parent = malloc(capacity * sizeof(int)),
+    .local = malloc(capacity * sizeof(Mat4)),
+    .world = malloc(capacity * sizeof(Mat4)),
+    .dirty = calloc(capacity, sizeof(uint8_t)),
+  };
+  scene_clear(s);
+}
+
+static void scene_free(Scene *s) {
+  free(s->parent);
+  free(s->local);
+  free(s->world);
+  free(s->dirty);
+  *s = (Scene) {0};
+}
+
+static void scene_clear(Scene *s) {
+  s->count = 0;
+  s->first_dirty = s->capacity;
+}
+
+/* returns the new node's index, or -1 if the scene is full */
+static int scene_add(Scene *s, int parent, Mat4 local) {
+  if (s->count >= s->capacity) return -1;
+  SOKOL_ASSERT(parent < s->count);
+  int node = s->count++;
+  s->parent[node] = parent;
+  s->local[node] = local;
+  s->dirty[node] = 1;
+  s->first_dirty = m_min(s->first_dirty, node);
+  return node;
+}
+
+static void scene_set_local(Scene *s, int node, Mat4 local) {
+  s->local[node] = local;
+  s->dirty[node] = 1;
+  s->first_dirty = m_min(s->first_dirty, node);
+}
+
+/* brings every world matrix up to date, returns how many were recomputed */
+static int scene_update(Scene *s) {
+  int updated = 0;
+  for (int i = s->first_dirty; i < s->count; i++) {
+    int p = s->parent[i];
+    if (p >= 0) s->dirty[i] |= s->dirty[p];
+    if (!s->dirty[i]) continue;
+
+    s->world[i] = (p >= 0) ? mul4x4(s->world[p], s->local[i]) : s->local[i];
+    updated++;
+  }
+
+  /* the flags are only cleared afterwards, children read their parent's */
+  if (s->first_dirty < s->count)
+    memset(s->dirty + s->first_dirty, 0, s->count - s->first_dirty);
+  s->first_dirty = s->count;
+  return updated;
+}
+
+#endif
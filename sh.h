@@ -0,0 +1,205 @@
+#ifndef _SH_H_
+
+#define _SH_H_
+
+/* Second order (L2) spherical harmonics of distant radiance, for ambient
+   light that follows the sky.
+
+   sh_project() integrates a radiance function times each of the nine real
+   SH basis functions over the sphere, through the centers of a cube's
+   texels, each weighted by its solid angle, with directions from the
+   cube_dirs() table of that size. Rows are spread over the job pool in
+   fixed chunks; each chunk sums into its own partial and the partials
+   are added in chunk order, so the result doesn't depend on how many
+   threads there are or which got which chunk. The sums over a row run
+   four texels wide with SSE.
+
+   sh_irradiance() convolves radiance coefficients with the cosine lobe
+   (Ramamoorthi and Hanrahan, "An Efficient Representation for Irradiance
+   Environment Maps", 2001) and divides by pi, giving the radiance a white
+   lambertian surface reflects. sh_shader_coeffs() folds the basis
+   constants in as well, so a shader needs one multiply-add per
+   coefficient and a few products of the normal:
+
+     c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2) */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define SH_CHUNK_ROWS (8)
+
+typedef struct {
+  Vec3 c[9];                  /* rgb per basis function, in the order above */
+} ShL2;
+
+/* radiance toward n directions, rgb into out.x, out.y and out.z; called
+   from several threads at once */
+typedef void (*ShRadianceFn)(void *user, Vec4SoA dirs, Vec4SoA out, int n);
+
+static ShL2 sh_project(int size, ShRadianceFn fn, void *user);
+static void sh_add_directional(ShL2 *sh, Vec3 dir, Vec3 color);
+static ShL2 sh_irradiance(ShL2 sh);
+static Vec3 sh_eval(const ShL2 *sh, Vec3 n);
+static void sh_shader_coeffs(const ShL2 *sh, float scale, Vec4 out[9]);
+
+static const float _sh_k[9] = {
+  0.282095f, 0.488603f, 0.488603f, 0.488603f,
+  1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f,
+};
+
+static void _sh_basis(Vec3 d, float y[9]) {
+  y[0] = _sh_k[0];
+  y[1] = _sh_k[1] * d.y;
+  y[2] = _sh_k[2] * d.z;
+  y[3] = _sh_k[3] * d.x;
+  y[4] = _sh_k[4] * d.x * d.y;
+  y[5] = _sh_k[5] * d.y * d.z;
+  y[6] = _sh_k[6] * (3.0f * d.z * d.z - 1.0f);
+  y[7] = _sh_k[7] * d.x * d.z;
+  y[8] = _sh_k[8] * (d.x * d.x - d.y * d.y);
+}
+
+typedef struct {
+  int size, chunks;
+  const CubeDirs *dirs;
+  ShRadianceFn fn;
+  void *user;
+  float *partials;            /* [chunk][28]: rgb per basis function, then the weight */
+} _ShProject;
+
+/* a texel's solid angle is 4/size^2 / |d|^3 for its unnormalized
+   direction d, whose major axis is 1; for the normalized direction that
+   is the major axis cubed */
+static void _sh_accumulate(Vec4SoA d, Vec4SoA rgb, int n, float scale, float acc[28]) {
+  int i = 0;
+#if defined(MATH_SSE)
+  __m128 sum[28];
+  for (int k = 0; k < 28; k++) sum[k] = _mm_setzero_ps();
+  __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_loadu_ps(d.x + i), y = _mm_loadu_ps(d.y + i), z = _mm_loadu_ps(d.z + i);
+    __m128 m = _mm_max_ps(_mm_and_ps(x, abs_mask), _mm_max_ps(_mm_and_ps(y, abs_mask), _mm_and_ps(z, abs_mask)));
+    __m128 w = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(m, m), m), _mm_set1_ps(scale));
+    __m128 basis[9] = {
+      _mm_set1_ps(_sh_k[0]),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[1]), y),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[2]), z),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[3]), x),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[4]), _mm_mul_ps(x, y)),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[5]), _mm_mul_ps(y, z)),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[6]), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), _mm_set1_ps(1.0f))),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[7]), _mm_mul_ps(x, z)),
+      _mm_mul_ps(_mm_set1_ps(_sh_k[8]), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y))),
+    };
+    __m128 wr = _mm_mul_ps(w, _mm_loadu_ps(rgb.x + i));
+    __m128 wg = _mm_mul_ps(w, _mm_loadu_ps(rgb.y + i));
+    __m128 wb = _mm_mul_ps(w, _mm_loadu_ps(rgb.z + i));
+    for (int k = 0; k < 9; k++) {
+      sum[3*k]     = _mm_add_ps(sum[3*k],     _mm_mul_ps(basis[k], wr));
+      sum[3*k + 1] = _mm_add_ps(sum[3*k + 1], _mm_mul_ps(basis[k], wg));
+      sum[3*k + 2] = _mm_add_ps(sum[3*k + 2], _mm_mul_ps(basis[k], wb));
+    }
+    sum[27] = _mm_add_ps(sum[27], w);
+  }
+  for (int k = 0; k < 28; k++) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum[k]);
+    acc[k] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  }
+#endif
+  for (; i < n; i++) {
+    Vec3 v = vec3(d.x[i], d.y[i], d.z[i]);
+    float m = m_max(fabsf(v.x), m_max(fabsf(v.y), fabsf(v.z)));
+    float w = m * m * m * scale, basis[9];
+    _sh_basis(v, basis);
+    for (int k = 0; k < 9; k++) {
+      acc[3*k]     += basis[k] * w * rgb.x[i];
+      acc[3*k + 1] += basis[k] * w * rgb.y[i];
+      acc[3*k + 2] += basis[k] * w * rgb.z[i];
+    }
+    acc[27] += w;
+  }
+}
+
+static void _sh_project_chunks(void *user, int begin, int end) {
+  _ShProject *job = user;
+  int size = job->size;
+  float *buf = malloc(6 * size * sizeof(float));
+  Vec4SoA rgb = { buf, buf + size, buf + 2*size, NULL };
+  float scale = 4.0f / ((float)size * size);
+  for (int c = begin; c < end; c++) {
+    float *acc = job->partials + 28 * c;
+    memset(acc, 0, 28 * sizeof(float));
+    for (int r = c * SH_CHUNK_ROWS; r < m_min((c + 1) * SH_CHUNK_ROWS, 6 * size); r++) {
+      Vec4SoA d = cube_texel_row_cached(job->dirs, r / size, r % size, size, buf + 3*size);
+      job->fn(job->user, d, rgb, size);
+      _sh_accumulate(d, rgb, size, scale, acc);
+    }
+  }
+  free(buf);
+}
+
+/* radiance coefficients from size x size directions per face. The texel
+   weights are rescaled to add up to exactly 4 pi, which takes out most
+   of the error of treating every texel as a point */
+static ShL2 sh_project(int size, ShRadianceFn fn, void *user) {
+  _ShProject job = {
+    .size = size,
+    .dirs = cube_dirs(size, false),
+    .chunks = (6 * size + SH_CHUNK_ROWS - 1) / SH_CHUNK_ROWS,
+    .fn = fn,
+    .user = user,
+  };
+  job.partials = malloc((size_t)job.chunks * 28 * sizeof(float));
+  jobs_parallel_for(job.chunks, 1, _sh_project_chunks, &job);
+
+  double sum[28] = {0};
+  for (int c = 0; c < job.chunks; c++)
+    for (int k = 0; k < 28; k++) sum[k] += job.partials[28 * c + k];
+  free(job.partials);
+
+  ShL2 sh;
+  double norm = 4.0 * PI_f / sum[27];
+  for (int k = 0; k < 9; k++)
+    sh.c[k] = vec3((float)(sum[3*k] * norm), (float)(sum[3*k + 1] * norm), (float)(sum[3*k + 2] * norm));
+  return sh;
+}
+
+/* a light from a single direction, like the sun, which would fall
+   between texels: color is its illuminance */
+static void sh_add_directional(ShL2 *sh, Vec3 dir, Vec3 color) {
+  float basis[9];
+  _sh_basis(dir, basis);
+  for (int k = 0; k < 9; k++) sh->c[k] = add3(sh->c[k], mul3_f(color, basis[k]));
+}
+
+/* the cosine lobe's coefficients per band are pi, 2 pi / 3 and pi / 4;
+   divided by pi for reflected radiance */
+static ShL2 sh_irradiance(ShL2 sh) {
+  static const float band[9] = {
+    1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f,
+  };
+  for (int k = 0; k < 9; k++) sh.c[k] = mul3_f(sh.c[k], band[k]);
+  return sh;
+}
+
+static Vec3 sh_eval(const ShL2 *sh, Vec3 n) {
+  float basis[9];
+  _sh_basis(n, basis);
+  Vec3 sum = vec3_f(0.0f);
+  for (int k = 0; k < 9; k++) sum = add3(sum, mul3_f(sh->c[k], basis[k]));
+  return sum;
+}
+
+/* coefficients with the basis constants multiplied in, times scale, for
+   the polynomial in the header comment; w is 0 */
+static void sh_shader_coeffs(const ShL2 *sh, float scale, Vec4 out[9]) {
+  for (int k = 0; k < 9; k++) {
+    Vec3 c = mul3_f(sh->c[k], _sh_k[k] * scale);
+    out[k] = vec4(c.x, c.y, c.z, 0.0f);
+  }
+}
+
+#endif
@@ -1,57 +1,252 @@
 @ctype mat4 Mat4
 @ctype vec2 Vec2
+@ctype vec4 Vec4
 
-@vs mesh_vs
-uniform mesh_vs_params {
-    mat4 mvp;
+/* computed once per frame by camera.h and shared by every pass */
+@block camera
+uniform camera_params {
+    mat4 view_proj;
+    mat4 inv_view_proj;
+    mat4 sky;
+    mat4 inv_sky;
+    vec4 eye_pos;
 };
+@end
+
+/* radiance is unbounded, the cubemap and tables are float; this is the
+   one place it is squeezed into [0, 1) */
+@block tone_map
+vec3 tone_map(vec3 lum) {
+  return 1.0 - exp(-lum);
+}
+@end
+
+@vs mesh_vs
+@include_block camera
 
 in vec4 position;
 in vec4 color0;
+in vec3 normal;
 
 out vec4 color;
+out vec3 normal_dir;
+out vec3 view_dir;
 
 void main() {
-  gl_Position = mvp * position;
+  gl_Position = view_proj * position;
   color = color0;
+  normal_dir = normal;
+  view_dir = position.xyz - eye_pos.xyz;
 }
 @end
 
 @fs mesh_fs
+@include_block tone_map
+
+/* ambient light from the sky as L2 spherical harmonics, with the basis
+   constants and the exposure folded in; see sh.h. specular is the
+   roughness, the reflectance at normal incidence, the environment map's
+   lod for roughness 1 and the exposure */
+uniform sh_params {
+    vec4 sh0;
+    vec4 sh1;
+    vec4 sh2;
+    vec4 sh3;
+    vec4 sh4;
+    vec4 sh5;
+    vec4 sh6;
+    vec4 sh7;
+    vec4 sh8;
+    vec4 specular;
+};
+/* the sky prefiltered for GGX, one mip per roughness; see envmap.h */
+uniform samplerCube env;
+
 in vec4 color;
+in vec3 normal_dir;
+in vec3 view_dir;
 out vec4 frag_color;
 
+/* the second half of the split sum, the GGX BRDF integrated over the
+   hemisphere as a scale and bias to the reflectance, fitted analytically
+   (Lazarov, "Getting More Physical in Call of Duty: Black Ops II", 2013) */
+vec2 env_brdf(float roughness, float nv) {
+  vec4 r = roughness * vec4(-1.0, -0.0275, -0.572, 0.022) + vec4(1.0, 0.0425, 1.04, -0.04);
+  float a004 = min(r.x * r.x, exp2(-9.28 * nv)) * r.x + r.y;
+  return vec2(-1.04, 1.04) * a004 + r.zw;
+}
+
 void main() {
-  frag_color = color;
+  vec3 n = normalize(normal_dir), v = normalize(view_dir);
+  vec3 ambient = sh0.rgb
+    + sh1.rgb * n.y + sh2.rgb * n.z + sh3.rgb * n.x
+    + sh4.rgb * (n.x * n.y) + sh5.rgb * (n.y * n.z) + sh6.rgb * (3.0 * n.z * n.z - 1.0)
+    + sh7.rgb * (n.x * n.z) + sh8.rgb * (n.x * n.x - n.y * n.y);
+  float roughness = specular.x, f0 = specular.y;
+  vec3 reflected = textureLod(env, reflect(v, n), roughness * specular.z).rgb * specular.w;
+  vec2 ab = env_brdf(roughness, max(dot(n, -v), 0.0));
+  vec3 lum = color.rgb * max(ambient, 0.0) * (1.0 - f0) + reflected * (f0 * ab.x + ab.y);
+  frag_color = vec4(tone_map(lum), color.a);
 }
 @end
 
 @program mesh mesh_vs mesh_fs
 
+@vs instanced_vs
+@include_block camera
+
+in vec4 position;
+in vec4 color0;
+in vec3 normal;
+/* per-instance stream: model matrix columns, then a tint */
+in vec4 inst_m0;
+in vec4 inst_m1;
+in vec4 inst_m2;
+in vec4 inst_m3;
+in vec4 inst_color;
+
+out vec4 color;
+out vec3 normal_dir;
+out vec3 view_dir;
+
+void main() {
+  mat4 model = mat4(inst_m0, inst_m1, inst_m2, inst_m3);
+  vec4 world = model * position;
+  gl_Position = view_proj * world;
+  color = color0 * inst_color;
+  normal_dir = (model * vec4(normal, 0.0)).xyz;
+  view_dir = world.xyz - eye_pos.xyz;
+}
+@end
+
+@program instanced instanced_vs mesh_fs
+
 
 @vs skybox_vs
-uniform mesh_vs_params {
-    mat4 mvp;
-};
+@include_block camera
 
 in vec3 position;
 out vec3 tex_coord;
 
 void main() {
   tex_coord = position;
-  gl_Position = (mvp * vec4(position, 1)).xyww;
+  gl_Position = (sky * vec4(position, 1)).xyww;
+}
+@end
+
+/* the atmosphere and the clouds over it, shared by the cube and the
+   octahedral skybox, which only differ in how the cloud layer is read */
+@block sky
+/* sun_dir.w is the sun disk's angular radius; planet is the atmosphere's
+   bottom and top radius, the camera's distance from the planet's center
+   and the exposure. Radii in km, see atmosphere.h. night.x scales the
+   stars, which fade in as the sun sets */
+uniform sky_params {
+    vec4 sun_dir;
+    vec4 planet;
+    vec4 night;
+};
+uniform sampler2D transmittance_lut;
+uniform sampler2D sky_view_lut;
+
+const float PI = 3.14159265;
+
+/* the mappings below mirror atmosphere.h's and must stay in sync; n is
+   the table's size along the axis */
+float from_unit(float x, float n) {
+  return 0.5 / n + x * (1.0 - 1.0 / n);
+}
+
+vec3 transmittance(float r, float mu) {
+  float bottom = planet.x, top = planet.y;
+  if (mu < -sqrt(max(1.0 - bottom * bottom / (r * r), 0.0))) return vec3(0.0);
+  float H = sqrt(top * top - bottom * bottom);
+  float rho = sqrt(max(r * r - bottom * bottom, 0.0));
+  float d = max(-r * mu + sqrt(max(r * r * (mu * mu - 1.0) + top * top, 0.0)), 0.0);
+  float d_min = top - r, d_max = rho + H;
+  vec2 uv = vec2(from_unit((d - d_min) / (d_max - d_min), 256.0), from_unit(rho / H, 64.0));
+  return texture(transmittance_lut, uv).rgb;
+}
+
+/* view zenith angles are squeezed toward the horizon, azimuths toward
+   the sun's */
+vec3 sky_view(vec3 dir) {
+  float r = planet.z, bottom = planet.x;
+  float beta = acos(sqrt(r * r - bottom * bottom) / r), zenith_horizon = PI - beta;
+  float zenith = acos(clamp(dir.y, -1.0, 1.0));
+  float v = zenith < zenith_horizon
+    ? 0.5 - 0.5 * sqrt(1.0 - zenith / zenith_horizon)
+    : 0.5 + 0.5 * sqrt((zenith - zenith_horizon) / beta);
+  vec2 a = dir.xz / max(length(dir.xz), 1e-6), b = sun_dir.xz / max(length(sun_dir.xz), 1e-6);
+  float u = sqrt(clamp(0.5 - 0.5 * dot(a, b), 0.0, 1.0));
+  return texture(sky_view_lut, vec2(from_unit(u, 192.0), from_unit(v, 108.0))).rgb;
+}
+
+/* through is the cloud layer toward dir: the fraction of the sky behind
+   that shows through; stars the star field's radiance there */
+vec4 sky_color(vec3 dir, vec3 through, vec3 stars) {
+  vec3 sun = sun_dir.xyz;
+  vec3 lum = sky_view(dir) + stars * night.x * transmittance(planet.z, dir.y);
+
+  /* the disk has an illuminance of 1, like the sun the tables were baked for */
+  float radius = sun_dir.w, c = dot(dir, sun);
+  float disk = smoothstep(cos(radius * 1.1), cos(radius * 0.9), c);
+  lum += disk * transmittance(planet.z, dir.y) / (PI * radius * radius);
+
+  /* white lambertian clouds, lit by the sun through the atmosphere and by
+     the sky above them */
+  vec3 light = transmittance(planet.z, sun.y) * max(sun.y, 0.0) / PI + sky_view(vec3(0.0, 1.0, 0.0));
+  lum = lum * through + light * (1.0 - through);
+
+  return vec4(tone_map(lum * planet.w), 1.0);
 }
 @end
 
 @fs skybox_fs
+@include_block tone_map
+@include_block sky
+
 uniform samplerCube skybox;
+uniform samplerCube stars;
+uniform samplerCube cloud_cover;
 
 out vec4 frag_color;
 in vec3 tex_coord;
 
 void main() {
-  frag_color = texture(skybox, tex_coord);
+  vec3 through = 1.0 - (1.0 - texture(skybox, tex_coord).rgb) * texture(cloud_cover, tex_coord).r;
+  frag_color = sky_color(normalize(tex_coord), through, texture(stars, tex_coord).rgb);
 }
 @end
 
 @program skybox skybox_vs skybox_fs
+
+@fs skybox_oct_fs
+@include_block tone_map
+@include_block sky
+
+/* the cloud layer and the stars as octahedral maps, see panorama.h. Their
+   border, where bilinear filtering can't follow the fold, is all below
+   the horizon. The clouds' animated cover stays a cube */
+uniform sampler2D skybox_oct;
+uniform sampler2D stars_oct;
+uniform samplerCube cloud_cover;
+
+out vec4 frag_color;
+in vec3 tex_coord;
+
+vec2 oct_uv(vec3 d) {
+  vec2 p = d.xz / (abs(d.x) + abs(d.y) + abs(d.z));
+  if (d.y < 0.0) p = (1.0 - abs(p.yx)) * vec2(p.x < 0.0 ? -1.0 : 1.0, p.y < 0.0 ? -1.0 : 1.0);
+  return p * 0.5 + 0.5;
+}
+
+void main() {
+  vec3 dir = normalize(tex_coord);
+  vec2 uv = oct_uv(dir);
+  vec3 through = 1.0 - (1.0 - texture(skybox_oct, uv).rgb) * texture(cloud_cover, dir).r;
+  frag_color = sky_color(dir, through, texture(stars_oct, uv).rgb);
+}
+@end
+
+@program skybox_oct skybox_vs skybox_oct_fs
@@ -22,6 +22,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#if !defined(SN_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#	include <emmintrin.h>
+#	define SN_SSE2
+#endif
+
 typedef struct
 {
 	sn3_scalar x,y,z,w;
@@ -34,6 +39,18 @@ static sn3_Grad sn3_grad3[ 12 ] =
 	0,1,1,0,	0,-1,1,0,	0,1,-1,0,	0,-1,-1,0,
 };
 
+static sn3_Grad sn4_grad4[ 32 ] =
+{
+	0,1,1,1,	0,1,1,-1,	0,1,-1,1,	0,1,-1,-1,
+	0,-1,1,1,	0,-1,1,-1,	0,-1,-1,1,	0,-1,-1,-1,
+	1,0,1,1,	1,0,1,-1,	1,0,-1,1,	1,0,-1,-1,
+	-1,0,1,1,	-1,0,1,-1,	-1,0,-1,1,	-1,0,-1,-1,
+	1,1,0,1,	1,1,0,-1,	1,-1,0,1,	1,-1,0,-1,
+	-1,1,0,1,	-1,1,0,-1,	-1,-1,0,1,	-1,-1,0,-1,
+	1,1,1,0,	1,1,-1,0,	1,-1,1,0,	1,-1,-1,0,
+	-1,1,1,0,	-1,1,-1,0,	-1,-1,1,0,	-1,-1,-1,0,
+};
+
 static int sn3_singletable[] = 
 {
   151,160,137,91,90,15,
@@ -189,3 +206,920 @@ sn3_scalar sn3_sample( sn3_scalar xin, sn3_scalar yin, sn3_scalar zin )
     // The result is scaled to stay just inside [-1,1]
     return 32.0f * ( n0 + n1 + n2 + n3 );
 }
+
+static __inline__ sn3_scalar sn4_dot4( sn3_Grad g, sn3_scalar x, sn3_scalar y, sn3_scalar z, sn3_scalar w )
+{
+	return g.x*x + g.y*y + g.z*z + g.w*w;
+}
+
+sn3_scalar sn4_sample( sn3_scalar xin, sn3_scalar yin, sn3_scalar zin, sn3_scalar win )
+{
+    // Skew the (x,y,z,w) space to determine which cell of 24 simplices we're in
+    sn3_scalar s = ( xin+yin+zin+win )*F4; // Factor for 4D skewing
+    int i = sn3_fastfloor( xin+s );
+    int j = sn3_fastfloor( yin+s );
+    int k = sn3_fastfloor( zin+s );
+    int l = sn3_fastfloor( win+s );
+    sn3_scalar t = ( i+j+k+l )*G4; // Factor for 4D unskewing
+    sn3_scalar X0 = i-t; // Unskew the cell origin back to (x,y,z,w) space
+    sn3_scalar Y0 = j-t;
+    sn3_scalar Z0 = k-t;
+    sn3_scalar W0 = l-t;
+    sn3_scalar x0 = xin-X0; // The x,y,z,w distances from the cell origin
+    sn3_scalar y0 = yin-Y0;
+    sn3_scalar z0 = zin-Z0;
+    sn3_scalar w0 = win-W0;
+    // For the 4D case, the simplex is a 4D shape I won't even try to describe.
+    // To find out which of the 24 possible simplices we're in, we need to
+    // determine the magnitude ordering of x0, y0, z0 and w0.
+    // Six pair-wise comparisons are performed between each possible pair
+    // of the four coordinates, and the results are used to rank the numbers.
+    int rankx = 0;
+    int ranky = 0;
+    int rankz = 0;
+    int rankw = 0;
+    if (x0 > y0) rankx++; else ranky++;
+    if (x0 > z0) rankx++; else rankz++;
+    if (x0 > w0) rankx++; else rankw++;
+    if (y0 > z0) ranky++; else rankz++;
+    if (y0 > w0) ranky++; else rankw++;
+    if (z0 > w0) rankz++; else rankw++;
+    // simplex[c] is a 4-vector with the numbers 0, 1, 2 and 3 in some order.
+    // Many values of c will never occur, since e.g. x>y>z>w makes x<z, y<w and x<w
+    // impossible. Only the 24 indices which have non-zero entries make any sense.
+    // We use a thresholding to set the coordinates in turn from the largest magnitude.
+    // Rank 3 denotes the largest coordinate.
+    int i1 = rankx >= 3 ? 1 : 0; // The integer offsets for the second simplex corner
+    int j1 = ranky >= 3 ? 1 : 0;
+    int k1 = rankz >= 3 ? 1 : 0;
+    int l1 = rankw >= 3 ? 1 : 0;
+    // Rank 2 denotes the second largest coordinate.
+    int i2 = rankx >= 2 ? 1 : 0; // The integer offsets for the third simplex corner
+    int j2 = ranky >= 2 ? 1 : 0;
+    int k2 = rankz >= 2 ? 1 : 0;
+    int l2 = rankw >= 2 ? 1 : 0;
+    // Rank 1 denotes the second smallest coordinate.
+    int i3 = rankx >= 1 ? 1 : 0; // The integer offsets for the fourth simplex corner
+    int j3 = ranky >= 1 ? 1 : 0;
+    int k3 = rankz >= 1 ? 1 : 0;
+    int l3 = rankw >= 1 ? 1 : 0;
+    // The fifth corner has all coordinate offsets = 1, so no need to compute that.
+    sn3_scalar x1 = x0 - i1 + G4; // Offsets for second corner in (x,y,z,w) coords
+    sn3_scalar y1 = y0 - j1 + G4;
+    sn3_scalar z1 = z0 - k1 + G4;
+    sn3_scalar w1 = w0 - l1 + G4;
+    sn3_scalar x2 = x0 - i2 + 2.0f*G4; // Offsets for third corner in (x,y,z,w) coords
+    sn3_scalar y2 = y0 - j2 + 2.0f*G4;
+    sn3_scalar z2 = z0 - k2 + 2.0f*G4;
+    sn3_scalar w2 = w0 - l2 + 2.0f*G4;
+    sn3_scalar x3 = x0 - i3 + 3.0f*G4; // Offsets for fourth corner in (x,y,z,w) coords
+    sn3_scalar y3 = y0 - j3 + 3.0f*G4;
+    sn3_scalar z3 = z0 - k3 + 3.0f*G4;
+    sn3_scalar w3 = w0 - l3 + 3.0f*G4;
+    sn3_scalar x4 = x0 - 1.0f + 4.0f*G4; // Offsets for last corner in (x,y,z,w) coords
+    sn3_scalar y4 = y0 - 1.0f + 4.0f*G4;
+    sn3_scalar z4 = z0 - 1.0f + 4.0f*G4;
+    sn3_scalar w4 = w0 - 1.0f + 4.0f*G4;
+    // Work out the hashed gradient indices of the five simplex corners
+    int ii = i & 255;
+    int jj = j & 255;
+    int kk = k & 255;
+    int ll = l & 255;
+    int gi0 = sn3_perm[ii+   sn3_perm[jj+   sn3_perm[kk+   sn3_perm[ll   ]]]] % 32;
+    int gi1 = sn3_perm[ii+i1+sn3_perm[jj+j1+sn3_perm[kk+k1+sn3_perm[ll+l1]]]] % 32;
+    int gi2 = sn3_perm[ii+i2+sn3_perm[jj+j2+sn3_perm[kk+k2+sn3_perm[ll+l2]]]] % 32;
+    int gi3 = sn3_perm[ii+i3+sn3_perm[jj+j3+sn3_perm[kk+k3+sn3_perm[ll+l3]]]] % 32;
+    int gi4 = sn3_perm[ii+1+ sn3_perm[jj+1+ sn3_perm[kk+1+ sn3_perm[ll+1 ]]]] % 32;
+    // Calculate the contribution from the five corners
+    const sn3_scalar t0 = 0.6f - x0*x0 - y0*y0 - z0*z0 - w0*w0;
+    const sn3_scalar t1 = 0.6f - x1*x1 - y1*y1 - z1*z1 - w1*w1;
+    const sn3_scalar t2 = 0.6f - x2*x2 - y2*y2 - z2*z2 - w2*w2;
+    const sn3_scalar t3 = 0.6f - x3*x3 - y3*y3 - z3*z3 - w3*w3;
+    const sn3_scalar t4 = 0.6f - x4*x4 - y4*y4 - z4*z4 - w4*w4;
+    const sn3_scalar n0 = t0 < 0 ? 0 : t0*t0*t0*t0 * sn4_dot4(sn4_grad4[gi0], x0, y0, z0, w0);
+    const sn3_scalar n1 = t1 < 0 ? 0 : t1*t1*t1*t1 * sn4_dot4(sn4_grad4[gi1], x1, y1, z1, w1);
+    const sn3_scalar n2 = t2 < 0 ? 0 : t2*t2*t2*t2 * sn4_dot4(sn4_grad4[gi2], x2, y2, z2, w2);
+    const sn3_scalar n3 = t3 < 0 ? 0 : t3*t3*t3*t3 * sn4_dot4(sn4_grad4[gi3], x3, y3, z3, w3);
+    const sn3_scalar n4 = t4 < 0 ? 0 : t4*t4*t4*t4 * sn4_dot4(sn4_grad4[gi4], x4, y4, z4, w4);
+    // Sum up and scale the result to cover the range [-1,1]
+    return 27.0f * ( n0 + n1 + n2 + n3 + n4 );
+}
+
+#if defined(SN_SSE2)
+
+// sn3_fastfloor for four lanes: truncate, then step down where that rounded up
+static __inline__ __m128i sn3_fastfloor4( __m128 x )
+{
+	__m128i xi = _mm_cvttps_epi32( x );
+	__m128 up = _mm_cmplt_ps( x, _mm_cvtepi32_ps( xi ) );
+	return _mm_add_epi32( xi, _mm_castps_si128( up ) );
+}
+
+// One corner's contribution for four lanes, in the same order of operations as sn4_sample
+static __inline__ __m128 sn4_corner4( __m128 x, __m128 y, __m128 z, __m128 w, const int gi[4] )
+{
+	__m128 t = _mm_sub_ps( _mm_set1_ps( 0.6f ), _mm_mul_ps( x, x ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( y, y ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( z, z ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( w, w ) );
+	const sn3_Grad *g0 = &sn4_grad4[gi[0]], *g1 = &sn4_grad4[gi[1]], *g2 = &sn4_grad4[gi[2]], *g3 = &sn4_grad4[gi[3]];
+	__m128 d = _mm_mul_ps( _mm_setr_ps( g0->x, g1->x, g2->x, g3->x ), x );
+	d = _mm_add_ps( d, _mm_mul_ps( _mm_setr_ps( g0->y, g1->y, g2->y, g3->y ), y ) );
+	d = _mm_add_ps( d, _mm_mul_ps( _mm_setr_ps( g0->z, g1->z, g2->z, g3->z ), z ) );
+	d = _mm_add_ps( d, _mm_mul_ps( _mm_setr_ps( g0->w, g1->w, g2->w, g3->w ), w ) );
+	__m128 n = _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( t, t ), t ), t ), d );
+	return _mm_andnot_ps( _mm_cmplt_ps( t, _mm_setzero_ps() ), n );
+}
+
+#endif
+
+// sn4_sample over n points that share the same w, the usual case of a field
+// animated over time. Results are identical to calling sn4_sample per point.
+void sn4_sample_n( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, sn3_scalar win, sn3_scalar *out, int n )
+{
+    int p = 0;
+#if defined(SN_SSE2)
+    const __m128i one = _mm_set1_epi32( 1 );
+    for ( ; p + 4 <= n; p += 4 )
+    {
+        __m128 x = _mm_loadu_ps( xin+p );
+        __m128 y = _mm_loadu_ps( yin+p );
+        __m128 z = _mm_loadu_ps( zin+p );
+        __m128 w = _mm_set1_ps( win );
+        __m128 s = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_add_ps( x, y ), z ), w ), _mm_set1_ps( F4 ) );
+        __m128i i = sn3_fastfloor4( _mm_add_ps( x, s ) );
+        __m128i j = sn3_fastfloor4( _mm_add_ps( y, s ) );
+        __m128i k = sn3_fastfloor4( _mm_add_ps( z, s ) );
+        __m128i l = sn3_fastfloor4( _mm_add_ps( w, s ) );
+        __m128 t = _mm_mul_ps( _mm_cvtepi32_ps( _mm_add_epi32( _mm_add_epi32( _mm_add_epi32( i, j ), k ), l ) ), _mm_set1_ps( G4 ) );
+        __m128 x0 = _mm_sub_ps( x, _mm_sub_ps( _mm_cvtepi32_ps( i ), t ) );
+        __m128 y0 = _mm_sub_ps( y, _mm_sub_ps( _mm_cvtepi32_ps( j ), t ) );
+        __m128 z0 = _mm_sub_ps( z, _mm_sub_ps( _mm_cvtepi32_ps( k ), t ) );
+        __m128 w0 = _mm_sub_ps( w, _mm_sub_ps( _mm_cvtepi32_ps( l ), t ) );
+        // Ranks from the six comparisons: a true compare is -1, which bumps the
+        // first rank and leaves 1 + -1 = 0 for the second.
+        __m128i rank[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        __m128 c[4] = { x0, y0, z0, w0 };
+        for ( int a = 0; a < 4; a++ )
+            for ( int b = a+1; b < 4; b++ )
+            {
+                __m128i gt = _mm_castps_si128( _mm_cmpgt_ps( c[a], c[b] ) );
+                rank[a] = _mm_sub_epi32( rank[a], gt );
+                rank[b] = _mm_add_epi32( rank[b], _mm_add_epi32( gt, one ) );
+            }
+        // Corner offsets are 1.0f where the rank reaches the threshold
+        __m128 o[3][4];
+        for ( int r = 0; r < 3; r++ )
+            for ( int a = 0; a < 4; a++ )
+                o[r][a] = _mm_and_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( rank[a], _mm_set1_epi32( 2-r ) ) ), _mm_set1_ps( 1.0f ) );
+        // The permutation lookups are gathers, done per lane
+        int cell[4][4], rk[4][4], gi[5][4];
+        _mm_storeu_si128( (__m128i*) cell[0], _mm_and_si128( i, _mm_set1_epi32( 255 ) ) );
+        _mm_storeu_si128( (__m128i*) cell[1], _mm_and_si128( j, _mm_set1_epi32( 255 ) ) );
+        _mm_storeu_si128( (__m128i*) cell[2], _mm_and_si128( k, _mm_set1_epi32( 255 ) ) );
+        _mm_storeu_si128( (__m128i*) cell[3], _mm_and_si128( l, _mm_set1_epi32( 255 ) ) );
+        for ( int a = 0; a < 4; a++ )
+            _mm_storeu_si128( (__m128i*) rk[a], rank[a] );
+        for ( int q = 0; q < 4; q++ )
+        {
+            int ii = cell[0][q], jj = cell[1][q], kk = cell[2][q], ll = cell[3][q];
+            for ( int r = 0; r < 3; r++ )
+            {
+                int i1 = rk[0][q] > 2-r, j1 = rk[1][q] > 2-r, k1 = rk[2][q] > 2-r, l1 = rk[3][q] > 2-r;
+                gi[r+1][q] = sn3_perm[ii+i1+sn3_perm[jj+j1+sn3_perm[kk+k1+sn3_perm[ll+l1]]]] % 32;
+            }
+            gi[0][q] = sn3_perm[ii+  sn3_perm[jj+  sn3_perm[kk+  sn3_perm[ll  ]]]] % 32;
+            gi[4][q] = sn3_perm[ii+1+sn3_perm[jj+1+sn3_perm[kk+1+sn3_perm[ll+1]]]] % 32;
+        }
+        __m128 sum = sn4_corner4( x0, y0, z0, w0, gi[0] );
+        for ( int r = 0; r < 3; r++ )
+        {
+            __m128 g = _mm_set1_ps( (r+1)*G4 );
+            sum = _mm_add_ps( sum, sn4_corner4(
+                _mm_add_ps( _mm_sub_ps( x0, o[r][0] ), g ),
+                _mm_add_ps( _mm_sub_ps( y0, o[r][1] ), g ),
+                _mm_add_ps( _mm_sub_ps( z0, o[r][2] ), g ),
+                _mm_add_ps( _mm_sub_ps( w0, o[r][3] ), g ), gi[r+1] ) );
+        }
+        __m128 g = _mm_set1_ps( 4.0f*G4 );
+        __m128 m = _mm_set1_ps( 1.0f );
+        sum = _mm_add_ps( sum, sn4_corner4(
+            _mm_add_ps( _mm_sub_ps( x0, m ), g ),
+            _mm_add_ps( _mm_sub_ps( y0, m ), g ),
+            _mm_add_ps( _mm_sub_ps( z0, m ), g ),
+            _mm_add_ps( _mm_sub_ps( w0, m ), g ), gi[4] ) );
+        _mm_storeu_ps( out+p, _mm_mul_ps( _mm_set1_ps( 27.0f ), sum ) );
+    }
+#endif
+    for ( ; p < n; p++ )
+        out[p] = sn4_sample( xin[p], yin[p], zin[p], win );
+}
+
+// Periodic 3D noise, after Gustavson and McEwan's psrdnoise. The simplex
+// grid is the A3* lattice: lattice coordinates are (y+z, x+z, x+y), and every
+// vertex sits on half-integer (x,y,z). Moving a vertex by an integer period
+// along x, y or z lands on another vertex, so hashing the wrapped vertex makes
+// the noise repeat with exactly that period. A period of 0 doesn't wrap.
+// This is not the lattice of sn3_sample, the two don't match.
+#define SN3P_SCALE	76.0f	// the largest magnitude found by search is 0.0130
+
+// h is twice a vertex coordinate
+static __inline__ int sn3_wrap( int h, int period )
+{
+	if ( period <= 0 )
+		return h;
+	h %= 2*period;
+	return h < 0 ? h + 2*period : h;
+}
+
+static __inline__ int sn3_hash_periodic( int i, int j, int k, int px, int py, int pz )
+{
+	// The vertex, doubled and wrapped in (x,y,z), then back to lattice coords
+	int hx = sn3_wrap( -i+j+k, px );
+	int hy = sn3_wrap( i-j+k, py );
+	int hz = sn3_wrap( i+j-k, pz );
+	int ii = ( (hy+hz)/2 ) & 255;
+	int jj = ( (hx+hz)/2 ) & 255;
+	int kk = ( (hx+hy)/2 ) & 255;
+	return sn3_permMod12[ii+sn3_perm[jj+sn3_perm[kk]]];
+}
+
+sn3_scalar sn3_sample_periodic( sn3_scalar xin, sn3_scalar yin, sn3_scalar zin, int px, int py, int pz )
+{
+    // Find the lattice cell and the position inside it
+    sn3_scalar u = yin+zin;
+    sn3_scalar v = xin+zin;
+    sn3_scalar w = xin+yin;
+    int i = sn3_fastfloor( u );
+    int j = sn3_fastfloor( v );
+    int k = sn3_fastfloor( w );
+    sn3_scalar fu = u-i;
+    sn3_scalar fv = v-j;
+    sn3_scalar fw = w-k;
+    // Rank the fractions, the simplex steps along the largest one first
+    int ranku = 0;
+    int rankv = 0;
+    int rankw = 0;
+    if (fu > fv) ranku++; else rankv++;
+    if (fu > fw) ranku++; else rankw++;
+    if (fv > fw) rankv++; else rankw++;
+    int corner[4][3] =
+    {
+        { i, j, k },
+        { i + (ranku >= 2), j + (rankv >= 2), k + (rankw >= 2) },
+        { i + (ranku >= 1), j + (rankv >= 1), k + (rankw >= 1) },
+        { i+1, j+1, k+1 },
+    };
+    sn3_scalar n[4];
+    for ( int c = 0; c < 4; c++ )
+    {
+        int a = corner[c][0], b = corner[c][1], d = corner[c][2];
+        // Offsets from the (unwrapped) vertex, which is half of (-a+b+d, a-b+d, a+b-d)
+        sn3_scalar x0 = xin - 0.5f*(-a+b+d);
+        sn3_scalar y0 = yin - 0.5f*(a-b+d);
+        sn3_scalar z0 = zin - 0.5f*(a+b-d);
+        int gi = sn3_hash_periodic( a, b, d, px, py, pz );
+        const sn3_scalar t = 0.5f - x0*x0 - y0*y0 - z0*z0;
+        n[c] = t < 0 ? 0 : t*t*t*t * sn3_dot3(sn3_grad3[gi], x0, y0, z0);
+    }
+    return SN3P_SCALE * ( n[0] + n[1] + n[2] + n[3] );
+}
+
+#if defined(SN_SSE2)
+
+// One corner of sn3_sample_periodic for four lanes, lattice coords in a, b, d
+static __inline__ __m128 sn3_corner_periodic4( __m128 x, __m128 y, __m128 z, __m128i a, __m128i b, __m128i d, int px, int py, int pz )
+{
+	__m128 half = _mm_set1_ps( 0.5f );
+	__m128 x0 = _mm_sub_ps( x, _mm_mul_ps( half, _mm_cvtepi32_ps( _mm_add_epi32( _mm_sub_epi32( b, a ), d ) ) ) );
+	__m128 y0 = _mm_sub_ps( y, _mm_mul_ps( half, _mm_cvtepi32_ps( _mm_add_epi32( _mm_sub_epi32( a, b ), d ) ) ) );
+	__m128 z0 = _mm_sub_ps( z, _mm_mul_ps( half, _mm_cvtepi32_ps( _mm_sub_epi32( _mm_add_epi32( a, b ), d ) ) ) );
+	int la[4], lb[4], ld[4];
+	_mm_storeu_si128( (__m128i*) la, a );
+	_mm_storeu_si128( (__m128i*) lb, b );
+	_mm_storeu_si128( (__m128i*) ld, d );
+	const sn3_Grad *g[4];
+	for ( int q = 0; q < 4; q++ )
+		g[q] = &sn3_grad3[sn3_hash_periodic( la[q], lb[q], ld[q], px, py, pz )];
+	__m128 t = _mm_sub_ps( _mm_set1_ps( 0.5f ), _mm_mul_ps( x0, x0 ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( y0, y0 ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( z0, z0 ) );
+	__m128 dot = _mm_mul_ps( _mm_setr_ps( g[0]->x, g[1]->x, g[2]->x, g[3]->x ), x0 );
+	dot = _mm_add_ps( dot, _mm_mul_ps( _mm_setr_ps( g[0]->y, g[1]->y, g[2]->y, g[3]->y ), y0 ) );
+	dot = _mm_add_ps( dot, _mm_mul_ps( _mm_setr_ps( g[0]->z, g[1]->z, g[2]->z, g[3]->z ), z0 ) );
+	__m128 n = _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( t, t ), t ), t ), dot );
+	return _mm_andnot_ps( _mm_cmplt_ps( t, _mm_setzero_ps() ), n );
+}
+
+#endif
+
+// sn3_sample_periodic over n points, with the same results
+void sn3_sample_periodic_n( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, int px, int py, int pz, sn3_scalar *out, int n )
+{
+    int p = 0;
+#if defined(SN_SSE2)
+    const __m128i one = _mm_set1_epi32( 1 );
+    for ( ; p + 4 <= n; p += 4 )
+    {
+        __m128 x = _mm_loadu_ps( xin+p );
+        __m128 y = _mm_loadu_ps( yin+p );
+        __m128 z = _mm_loadu_ps( zin+p );
+        __m128 u = _mm_add_ps( y, z );
+        __m128 v = _mm_add_ps( x, z );
+        __m128 w = _mm_add_ps( x, y );
+        __m128i i = sn3_fastfloor4( u );
+        __m128i j = sn3_fastfloor4( v );
+        __m128i k = sn3_fastfloor4( w );
+        __m128 fu = _mm_sub_ps( u, _mm_cvtepi32_ps( i ) );
+        __m128 fv = _mm_sub_ps( v, _mm_cvtepi32_ps( j ) );
+        __m128 fw = _mm_sub_ps( w, _mm_cvtepi32_ps( k ) );
+        // Ranks as in sn4_sample_n: a true compare is -1
+        __m128i uv = _mm_castps_si128( _mm_cmpgt_ps( fu, fv ) );
+        __m128i uw = _mm_castps_si128( _mm_cmpgt_ps( fu, fw ) );
+        __m128i vw = _mm_castps_si128( _mm_cmpgt_ps( fv, fw ) );
+        __m128i ranku = _mm_sub_epi32( _mm_setzero_si128(), _mm_add_epi32( uv, uw ) );
+        __m128i rankv = _mm_sub_epi32( _mm_add_epi32( uv, one ), vw );
+        __m128i rankw = _mm_add_epi32( _mm_add_epi32( uw, one ), _mm_add_epi32( vw, one ) );
+        __m128 sum = sn3_corner_periodic4( x, y, z, i, j, k, px, py, pz );
+        for ( int r = 1; r >= 0; r-- )
+        {
+            __m128i lim = _mm_set1_epi32( r );
+            sum = _mm_add_ps( sum, sn3_corner_periodic4( x, y, z,
+                _mm_add_epi32( i, _mm_and_si128( _mm_cmpgt_epi32( ranku, lim ), one ) ),
+                _mm_add_epi32( j, _mm_and_si128( _mm_cmpgt_epi32( rankv, lim ), one ) ),
+                _mm_add_epi32( k, _mm_and_si128( _mm_cmpgt_epi32( rankw, lim ), one ) ), px, py, pz ) );
+        }
+        sum = _mm_add_ps( sum, sn3_corner_periodic4( x, y, z,
+            _mm_add_epi32( i, one ), _mm_add_epi32( j, one ), _mm_add_epi32( k, one ), px, py, pz ) );
+        _mm_storeu_ps( out+p, _mm_mul_ps( _mm_set1_ps( SN3P_SCALE ), sum ) );
+    }
+#endif
+    for ( ; p < n; p++ )
+        out[p] = sn3_sample_periodic( xin[p], yin[p], zin[p], px, py, pz );
+}
+
+// One corner of sn3_sample_grad. The contribution is t^4 (g.x) with
+// t = 0.6 - |x|^2, so its gradient is t^4 g - 8 t^3 (g.x) x.
+static __inline__ sn3_scalar sn3_corner_grad( sn3_Grad g, sn3_scalar x, sn3_scalar y, sn3_scalar z, sn3_scalar *d )
+{
+	const sn3_scalar t = 0.6f - x*x - y*y - z*z;
+	if ( t < 0 )
+		return 0;
+	const sn3_scalar t3 = t*t*t;
+	const sn3_scalar t4 = t3*t;
+	const sn3_scalar gx = sn3_dot3( g, x, y, z );
+	const sn3_scalar s = -8.0f*t3*gx;
+	d[0] += t4*g.x + s*x;
+	d[1] += t4*g.y + s*y;
+	d[2] += t4*g.z + s*z;
+	return t4*gx;
+}
+
+// sn3_sample plus its analytic gradient, from the same four corners.
+// The value is identical to sn3_sample's.
+sn3_scalar sn3_sample_grad( sn3_scalar xin, sn3_scalar yin, sn3_scalar zin, sn3_scalar *dnoise_dx, sn3_scalar *dnoise_dy, sn3_scalar *dnoise_dz )
+{
+    // Skew, find the simplex and hash its corners exactly as sn3_sample does
+    sn3_scalar s = ( xin+yin+zin )*F3;
+    int i = sn3_fastfloor( xin+s );
+    int j = sn3_fastfloor( yin+s );
+    int k = sn3_fastfloor( zin+s );
+    sn3_scalar t = ( i+j+k )*G3;
+    sn3_scalar x0 = xin-(i-t);
+    sn3_scalar y0 = yin-(j-t);
+    sn3_scalar z0 = zin-(k-t);
+    int i1, j1, k1;
+    int i2, j2, k2;
+    if (x0>=y0)
+    {
+      if (y0>=z0)
+      {
+        i1=1; j1=0; k1=0; i2=1; j2=1; k2=0;
+      }
+      else
+        if (x0>=z0)
+        {
+          i1=1; j1=0; k1=0; i2=1; j2=0; k2=1;
+        }
+        else
+        {
+          i1=0; j1=0; k1=1; i2=1; j2=0; k2=1;
+        }
+    }
+    else
+    {
+      if (y0<z0)
+      {
+        i1=0; j1=0; k1=1; i2=0; j2=1; k2=1;
+      }
+      else
+        if (x0<z0)
+        {
+          i1=0; j1=1; k1=0; i2=0; j2=1; k2=1;
+        }
+        else
+        {
+          i1=0; j1=1; k1=0; i2=1; j2=1; k2=0;
+        }
+    }
+    sn3_scalar x1 = x0 - i1 + G3;
+    sn3_scalar y1 = y0 - j1 + G3;
+    sn3_scalar z1 = z0 - k1 + G3;
+    sn3_scalar x2 = x0 - i2 + 2.0f*G3;
+    sn3_scalar y2 = y0 - j2 + 2.0f*G3;
+    sn3_scalar z2 = z0 - k2 + 2.0f*G3;
+    sn3_scalar x3 = x0 - 1.0f + 3.0f*G3;
+    sn3_scalar y3 = y0 - 1.0f + 3.0f*G3;
+    sn3_scalar z3 = z0 - 1.0f + 3.0f*G3;
+    int ii = i & 255;
+    int jj = j & 255;
+    int kk = k & 255;
+    int gi0 = sn3_permMod12[ii+   sn3_perm[jj+   sn3_perm[kk   ]]];
+    int gi1 = sn3_permMod12[ii+i1+sn3_perm[jj+j1+sn3_perm[kk+k1]]];
+    int gi2 = sn3_permMod12[ii+i2+sn3_perm[jj+j2+sn3_perm[kk+k2]]];
+    int gi3 = sn3_permMod12[ii+1+ sn3_perm[jj+1+ sn3_perm[kk+1 ]]];
+    // Each corner adds its value and its gradient
+    sn3_scalar d[3] = { 0, 0, 0 };
+    const sn3_scalar n0 = sn3_corner_grad( sn3_grad3[gi0], x0, y0, z0, d );
+    const sn3_scalar n1 = sn3_corner_grad( sn3_grad3[gi1], x1, y1, z1, d );
+    const sn3_scalar n2 = sn3_corner_grad( sn3_grad3[gi2], x2, y2, z2, d );
+    const sn3_scalar n3 = sn3_corner_grad( sn3_grad3[gi3], x3, y3, z3, d );
+    *dnoise_dx = 32.0f * d[0];
+    *dnoise_dy = 32.0f * d[1];
+    *dnoise_dz = 32.0f * d[2];
+    return 32.0f * ( n0 + n1 + n2 + n3 );
+}
+
+#if defined(SN_SSE2)
+
+// The simplex of sn3_sample for four lanes: offsets of the four corners in
+// c[corner][axis], the cell in cell[axis] and the steps to the second and
+// third corners in step[corner-1][axis], as all-ones where the step is 1
+static __inline__ void sn3_skew4( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, __m128 c[4][3], __m128i cell[3], __m128i step[2][3] )
+{
+	const __m128i one = _mm_set1_epi32( 1 );
+	__m128 x = _mm_loadu_ps( xin );
+	__m128 y = _mm_loadu_ps( yin );
+	__m128 z = _mm_loadu_ps( zin );
+	__m128 s = _mm_mul_ps( _mm_add_ps( _mm_add_ps( x, y ), z ), _mm_set1_ps( F3 ) );
+	__m128i i = sn3_fastfloor4( _mm_add_ps( x, s ) );
+	__m128i j = sn3_fastfloor4( _mm_add_ps( y, s ) );
+	__m128i k = sn3_fastfloor4( _mm_add_ps( z, s ) );
+	__m128 t = _mm_mul_ps( _mm_cvtepi32_ps( _mm_add_epi32( _mm_add_epi32( i, j ), k ) ), _mm_set1_ps( G3 ) );
+	__m128 x0 = _mm_sub_ps( x, _mm_sub_ps( _mm_cvtepi32_ps( i ), t ) );
+	__m128 y0 = _mm_sub_ps( y, _mm_sub_ps( _mm_cvtepi32_ps( j ), t ) );
+	__m128 z0 = _mm_sub_ps( z, _mm_sub_ps( _mm_cvtepi32_ps( k ), t ) );
+	// Ranking with >= picks the same simplex as sn3_sample's if-tree,
+	// ties included; a true compare is -1
+	__m128i xy = _mm_castps_si128( _mm_cmpge_ps( x0, y0 ) );
+	__m128i xz = _mm_castps_si128( _mm_cmpge_ps( x0, z0 ) );
+	__m128i yz = _mm_castps_si128( _mm_cmpge_ps( y0, z0 ) );
+	__m128i rank[3] = {
+		_mm_sub_epi32( _mm_setzero_si128(), _mm_add_epi32( xy, xz ) ),
+		_mm_sub_epi32( _mm_add_epi32( xy, one ), yz ),
+		_mm_add_epi32( _mm_add_epi32( xz, one ), _mm_add_epi32( yz, one ) ),
+	};
+	cell[0] = i;
+	cell[1] = j;
+	cell[2] = k;
+	c[0][0] = x0;
+	c[0][1] = y0;
+	c[0][2] = z0;
+	for ( int r = 0; r < 2; r++ )
+	{
+		__m128 g = _mm_set1_ps( (r+1)*G3 );
+		for ( int a = 0; a < 3; a++ )
+		{
+			step[r][a] = _mm_cmpgt_epi32( rank[a], _mm_set1_epi32( 1-r ) );
+			__m128 o = _mm_and_ps( _mm_castsi128_ps( step[r][a] ), _mm_set1_ps( 1.0f ) );
+			c[r+1][a] = _mm_add_ps( _mm_sub_ps( c[0][a], o ), g );
+		}
+	}
+	for ( int a = 0; a < 3; a++ )
+		c[3][a] = _mm_add_ps( _mm_sub_ps( c[0][a], _mm_set1_ps( 1.0f ) ), _mm_set1_ps( 3.0f*G3 ) );
+}
+
+// sn3_skew4 plus the gradient indices of the corners, gi[corner][lane]
+static __inline__ void sn3_simplex4( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, __m128 c[4][3], int gi[4][4] )
+{
+	__m128i cell[3], step[2][3];
+	sn3_skew4( xin, yin, zin, c, cell, step );
+	int ijk[3][4], o[2][3][4];
+	for ( int a = 0; a < 3; a++ )
+	{
+		_mm_storeu_si128( (__m128i*) ijk[a], _mm_and_si128( cell[a], _mm_set1_epi32( 255 ) ) );
+		for ( int r = 0; r < 2; r++ )
+			_mm_storeu_si128( (__m128i*) o[r][a], _mm_sub_epi32( _mm_setzero_si128(), step[r][a] ) );
+	}
+	for ( int q = 0; q < 4; q++ )
+	{
+		int ii = ijk[0][q], jj = ijk[1][q], kk = ijk[2][q];
+		for ( int r = 0; r < 2; r++ )
+		{
+			int i1 = o[r][0][q], j1 = o[r][1][q], k1 = o[r][2][q];
+			gi[r+1][q] = sn3_permMod12[ii+i1+sn3_perm[jj+j1+sn3_perm[kk+k1]]];
+		}
+		gi[0][q] = sn3_permMod12[ii+  sn3_perm[jj+  sn3_perm[kk  ]]];
+		gi[3][q] = sn3_permMod12[ii+1+sn3_perm[jj+1+sn3_perm[kk+1]]];
+	}
+}
+
+// One corner of sn3_sample for four lanes
+static __inline__ __m128 sn3_corner4( __m128 x, __m128 y, __m128 z, const int gi[4] )
+{
+	__m128 t = _mm_sub_ps( _mm_set1_ps( 0.6f ), _mm_mul_ps( x, x ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( y, y ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( z, z ) );
+	const sn3_Grad *g0 = &sn3_grad3[gi[0]], *g1 = &sn3_grad3[gi[1]], *g2 = &sn3_grad3[gi[2]], *g3 = &sn3_grad3[gi[3]];
+	__m128 d = _mm_mul_ps( _mm_setr_ps( g0->x, g1->x, g2->x, g3->x ), x );
+	d = _mm_add_ps( d, _mm_mul_ps( _mm_setr_ps( g0->y, g1->y, g2->y, g3->y ), y ) );
+	d = _mm_add_ps( d, _mm_mul_ps( _mm_setr_ps( g0->z, g1->z, g2->z, g3->z ), z ) );
+	__m128 n = _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( t, t ), t ), t ), d );
+	return _mm_andnot_ps( _mm_cmplt_ps( t, _mm_setzero_ps() ), n );
+}
+
+// sn3_corner_grad for four lanes; lanes outside the corner's reach add nothing
+static __inline__ __m128 sn3_corner_grad4( __m128 x, __m128 y, __m128 z, const int gi[4], __m128 d[3] )
+{
+	__m128 t = _mm_sub_ps( _mm_set1_ps( 0.6f ), _mm_mul_ps( x, x ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( y, y ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( z, z ) );
+	__m128 live = _mm_cmpge_ps( t, _mm_setzero_ps() );
+	const sn3_Grad *g0 = &sn3_grad3[gi[0]], *g1 = &sn3_grad3[gi[1]], *g2 = &sn3_grad3[gi[2]], *g3 = &sn3_grad3[gi[3]];
+	__m128 gx = _mm_setr_ps( g0->x, g1->x, g2->x, g3->x );
+	__m128 gy = _mm_setr_ps( g0->y, g1->y, g2->y, g3->y );
+	__m128 gz = _mm_setr_ps( g0->z, g1->z, g2->z, g3->z );
+	__m128 dot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( gx, x ), _mm_mul_ps( gy, y ) ), _mm_mul_ps( gz, z ) );
+	__m128 t3 = _mm_mul_ps( _mm_mul_ps( t, t ), t );
+	__m128 t4 = _mm_and_ps( live, _mm_mul_ps( t3, t ) );
+	__m128 s = _mm_and_ps( live, _mm_mul_ps( _mm_mul_ps( _mm_set1_ps( -8.0f ), t3 ), dot ) );
+	d[0] = _mm_add_ps( d[0], _mm_add_ps( _mm_mul_ps( t4, gx ), _mm_mul_ps( s, x ) ) );
+	d[1] = _mm_add_ps( d[1], _mm_add_ps( _mm_mul_ps( t4, gy ), _mm_mul_ps( s, y ) ) );
+	d[2] = _mm_add_ps( d[2], _mm_add_ps( _mm_mul_ps( t4, gz ), _mm_mul_ps( s, z ) ) );
+	return _mm_mul_ps( t4, dot );
+}
+
+#endif
+
+// sn3_sample over n points, with the same results
+void sn3_sample_n( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, sn3_scalar *out, int n )
+{
+    int p = 0;
+#if defined(SN_SSE2)
+    for ( ; p + 4 <= n; p += 4 )
+    {
+        __m128 c[4][3];
+        int gi[4][4];
+        sn3_simplex4( xin+p, yin+p, zin+p, c, gi );
+        __m128 sum = sn3_corner4( c[0][0], c[0][1], c[0][2], gi[0] );
+        for ( int r = 1; r < 4; r++ )
+            sum = _mm_add_ps( sum, sn3_corner4( c[r][0], c[r][1], c[r][2], gi[r] ) );
+        _mm_storeu_ps( out+p, _mm_mul_ps( _mm_set1_ps( 32.0f ), sum ) );
+    }
+#endif
+    for ( ; p < n; p++ )
+        out[p] = sn3_sample( xin[p], yin[p], zin[p] );
+}
+
+// sn3_sample_grad over n points, with the same results
+void sn3_sample_grad_n( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, sn3_scalar *out, sn3_scalar *dx, sn3_scalar *dy, sn3_scalar *dz, int n )
+{
+    int p = 0;
+#if defined(SN_SSE2)
+    for ( ; p + 4 <= n; p += 4 )
+    {
+        __m128 c[4][3];
+        int gi[4][4];
+        sn3_simplex4( xin+p, yin+p, zin+p, c, gi );
+        __m128 d[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        __m128 sum = sn3_corner_grad4( c[0][0], c[0][1], c[0][2], gi[0], d );
+        for ( int r = 1; r < 4; r++ )
+            sum = _mm_add_ps( sum, sn3_corner_grad4( c[r][0], c[r][1], c[r][2], gi[r], d ) );
+        __m128 scale = _mm_set1_ps( 32.0f );
+        _mm_storeu_ps( out+p, _mm_mul_ps( scale, sum ) );
+        _mm_storeu_ps( dx+p, _mm_mul_ps( scale, d[0] ) );
+        _mm_storeu_ps( dy+p, _mm_mul_ps( scale, d[1] ) );
+        _mm_storeu_ps( dz+p, _mm_mul_ps( scale, d[2] ) );
+    }
+#endif
+    for ( ; p < n; p++ )
+        out[p] = sn3_sample_grad( xin[p], yin[p], zin[p], dx+p, dy+p, dz+p );
+}
+
+// Table-free 3D simplex noise. The simplex is sn3_sample's, but a corner's
+// gradient comes from an integer hash of its lattice coordinates instead of
+// three dependent loads from sn3_perm, so it vectorizes without gathers and
+// doesn't repeat every 256 units. The hash multiplies each coordinate by a
+// large odd constant and mixes the sum with the first two rounds of
+// MurmurHash3's finalizer; the top four bits pick one of Perlin's sixteen
+// "improved noise" gradients (the twelve cube edges, four of them twice),
+// which need no table either. Same range and character as sn3_sample,
+// a different pattern.
+#define SN3H_I	0x8da6b343u
+#define SN3H_J	0xd8163841u
+#define SN3H_K	0xcb1ab31fu
+
+static __inline__ unsigned int sn3_hash( unsigned int h )
+{
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	return h >> 28; // the last xor-shift of the finalizer wouldn't touch these
+}
+
+static __inline__ sn3_scalar sn3_grad_hash( unsigned int h, sn3_scalar x, sn3_scalar y, sn3_scalar z )
+{
+	// Branch-free: the index is random, so branches would mispredict
+	const sn3_scalar c[3] = { x, y, z };
+	sn3_scalar u = c[h >= 8];
+	sn3_scalar v = c[h < 4 ? 1 : 2 - ( ( h & 13 ) == 12 ) * 2];
+	return u * ( 1 - (int) ( h & 1 ) * 2 ) + v * ( 1 - (int) ( h & 2 ) );
+}
+
+sn3_scalar sn3_sample_hash( sn3_scalar xin, sn3_scalar yin, sn3_scalar zin )
+{
+    // Skew the input space to determine which simplex cell we're in
+    sn3_scalar s = ( xin+yin+zin )*F3;
+    int i = sn3_fastfloor( xin+s );
+    int j = sn3_fastfloor( yin+s );
+    int k = sn3_fastfloor( zin+s );
+    sn3_scalar t = ( i+j+k )*G3;
+    sn3_scalar x0 = xin-( i-t );
+    sn3_scalar y0 = yin-( j-t );
+    sn3_scalar z0 = zin-( k-t );
+    // The same ranking as sn3_sample's if-tree, ties included
+    int xy = x0>=y0, xz = x0>=z0, yz = y0>=z0;
+    int i1 = xy & xz, j1 = (!xy) & yz, k1 = (!xz) & (!yz);
+    int i2 = xy | xz, j2 = (!xy) | yz, k2 = (!xz) | (!yz);
+    sn3_scalar x1 = x0 - i1 + G3;
+    sn3_scalar y1 = y0 - j1 + G3;
+    sn3_scalar z1 = z0 - k1 + G3;
+    sn3_scalar x2 = x0 - i2 + 2.0f*G3;
+    sn3_scalar y2 = y0 - j2 + 2.0f*G3;
+    sn3_scalar z2 = z0 - k2 + 2.0f*G3;
+    sn3_scalar x3 = x0 - 1.0f + 3.0f*G3;
+    sn3_scalar y3 = y0 - 1.0f + 3.0f*G3;
+    sn3_scalar z3 = z0 - 1.0f + 3.0f*G3;
+    // Hash the corners; stepping along an axis adds that axis' constant
+    unsigned int base = (unsigned int) i*SN3H_I + (unsigned int) j*SN3H_J + (unsigned int) k*SN3H_K;
+    unsigned int h0 = sn3_hash( base );
+    unsigned int h1 = sn3_hash( base + i1*SN3H_I + j1*SN3H_J + k1*SN3H_K );
+    unsigned int h2 = sn3_hash( base + i2*SN3H_I + j2*SN3H_J + k2*SN3H_K );
+    unsigned int h3 = sn3_hash( base + SN3H_I + SN3H_J + SN3H_K );
+    const sn3_scalar t0 = 0.6f - x0*x0 - y0*y0 - z0*z0;
+    const sn3_scalar t1 = 0.6f - x1*x1 - y1*y1 - z1*z1;
+    const sn3_scalar t2 = 0.6f - x2*x2 - y2*y2 - z2*z2;
+    const sn3_scalar t3 = 0.6f - x3*x3 - y3*y3 - z3*z3;
+    const sn3_scalar n0 = t0 < 0 ? 0 : t0*t0*t0*t0 * sn3_grad_hash( h0, x0, y0, z0 );
+    const sn3_scalar n1 = t1 < 0 ? 0 : t1*t1*t1*t1 * sn3_grad_hash( h1, x1, y1, z1 );
+    const sn3_scalar n2 = t2 < 0 ? 0 : t2*t2*t2*t2 * sn3_grad_hash( h2, x2, y2, z2 );
+    const sn3_scalar n3 = t3 < 0 ? 0 : t3*t3*t3*t3 * sn3_grad_hash( h3, x3, y3, z3 );
+    return 32.0f * ( n0 + n1 + n2 + n3 );
+}
+
+#if defined(SN_SSE2)
+
+// 32-bit multiply by a constant; SSE2 only multiplies two lanes at a time
+static __inline__ __m128i sn3_mullo4( __m128i a, unsigned int b )
+{
+	__m128i bb = _mm_set1_epi32( (int) b );
+	__m128i even = _mm_mul_epu32( a, bb );
+	__m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), bb );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0,0,2,0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0,0,2,0 ) ) );
+}
+
+// One corner of sn3_sample_hash for four lanes, from the unmixed hash h
+static __inline__ __m128 sn3_corner_hash4( __m128 x, __m128 y, __m128 z, __m128i h )
+{
+	h = _mm_xor_si128( h, _mm_srli_epi32( h, 16 ) );
+	h = sn3_mullo4( h, 0x85ebca6bu );
+	h = _mm_xor_si128( h, _mm_srli_epi32( h, 13 ) );
+	h = _mm_srli_epi32( sn3_mullo4( h, 0xc2b2ae35u ), 28 );
+	__m128 lt8 = _mm_castsi128_ps( _mm_cmplt_epi32( h, _mm_set1_epi32( 8 ) ) );
+	__m128 lt4 = _mm_castsi128_ps( _mm_cmplt_epi32( h, _mm_set1_epi32( 4 ) ) );
+	__m128 hx = _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128( h, _mm_set1_epi32( 13 ) ), _mm_set1_epi32( 12 ) ) );
+	__m128 u = _mm_or_ps( _mm_and_ps( lt8, x ), _mm_andnot_ps( lt8, y ) );
+	__m128 v = _mm_or_ps( _mm_and_ps( hx, x ), _mm_andnot_ps( hx, z ) );
+	v = _mm_or_ps( _mm_and_ps( lt4, y ), _mm_andnot_ps( lt4, v ) );
+	// bits 0 and 1 of the hash flip the signs of u and v
+	u = _mm_xor_ps( u, _mm_castsi128_ps( _mm_slli_epi32( h, 31 ) ) );
+	v = _mm_xor_ps( v, _mm_castsi128_ps( _mm_slli_epi32( _mm_srli_epi32( h, 1 ), 31 ) ) );
+	__m128 d = _mm_add_ps( u, v );
+	__m128 t = _mm_sub_ps( _mm_set1_ps( 0.6f ), _mm_mul_ps( x, x ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( y, y ) );
+	t = _mm_sub_ps( t, _mm_mul_ps( z, z ) );
+	__m128 n = _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( _mm_mul_ps( t, t ), t ), t ), d );
+	return _mm_andnot_ps( _mm_cmplt_ps( t, _mm_setzero_ps() ), n );
+}
+
+#endif
+
+// sn3_sample_hash over n points, with the same results
+void sn3_sample_hash_n( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, sn3_scalar *out, int n )
+{
+    int p = 0;
+#if defined(SN_SSE2)
+    const unsigned int axis[3] = { SN3H_I, SN3H_J, SN3H_K };
+    for ( ; p + 4 <= n; p += 4 )
+    {
+        __m128 c[4][3];
+        __m128i cell[3], step[2][3];
+        sn3_skew4( xin+p, yin+p, zin+p, c, cell, step );
+        __m128i base = _mm_setzero_si128();
+        __m128i h[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        for ( int a = 0; a < 3; a++ )
+        {
+            __m128i m = _mm_set1_epi32( (int) axis[a] );
+            base = _mm_add_epi32( base, sn3_mullo4( cell[a], axis[a] ) );
+            h[1] = _mm_add_epi32( h[1], _mm_and_si128( step[0][a], m ) );
+            h[2] = _mm_add_epi32( h[2], _mm_and_si128( step[1][a], m ) );
+            h[3] = _mm_add_epi32( h[3], m );
+        }
+        __m128 sum = sn3_corner_hash4( c[0][0], c[0][1], c[0][2], base );
+        for ( int r = 1; r < 4; r++ )
+            sum = _mm_add_ps( sum, sn3_corner_hash4( c[r][0], c[r][1], c[r][2], _mm_add_epi32( base, h[r] ) ) );
+        _mm_storeu_ps( out+p, _mm_mul_ps( _mm_set1_ps( 32.0f ), sum ) );
+    }
+#endif
+    for ( ; p < n; p++ )
+        out[p] = sn3_sample_hash( xin[p], yin[p], zin[p] );
+}
+
+// Fixed-point 3D simplex noise, for bakes that must come out bit-identical
+// on every machine. Float noise depends on whether the compiler contracts
+// a*b+c into FMAs and on how it vectorizes; here the input is scaled once,
+// truncated to an integer, and everything after that is integer arithmetic
+// until a single int-to-float conversion and multiply at the end. Those are
+// correctly rounded everywhere, so the scalar form, the SSE2 form and any
+// future width agree exactly. The lattice and the gradients are those of
+// sn3_sample_hash, which it follows to within about 2e-3.
+//
+// Coordinates are in units of 1/12288 (3*4096), so that the unskew factor
+// 1/6 is a whole number of units. The skew needs a floor division by 3,
+// done with the usual multiply by 0xAAAAAAAB on an offset, unsigned value.
+// Inputs must stay within +-20000.
+#define SN3F_UNIT	12288
+#define SN3F_T0	90596966	// 0.6 in units squared
+#define SN3F_SCALE	( 32.0f / ( 52488.0f * SN3F_UNIT ) )	// from t^4 * dot units back to sn3_sample's range
+
+static __inline__ int sn3_floor3( int a )
+{
+	unsigned int u = (unsigned int) a + 0x60000000u;
+	return (int) ( ( (unsigned long long) u * 0xAAAAAAABull ) >> 33 ) - 0x20000000;
+}
+
+// One corner: t = 0.6 - |x|^2 goes from units^2 to Q15-ish steps so that
+// t^4 * dot stays within 32 bits
+static __inline__ int sn3_corner_fixed( unsigned int h, int x, int y, int z )
+{
+	int t = SN3F_T0 - x*x - y*y - z*z;
+	if ( t < 0 ) return 0;
+	t >>= 12;
+	t = ( t*t ) >> 15;
+	t = ( t*t ) >> 15;
+	const int c[3] = { x, y, z };
+	int u = c[h >= 8];
+	int v = c[h < 4 ? 1 : 2 - ( ( h & 13 ) == 12 ) * 2];
+	int su = -(int) ( h & 1 ), sv = -(int) ( ( h >> 1 ) & 1 );
+	return t * ( ( ( u ^ su ) - su ) + ( ( v ^ sv ) - sv ) );
+}
+
+sn3_scalar sn3_sample_fixed( sn3_scalar xin, sn3_scalar yin, sn3_scalar zin )
+{
+    int X = (int) ( xin * (sn3_scalar) SN3F_UNIT );
+    int Y = (int) ( yin * (sn3_scalar) SN3F_UNIT );
+    int Z = (int) ( zin * (sn3_scalar) SN3F_UNIT );
+    // Skew, floor to the cell, unskew; shifts of negative values are arithmetic
+    int s = sn3_floor3( X+Y+Z );
+    int i = sn3_floor3( X+s ) >> 12;
+    int j = sn3_floor3( Y+s ) >> 12;
+    int k = sn3_floor3( Z+s ) >> 12;
+    int t = ( i+j+k ) * ( SN3F_UNIT/6 );
+    int x0 = X - i*SN3F_UNIT + t;
+    int y0 = Y - j*SN3F_UNIT + t;
+    int z0 = Z - k*SN3F_UNIT + t;
+    int xy = x0>=y0, xz = x0>=z0, yz = y0>=z0;
+    int i1 = xy & xz, j1 = (!xy) & yz, k1 = (!xz) & (!yz);
+    int i2 = xy | xz, j2 = (!xy) | yz, k2 = (!xz) | (!yz);
+    unsigned int base = (unsigned int) i*SN3H_I + (unsigned int) j*SN3H_J + (unsigned int) k*SN3H_K;
+    int n = sn3_corner_fixed( sn3_hash( base ), x0, y0, z0 );
+    n += sn3_corner_fixed( sn3_hash( base + i1*SN3H_I + j1*SN3H_J + k1*SN3H_K ),
+                           x0 - i1*SN3F_UNIT + SN3F_UNIT/6, y0 - j1*SN3F_UNIT + SN3F_UNIT/6, z0 - k1*SN3F_UNIT + SN3F_UNIT/6 );
+    n += sn3_corner_fixed( sn3_hash( base + i2*SN3H_I + j2*SN3H_J + k2*SN3H_K ),
+                           x0 - i2*SN3F_UNIT + SN3F_UNIT/3, y0 - j2*SN3F_UNIT + SN3F_UNIT/3, z0 - k2*SN3F_UNIT + SN3F_UNIT/3 );
+    n += sn3_corner_fixed( sn3_hash( base + SN3H_I + SN3H_J + SN3H_K ),
+                           x0 - SN3F_UNIT/2, y0 - SN3F_UNIT/2, z0 - SN3F_UNIT/2 );
+    return (sn3_scalar) n * SN3F_SCALE;
+}
+
+#if defined(SN_SSE2)
+
+static __inline__ __m128i sn3_floor3_4( __m128i a )
+{
+	const __m128i m = _mm_set1_epi32( (int) 0xAAAAAAABu );
+	__m128i u = _mm_add_epi32( a, _mm_set1_epi32( 0x60000000 ) );
+	__m128i even = _mm_srli_epi64( _mm_mul_epu32( u, m ), 33 );
+	__m128i odd = _mm_srli_epi64( _mm_mul_epu32( _mm_srli_epi64( u, 32 ), m ), 33 );
+	return _mm_sub_epi32( _mm_or_si128( even, _mm_slli_epi64( odd, 32 ) ), _mm_set1_epi32( 0x20000000 ) );
+}
+
+static __inline__ __m128i sn3_mul4( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0,0,2,0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0,0,2,0 ) ) );
+}
+
+static __inline__ __m128i sn3_select4( __m128i mask, __m128i a, __m128i b )
+{
+	return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+// sn3_corner_fixed for four lanes, from the unmixed hash h
+static __inline__ __m128i sn3_corner_fixed4( __m128i h, __m128i x, __m128i y, __m128i z )
+{
+	h = _mm_xor_si128( h, _mm_srli_epi32( h, 16 ) );
+	h = sn3_mullo4( h, 0x85ebca6bu );
+	h = _mm_xor_si128( h, _mm_srli_epi32( h, 13 ) );
+	h = _mm_srli_epi32( sn3_mullo4( h, 0xc2b2ae35u ), 28 );
+	__m128i t = _mm_sub_epi32( _mm_set1_epi32( SN3F_T0 ), sn3_mul4( x, x ) );
+	t = _mm_sub_epi32( t, sn3_mul4( y, y ) );
+	t = _mm_sub_epi32( t, sn3_mul4( z, z ) );
+	t = _mm_andnot_si128( _mm_cmplt_epi32( t, _mm_setzero_si128() ), t );
+	t = _mm_srai_epi32( t, 12 );
+	t = _mm_srai_epi32( sn3_mul4( t, t ), 15 );
+	t = _mm_srai_epi32( sn3_mul4( t, t ), 15 );
+	__m128i lt8 = _mm_cmplt_epi32( h, _mm_set1_epi32( 8 ) );
+	__m128i lt4 = _mm_cmplt_epi32( h, _mm_set1_epi32( 4 ) );
+	__m128i hx = _mm_cmpeq_epi32( _mm_and_si128( h, _mm_set1_epi32( 13 ) ), _mm_set1_epi32( 12 ) );
+	__m128i u = sn3_select4( lt8, x, y );
+	__m128i v = sn3_select4( lt4, y, sn3_select4( hx, x, z ) );
+	__m128i su = _mm_sub_epi32( _mm_setzero_si128(), _mm_and_si128( h, _mm_set1_epi32( 1 ) ) );
+	__m128i sv = _mm_sub_epi32( _mm_setzero_si128(), _mm_and_si128( _mm_srli_epi32( h, 1 ), _mm_set1_epi32( 1 ) ) );
+	u = _mm_sub_epi32( _mm_xor_si128( u, su ), su );
+	v = _mm_sub_epi32( _mm_xor_si128( v, sv ), sv );
+	return sn3_mul4( t, _mm_add_epi32( u, v ) );
+}
+
+#endif
+
+// sn3_sample_fixed over n points, with the same results
+void sn3_sample_fixed_n( const sn3_scalar *xin, const sn3_scalar *yin, const sn3_scalar *zin, sn3_scalar *out, int n )
+{
+    int p = 0;
+#if defined(SN_SSE2)
+    const __m128 unit = _mm_set1_ps( (sn3_scalar) SN3F_UNIT );
+    const __m128i axis[3] = { _mm_set1_epi32( (int) SN3H_I ), _mm_set1_epi32( (int) SN3H_J ), _mm_set1_epi32( (int) SN3H_K ) };
+    for ( ; p + 4 <= n; p += 4 )
+    {
+        __m128i X[3] = {
+            _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( xin+p ), unit ) ),
+            _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( yin+p ), unit ) ),
+            _mm_cvttps_epi32( _mm_mul_ps( _mm_loadu_ps( zin+p ), unit ) ),
+        };
+        __m128i s = sn3_floor3_4( _mm_add_epi32( _mm_add_epi32( X[0], X[1] ), X[2] ) );
+        __m128i cell[3], c0[3];
+        for ( int a = 0; a < 3; a++ )
+            cell[a] = _mm_srai_epi32( sn3_floor3_4( _mm_add_epi32( X[a], s ) ), 12 );
+        __m128i t = _mm_slli_epi32( _mm_add_epi32( _mm_add_epi32( cell[0], cell[1] ), cell[2] ), 11 );
+        for ( int a = 0; a < 3; a++ )
+        {
+            // cell * 12288 = (cell * 3) << 12
+            __m128i origin = _mm_slli_epi32( _mm_add_epi32( _mm_add_epi32( cell[a], cell[a] ), cell[a] ), 12 );
+            c0[a] = _mm_add_epi32( _mm_sub_epi32( X[a], origin ), t );
+        }
+        // Ranks as in sn3_skew4; a >= b is not b > a
+        const __m128i ones = _mm_set1_epi32( -1 ), one = _mm_set1_epi32( 1 );
+        __m128i xy = _mm_xor_si128( _mm_cmpgt_epi32( c0[1], c0[0] ), ones );
+        __m128i xz = _mm_xor_si128( _mm_cmpgt_epi32( c0[2], c0[0] ), ones );
+        __m128i yz = _mm_xor_si128( _mm_cmpgt_epi32( c0[2], c0[1] ), ones );
+        __m128i rank[3] = {
+            _mm_sub_epi32( _mm_setzero_si128(), _mm_add_epi32( xy, xz ) ),
+            _mm_sub_epi32( _mm_add_epi32( xy, one ), yz ),
+            _mm_add_epi32( _mm_add_epi32( xz, one ), _mm_add_epi32( yz, one ) ),
+        };
+        __m128i base = _mm_setzero_si128();
+        for ( int a = 0; a < 3; a++ )
+            base = _mm_add_epi32( base, sn3_mul4( cell[a], axis[a] ) );
+        __m128i sum = sn3_corner_fixed4( base, c0[0], c0[1], c0[2] );
+        for ( int r = 0; r < 2; r++ )
+        {
+            __m128i h = base, c[3];
+            for ( int a = 0; a < 3; a++ )
+            {
+                __m128i step = _mm_cmpgt_epi32( rank[a], _mm_set1_epi32( 1-r ) );
+                h = _mm_add_epi32( h, _mm_and_si128( step, axis[a] ) );
+                c[a] = _mm_add_epi32( _mm_sub_epi32( c0[a], _mm_and_si128( step, _mm_set1_epi32( SN3F_UNIT ) ) ), _mm_set1_epi32( (r+1) * SN3F_UNIT/6 ) );
+            }
+            sum = _mm_add_epi32( sum, sn3_corner_fixed4( h, c[0], c[1], c[2] ) );
+        }
+        __m128i h3 = _mm_add_epi32( _mm_add_epi32( _mm_add_epi32( base, axis[0] ), axis[1] ), axis[2] );
+        __m128i half = _mm_set1_epi32( SN3F_UNIT/2 );
+        sum = _mm_add_epi32( sum, sn3_corner_fixed4( h3, _mm_sub_epi32( c0[0], half ), _mm_sub_epi32( c0[1], half ), _mm_sub_epi32( c0[2], half ) ) );
+        _mm_storeu_ps( out+p, _mm_mul_ps( _mm_cvtepi32_ps( sum ), _mm_set1_ps( SN3F_SCALE ) ) );
+    }
+#endif
+    for ( ; p < n; p++ )
+        out[p] = sn3_sample_fixed( xin[p], yin[p], zin[p] );
+}
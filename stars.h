@@ -0,0 +1,281 @@
+#ifndef _STARS_H_
+
+#define _STARS_H_
+
+/* A procedural star field, splatted into a sky texture star by star
+   instead of evaluated per texel.
+
+   stars_scatter() draws the stars from a seeded generator: directions
+   uniform over the sphere, two and a half times as many stars per
+   magnitude fainter, each tinted somewhere between orange and
+   blue-white. The same seed and count give the same sky everywhere.
+
+   stars_bake() splats them into a CubeImg, either six cube faces or one
+   octahedral map (see panorama.h). Every star spreads its illuminance
+   over (2 STARS_RADIUS + 1)^2 texels with a gaussian point spread
+   function, divided by the texels' solid angle, so what comes out is
+   radiance. Footprints that cross an edge continue on the texels the
+   layout continues with. Stars are binned into STARS_TILE^2 tiles of
+   every texel their footprint touches, then each tile with stars in it
+   is accumulated in floats on the job pool, and the texels stars reached
+   are stored packed. Tiles without stars are never touched, so the cost
+   follows the star count; the image has to start out zeroed.
+
+   Brightness follows half the astronomical magnitude scale, 10^(-0.2 m)
+   instead of 10^(-0.4 m). Otherwise, with the sky's fixed exposure,
+   only the few brightest stars would show. */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define STARS_TILE (8)
+#define STARS_RADIUS (2)
+#define STARS_SIGMA (0.7f)          /* of the point spread function, in texels */
+#define STARS_FAINTEST (6.5f)       /* magnitude */
+#define STARS_BRIGHTEST (-1.5f)
+
+typedef struct {
+  Vec3 dir;
+  Vec3 color;                 /* illuminance */
+} Star;
+
+typedef struct {
+  Star *stars;
+  int count;
+  /* of the last bake */
+  int tiles, busy_count;      /* tiles in the layout, tiles with stars */
+  double bin_ms, splat_ms;
+} StarField;
+
+static void stars_scatter(StarField *field, int count, uint32_t seed, float brightness);
+static void stars_bake(StarField *field, CubeImg *img);
+static void stars_free(StarField *field);
+
+/* brightness is the illuminance of a magnitude 0 star */
+static void stars_scatter(StarField *field, int count, uint32_t seed, float brightness) {
+  *field = (StarField) { .count = count };
+  field->stars = malloc((size_t)count * sizeof(Star));
+  Rand r = rand_seeded(seed);
+  Vec3 warm = vec3(1.0f, 0.78f, 0.55f), cool = vec3(0.72f, 0.82f, 1.0f);
+  for (int i = 0; i < count; i++) {
+    float y = 2.0f * randf_r(&r) - 1.0f, phi = 2.0f * PI_f * randf_r(&r);
+    float s = sqrtf(m_max(1.0f - y * y, 0.0f));
+    /* 2.5 times as many stars per magnitude fainter, 1 / log2(2.5) */
+    float m = m_max(STARS_FAINTEST + log2f(1.0f - randf_r(&r)) * 0.756f, STARS_BRIGHTEST);
+    Vec3 tint = lerp3(warm, cool, randf_r(&r));
+    tint = mul3_f(tint, 1.0f / (0.2126f * tint.x + 0.7152f * tint.y + 0.0722f * tint.z));
+    field->stars[i] = (Star) {
+      .dir = vec3(s * cosf(phi), y, s * sinf(phi)),
+      .color = mul3_f(tint, brightness * powf(10.0f, -0.2f * m)),
+    };
+  }
+}
+
+/* where a star lands and how it spreads, worked out once per star
+   rather than per tile it touches */
+typedef struct {
+  int face;
+  int cx, cy;                 /* texel the footprint is centered on */
+  bool inside;                /* the footprint stays on the face, nothing to wrap */
+  float wx[2 * STARS_RADIUS + 1];   /* normalized weights along x */
+  float wy[2 * STARS_RADIUS + 1];   /* along y, times illuminance to radiance */
+} _StarSplat;
+
+typedef struct {
+  const StarField *field;
+  CubeImg *img;
+  int tiles_per_edge;
+  _StarSplat *splats;
+  int *tile_start;            /* [tile + 1], into tile_stars */
+  int *tile_stars;
+  int *busy;                  /* tiles with stars */
+} _StarsBake;
+
+static bool _stars_inside(const CubeImg *img, int cx, int cy) {
+  return cx >= STARS_RADIUS && cy >= STARS_RADIUS && cx + STARS_RADIUS < img->size && cy + STARS_RADIUS < img->size;
+}
+
+static _StarSplat _stars_locate(const CubeImg *img, Vec3 d) {
+  int n = img->size;
+  float u, v, scale;
+  _StarSplat s;
+  if (img->face_count == 1) {
+    _pano_dir_uv(PANO_OCTAHEDRAL, d, &u, &v);
+    s.face = 0;
+    /* about the average, the octahedral map's texels differ within 2x */
+    scale = (float)n * n / (4.0f * PI_f);
+  } else {
+    s.face = cube_dir_texel(d, &u, &v);
+    float sc = 2.0f * u - 1.0f, tc = 2.0f * v - 1.0f, l2 = 1.0f + sc * sc + tc * tc;
+    scale = (float)n * n / 4.0f * l2 * sqrtf(l2);
+  }
+  /* texel centers on integers */
+  float x = u * n - 0.5f, y = v * n - 0.5f;
+  s.cx = (int)floorf(x + 0.5f);
+  s.cy = (int)floorf(y + 0.5f);
+  s.inside = _stars_inside(img, s.cx, s.cy);
+  /* the gaussian is separable, a row and a column of weights */
+  float sum_x = 0.0f, sum_y = 0.0f;
+  for (int d = -STARS_RADIUS; d <= STARS_RADIUS; d++) {
+    float ex = s.cx + d - x, ey = s.cy + d - y;
+    sum_x += s.wx[d + STARS_RADIUS] = expf(-ex * ex / (2.0f * STARS_SIGMA * STARS_SIGMA));
+    sum_y += s.wy[d + STARS_RADIUS] = expf(-ey * ey / (2.0f * STARS_SIGMA * STARS_SIGMA));
+  }
+  for (int i = 0; i < 2 * STARS_RADIUS + 1; i++) {
+    s.wx[i] /= sum_x;
+    s.wy[i] *= scale / sum_y;
+  }
+  return s;
+}
+
+/* footprint texel (x, y) of a face, moved onto the texel the layout
+   continues with when it's off the edge */
+static void _stars_wrap(const CubeImg *img, int *face, int *x, int *y) {
+  if (img->face_count == 1)
+    _pano_wrap(PANO_OCTAHEDRAL, img->size, img->size, x, y);
+  else
+    _pano_cube_wrap(img->size, face, x, y);
+}
+
+/* the distinct tiles a star's footprint touches, at most its texel count */
+static int _stars_tiles(const _StarsBake *bake, const _StarSplat *s, int *out) {
+  int count = 0, t = bake->tiles_per_edge;
+  int cx = s->cx, cy = s->cy;
+  if (s->inside) {
+    for (int ty = (cy - STARS_RADIUS) / STARS_TILE; ty <= (cy + STARS_RADIUS) / STARS_TILE; ty++)
+      for (int tx = (cx - STARS_RADIUS) / STARS_TILE; tx <= (cx + STARS_RADIUS) / STARS_TILE; tx++)
+        out[count++] = (s->face * t + ty) * t + tx;
+    return count;
+  }
+  for (int dy = -STARS_RADIUS; dy <= STARS_RADIUS; dy++)
+    for (int dx = -STARS_RADIUS; dx <= STARS_RADIUS; dx++) {
+      int face = s->face, x = cx + dx, y = cy + dy;
+      _stars_wrap(bake->img, &face, &x, &y);
+      int tile = (face * t + y / STARS_TILE) * t + x / STARS_TILE;
+      bool seen = false;
+      for (int i = 0; i < count; i++) seen |= out[i] == tile;
+      if (!seen) out[count++] = tile;
+    }
+  return count;
+}
+
+static void _stars_locate_range(void *user, int begin, int end) {
+  _StarsBake *bake = user;
+  for (int i = begin; i < end; i++) bake->splats[i] = _stars_locate(bake->img, bake->field->stars[i].dir);
+}
+
+static void _stars_splat_tiles(void *user, int begin, int end) {
+  _StarsBake *bake = user;
+  const CubeImg *img = bake->img;
+  int t = bake->tiles_per_edge;
+  float *acc = malloc(STARS_TILE * STARS_TILE * 4 * sizeof(float));
+  for (int b = begin; b < end; b++) {
+    int tile = bake->busy[b];
+    int face = tile / (t * t), x0 = tile % t * STARS_TILE, y0 = tile / t % t * STARS_TILE;
+    int w = m_min(STARS_TILE, img->size - x0), h = m_min(STARS_TILE, img->size - y0);
+    memset(acc, 0, STARS_TILE * STARS_TILE * 4 * sizeof(float));
+    /* the texels stars landed on, only those are stored */
+    int min_x = w, min_y = h, max_x = -1, max_y = -1;
+    for (int k = bake->tile_start[tile]; k < bake->tile_start[tile + 1]; k++) {
+      int star = bake->tile_stars[k];
+      const _StarSplat *s = &bake->splats[star];
+      Vec3 color = bake->field->stars[star].color;
+      if (s->inside) {
+        /* the footprint clipped to the tile, in tile texels */
+        int ax = m_max(s->cx - STARS_RADIUS, x0) - x0, bx = m_min(s->cx + STARS_RADIUS, x0 + w - 1) - x0;
+        int ay = m_max(s->cy - STARS_RADIUS, y0) - y0, by = m_min(s->cy + STARS_RADIUS, y0 + h - 1) - y0;
+        min_x = m_min(min_x, ax);
+        max_x = m_max(max_x, bx);
+        min_y = m_min(min_y, ay);
+        max_y = m_max(max_y, by);
+        const float *wx = s->wx + STARS_RADIUS - (s->cx - x0), *wy = s->wy + STARS_RADIUS - (s->cy - y0);
+        for (int y = ay; y <= by; y++)
+          for (int x = ax; x <= bx; x++) {
+            float *texel = acc + 4 * (y * STARS_TILE + x), wt = wx[x] * wy[y];
+            texel[0] += color.x * wt;
+            texel[1] += color.y * wt;
+            texel[2] += color.z * wt;
+          }
+        continue;
+      }
+      /* across an edge: every texel wrapped onto the face that continues there */
+      for (int dy = -STARS_RADIUS; dy <= STARS_RADIUS; dy++)
+        for (int dx = -STARS_RADIUS; dx <= STARS_RADIUS; dx++) {
+          int f = s->face, x = s->cx + dx, y = s->cy + dy;
+          _stars_wrap(img, &f, &x, &y);
+          if (f != face || x < x0 || x >= x0 + w || y < y0 || y >= y0 + h) continue;
+          min_x = m_min(min_x, x - x0);
+          max_x = m_max(max_x, x - x0);
+          min_y = m_min(min_y, y - y0);
+          max_y = m_max(max_y, y - y0);
+          float *texel = acc + 4 * ((y - y0) * STARS_TILE + (x - x0));
+          float wt = s->wx[dx + STARS_RADIUS] * s->wy[dy + STARS_RADIUS];
+          texel[0] += color.x * wt;
+          texel[1] += color.y * wt;
+          texel[2] += color.z * wt;
+        }
+    }
+    for (int y = min_y; y <= max_y; y++) {
+      float *row = acc + 4 * (y * STARS_TILE + min_x);
+      for (int x = 0; x <= max_x - min_x; x++) row[4 * x + 3] = 1.0f;
+      cube_img_store_span(bake->img, face, y0 + y, x0 + min_x, max_x - min_x + 1, row);
+    }
+  }
+  free(acc);
+}
+
+/* stores only the tiles with stars in them, into an image that starts
+   out zeroed */
+static void stars_bake(StarField *field, CubeImg *img) {
+  uint64_t start = stm_now();
+  int t = (img->size + STARS_TILE - 1) / STARS_TILE;
+  _StarsBake bake = {
+    .field = field,
+    .img = img,
+    .tiles_per_edge = t,
+    .splats = malloc((size_t)field->count * sizeof(_StarSplat)),
+  };
+  field->tiles = img->face_count * t * t;
+  jobs_parallel_for(field->count, 1024, _stars_locate_range, &bake);
+
+  /* counting sort by tile: count, prefix sum, then fill */
+  int tiles[(2 * STARS_RADIUS + 1) * (2 * STARS_RADIUS + 1)];
+  bake.tile_start = calloc(field->tiles + 1, sizeof(int));
+  for (int i = 0; i < field->count; i++) {
+    int n = _stars_tiles(&bake, &bake.splats[i], tiles);
+    for (int k = 0; k < n; k++) bake.tile_start[tiles[k] + 1]++;
+  }
+  bake.busy = malloc((size_t)field->tiles * sizeof(int));
+  field->busy_count = 0;
+  for (int i = 0; i < field->tiles; i++) {
+    if (bake.tile_start[i + 1] > 0) bake.busy[field->busy_count++] = i;
+    bake.tile_start[i + 1] += bake.tile_start[i];
+  }
+  bake.tile_stars = malloc((size_t)m_max(bake.tile_start[field->tiles], 1) * sizeof(int));
+  int *fill = malloc((size_t)field->tiles * sizeof(int));
+  memcpy(fill, bake.tile_start, (size_t)field->tiles * sizeof(int));
+  for (int i = 0; i < field->count; i++) {
+    int n = _stars_tiles(&bake, &bake.splats[i], tiles);
+    for (int k = 0; k < n; k++) bake.tile_stars[fill[tiles[k]]++] = i;
+  }
+  free(fill);
+  field->bin_ms = stm_ms(stm_since(start));
+
+  start = stm_now();
+  jobs_parallel_for(field->busy_count, 16, _stars_splat_tiles, &bake);
+  field->splat_ms = stm_ms(stm_since(start));
+
+  free(bake.splats);
+  free(bake.tile_start);
+  free(bake.tile_stars);
+  free(bake.busy);
+}
+
+static void stars_free(StarField *field) {
+  free(field->stars);
+  *field = (StarField) {0};
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef _WORLEY3_H_
+
+#define _WORLEY3_H_
+
+/* 3D Worley (cellular) noise: distances to the nearest and second nearest
+   of a set of feature points, one per unit cell, among the 27 cells
+   around the point.
+
+   Cells are hashed with snoise3.h's permutation table, the same way
+   simplex corners are, and the hash picks one of 256 jittered points that
+   worley3_init() derives from that table. Call it after sn3_sino_init().
+   The points stay WORLEY3_MARGIN away from the faces of their cells.
+
+   The search goes by the octant of the cell the point is in. Along each
+   axis the neighbour toward the nearer face is at most half a cell away
+   and every point past the farther face is at least that half plus the
+   margin, so the 2x2x2 block toward the nearest corner is searched first,
+   and cells across one, two or three far faces only while the squared
+   distance to their points can be below the current F2. Cells go in
+   groups of four, which is one SSE vector of distances each: two for the
+   block, one per far face, two for the rest. About 11 of the 27 cells
+   are visited on average, and the result is the same as searching all of
+   them.
+
+   worley3_n() is worley3() over arrays. At -O2 with SSE2 either costs
+   about 1.8x an sn3_sample() measured alone, 1.6-1.8x in bench=1, and
+   about 2x without SIMD. */
+
+#include <math.h>
+#include <stdint.h>
+
+typedef struct {
+  float f1, f2;
+} Worley;
+
+static void worley3_init(void);
+static Worley worley3(float x, float y, float z);
+static void worley3_n(const float *x, const float *y, const float *z, float *f1, float *f2, int n);
+
+/* points are kept this far into their cells, (1 - jitter) / 2 from every
+   face, which is what lets the far cells be skipped */
+#define WORLEY3_JITTER (0.75f)
+#define WORLEY3_MARGIN ((1.0f - WORLEY3_JITTER) * 0.5f)
+
+/* x, y, z and a 0 that makes a point one 16 byte load */
+static float _worley3_points[256][4];
+
+/* cells in octant coordinates, per axis 0 for the point's own, 1 for the
+   neighbour toward the nearer face and 2 for the one past the farther:
+   the block, across the far x, y and z faces, then across two or three.
+   The last lane of the last group repeats a cell and is masked out */
+static const uint8_t _worley3_groups[7][4][3] = {
+  {{0,0,0}, {1,0,0}, {0,1,0}, {1,1,0}},
+  {{0,0,1}, {1,0,1}, {0,1,1}, {1,1,1}},
+  {{2,0,0}, {2,1,0}, {2,0,1}, {2,1,1}},
+  {{0,2,0}, {1,2,0}, {0,2,1}, {1,2,1}},
+  {{0,0,2}, {1,0,2}, {0,1,2}, {1,1,2}},
+  {{2,2,0}, {2,2,1}, {2,0,2}, {2,1,2}},
+  {{0,2,2}, {1,2,2}, {2,2,2}, {2,2,2}},
+};
+/* the same as multiples of the offset toward the nearer face, [group][axis][lane] */
+static float _worley3_lanes[7][3][4];
+
+static void worley3_init(void) {
+  for (int h = 0; h < 256; h++) {
+    _worley3_points[h][0] = WORLEY3_MARGIN + WORLEY3_JITTER * (sn3_perm[h] + 0.5f) / 256.0f;
+    _worley3_points[h][1] = WORLEY3_MARGIN + WORLEY3_JITTER * (sn3_perm[h ^ 0x55] + 0.5f) / 256.0f;
+    _worley3_points[h][2] = WORLEY3_MARGIN + WORLEY3_JITTER * (sn3_perm[h ^ 0xAA] + 0.5f) / 256.0f;
+    _worley3_points[h][3] = 0.0f;
+  }
+  static const float sign[3] = { 0.0f, 1.0f, -1.0f };
+  for (int g = 0; g < 7; g++)
+    for (int a = 0; a < 3; a++)
+      for (int l = 0; l < 4; l++) _worley3_lanes[g][a][l] = sign[_worley3_groups[g][l][a]];
+}
+
+/* the hash of a cell is perm[i + perm[j + perm[k]]]; the inner two
+   lookups only depend on the y and z offsets, so they are done once per
+   point for all nine combinations and each cell costs one more lookup */
+static void _worley3_hash_yz(int j, int k, int yz[3][3]) {
+  int pk[3] = { sn3_perm[(k - 1) & 255], sn3_perm[k & 255], sn3_perm[(k + 1) & 255] };
+  for (int b = 0; b < 3; b++)
+    for (int c = 0; c < 3; c++)
+      yz[b][c] = sn3_perm[((j + b - 1) & 255) + pk[c]];
+}
+
+static const float *_worley3_point(int i, const int8_t *o, int yz[3][3]) {
+  return _worley3_points[sn3_perm[((i + o[0]) & 255) + yz[o[1] + 1][o[2] + 1]]];
+}
+
+static void _worley3_visit(const float *p, int ox, int oy, int oz, float fx, float fy, float fz, float *f1, float *f2) {
+  float dx = (ox + p[0]) - fx;
+  float dy = (oy + p[1]) - fy;
+  float dz = (oz + p[2]) - fz;
+  float d = dx*dx + dy*dy + dz*dz;
+  *f2 = m_min(*f2, m_max(*f1, d));
+  *f1 = m_min(*f1, d);
+}
+
+/* one point's search, in octant coordinates */
+typedef struct {
+  float f[3];                 /* position in its cell */
+  float near[3];              /* -1 or 1, the neighbour toward the nearer face */
+  int o[3][3];                /* [axis][octant index], the cell offset */
+  int xi[3];                  /* i + offset, wrapped */
+  int yz[3][3];               /* [y index][z index], the inner two lookups */
+  float far[3];               /* squared distance to the nearest point past the farther face */
+} _Worley3Search;
+
+static inline void _worley3_search(_Worley3Search *s, float x, float y, float z) {
+  int c[3] = { sn3_fastfloor(x), sn3_fastfloor(y), sn3_fastfloor(z) };
+  s->f[0] = x - c[0];
+  s->f[1] = y - c[1];
+  s->f[2] = z - c[2];
+  for (int a = 0; a < 3; a++) {
+    int near = s->f[a] < 0.5f ? -1 : 1;
+    float d = (near < 0 ? 1.0f - s->f[a] : s->f[a]) + WORLEY3_MARGIN;
+    s->near[a] = (float)near;
+    s->o[a][0] = 0;
+    s->o[a][1] = near;
+    s->o[a][2] = -near;
+    s->far[a] = d * d;
+  }
+  for (int a = 0; a < 3; a++) s->xi[a] = (c[0] + s->o[0][a]) & 255;
+  int pk[3];
+  for (int b = 0; b < 3; b++) pk[b] = sn3_perm[(c[2] + s->o[2][b]) & 255];
+  for (int a = 0; a < 3; a++)
+    for (int b = 0; b < 3; b++)
+      s->yz[a][b] = sn3_perm[((c[1] + s->o[1][a]) & 255) + pk[b]];
+}
+
+static inline const float *_worley3_cell(const _Worley3Search *s, const uint8_t *g) {
+  return _worley3_points[sn3_perm[s->xi[g[0]] + s->yz[g[1]][g[2]]]];
+}
+
+#if defined(MATH_SSE2)
+/* the squared distances to a group's four points, lane by lane */
+static inline __m128 _worley3_group4(const _Worley3Search *s, int group) {
+  const uint8_t (*g)[3] = _worley3_groups[group];
+  __m128 px = _mm_loadu_ps(_worley3_cell(s, g[0])), py = _mm_loadu_ps(_worley3_cell(s, g[1]));
+  __m128 pz = _mm_loadu_ps(_worley3_cell(s, g[2])), pw = _mm_loadu_ps(_worley3_cell(s, g[3]));
+  _MM_TRANSPOSE4_PS(px, py, pz, pw);
+  __m128 ox = _mm_mul_ps(_mm_set1_ps(s->near[0]), _mm_loadu_ps(_worley3_lanes[group][0]));
+  __m128 oy = _mm_mul_ps(_mm_set1_ps(s->near[1]), _mm_loadu_ps(_worley3_lanes[group][1]));
+  __m128 oz = _mm_mul_ps(_mm_set1_ps(s->near[2]), _mm_loadu_ps(_worley3_lanes[group][2]));
+  __m128 dx = _mm_sub_ps(_mm_add_ps(ox, px), _mm_set1_ps(s->f[0]));
+  __m128 dy = _mm_sub_ps(_mm_add_ps(oy, py), _mm_set1_ps(s->f[1]));
+  __m128 dz = _mm_sub_ps(_mm_add_ps(oz, pz), _mm_set1_ps(s->f[2]));
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+}
+
+static inline void _worley3_add4(__m128 d, __m128 *d1, __m128 *d2) {
+  *d2 = _mm_min_ps(*d2, _mm_max_ps(*d1, d));
+  *d1 = _mm_min_ps(*d1, d);
+}
+
+/* F1 and F2 over the four lanes into lane 0, the other lanes cleared so
+   that adding to them doesn't count a distance twice */
+static inline void _worley3_merge4(__m128 *d1, __m128 *d2) {
+  for (int step = 0; step < 2; step++) {
+    __m128 b1 = step ? _mm_movehl_ps(*d1, *d1) : _mm_shuffle_ps(*d1, *d1, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 b2 = step ? _mm_movehl_ps(*d2, *d2) : _mm_shuffle_ps(*d2, *d2, _MM_SHUFFLE(2, 3, 0, 1));
+    *d2 = _mm_min_ps(_mm_max_ps(*d1, b1), _mm_min_ps(*d2, b2));
+    *d1 = _mm_min_ps(*d1, b1);
+  }
+  __m128 inf = _mm_set1_ps(INFINITY);
+  *d1 = _mm_move_ss(inf, *d1);
+  *d2 = _mm_move_ss(inf, *d2);
+}
+#else
+static void _worley3_group(const _Worley3Search *s, int group, int lanes, float *f1, float *f2) {
+  for (int l = 0; l < lanes; l++) {
+    const uint8_t *g = _worley3_groups[group][l];
+    _worley3_visit(_worley3_cell(s, g), s->o[0][g[0]], s->o[1][g[1]], s->o[2][g[2]],
+                   s->f[0], s->f[1], s->f[2], f1, f2);
+  }
+}
+#endif
+
+static Worley worley3(float x, float y, float z) {
+  _Worley3Search s;
+  _worley3_search(&s, x, y, z);
+  float bx = s.far[0], by = s.far[1], bz = s.far[2];
+#if defined(MATH_SSE2)
+  __m128 d1 = _mm_set1_ps(INFINITY), d2 = d1;
+  _worley3_add4(_worley3_group4(&s, 0), &d1, &d2);
+  _worley3_add4(_worley3_group4(&s, 1), &d1, &d2);
+  _worley3_merge4(&d1, &d2);
+  /* F2 only shrinks, a stale one skips less but never too much */
+  float f2 = _mm_cvtss_f32(d2);
+  if (bx < f2) _worley3_add4(_worley3_group4(&s, 2), &d1, &d2);
+  if (by < f2) _worley3_add4(_worley3_group4(&s, 3), &d1, &d2);
+  if (bz < f2) _worley3_add4(_worley3_group4(&s, 4), &d1, &d2);
+  if (m_min(bx + by, m_min(bx + bz, by + bz)) < f2) {
+    _worley3_merge4(&d1, &d2);
+    if (m_min(bx + by, m_min(bx + bz, by + bz)) < _mm_cvtss_f32(d2)) {
+      _worley3_add4(_worley3_group4(&s, 5), &d1, &d2);
+      __m128 last = _mm_max_ps(_worley3_group4(&s, 6), _mm_setr_ps(0.0f, 0.0f, 0.0f, INFINITY));
+      _worley3_add4(last, &d1, &d2);
+    }
+  }
+  _worley3_merge4(&d1, &d2);
+  __m128 f = _mm_sqrt_ps(_mm_unpacklo_ps(d1, d2));
+  return (Worley) { _mm_cvtss_f32(f), _mm_cvtss_f32(_mm_shuffle_ps(f, f, _MM_SHUFFLE(1, 1, 1, 1))) };
+#else
+  float f1 = INFINITY, f2 = INFINITY;
+  _worley3_group(&s, 0, 4, &f1, &f2);
+  _worley3_group(&s, 1, 4, &f1, &f2);
+  if (bx < f2) _worley3_group(&s, 2, 4, &f1, &f2);
+  if (by < f2) _worley3_group(&s, 3, 4, &f1, &f2);
+  if (bz < f2) _worley3_group(&s, 4, 4, &f1, &f2);
+  if (m_min(bx + by, m_min(bx + bz, by + bz)) < f2) {
+    _worley3_group(&s, 5, 4, &f1, &f2);
+    _worley3_group(&s, 6, 3, &f1, &f2);
+  }
+  return (Worley) { sqrtf(f1), sqrtf(f2) };
+#endif
+}
+
+static void worley3_n(const float *x, const float *y, const float *z, float *f1, float *f2, int n) {
+  for (int p = 0; p < n; p++) {
+    Worley w = worley3(x[p], y[p], z[p]);
+    f1[p] = w.f1;
+    f2[p] = w.f2;
+  }
+}
+
+#endif